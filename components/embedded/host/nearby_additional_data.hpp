@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "nearby_soft_crypto.hpp"
+
+// Fast Pair additional data packets, which carry the personalized name:
+//
+//   | hmac (8) | nonce (8) | data, AES-CTR encrypted |
+//
+// Block i of the key stream is AES(key, i || 7 zero bytes || nonce) and the
+// hmac is the first 8 bytes of HMAC-SHA256(key, nonce || encrypted data).
+// Encrypting and authenticating are done in one pass over the caller's
+// buffer: each block is XORed in place and fed to the HMAC while it is still
+// in cache, so the data is neither copied nor read twice.
+//
+// Host only: the Fast Pair library encodes and decodes the packets on the
+// characteristic itself, so the firmware doesn't build this codec and only
+// sizes the characteristic (NEARBY_PLATFORM_ADDITIONAL_DATA_HEADER_BYTES in
+// nearby_device_name.hpp). nearby_additional_data_host.cpp checks the format
+// against the spec's test vector.
+
+namespace gfps {
+
+struct AdditionalData {
+  static constexpr size_t kHmacBytes = 8;
+  static constexpr size_t kNonceBytes = 8;
+  static constexpr size_t kHeaderBytes = kHmacBytes + kNonceBytes;
+  // the block counter is a single byte
+  static constexpr size_t kMaxDataBytes = 256 * Aes128::kBlockBytes;
+
+  // Encrypts packet[kHeaderBytes, length) in place and writes the hmac. The
+  // nonce must already be in packet[kHmacBytes, kHeaderBytes).
+  static bool encode(const uint8_t key[16], uint8_t *packet, size_t length) {
+    if (!valid_length(length))
+      return false;
+    uint8_t digest[HmacSha256::kDigestBytes];
+    crypt(key, packet, length, true, digest);
+    memcpy(packet, digest, kHmacBytes);
+    return true;
+  }
+
+  // Checks the hmac and decrypts packet[kHeaderBytes, length) in place. On a
+  // mismatch the data is wiped rather than left decrypted.
+  static bool decode(const uint8_t key[16], uint8_t *packet, size_t length) {
+    if (!valid_length(length))
+      return false;
+    uint8_t digest[HmacSha256::kDigestBytes];
+    crypt(key, packet, length, false, digest);
+    uint8_t diff = 0;
+    for (size_t i = 0; i < kHmacBytes; i++)
+      diff |= digest[i] ^ packet[i];
+    if (diff) {
+      volatile uint8_t *p = packet + kHeaderBytes;
+      for (size_t i = 0; i < length - kHeaderBytes; i++)
+        p[i] = 0;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  static bool valid_length(size_t length) {
+    return length >= kHeaderBytes && length - kHeaderBytes <= kMaxDataBytes;
+  }
+
+  static void crypt(const uint8_t key[16], uint8_t *packet, size_t length, bool encrypting,
+                    uint8_t digest[32]) {
+    Aes128 aes(key);
+    HmacSha256 hmac(key, 16);
+    const uint8_t *nonce = packet + kHmacBytes;
+    hmac.update(nonce, kNonceBytes);
+    uint8_t counter[16] = {};
+    memcpy(counter + 8, nonce, kNonceBytes);
+    uint8_t stream[16];
+    uint8_t *data = packet + kHeaderBytes;
+    size_t data_length = length - kHeaderBytes;
+    for (size_t offset = 0; offset < data_length; offset += sizeof(stream)) {
+      size_t chunk = std::min(sizeof(stream), data_length - offset);
+      counter[0] = (uint8_t)(offset / sizeof(stream));
+      aes.encrypt(counter, stream);
+      // the hmac covers the encrypted data
+      if (!encrypting)
+        hmac.update(data + offset, chunk);
+      for (size_t i = 0; i < chunk; i++)
+        data[offset + i] ^= stream[i];
+      if (encrypting)
+        hmac.update(data + offset, chunk);
+    }
+    hmac.finish(digest);
+    volatile uint8_t *p = stream;
+    for (size_t i = 0; i < sizeof(stream); i++)
+      p[i] = 0;
+  }
+};
+
+} // namespace gfps
@@ -0,0 +1,114 @@
+// Host (Linux) known answer test of the additional data packets in
+// nearby_additional_data.hpp. Not part of the ESP-IDF component; build it
+// with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_additional_data_host.cpp -o additional_data
+//
+// Encodes the personalized name test vector of the Fast Pair spec and
+// compares the packet byte for byte, decodes it back, and checks that a
+// packet with a flipped bit anywhere is refused and its data wiped, and
+// that lengths outside the format are refused. Exits non-zero if a check
+// fails.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nearby_additional_data.hpp"
+
+using gfps::AdditionalData;
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, unsigned long a = 0) {
+  if (!ok && failures++ < 20)
+    printf("FAIL: %s (%lu)\n", what, a);
+}
+
+static std::vector<uint8_t> from_hex(const char *hex) {
+  std::vector<uint8_t> out;
+  for (; hex[0] && hex[1]; hex += 2)
+    out.push_back((uint8_t)std::stoi(std::string(hex, 2), nullptr, 16));
+  return out;
+}
+
+static const std::vector<uint8_t> kKey = from_hex("0123456789abcdef0123456789abcdef");
+static const std::vector<uint8_t> kNonce = from_hex("0001020304050607");
+static const char kName[] = "Someone's Google Headphone";
+static const std::vector<uint8_t> kPacket =
+    from_hex("55ec5e6055af6e92"
+             "0001020304050607"
+             "ee4a2483738052e44e9b2a145e5ddfaa44b9e5536af438e1e5c6");
+
+static std::vector<uint8_t> plain_packet(const uint8_t *data, size_t length) {
+  std::vector<uint8_t> packet(AdditionalData::kHeaderBytes + length);
+  memcpy(packet.data() + AdditionalData::kHmacBytes, kNonce.data(), kNonce.size());
+  if (length)
+    memcpy(packet.data() + AdditionalData::kHeaderBytes, data, length);
+  return packet;
+}
+
+static void check_spec_vector() {
+  std::vector<uint8_t> packet = plain_packet((const uint8_t *)kName, strlen(kName));
+  expect(AdditionalData::encode(kKey.data(), packet.data(), packet.size()), "encode");
+  expect(packet == kPacket, "encoded packet matches the spec");
+
+  packet = kPacket;
+  expect(AdditionalData::decode(kKey.data(), packet.data(), packet.size()), "decode");
+  expect(memcmp(packet.data() + AdditionalData::kHeaderBytes, kName, strlen(kName)) == 0,
+         "decoded name");
+}
+
+static void check_tampering() {
+  size_t data_length = kPacket.size() - AdditionalData::kHeaderBytes;
+  for (size_t bit = 0; bit < kPacket.size() * 8; bit++) {
+    std::vector<uint8_t> packet = kPacket;
+    packet[bit / 8] ^= 1 << (bit % 8);
+    expect(!AdditionalData::decode(kKey.data(), packet.data(), packet.size()),
+           "flipped bit refused", bit);
+    std::vector<uint8_t> zero(data_length, 0);
+    expect(memcmp(packet.data() + AdditionalData::kHeaderBytes, zero.data(), data_length) == 0,
+           "refused data wiped", bit);
+  }
+  std::vector<uint8_t> other_key = kKey, packet = kPacket;
+  other_key[15] ^= 1;
+  expect(!AdditionalData::decode(other_key.data(), packet.data(), packet.size()),
+         "wrong key refused");
+}
+
+static void check_lengths() {
+  // no data: the hmac covers the nonce alone, and round trips
+  std::vector<uint8_t> packet = plain_packet(nullptr, 0);
+  expect(AdditionalData::encode(kKey.data(), packet.data(), packet.size()), "header only");
+  expect(AdditionalData::decode(kKey.data(), packet.data(), packet.size()),
+         "header only decodes");
+  uint8_t short_packet[AdditionalData::kHeaderBytes] = {};
+  expect(!AdditionalData::encode(kKey.data(), short_packet, sizeof(short_packet) - 1),
+         "shorter than the header");
+  expect(!AdditionalData::decode(kKey.data(), short_packet, sizeof(short_packet) - 1),
+         "shorter than the header decodes");
+
+  // the longest data the one byte block counter allows, and one more byte
+  std::vector<uint8_t> data(AdditionalData::kMaxDataBytes + 1);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (uint8_t)(i * 7);
+  packet = plain_packet(data.data(), data.size());
+  expect(!AdditionalData::encode(kKey.data(), packet.data(), packet.size()), "too long");
+  packet.pop_back();
+  expect(AdditionalData::encode(kKey.data(), packet.data(), packet.size()), "longest");
+  expect(memcmp(packet.data() + AdditionalData::kHeaderBytes, data.data(), 16) != 0,
+         "longest is encrypted");
+  expect(AdditionalData::decode(kKey.data(), packet.data(), packet.size()) &&
+             memcmp(packet.data() + AdditionalData::kHeaderBytes, data.data(),
+                    AdditionalData::kMaxDataBytes) == 0,
+         "longest round trips");
+}
+
+int main() {
+  check_spec_vector();
+  check_tampering();
+  check_lengths();
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+// Host (Linux) check and benchmark of the connection table in
+// nearby_connections.hpp. Not part of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_connections_host.cpp -o connections
+//
+// Opens and closes a million connections in random order against a simple
+// model (a linear scan over the same capacity), with addresses drawn from a
+// small pool so seekers reconnect and collide in the hash, and checks every
+// lookup by conn_id and by address agrees with the model. Then times both
+// lookups with the table full. Exits non-zero if a check fails.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+#include "nearby_connections.hpp"
+
+static constexpr size_t kCapacity = 9; // most links a Bluedroid controller has
+static constexpr size_t kMaxConnId = 16;
+static constexpr int kSteps = 1000000;
+
+struct Session {
+  uint32_t passkey;
+  uint8_t remote_public_key[64];
+};
+
+using Table = gfps::ConnectionTable<Session, kCapacity, kMaxConnId>;
+
+struct Model {
+  bool open;
+  uint64_t address;
+};
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, int step) {
+  if (!ok && failures++ < 10)
+    printf("FAIL at step %d: %s\n", step, what);
+}
+
+int main() {
+  static Table table;
+  Model model[kMaxConnId] = {};
+  std::mt19937_64 rng(1);
+  // a pool small enough that addresses come back while still connected
+  uint64_t pool[24];
+  for (auto &address : pool)
+    address = rng() & 0xffffffffffffull;
+
+  for (int step = 0; step < kSteps; step++) {
+    uint16_t conn_id = rng() % kMaxConnId;
+    uint64_t address = pool[rng() % std::size(pool)];
+    size_t open = 0;
+    for (auto &m : model)
+      open += m.open;
+    if (!model[conn_id].open) {
+      Table::Connection *connection = table.open(conn_id, address);
+      // an address still open on another conn_id is replaced
+      for (auto &m : model)
+        if (m.open && m.address == address) {
+          m.open = false;
+          open--;
+        }
+      if (open == kCapacity) {
+        expect(connection == nullptr, "open succeeded on a full table", step);
+        continue;
+      }
+      expect(connection != nullptr, "open failed with room left", step);
+      if (!connection)
+        continue;
+      expect(connection->session.passkey == 0, "session not recycled clean", step);
+      connection->session.passkey = step + 1;
+      model[conn_id] = {true, address};
+    } else {
+      expect(table.close(conn_id), "close of an open conn_id", step);
+      model[conn_id].open = false;
+    }
+    for (uint16_t id = 0; id < kMaxConnId; id++) {
+      Table::Connection *by_id = table.find_conn_id(id);
+      expect((by_id != nullptr) == model[id].open, "lookup by conn_id", step);
+      if (!by_id)
+        continue;
+      expect(by_id->address == model[id].address, "address of a connection", step);
+      expect(table.find(model[id].address) == by_id, "lookup by address", step);
+    }
+    expect(table.find(0x123456789abc) == nullptr, "unknown address", step);
+  }
+  auto &stats = table.stats();
+  printf("opened %u closed %u rejected %u replaced %u peak %u\n", stats.opened, stats.closed,
+         stats.rejected, stats.replaced, stats.peak);
+
+  // full table, time the lookups a request and a notification make
+  static Table full;
+  uint64_t addresses[kCapacity];
+  for (size_t i = 0; i < kCapacity; i++) {
+    addresses[i] = rng() & 0xffffffffffffull;
+    full.open(i, addresses[i]);
+  }
+  using clock = std::chrono::steady_clock;
+  constexpr int kLookups = 10000000;
+  // volatile, so every lookup's result is stored and none can be dropped
+  volatile uintptr_t sink = 0;
+  auto start = clock::now();
+  for (int i = 0; i < kLookups; i++)
+    sink = sink + (uintptr_t)full.find_conn_id(i % kCapacity);
+  double by_id_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / kLookups;
+  start = clock::now();
+  for (int i = 0; i < kLookups; i++)
+    sink = sink + (uintptr_t)full.find(addresses[i % kCapacity]);
+  double by_address_ns =
+      std::chrono::duration<double, std::nano>(clock::now() - start).count() / kLookups;
+  printf("lookup by conn_id %.1f ns, by address %.1f ns (%zu connections, sink %#zx)\n",
+         by_id_ns, by_address_ns, kCapacity, (size_t)sink);
+
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,398 @@
+// Host (Linux) microbenchmarks of the crypto the secure element layer uses.
+// Not part of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_crypto_host.cpp -o crypto_bench
+//
+// and to compare against mbedtls, add the mbedtls sources the firmware
+// links (ESP-IDF's copy):
+//
+//   g++ -std=c++20 -O2 -DNEARBY_CRYPTO_HOST_MBEDTLS -I../include
+//       -I$IDF_PATH/components/mbedtls/mbedtls/include
+//       nearby_crypto_host.cpp $IDF_PATH/components/mbedtls/mbedtls/library/*.c
+//       -o crypto_bench
+//
+// The "gfps" rows are the implementations nearby_se.cpp and nearby_ecdh.cpp
+// use with the software backend. Every input is fixed, known answer tests
+// (including NIST and RFC 5903 ECDH exchanges, run through mbedtls too when
+// it is linked) run first and fail the run, and the results are printed to
+// stdout as one JSON document for tracking regressions between releases.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nearby_p256.hpp"
+#include "nearby_random.hpp"
+#include "nearby_soft_crypto.hpp"
+
+#if defined(NEARBY_CRYPTO_HOST_MBEDTLS)
+#include <mbedtls/aes.h>
+#include <mbedtls/ecdh.h>
+#include <mbedtls/hkdf.h>
+#include <mbedtls/md.h>
+#include <mbedtls/sha256.h>
+#endif
+
+struct Result {
+  std::string name;
+  std::string implementation;
+  size_t bytes;
+  size_t iterations;
+  double ns_per_op;
+};
+
+static std::vector<Result> s_results;
+
+// Keeps the optimizer from dropping a benchmarked computation.
+static void consume(const void *data, size_t length) {
+  static volatile uint8_t sink;
+  for (size_t i = 0; i < length; i++)
+    sink = sink ^ static_cast<const uint8_t *>(data)[i];
+}
+
+// Runs `f` for at least ~100 ms (and at least `min_iterations` times).
+template <typename F>
+static void measure(const char *name, const char *implementation, size_t bytes, F &&f,
+                    size_t min_iterations = 16) {
+  using clock = std::chrono::steady_clock;
+  f();
+  size_t iterations = 0;
+  auto start = clock::now();
+  auto elapsed = clock::duration::zero();
+  while (iterations < min_iterations || elapsed < std::chrono::milliseconds(100)) {
+    f();
+    iterations++;
+    elapsed = clock::now() - start;
+  }
+  double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+  s_results.push_back({name, implementation, bytes, iterations, ns});
+}
+
+static uint8_t s_key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                            0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+static uint8_t s_data[4096];
+
+// P-256 generator, a valid public key to run ECDH against
+static constexpr uint8_t kGenerator[64] = {
+    0x6b, 0x17, 0xd1, 0xf2, 0xe1, 0x2c, 0x42, 0x47, 0xf8, 0xbc, 0xe6, 0xe5, 0x63, 0xa4, 0x40, 0xf2,
+    0x77, 0x03, 0x7d, 0x81, 0x2d, 0xeb, 0x33, 0xa0, 0xf4, 0xa1, 0x39, 0x45, 0xd8, 0x98, 0xc2, 0x96,
+    0x4f, 0xe3, 0x42, 0xe2, 0xfe, 0x1a, 0x7f, 0x9b, 0x8e, 0xe7, 0xeb, 0x4a, 0x7c, 0x0f, 0x9e, 0x16,
+    0x2b, 0xce, 0x33, 0x57, 0x6b, 0x31, 0x5e, 0xce, 0xcb, 0xb6, 0x40, 0x68, 0x37, 0xbf, 0x51, 0xf5};
+
+static std::vector<uint8_t> from_hex(const char *hex) {
+  std::vector<uint8_t> out;
+  for (; hex[0] && hex[1]; hex += 2)
+    out.push_back((uint8_t)std::stoi(std::string(hex, 2), nullptr, 16));
+  return out;
+}
+
+static bool check(const char *what, const uint8_t *actual, const char *expected_hex) {
+  std::vector<uint8_t> expected = from_hex(expected_hex);
+  if (memcmp(actual, expected.data(), expected.size()) == 0)
+    return true;
+  fprintf(stderr, "known answer test failed: %s\n", what);
+  return false;
+}
+
+struct EcdhVector {
+  const char *name;
+  const char *private_key;
+  const char *public_key; // x || y
+  const char *secret;
+};
+
+static constexpr EcdhVector kEcdhVectors[] = {
+    // NIST CAVS 14.1 ECC CDH primitive, P-256 COUNT = 0
+    {"p256 ecdh cavs 0", "7d7dc5f71eb29ddaf80d6214632eeae03d9058af1fb6d22ed80badb62bc1a534",
+     "700c48f77f56584c5cc632ca65640db91b6bacce3a4df6b42ce7cc838833d287"
+     "db71e509e3fd9b060ddb20ba5c51dcc5948d46fbf640dfe0441782cab85fa4ac",
+     "46fc62106420ff012e54a434fbdd2d25ccc5852060561e68040dd7778997bd7b"},
+    // RFC 5903 8.1, both sides
+    {"p256 ecdh rfc 5903 i", "c88f01f510d9ac3f70a292daa2316de544e9aab8afe84049c62a9c57862d1433",
+     "d12dfb5289c8d4f81208b70270398c342296970a0bccb74c736fc7554494bf63"
+     "56fbf3ca366cc23e8157854c13c58d6aac23f046ada30f8353e74f33039872ab",
+     "d6840f6b42f6edafd13116e0e12565202fef8e9ece7dce03812464d04b9442de"},
+    {"p256 ecdh rfc 5903 r", "c6ef9c5d78ae012a011164acb397ce2088685d8f06bf9be0b283ab46476bee53",
+     "dad0b65394221cf9b051e1feca5787d098dfe637fc90b9ef945d0c3772581180"
+     "5271a0461cdb8252d61f1c456fa3e59ab1f45b33accf5f58389e0577b8990bb3",
+     "d6840f6b42f6edafd13116e0e12565202fef8e9ece7dce03812464d04b9442de"},
+};
+
+#if defined(NEARBY_CRYPTO_HOST_MBEDTLS)
+static int drbg_random(void *drbg, unsigned char *out, size_t length) {
+  static_cast<gfps::CtrDrbg *>(drbg)->generate(out, length);
+  return 0;
+}
+
+static bool ecdh_mbedtls(const uint8_t private_key[32], const uint8_t public_key[64],
+                         uint8_t secret[32]) {
+  mbedtls_ecp_group group;
+  mbedtls_mpi d, z;
+  mbedtls_ecp_point q;
+  mbedtls_ecp_group_init(&group);
+  mbedtls_mpi_init(&d);
+  mbedtls_mpi_init(&z);
+  mbedtls_ecp_point_init(&q);
+  uint8_t point[65] = {0x04};
+  memcpy(point + 1, public_key, 64);
+  gfps::CtrDrbg drbg(s_data);
+  bool ok = mbedtls_ecp_group_load(&group, MBEDTLS_ECP_DP_SECP256R1) == 0 &&
+            mbedtls_mpi_read_binary(&d, private_key, 32) == 0 &&
+            mbedtls_ecp_point_read_binary(&group, &q, point, sizeof(point)) == 0 &&
+            mbedtls_ecdh_compute_shared(&group, &z, &q, &d, drbg_random, &drbg) == 0 &&
+            mbedtls_mpi_write_binary(&z, secret, 32) == 0;
+  mbedtls_ecp_point_free(&q);
+  mbedtls_mpi_free(&z);
+  mbedtls_mpi_free(&d);
+  mbedtls_ecp_group_free(&group);
+  return ok;
+}
+#endif
+
+static bool known_answer_tests() {
+  bool ok = true;
+  uint8_t out[64];
+  // FIPS-197 C.1
+  uint8_t plain[16];
+  for (int i = 0; i < 16; i++)
+    plain[i] = i * 0x11;
+  gfps::Aes128(s_key).encrypt(plain, out);
+  ok &= check("aes128", out, "69c4e0d86a7b0430d8cdb78070b4c55a");
+  gfps::Aes128Decryptor(s_key).decrypt(out, out);
+  ok &= check("aes128 decrypt", out, "00112233445566778899aabbccddeeff");
+  // FIPS 180-2 "abc"
+  gfps::Sha256 sha;
+  sha.update("abc", 3);
+  sha.finish(out);
+  ok &= check("sha256", out, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  // RFC 4231 test case 2
+  gfps::HmacSha256 hmac((const uint8_t *)"Jefe", 4);
+  hmac.update("what do ya want for nothing?", 28);
+  hmac.finish(out);
+  ok &= check("hmac-sha256", out,
+              "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+  // RFC 5869 test case 1
+  std::vector<uint8_t> ikm(22, 0x0b), salt = from_hex("000102030405060708090a0b0c"),
+                       info = from_hex("f0f1f2f3f4f5f6f7f8f9");
+  gfps::hkdf_sha256(salt.data(), salt.size(), ikm.data(), ikm.size(), info.data(), info.size(),
+                    out, 42);
+  ok &= check("hkdf-sha256", out,
+              "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865");
+  for (const EcdhVector &v : kEcdhVectors) {
+    std::vector<uint8_t> d = from_hex(v.private_key), q = from_hex(v.public_key);
+    ok &= gfps::P256::ecdh(d.data(), q.data(), out);
+    ok &= check(v.name, out, v.secret);
+#if defined(NEARBY_CRYPTO_HOST_MBEDTLS)
+    ok &= ecdh_mbedtls(d.data(), q.data(), out);
+    ok &= check(v.name, out, v.secret);
+#endif
+  }
+  return ok;
+}
+
+// Account key filter as the Fast Pair spec builds it: s = 1.2 n + 3 bytes,
+// and every key sets the bits picked by SHA-256(key || salt).
+static size_t account_key_filter(const uint8_t (*keys)[16], size_t num_keys, uint8_t salt,
+                                 uint8_t *filter) {
+  size_t size = num_keys * 6 / 5 + 3;
+  memset(filter, 0, size);
+  for (size_t i = 0; i < num_keys; i++) {
+    uint8_t digest[32];
+    gfps::Sha256 sha;
+    sha.update(keys[i], 16);
+    sha.update(&salt, 1);
+    sha.finish(digest);
+    for (int j = 0; j < 8; j++) {
+      uint32_t x = (uint32_t)digest[j * 4] << 24 | (uint32_t)digest[j * 4 + 1] << 16 |
+                   (uint32_t)digest[j * 4 + 2] << 8 | digest[j * 4 + 3];
+      uint32_t bit = x % (size * 8);
+      filter[bit / 8] |= 1 << (bit % 8);
+    }
+  }
+  return size;
+}
+
+static void benchmark_aes() {
+  uint8_t block[16] = {};
+  // as the platform API does it: key setup plus one block
+  measure("aes128-ecb-encrypt", "gfps", 16, [&] {
+    gfps::Aes128(s_key).encrypt(block, block);
+  });
+  measure("aes128-ecb-decrypt", "gfps", 16, [&] {
+    gfps::Aes128(s_key).decrypt(block, block);
+  });
+  measure("aes128-ecb-decrypt", "gfps-table", 16, [&] {
+    gfps::Aes128Decryptor(s_key).decrypt(block, block);
+  });
+  consume(block, sizeof(block));
+  // trial decryption against the stored account keys
+  for (size_t num_keys : {1, 5, 16, 64}) {
+    std::vector<gfps::Aes128Decryptor> schedules(num_keys);
+    std::vector<uint8_t> outputs(num_keys * 16);
+    std::vector<uint8_t *> output_pointers(num_keys);
+    for (size_t i = 0; i < num_keys; i++) {
+      uint8_t key[16];
+      memcpy(key, s_data + i * 16, sizeof(key));
+      schedules[i].set_key(key);
+      output_pointers[i] = &outputs[i * 16];
+    }
+    std::string name = "aes128-decrypt-multi-" + std::to_string(num_keys);
+    measure(name.c_str(), "gfps", 16 * num_keys, [&] {
+      gfps::Aes128Decryptor::decrypt_multi(schedules.data(), num_keys, block,
+                                           output_pointers.data());
+    });
+    consume(outputs.data(), outputs.size());
+  }
+#if defined(NEARBY_CRYPTO_HOST_MBEDTLS)
+  measure("aes128-ecb-encrypt", "mbedtls", 16, [&] {
+    mbedtls_aes_context context;
+    mbedtls_aes_init(&context);
+    mbedtls_aes_setkey_enc(&context, s_key, 128);
+    mbedtls_aes_crypt_ecb(&context, MBEDTLS_AES_ENCRYPT, block, block);
+    mbedtls_aes_free(&context);
+  });
+  measure("aes128-ecb-decrypt", "mbedtls", 16, [&] {
+    mbedtls_aes_context context;
+    mbedtls_aes_init(&context);
+    mbedtls_aes_setkey_dec(&context, s_key, 128);
+    mbedtls_aes_crypt_ecb(&context, MBEDTLS_AES_DECRYPT, block, block);
+    mbedtls_aes_free(&context);
+  });
+  consume(block, sizeof(block));
+#endif
+}
+
+// Streams the input in 20 byte pieces, as the library feeds its hashes.
+static void benchmark_sha() {
+  uint8_t digest[32];
+  for (size_t bytes : {16, 64, 256, 1024, 4096}) {
+    measure("sha256-stream", "gfps", bytes, [&] {
+      gfps::Sha256 sha;
+      for (size_t i = 0; i < bytes; i += 20)
+        sha.update(s_data + i, std::min<size_t>(20, bytes - i));
+      sha.finish(digest);
+    });
+#if defined(NEARBY_CRYPTO_HOST_MBEDTLS)
+    measure("sha256-stream", "mbedtls", bytes, [&] {
+      mbedtls_sha256_context sha;
+      mbedtls_sha256_init(&sha);
+      mbedtls_sha256_starts(&sha, 0);
+      for (size_t i = 0; i < bytes; i += 20)
+        mbedtls_sha256_update(&sha, s_data + i, std::min<size_t>(20, bytes - i));
+      mbedtls_sha256_finish(&sha, digest);
+      mbedtls_sha256_free(&sha);
+    });
+#endif
+  }
+  consume(digest, sizeof(digest));
+}
+
+static void benchmark_hmac() {
+  uint8_t out[64];
+  for (size_t bytes : {32, 256, 1024}) {
+    measure("hmac-sha256", "gfps", bytes, [&] {
+      gfps::HmacSha256 hmac(s_key, sizeof(s_key));
+      hmac.update(s_data, bytes);
+      hmac.finish(out);
+    });
+#if defined(NEARBY_CRYPTO_HOST_MBEDTLS)
+    measure("hmac-sha256", "mbedtls", bytes, [&] {
+      mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), s_key, sizeof(s_key), s_data,
+                      bytes, out);
+    });
+#endif
+  }
+  // the key based pairing sizes: 16 byte input, 16 / 32 / 64 bytes out
+  for (size_t bytes : {16, 32, 64}) {
+    measure("hkdf-sha256", "gfps", bytes, [&] {
+      gfps::hkdf_sha256(nullptr, 0, s_key, sizeof(s_key), s_data, 16, out, bytes);
+    });
+#if defined(NEARBY_CRYPTO_HOST_MBEDTLS)
+    measure("hkdf-sha256", "mbedtls", bytes, [&] {
+      mbedtls_hkdf(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), nullptr, 0, s_key,
+                   sizeof(s_key), s_data, 16, out, bytes);
+    });
+#endif
+  }
+  consume(out, sizeof(out));
+}
+
+static void benchmark_ecdh() {
+  uint8_t private_key[32], secret[32];
+  memcpy(private_key, s_data, sizeof(private_key));
+  private_key[0] &= 0x7f; // below the group order
+  measure("p256-ecdh", "gfps", 64, [&] {
+    gfps::P256::ecdh(private_key, kGenerator, secret);
+  });
+#if defined(NEARBY_CRYPTO_HOST_MBEDTLS)
+  mbedtls_ecp_group group;
+  mbedtls_mpi d, z;
+  mbedtls_ecp_point q;
+  mbedtls_ecp_group_init(&group);
+  mbedtls_mpi_init(&d);
+  mbedtls_mpi_init(&z);
+  mbedtls_ecp_point_init(&q);
+  uint8_t point[65] = {0x04};
+  memcpy(point + 1, kGenerator, 64);
+  mbedtls_ecp_group_load(&group, MBEDTLS_ECP_DP_SECP256R1);
+  mbedtls_mpi_read_binary(&d, private_key, sizeof(private_key));
+  mbedtls_ecp_point_read_binary(&group, &q, point, sizeof(point));
+  gfps::CtrDrbg drbg(s_data);
+  measure("p256-ecdh", "mbedtls", 64, [&] {
+    mbedtls_ecdh_compute_shared(&group, &z, &q, &d, drbg_random, &drbg);
+    mbedtls_mpi_write_binary(&z, secret, sizeof(secret));
+  });
+  mbedtls_ecp_point_free(&q);
+  mbedtls_mpi_free(&z);
+  mbedtls_mpi_free(&d);
+  mbedtls_ecp_group_free(&group);
+#endif
+  consume(secret, sizeof(secret));
+}
+
+static void benchmark_account_key_filter() {
+  uint8_t filter[64];
+  for (size_t num_keys : {1, 2, 5, 10}) {
+    std::string name = "account-key-filter-" + std::to_string(num_keys);
+    measure(name.c_str(), "gfps", 16 * num_keys, [&] {
+      account_key_filter((const uint8_t(*)[16])s_data, num_keys, 0x5a, filter);
+    });
+  }
+  consume(filter, sizeof(filter));
+}
+
+static void print_json() {
+  printf("{\n  \"suite\": \"nearby_crypto_host\",\n");
+#if defined(NEARBY_CRYPTO_HOST_MBEDTLS)
+  printf("  \"mbedtls\": true,\n");
+#else
+  printf("  \"mbedtls\": false,\n");
+#endif
+  printf("  \"results\": [\n");
+  for (size_t i = 0; i < s_results.size(); i++) {
+    const Result &r = s_results[i];
+    printf("    {\"name\": \"%s\", \"implementation\": \"%s\", \"bytes\": %zu, "
+           "\"iterations\": %zu, \"ns_per_op\": %.1f, \"mb_per_s\": %.2f}%s\n",
+           r.name.c_str(), r.implementation.c_str(), r.bytes, r.iterations, r.ns_per_op,
+           r.bytes * 1e3 / r.ns_per_op, i + 1 < s_results.size() ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+int main() {
+  // fixed input, so runs are comparable
+  gfps::CtrDrbg drbg(s_data);
+  drbg.generate(s_data, sizeof(s_data));
+  if (!known_answer_tests()) {
+    return 1;
+  }
+  benchmark_aes();
+  benchmark_sha();
+  benchmark_hmac();
+  benchmark_ecdh();
+  benchmark_account_key_filter();
+  print_json();
+  return 0;
+}
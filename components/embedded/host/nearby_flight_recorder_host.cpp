@@ -0,0 +1,154 @@
+// Host (Linux) round trip test of the flight recorder log in
+// nearby_flight_recorder.hpp. Not part of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_flight_recorder_host.cpp -o flight_recorder
+//   ./flight_recorder [path/to/tools/flight_recorder.py]
+//
+// Writes more events than the log holds, tears a slot the way a reset in the
+// middle of write() would, and checks for_each hands back exactly the
+// surviving entries, oldest first. Then saves the log as a memory image,
+// padded on both sides like a dump of RTC memory, runs tools/flight_recorder.py
+// on it and checks it prints the same lines as format_flight_entry. Exits
+// non-zero if a check fails.
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nearby_flight_recorder.hpp"
+
+using gfps::FlightEntry;
+
+static constexpr size_t kSize = 16;
+static constexpr uint32_t kCpuMhz = 160;
+static constexpr uint32_t kWritten = 2 * kSize + 5; // wrapped around twice
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, unsigned long a = 0, unsigned long b = 0) {
+  if (!ok && failures++ < 20)
+    printf("FAIL: %s (%lu, %lu)\n", what, a, b);
+}
+
+static std::vector<std::string> format_log(const gfps::FlightLog<kSize> &log) {
+  std::vector<std::string> lines;
+  uint32_t prev_cycles = 0;
+  bool first = true;
+  log.for_each([&](const FlightEntry &entry) {
+    char line[96];
+    gfps::format_flight_entry(entry, first ? entry.cycles : prev_cycles, kCpuMhz, line,
+                              sizeof(line));
+    lines.push_back(line);
+    prev_cycles = entry.cycles;
+    first = false;
+  });
+  return lines;
+}
+
+static void fill(gfps::FlightLog<kSize> &log) {
+  log.clear();
+  // cycles start close to the top so the counter wraps inside the log
+  uint32_t cycles = 0xffffffffu - 40 * kCpuMhz;
+  for (uint32_t seq = 1; seq <= kWritten; seq++) {
+    cycles += (seq % 5 + 1) * kCpuMhz;
+    log.write(seq, cycles, seq % (gfps::kFlightNumEvents + 1), seq & 0xff, 0xffff - seq,
+              seq * 0x01000193u);
+  }
+}
+
+static void check_log() {
+  static gfps::FlightLog<kSize> log;
+  memset(&log, 0xa5, sizeof(log)); // garbage after power on
+  expect(!log.valid(), "garbage is not a log");
+  log.clear();
+  expect(log.valid() && log.next_seq() == 1, "cleared log is valid and empty");
+  size_t count = 0;
+  log.for_each([&](const FlightEntry &) { count++; });
+  expect(count == 0, "cleared log has no entries", count);
+
+  fill(log);
+  expect(log.next_seq() == kWritten + 1, "next sequence number", log.next_seq());
+  uint32_t expected = kWritten - kSize + 1;
+  log.for_each([&](const FlightEntry &entry) {
+    expect(entry.seq == expected, "entries come oldest first", entry.seq, expected);
+    expect(entry.type() == entry.seq % (gfps::kFlightNumEvents + 1) &&
+               entry.code() == (entry.seq & 0xff) && entry.arg16() == 0xffff - entry.seq &&
+               entry.arg == entry.seq * 0x01000193u,
+           "fields survive", entry.seq);
+    expected++;
+  });
+  expect(expected == kWritten + 1, "every surviving entry is visited", expected);
+
+  // a reset while writing the next entry, after the slot was marked empty
+  // and some of the new fields were stored
+  FlightEntry &torn = log.entries[(kWritten + 1) & (kSize - 1)];
+  torn.seq = 0;
+  torn.cycles = 0;
+  torn.info = gfps::kFlightAssert;
+  count = 0;
+  bool saw_torn = false;
+  log.for_each([&](const FlightEntry &entry) {
+    count++;
+    saw_torn |= &entry == &torn;
+  });
+  expect(count == kSize - 1 && !saw_torn, "a torn slot is skipped", count);
+
+  char line[96];
+  FlightEntry entry{7, 1000 + 3 * kCpuMhz, gfps::kFlightTimerStart | 2u << 8 | 9u << 16, 250};
+  gfps::format_flight_entry(entry, 1000, kCpuMhz, line, sizeof(line));
+  expect(strcmp(line, "#7 +3us TIMER_START code=2 arg16=9 arg=250 (0xfa)") == 0,
+         "format of one entry");
+  entry.info = 0xff;
+  gfps::format_flight_entry(entry, 1000, kCpuMhz, line, sizeof(line));
+  expect(strstr(line, " UNKNOWN ") != nullptr, "unknown event type");
+}
+
+static void check_decoder(const char *decoder) {
+  static gfps::FlightLog<kSize> log;
+  fill(log);
+  log.entries[(kWritten + 1) & (kSize - 1)].seq = 0; // torn
+  log.entries[(kWritten + 1) & (kSize - 1)].info = gfps::kFlightAssert;
+  std::vector<std::string> expected = format_log(log);
+
+  char image_path[] = "/tmp/flight_recorder_XXXXXX";
+  int fd = mkstemp(image_path);
+  FILE *image = fd >= 0 ? fdopen(fd, "wb") : nullptr;
+  expect(image != nullptr, "create the memory image");
+  if (!image)
+    return;
+  // the log sits somewhere in the middle of a dump of RTC memory
+  std::vector<uint8_t> padding(100, 0x5a);
+  fwrite(padding.data(), 1, padding.size(), image);
+  fwrite(&log, sizeof(log), 1, image);
+  fwrite(padding.data(), 1, padding.size(), image);
+  fclose(image);
+
+  std::string command = std::string("python3 ") + decoder + " --cpu-mhz " +
+                        std::to_string(kCpuMhz) + " " + image_path;
+  FILE *output = popen(command.c_str(), "r");
+  std::vector<std::string> decoded;
+  char line[256];
+  while (output && fgets(line, sizeof(line), output)) {
+    line[strcspn(line, "\n")] = 0;
+    decoded.push_back(line);
+  }
+  int status = output ? pclose(output) : -1;
+  remove(image_path);
+  expect(status == 0, "decoder ran", status);
+  expect(decoded.size() == expected.size(), "decoder printed every entry", decoded.size(),
+         expected.size());
+  for (size_t i = 0; i < decoded.size() && i < expected.size(); i++)
+    if (decoded[i] != expected[i]) {
+      printf("  decoder: %s\n  expected: %s\n", decoded[i].c_str(), expected[i].c_str());
+      expect(false, "decoder output matches format_flight_entry", i);
+    }
+  printf("decoder: %zu entries round tripped\n", decoded.size());
+}
+
+int main(int argc, char **argv) {
+  check_log();
+  check_decoder(argc > 1 ? argv[1] : "../../../tools/flight_recorder.py");
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+// Host (Linux) check of the GATT layout generated by nearby_gatt_db.hpp. Not
+// part of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_gatt_layout_host.cpp -o gatt_layout
+//
+// Describes the Fast Pair service as nearby_ble.cpp does, with both optional
+// characteristics (Additional Data and Message Stream PSM) present, checks
+// the generated attribute order and lookup tables, at compile time and
+// against handles as the stack would assign them, and prints the layout.
+// Exits non-zero if a check fails.
+
+#include <cstdio>
+
+#include "nearby_gatt_db.hpp"
+
+// nearby_fp_Characteristic
+enum : uint8_t {
+  kModelId,
+  kKeyBasedPairing,
+  kPasskey,
+  kAccountKey,
+  kFirmwareRevision,
+  kAdditionalData,
+  kMessageStreamPsm,
+};
+
+static constexpr uint8_t kUuid[16] = {0xEA, 0x0B, 0x10, 0x32, 0xDE, 0x01, 0xB0, 0x8E,
+                                      0x14, 0x48, 0x66, 0x83, 0x33, 0x12, 0x2C, 0xFE};
+static constexpr uint8_t kFwRevisionUuid[2] = {0x26, 0x2A};
+static constexpr uint8_t kModelIdValue[3] = {0x12, 0x34, 0x56};
+static constexpr uint8_t kFwRevision[4] = {'1', '.', '0', 0x00};
+
+using Gatt = gfps::GattCharacteristic;
+static constexpr gfps::GattCharacteristic kCharacteristics[] = {
+    {kModelId, kUuid, 16, Gatt::kRead, 3, kModelIdValue, 3},
+    {kKeyBasedPairing, kUuid, 16, Gatt::kRead | Gatt::kWrite | Gatt::kNotify, 80},
+    {kPasskey, kUuid, 16, Gatt::kRead | Gatt::kWrite | Gatt::kNotify, 16},
+    {kAccountKey, kUuid, 16, Gatt::kWrite, 16},
+    {kFirmwareRevision, kFwRevisionUuid, 2, Gatt::kRead, 4, kFwRevision, 4},
+    {kAdditionalData, kUuid, 16, Gatt::kWrite | Gatt::kNotify, 80},
+    {kMessageStreamPsm, kUuid, 16, Gatt::kRead, 3},
+};
+
+using Layout = gfps::GattLayout<kCharacteristics>;
+using Kind = gfps::GattAttributeKind;
+
+// service + 7 declarations + 7 values + 3 descriptors
+static_assert(Layout::kNumAttributes == 18);
+static_assert(Layout::attributes[0].kind == Kind::Service);
+static_assert(Layout::value_index[0] == 2 && Layout::value_index[1] == 4);
+static_assert(Layout::ccc_index[1] == 5 && Layout::ccc_index[0] == Layout::kNone);
+static_assert(Layout::slot(kAdditionalData) == 5 && Layout::slot(99) == Layout::kNone);
+// key based pairing, passkey and the psm are read through the app
+static_assert(Layout::kNumReadBuffers == 3 && Layout::kMaxReadLength == 80);
+static_assert(Layout::read_buffer[0] == Layout::kNone && Layout::read_buffer[6] == 2);
+// prepared writes are reassembled in buffers of the longest writable value
+static_assert(Layout::kMaxWriteLength == 80);
+// and notifications are queued in buffers of the longest notifying value
+static_assert(Layout::kMaxNotifyLength == 80);
+
+static const char *kind_name(Kind kind) {
+  switch (kind) {
+  case Kind::Service:
+    return "service";
+  case Kind::Declaration:
+    return "declaration";
+  case Kind::Value:
+    return "value";
+  case Kind::Ccc:
+    return "ccc";
+  }
+  return "?";
+}
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+int main() {
+  gfps::GattHandles<Layout> handles;
+  expect(handles.value_handle(kPasskey) == 0, "no handles before the table is created");
+
+  uint16_t assigned[Layout::kNumAttributes];
+  for (size_t i = 0; i < Layout::kNumAttributes; i++)
+    assigned[i] = 40 + i;
+  expect(!handles.assign(assigned, Layout::kNumAttributes - 1), "a short table is refused");
+  assigned[7]++;
+  expect(!handles.assign(assigned, Layout::kNumAttributes), "a gap in the handles is refused");
+  assigned[7]--;
+  expect(handles.assign(assigned, Layout::kNumAttributes), "consecutive handles are taken");
+
+  printf("%-6s %-6s %-12s %-4s %s\n", "handle", "index", "kind", "id", "max length");
+  for (size_t i = 0; i < Layout::kNumAttributes; i++) {
+    const auto &attribute = Layout::attributes[i];
+    const auto &c = kCharacteristics[attribute.slot];
+    uint16_t handle = handles.handle(i);
+    expect(handles.attribute(handle) == i, "handle -> attribute");
+    bool is_value = attribute.kind == Kind::Value;
+    bool is_ccc = attribute.kind == Kind::Ccc;
+    expect(handles.value_slot(handle) == (is_value ? attribute.slot : Layout::kNone),
+           "handle -> characteristic");
+    expect(handles.ccc_slot(handle) == (is_ccc ? attribute.slot : Layout::kNone),
+           "handle -> descriptor");
+    if (is_value)
+      expect(handles.value_handle(c.id) == handle, "characteristic -> handle");
+    if (attribute.kind == Kind::Service)
+      printf("%-6u %-6zu %-12s\n", handle, i, kind_name(attribute.kind));
+    else
+      printf("%-6u %-6zu %-12s %-4u %u\n", handle, i, kind_name(attribute.kind), c.id,
+             is_value ? c.max_length : is_ccc ? 2 : 1);
+  }
+  expect(handles.attribute(39) == Layout::kNone, "handle below the table");
+  expect(handles.attribute(40 + Layout::kNumAttributes) == Layout::kNone, "handle above the table");
+  expect(handles.value_handle(99) == 0, "unknown characteristic");
+
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
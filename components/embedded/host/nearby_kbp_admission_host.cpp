@@ -0,0 +1,152 @@
+// Host (Linux) load benchmark of key based pairing admission control. Not
+// part of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_kbp_admission_host.cpp -o kbp_bench
+//
+// Runs a minute of virtual time in which a legitimate seeker pairs every few
+// seconds while an attacker floods the key based pairing characteristic, and
+// reports how many legitimate requests got through, how many ECDHs the
+// attacker caused (and the CPU share they'd take at NEARBY_KBP_ECDH_MS each)
+// and what a rejection costs on this machine. Unless the scenario says
+// "new seeker", the seeker pairs once before the flood starts, as a phone
+// which has paired with the device before would. Without admission control
+// every legitimate request is accepted, but once the ECDH CPU share is
+// above 100% they queue behind the flood. Exits non-zero if, with admission
+// control, a scenario lets fewer legitimate requests through than it should
+// or the flood takes more than kMaxEcdhCpu of the CPU.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "nearby_kbp_admission.hpp"
+
+#if !defined(NEARBY_KBP_ECDH_MS)
+// roughly an ECDH on a 240 MHz ESP32
+#define NEARBY_KBP_ECDH_MS 40
+#endif
+
+static constexpr uint64_t kDurationMs = 60000;
+static constexpr uint64_t kLegitPeriodMs = 3000;
+static constexpr uint64_t kLegitAddress = 0xa0a0a0a0a0a0;
+static constexpr uint64_t kFloodStartMs = 5000;
+static constexpr double kMaxEcdhCpu = 25.0; // percent
+
+enum class Flood { None, SamePeer, RotatingPeers, Malformed };
+
+struct Outcome {
+  uint32_t legit_sent;
+  uint32_t legit_admitted;
+  uint32_t attack_sent;
+  uint32_t attack_admitted; // ECDHs the attacker caused
+};
+
+static void fill_request(uint8_t request[80], uint32_t seed) {
+  for (int i = 0; i < 80; i++)
+    request[i] = (uint8_t)(seed * 2654435761u >> (i % 24));
+  // keep the coordinates below the prime
+  request[16] = request[48] = 0x10;
+}
+
+static Outcome run(Flood flood, uint32_t attack_per_second, bool known_seeker, bool admission) {
+  gfps::KbpAdmission control;
+  Outcome outcome{};
+  uint8_t request[80];
+  uint64_t attack_period_us = attack_per_second ? 1000000 / attack_per_second : 0;
+  uint64_t next_attack_us = known_seeker ? kFloodStartMs * 1000 : 0;
+  // a phone doesn't retry on a millisecond grid: jitter the seeker's
+  // requests (with a fixed seed), so they don't stay in lockstep with the flood
+  uint32_t jitter_state = 12345;
+  auto next_legit = [&](uint64_t period_start) {
+    jitter_state = jitter_state * 1103515245 + 12345;
+    return period_start + kLegitPeriodMs / 3 + (jitter_state >> 16) % 200;
+  };
+  uint64_t next_legit_ms = next_legit(0);
+  for (uint64_t now = 0; now < kDurationMs; now++) {
+    if (now == next_legit_ms) {
+      next_legit_ms = next_legit((now / kLegitPeriodMs + 1) * kLegitPeriodMs);
+      fill_request(request, (uint32_t)now);
+      outcome.legit_sent++;
+      if (!admission ||
+          control.admit(kLegitAddress, request, 80, now) == gfps::KbpAdmission::Verdict::Admit) {
+        outcome.legit_admitted++;
+        control.report(kLegitAddress, true, now);
+      }
+    }
+    while (flood != Flood::None && next_attack_us < (now + 1) * 1000) {
+      next_attack_us += attack_period_us;
+      uint64_t address =
+          flood == Flood::RotatingPeers ? 0xc00000000000 + outcome.attack_sent : 0xbbbbbbbbbbbb;
+      fill_request(request, outcome.attack_sent);
+      size_t length = 80;
+      if (flood == Flood::Malformed)
+        length = 79;
+      outcome.attack_sent++;
+      if (!admission ||
+          control.admit(address, request, length, now) == gfps::KbpAdmission::Verdict::Admit) {
+        outcome.attack_admitted++;
+        // the attacker can't produce a request the library accepts
+        control.report(address, false, now);
+      }
+    }
+  }
+  return outcome;
+}
+
+static double rejection_ns() {
+  using clock = std::chrono::steady_clock;
+  gfps::KbpAdmission control;
+  uint8_t request[80];
+  fill_request(request, 1);
+  // use up the peer's bucket so every later call is a rate rejection
+  while (control.admit(1, request, 80, 0) == gfps::KbpAdmission::Verdict::Admit) {
+  }
+  constexpr int kCalls = 1000000;
+  uint32_t admitted = 0;
+  auto start = clock::now();
+  for (int i = 0; i < kCalls; i++)
+    admitted += control.admit(1, request, 80, 0) == gfps::KbpAdmission::Verdict::Admit;
+  double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+  return admitted ? 0 : ns / kCalls;
+}
+
+int main() {
+  struct {
+    const char *name;
+    Flood flood;
+    uint32_t rate;
+    bool known_seeker;
+    uint32_t min_legit; // of 20, with admission control
+  } scenarios[] = {
+      {"no attack", Flood::None, 0, true, 20},
+      {"one peer, 200/s", Flood::SamePeer, 200, true, 20},
+      {"rotating peers, 20/s", Flood::RotatingPeers, 20, true, 20},
+      {"rotating peers, 200/s", Flood::RotatingPeers, 200, true, 20},
+      // the first request is turned away, the retries get through
+      {"rotating 20/s, new seeker", Flood::RotatingPeers, 20, false, 18},
+      // the retry memory only takes some of the addresses turned away, so
+      // whether the seeker gets in depends on timing: reported, not checked
+      {"rotating 200/s, new seeker", Flood::RotatingPeers, 200, false, 0},
+      {"malformed, 1000/s", Flood::Malformed, 1000, true, 20},
+  };
+  int failures = 0;
+  printf("%-26s %-9s %8s %10s %12s\n", "scenario", "admission", "legit", "attack ecdh",
+         "ecdh cpu");
+  for (auto &scenario : scenarios) {
+    for (bool admission : {false, true}) {
+      Outcome o = run(scenario.flood, scenario.rate, scenario.known_seeker, admission);
+      uint32_t ecdh = o.legit_admitted + o.attack_admitted;
+      double cpu = 100.0 * ecdh * NEARBY_KBP_ECDH_MS / kDurationMs;
+      printf("%-26s %-9s %3u / %-3u %10u %11.1f%%\n", scenario.name, admission ? "on" : "off",
+             o.legit_admitted, o.legit_sent, o.attack_admitted, cpu);
+      if (admission && (o.legit_admitted < scenario.min_legit || cpu > kMaxEcdhCpu)) {
+        printf("FAIL: %s: expected at least %u legitimate requests and at most %.0f%% cpu\n",
+               scenario.name, scenario.min_legit, kMaxEcdhCpu);
+        failures++;
+      }
+    }
+  }
+  printf("rejection: %.1f ns\n", rejection_ns());
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,323 @@
+// Host (Linux) power loss and replay test of the account key log in
+// nearby_keylog.hpp. Not part of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_keylog_host.cpp -o keylog
+//
+// Runs gfps::KeyLog on simulated NOR flash (erase sets bytes to 0xff, a
+// write only clears bits) with small banks, so compaction happens every few
+// saves. First saves a few thousand account key lists, rebooting (a fresh
+// KeyLog replaying the flash) in between, and checks every replay against the
+// last value saved, and that a read error doesn't get the log formatted. Then,
+// for a few hundred saves and compactions, cuts the power at every byte
+// programmed and every sector erased, reboots, and checks the replayed value
+// is either the old or the new one, and that the next save after the reboot
+// sticks. That runs twice: once leaving the byte or sector being worked on
+// half done, and once tearing the whole write out of order, as a page
+// program can, so any byte of it may be done, half done or untouched. Exits
+// non-zero if a check fails.
+
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "nearby_keylog.hpp"
+
+static constexpr size_t kMaxBytes = 256; // the firmware's default
+static constexpr size_t kSectorBytes = 256;
+static constexpr size_t kBankBytes = 4 * kSectorBytes; // 31 records
+static constexpr size_t kKeyBytes = 16;
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, unsigned long a = 0, unsigned long b = 0) {
+  if (!ok && failures++ < 20)
+    printf("FAIL: %s (%lu, %lu)\n", what, a, b);
+}
+
+// NOR flash which can lose power. Each byte programmed and each sector
+// erased costs one unit of `budget`; when it runs out the operation in
+// progress is left half done and every later operation fails, until the
+// next power up.
+struct SimFlash {
+  std::vector<uint8_t> bytes = std::vector<uint8_t>(2 * kBankBytes, 0xff);
+  long budget = -1; // < 0: no power cut planned
+  bool powered = true;
+  bool out_of_order = false; // a cut write tears any of its bytes, not just the last
+  long used = 0;
+  std::mt19937 rng{1};
+
+  bool spend() {
+    used++;
+    if (budget < 0)
+      return true;
+    if (budget-- > 0)
+      return true;
+    powered = false;
+    return false;
+  }
+
+  bool read(size_t offset, void *data, size_t size) {
+    if (!powered || offset + size > bytes.size())
+      return false;
+    memcpy(data, bytes.data() + offset, size);
+    return true;
+  }
+
+  bool write(size_t offset, const void *data, size_t size) {
+    if (!powered || offset + size > bytes.size())
+      return false;
+    const uint8_t *in = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+      if (spend())
+        continue;
+      for (size_t j = 0; j < size; j++) {
+        if (!out_of_order) {
+          // the bytes before made it, and some of the bits the one being
+          // programmed was clearing
+          if (j < i)
+            bytes[offset + j] &= in[j];
+          else if (j == i)
+            bytes[offset + j] &= in[j] | (uint8_t)rng();
+          continue;
+        }
+        switch (rng() % 4) {
+        case 0:
+          bytes[offset + j] &= in[j];
+          break;
+        case 1:
+          bytes[offset + j] &= in[j] | (uint8_t)rng();
+          break;
+        default: // untouched
+          break;
+        }
+      }
+      return false;
+    }
+    for (size_t i = 0; i < size; i++)
+      bytes[offset + i] &= in[i];
+    return true;
+  }
+
+  bool erase(size_t offset, size_t size) {
+    if (!powered || offset % kSectorBytes || size % kSectorBytes)
+      return false;
+    for (size_t sector = offset; sector < offset + size; sector += kSectorBytes) {
+      if (!spend()) {
+        // an interrupted erase leaves anything behind
+        for (size_t i = 0; i < kSectorBytes; i++)
+          if (rng() % 2)
+            bytes[sector + i] = rng() % 3 ? 0xff : (uint8_t)rng();
+        return false;
+      }
+      memset(bytes.data() + sector, 0xff, kSectorBytes);
+    }
+    return true;
+  }
+
+  void power_up(long cut_after = -1) {
+    powered = true;
+    budget = cut_after;
+    used = 0;
+  }
+
+  static uint32_t crc32(const void *data, size_t size) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; i++) {
+      crc ^= p[i];
+      for (int bit = 0; bit < 8; bit++)
+        crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+  }
+};
+
+typedef gfps::KeyLog<SimFlash, kMaxBytes> KeyLog;
+typedef std::vector<uint8_t> Value;
+
+// Boots: replays whatever is in flash.
+static Value replay(SimFlash &flash, bool *present = nullptr) {
+  KeyLog log(flash, kBankBytes);
+  expect(log.mount(), "mount");
+  Value value(kMaxBytes);
+  size_t length = value.size();
+  bool ok = log.load(value.data(), &length);
+  if (present)
+    *present = ok;
+  value.resize(ok ? length : 0);
+  return value;
+}
+
+// The next account key list: the library keeps the most recently used key
+// first, so a change adds or moves one key to the front, or drops the last.
+static Value next_value(const Value &value, std::mt19937 &rng) {
+  size_t keys = value.size() / kKeyBytes;
+  Value next = value;
+  switch (rng() % 4) {
+  case 0:
+  case 1: {
+    if (keys == kMaxBytes / kKeyBytes)
+      next.resize(next.size() - kKeyBytes);
+    Value key(kKeyBytes);
+    for (auto &b : key)
+      b = rng();
+    next.insert(next.begin(), key.begin(), key.end());
+    break;
+  }
+  case 2:
+    if (keys > 1) {
+      size_t k = 1 + rng() % (keys - 1);
+      Value key(next.begin() + k * kKeyBytes, next.begin() + (k + 1) * kKeyBytes);
+      next.erase(next.begin() + k * kKeyBytes, next.begin() + (k + 1) * kKeyBytes);
+      next.insert(next.begin(), key.begin(), key.end());
+    }
+    break;
+  case 3:
+    if (keys > 0)
+      next.resize(next.size() - kKeyBytes);
+    break;
+  }
+  return next;
+}
+
+static void check_replay() {
+  SimFlash flash;
+  for (auto &b : flash.bytes)
+    b = flash.rng(); // never formatted: garbage
+  std::optional<KeyLog> log;
+  log.emplace(flash, kBankBytes);
+  expect(log->mount() && log->formatted(), "garbage is formatted");
+  bool present = true;
+  replay(flash, &present);
+  expect(!present, "nothing to load after formatting");
+
+  std::mt19937 rng(2);
+  Value value;
+  uint32_t records = 0, saves = 0, compactions = 0;
+  for (int i = 0; i < 3000; i++) {
+    value = next_value(value, rng);
+    expect(log->save(value.data(), value.size()), "save", i);
+    records += log->stats().last_save_records;
+    saves++;
+    if (i % 7 == 0)
+      expect(log->maintain(), "maintain", i);
+    if (i % 3 == 0) {
+      compactions += log->stats().compactions;
+      expect(replay(flash, &present) == value && present, "replay after save", i);
+      // carry on from a freshly mounted log, as after a reboot
+      log.emplace(flash, kBankBytes);
+      expect(log->mount() && !log->formatted(), "remount", i);
+    }
+  }
+  // too long a value is refused and changes nothing
+  Value too_long(kMaxBytes + 1, 0x55);
+  expect(!log->save(too_long.data(), too_long.size()), "too long a value");
+  expect(replay(flash) == value, "a refused save leaves the value");
+
+  // a read error at boot fails the mount rather than formatting the region,
+  // and a later mount finds the value
+  {
+    const std::vector<uint8_t> before = flash.bytes;
+    KeyLog unreadable(flash, kBankBytes);
+    flash.powered = false;
+    expect(!unreadable.mount() && !unreadable.formatted(), "mount fails on a read error");
+    expect(!unreadable.present() && !unreadable.save(value.data(), value.size()),
+           "no loads or saves while unmounted");
+    flash.power_up();
+    expect(flash.bytes == before, "a failed mount leaves the flash alone");
+    expect(unreadable.mount() && unreadable.present() && unreadable.length() == value.size(),
+           "mount after the read error");
+  }
+  printf("replay: %u saves, %.1f records per save, %u compactions\n", saves,
+         (double)records / saves, compactions + log->stats().compactions);
+}
+
+static void check_power_loss(bool out_of_order) {
+  std::mt19937 rng(3);
+  SimFlash flash;
+  flash.out_of_order = out_of_order;
+  Value value;
+  {
+    KeyLog log(flash, kBankBytes);
+    log.mount();
+  }
+  uint32_t scenarios = 0, cuts = 0, compacting = 0, old_kept = 0, new_kept = 0;
+  for (int scenario = 0; scenario < 300; scenario++) {
+    // move on to a new starting point, with the log at a random fill level
+    for (int i = rng() % 4; i >= 0; i--) {
+      value = next_value(value, rng);
+      KeyLog log(flash, kBankBytes);
+      log.mount();
+      log.save(value.data(), value.size());
+    }
+    expect(replay(flash) == value, "starting point", scenario);
+    Value next = next_value(value, rng);
+    bool maintain = rng() % 5 == 0;
+    auto run = [&](KeyLog &log) {
+      return maintain ? log.maintain() : log.save(next.data(), next.size());
+    };
+    if (maintain)
+      next = value;
+
+    // how much flash work the operation does without a power cut
+    const std::vector<uint8_t> before = flash.bytes;
+    long units;
+    {
+      KeyLog log(flash, kBankBytes);
+      log.mount();
+      flash.power_up();
+      uint32_t compactions = log.stats().compactions;
+      expect(run(log), "uninterrupted operation", scenario);
+      units = flash.used;
+      compacting += log.stats().compactions != compactions;
+    }
+    expect(replay(flash) == next, "uninterrupted operation replays", scenario);
+
+    for (long cut = 0; cut < units; cut++) {
+      flash.bytes = before;
+      {
+        KeyLog log(flash, kBankBytes);
+        log.mount();
+        flash.power_up(cut);
+        expect(!run(log), "operation fails when the power goes", scenario, cut);
+      }
+      flash.power_up();
+      Value replayed = replay(flash);
+      bool is_old = replayed == value, is_new = replayed == next;
+      expect(is_old || is_new, "replayed value is the old or the new one", scenario, cut);
+      old_kept += is_old && !is_new;
+      new_kept += is_new && !is_old;
+      // life goes on after the reboot
+      Value after = next_value(replayed, rng);
+      {
+        KeyLog log(flash, kBankBytes);
+        expect(log.mount() && log.save(after.data(), after.size()), "save after power loss",
+               scenario, cut);
+      }
+      expect(replay(flash) == after, "save after power loss replays", scenario, cut);
+      cuts++;
+    }
+    flash.bytes = before;
+    {
+      KeyLog log(flash, kBankBytes);
+      log.mount();
+      run(log);
+    }
+    value = next;
+    scenarios++;
+  }
+  printf("power loss (%s): %u operations (%u compacting), cut at %u points: %u kept the old "
+         "value, %u the new one\n",
+         out_of_order ? "out of order" : "in order", scenarios, compacting, cuts, old_kept,
+         new_kept);
+}
+
+int main() {
+  check_replay();
+  check_power_loss(false);
+  check_power_loss(true);
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+// Host (Linux) test of the latency histogram in nearby_latency.hpp. Not part
+// of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_latency_host.cpp -o latency
+//
+// Checks every bucket boundary, then records samples from a few
+// distributions (constant, uniform, log-normal with a long tail) and checks
+// each reported percentile against the exact one from the sorted samples:
+// it may only be rounded up to the end of the exact value's bucket, and
+// never past the observed maximum. Exits non-zero if a check fails.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "nearby_latency.hpp"
+
+using gfps::LatencyHistogram;
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, uint32_t a = 0, uint32_t b = 0) {
+  if (!ok && failures++ < 20)
+    printf("FAIL: %s (%u, %u)\n", what, a, b);
+}
+
+static void check_buckets() {
+  expect(LatencyHistogram::bucket_floor_us(0) == 0, "bucket 0 starts at 0");
+  for (size_t i = 1; i < LatencyHistogram::kNumBuckets; i++) {
+    uint32_t floor = LatencyHistogram::bucket_floor_us(i);
+    expect(floor == 1u << i, "bucket floor is a power of two", i, floor);
+    expect(LatencyHistogram::bucket_for(floor) == i, "floor is in its bucket", i, floor);
+    expect(LatencyHistogram::bucket_for(floor - 1) == i - 1, "floor - 1 is in the bucket below",
+           i, floor - 1);
+  }
+  expect(LatencyHistogram::bucket_for(0) == 0 && LatencyHistogram::bucket_for(1) == 0,
+         "0 and 1 us share bucket 0");
+  // everything from the last floor up lands in the last bucket
+  expect(LatencyHistogram::bucket_for(UINT32_MAX) == LatencyHistogram::kNumBuckets - 1,
+         "the last bucket is open ended");
+
+  LatencyHistogram h;
+  expect(h.percentile_us(50) == 0 && h.mean_us() == 0, "empty histogram");
+  h.record(5);
+  expect(h.count() == 1 && h.min_us() == 5 && h.max_us() == 5 && h.mean_us() == 5,
+         "single sample stats");
+  // the bucket of 5 is [4, 8), clamped to the maximum
+  expect(h.percentile_us(0) == 5 && h.percentile_us(50) == 5 && h.percentile_us(100) == 5,
+         "single sample percentiles clamp to the maximum", h.percentile_us(50));
+  h.record(100);
+  expect(h.bucket(2) == 1 && h.bucket(6) == 1, "samples land in their buckets");
+  expect(h.percentile_us(50) == 7, "p50 is the end of the lower bucket", h.percentile_us(50));
+  expect(h.percentile_us(51) == 100, "p51 reaches the upper sample", h.percentile_us(51));
+  h.record(UINT32_MAX);
+  expect(h.percentile_us(100) == UINT32_MAX, "the last bucket reports the maximum");
+  h.reset();
+  expect(h.count() == 0 && h.max_us() == 0 && h.bucket(2) == 0, "reset clears everything");
+}
+
+// The percentile of `sorted` the histogram aims for: the smallest sample
+// with at least `percent`% of the samples at or below it.
+static uint32_t exact_percentile(const std::vector<uint32_t> &sorted, uint32_t percent) {
+  size_t target = (sorted.size() * percent + 99) / 100;
+  return sorted[target == 0 ? 0 : target - 1];
+}
+
+template <typename Draw> static void check_distribution(const char *name, Draw &&draw) {
+  std::mt19937 rng(7);
+  LatencyHistogram h;
+  std::vector<uint32_t> samples;
+  for (int i = 0; i < 100000; i++) {
+    uint32_t us = draw(rng);
+    samples.push_back(us);
+    h.record(us);
+  }
+  std::sort(samples.begin(), samples.end());
+  printf("%-10s", name);
+  for (uint32_t percent : {0u, 1u, 50u, 90u, 99u, 100u}) {
+    uint32_t exact = exact_percentile(samples, percent);
+    uint32_t reported = h.percentile_us(percent);
+    size_t bucket = LatencyHistogram::bucket_for(exact);
+    uint32_t bucket_end = bucket == LatencyHistogram::kNumBuckets - 1
+                              ? UINT32_MAX
+                              : LatencyHistogram::bucket_floor_us(bucket + 1) - 1;
+    expect(reported >= exact, "percentile below the exact value", exact, reported);
+    expect(reported <= bucket_end, "percentile beyond the exact value's bucket", exact, reported);
+    expect(reported <= samples.back(), "percentile beyond the maximum", samples.back(), reported);
+    printf("  p%u %u<=%u", percent, exact, reported);
+  }
+  printf("\n");
+  expect(h.min_us() == samples.front() && h.max_us() == samples.back(), "min / max");
+  uint64_t sum = 0;
+  for (auto us : samples)
+    sum += us;
+  expect(h.mean_us() == sum / samples.size(), "mean", h.mean_us(), sum / samples.size());
+}
+
+int main() {
+  check_buckets();
+  check_distribution("constant", [](std::mt19937 &) { return 1500u; });
+  check_distribution("uniform", [](std::mt19937 &rng) {
+    return std::uniform_int_distribution<uint32_t>(0, 20000)(rng);
+  });
+  check_distribution("lognormal", [](std::mt19937 &rng) {
+    // a write path: mostly a few hundred us, with an ECDH tail of tens of ms
+    double us = std::lognormal_distribution<double>(6.0, 1.5)(rng);
+    return (uint32_t)std::min(us, 4e9);
+  });
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
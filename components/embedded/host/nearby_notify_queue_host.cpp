@@ -0,0 +1,184 @@
+// Host (Linux) test of the notification queue in nearby_notify_queue.hpp.
+// Not part of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_notify_queue_host.cpp -o notify_queue
+//
+// Checks the queue's limits (capacity, value length, a batch in flight, a
+// congested link), that a refused send stays first and that only one sender
+// has the front at a time. Then runs a hundred thousand random pushes, sends,
+// refusals, confirmations and congestion changes against a simple model (a
+// deque) and checks notifications leave whole and in the order they were
+// queued. Exits non-zero if a check fails.
+
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "nearby_notify_queue.hpp"
+
+static constexpr size_t kDepth = 4;
+static constexpr size_t kBytes = 8;
+static constexpr size_t kBatch = 2;
+
+using Queue = gfps::NotifyQueue<kDepth, kBytes>;
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, unsigned long a = 0) {
+  if (!ok && failures++ < 20)
+    printf("FAIL: %s (%lu)\n", what, a);
+}
+
+// Queues notification `n`: its handle, and as many bytes of n as it is long.
+static bool push(Queue &queue, uint16_t n) {
+  uint8_t data[kBytes];
+  size_t length = n % (kBytes + 1);
+  for (size_t i = 0; i < length; i++)
+    data[i] = (uint8_t)(n + i);
+  return queue.push(n, (uint8_t)(n % 7), data, length);
+}
+
+static bool is_notification(const Queue::Entry &entry, uint16_t n) {
+  if (entry.handle != n || entry.characteristic != n % 7 || entry.length != n % (kBytes + 1))
+    return false;
+  for (size_t i = 0; i < entry.length; i++)
+    if (entry.data[i] != (uint8_t)(n + i))
+      return false;
+  return true;
+}
+
+static void check_limits() {
+  Queue queue;
+  Queue::Entry entry{};
+  expect(!queue.next(entry, kBatch) && !queue.stalled(), "empty queue sends nothing");
+  uint8_t too_long[kBytes + 1] = {};
+  expect(!queue.push(1, 0, too_long, sizeof(too_long)), "too long a value refused");
+  for (uint16_t n = 0; n < kDepth; n++)
+    expect(push(queue, n), "push", n);
+  expect(!push(queue, kDepth) && queue.size() == kDepth, "full queue refuses");
+
+  // a batch goes, the next waits for a confirmation
+  for (uint16_t n = 0; n < kBatch; n++) {
+    expect(queue.next(entry, kBatch) && is_notification(entry, n), "batch", n);
+    queue.sent();
+  }
+  expect(queue.in_flight() == kBatch && !queue.next(entry, kBatch), "batch limit");
+  expect(!queue.stalled(), "a confirmation will restart the queue");
+  queue.confirmed();
+  expect(queue.next(entry, kBatch) && is_notification(entry, kBatch), "after a confirmation");
+  queue.sent();
+
+  // congestion pauses the queue until it clears
+  queue.confirmed();
+  queue.set_congested(true);
+  expect(!queue.next(entry, kBatch), "congested");
+  queue.set_congested(false);
+  expect(queue.next(entry, kBatch) && is_notification(entry, kBatch + 1), "uncongested");
+  queue.sent();
+  expect(queue.empty(), "all sent");
+  queue.confirmed();
+  queue.confirmed();
+  queue.confirmed();
+  expect(queue.in_flight() == 0, "extra confirmations ignored");
+}
+
+static void check_refused_send() {
+  Queue queue;
+  Queue::Entry entry{};
+  push(queue, 10);
+  push(queue, 11);
+  expect(queue.next(entry, kBatch) && is_notification(entry, 10), "first send");
+  // while the front is with one sender nobody else gets anything, and it
+  // keeps its slot
+  Queue::Entry other{};
+  expect(!queue.next(other, kBatch), "one sender at a time");
+  push(queue, 12);
+  push(queue, 13);
+  expect(!push(queue, 14), "the front keeps its slot");
+  queue.failed();
+  expect(queue.size() == kDepth && queue.stalled(), "refused send stays queued, stalled");
+  expect(queue.next(entry, kBatch) && is_notification(entry, 10), "retry sends the same front");
+  queue.sent();
+  expect(!queue.stalled(), "not stalled with one in flight");
+
+  // settling a send nobody started (a session recycled meanwhile) does nothing
+  Queue fresh;
+  push(fresh, 20);
+  fresh.sent();
+  fresh.failed();
+  expect(fresh.size() == 1 && fresh.in_flight() == 0, "unstarted send ignored");
+}
+
+static void check_random() {
+  std::mt19937 rng(1);
+  Queue queue;
+  std::deque<uint16_t> model;
+  Queue::Entry entry{};
+  bool sending = false;
+  uint16_t next_pushed = 0, next_sent = 0, in_flight = 0;
+  uint32_t sent = 0, refused = 0, full = 0;
+  for (int step = 0; step < 100000; step++) {
+    switch (rng() % 6) {
+    case 0:
+    case 1: {
+      bool room = model.size() < kDepth;
+      expect(push(queue, next_pushed) == room, "push", step);
+      if (room)
+        model.push_back(next_pushed++);
+      else
+        full++;
+      break;
+    }
+    case 2:
+      if (sending) {
+        // settle the send in progress
+        if (rng() % 4) {
+          queue.sent();
+          expect(is_notification(entry, next_sent), "sent in order", step);
+          model.pop_front();
+          next_sent++;
+          in_flight++;
+          sent++;
+        } else {
+          queue.failed();
+          refused++;
+        }
+        sending = false;
+      } else {
+        bool takes = !model.empty() && in_flight < kBatch && !queue.congested();
+        sending = queue.next(entry, kBatch);
+        expect(sending == takes, "next", step);
+        expect(!sending || is_notification(entry, model.front()), "front", step);
+      }
+      break;
+    case 3:
+      queue.confirmed();
+      if (in_flight)
+        in_flight--;
+      break;
+    case 4:
+      queue.set_congested(rng() % 3 == 0);
+      break;
+    case 5: {
+      Queue::Entry other{};
+      expect(!sending || !queue.next(other, kBatch), "one sender", step);
+      break;
+    }
+    }
+    expect(queue.size() == model.size() && queue.in_flight() == in_flight, "size", step);
+    expect(queue.stalled() == (!model.empty() && in_flight == 0 && !queue.congested() && !sending),
+           "stalled", step);
+  }
+  printf("random: %u sent, %u refused sends, %u pushes refused with the queue full\n", sent,
+         refused, full);
+}
+
+int main() {
+  check_limits();
+  check_refused_send();
+  check_random();
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+// Host (Linux) test of the compact P-256 ECDH in nearby_p256.hpp, which
+// nearby_ecdh.cpp uses by default. Not part of the ESP-IDF component; build
+// it with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_p256_host.cpp -o p256
+//
+// Checks the shared secrets of the RFC 5903 (section 8.1) and NIST CAVS ECC
+// CDH exchanges in both directions, and that the keys the handshake must
+// refuse are refused: a private key of zero or of at least the group order,
+// a public key off the curve and one with a coordinate not reduced mod p
+// which would be on the curve if it were. Exits non-zero if a check fails.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nearby_p256.hpp"
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what) {
+  if (!ok && failures++ < 20)
+    printf("FAIL: %s\n", what);
+}
+
+static std::vector<uint8_t> from_hex(const char *hex) {
+  std::vector<uint8_t> out;
+  for (; hex[0] && hex[1]; hex += 2)
+    out.push_back((uint8_t)std::stoi(std::string(hex, 2), nullptr, 16));
+  return out;
+}
+
+// Runs private_key * public_key (x || y) and compares the secret.
+static void expect_secret(const char *what, const char *private_key, const char *x,
+                          const char *y, const char *secret) {
+  std::vector<uint8_t> d = from_hex(private_key), q = from_hex(x), z = from_hex(secret);
+  std::vector<uint8_t> qy = from_hex(y);
+  q.insert(q.end(), qy.begin(), qy.end());
+  uint8_t out[32];
+  expect(gfps::P256::valid_scalar(d.data()), what);
+  expect(gfps::P256::ecdh(d.data(), q.data(), out) && memcmp(out, z.data(), 32) == 0, what);
+}
+
+static void expect_rejected(const char *what, const char *private_key, const char *x,
+                            const char *y) {
+  std::vector<uint8_t> d = from_hex(private_key), q = from_hex(x), qy = from_hex(y);
+  q.insert(q.end(), qy.begin(), qy.end());
+  uint8_t out[32];
+  expect(!gfps::P256::ecdh(d.data(), q.data(), out), what);
+}
+
+static constexpr char kGx[] = "6b17d1f2e12c4247f8bce6e563a440f277037d812deb33a0f4a13945d898c296";
+static constexpr char kGy[] = "4fe342e2fe1a7f9b8ee7eb4a7c0f9e162bce33576b315ececbb6406837bf51f5";
+
+// RFC 5903 8.1
+static constexpr char kI[] = "c88f01f510d9ac3f70a292daa2316de544e9aab8afe84049c62a9c57862d1433";
+static constexpr char kGix[] = "dad0b65394221cf9b051e1feca5787d098dfe637fc90b9ef945d0c3772581180";
+static constexpr char kGiy[] = "5271a0461cdb8252d61f1c456fa3e59ab1f45b33accf5f58389e0577b8990bb3";
+static constexpr char kR[] = "c6ef9c5d78ae012a011164acb397ce2088685d8f06bf9be0b283ab46476bee53";
+static constexpr char kGrx[] = "d12dfb5289c8d4f81208b70270398c342296970a0bccb74c736fc7554494bf63";
+static constexpr char kGry[] = "56fbf3ca366cc23e8157854c13c58d6aac23f046ada30f8353e74f33039872ab";
+static constexpr char kGirx[] = "d6840f6b42f6edafd13116e0e12565202fef8e9ece7dce03812464d04b9442de";
+
+// group order n
+static constexpr char kN[] = "ffffffff00000000ffffffffffffffffbce6faada7179e84f3b9cac2fc632551";
+static constexpr char kNMinus1[] =
+    "ffffffff00000000ffffffffffffffffbce6faada7179e84f3b9cac2fc632550";
+
+static void check_vectors() {
+  // both sides of the RFC 5903 exchange, and the public keys themselves
+  expect_secret("rfc 5903 i * gr", kI, kGrx, kGry, kGirx);
+  expect_secret("rfc 5903 r * gi", kR, kGix, kGiy, kGirx);
+  expect_secret("rfc 5903 i * G", kI, kGx, kGy, kGix);
+  expect_secret("rfc 5903 r * G", kR, kGx, kGy, kGrx);
+  // NIST CAVS 14.1 ECC CDH primitive, P-256 COUNT = 0
+  expect_secret("cavs count 0",
+                "7d7dc5f71eb29ddaf80d6214632eeae03d9058af1fb6d22ed80badb62bc1a534",
+                "700c48f77f56584c5cc632ca65640db91b6bacce3a4df6b42ce7cc838833d287",
+                "db71e509e3fd9b060ddb20ba5c51dcc5948d46fbf640dfe0441782cab85fa4ac",
+                "46fc62106420ff012e54a434fbdd2d25ccc5852060561e68040dd7778997bd7b");
+  // the largest valid scalar: (n - 1) * P = -P, which has the x of P
+  expect_secret("(n - 1) * G", kNMinus1, kGx, kGy, kGx);
+  expect_secret("(n - 1) * gr", kNMinus1, kGrx, kGry, kGrx);
+}
+
+static void check_rejections() {
+  std::vector<uint8_t> zero(32, 0), n = from_hex(kN), ones(32, 0xff);
+  expect(!gfps::P256::valid_scalar(zero.data()), "zero scalar is invalid");
+  expect(!gfps::P256::valid_scalar(n.data()), "n is invalid");
+  expect(!gfps::P256::valid_scalar(ones.data()), "2^256 - 1 is invalid");
+  expect_rejected("zero scalar", "0000000000000000000000000000000000000000000000000000000000000000",
+                  kGx, kGy);
+  expect_rejected("scalar n", kN, kGx, kGy);
+  expect_rejected("scalar 2^256 - 1",
+                  "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff", kGx, kGy);
+
+  // off the curve: y + 1, and the all zero "point"
+  expect_rejected("off curve", kI, kGrx,
+                  "56fbf3ca366cc23e8157854c13c58d6aac23f046ada30f8353e74f33039872ac");
+  expect_rejected("zero point", kI,
+                  "0000000000000000000000000000000000000000000000000000000000000000",
+                  "0000000000000000000000000000000000000000000000000000000000000000");
+  // (0, y) is on the curve; x = p is the same point if reduced, so only the
+  // range check catches it
+  static constexpr char kY0[] = "66485c780e2f83d72433bd5d84a06bb6541c2af31dae871728bf856a174f93f4";
+  uint8_t out[32];
+  std::vector<uint8_t> q = from_hex("0000000000000000000000000000000000000000000000000000000000000000"),
+                       y0 = from_hex(kY0), d = from_hex(kI);
+  q.insert(q.end(), y0.begin(), y0.end());
+  expect(gfps::P256::ecdh(d.data(), q.data(), out), "(0, y) is a valid public key");
+  expect_rejected("x = p", kI, "ffffffff00000001000000000000000000000000ffffffffffffffffffffffff",
+                  kY0);
+  expect_rejected("y >= p", kI, kGx,
+                  "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+}
+
+int main() {
+  check_vectors();
+  check_rejections();
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,282 @@
+// Host (Linux) implementation of the nearby persistence API, used to run the
+// persistence paths off-target. Not part of the ESP-IDF component: it is
+// built together with the host sources that need it, e.g.
+//
+//   g++ -std=c++20 -O2 -DNEARBY_PERSISTENCE_HOST_BENCHMARK
+//       -I../../../external/nearby/embedded/common/target
+//       -I../../../external/nearby/embedded/client/source
+//       nearby_persistence_host.cpp -o persistence_bench
+//
+// Values live in a memory-mapped file (NEARBY_PERSISTENCE_FILE, default
+// "nearby_persistence.bin"). Like NVS, a save either fully replaces the old
+// value or leaves it intact: every key has two slots which are written
+// alternately, and a slot only counts if its CRC matches. Loading a missing
+// key, or into a buffer which is too small, fails.
+//
+// nearby_platform_HostPersistenceInjectPowerLoss() makes a later save stop
+// part way through its write and fail every access afterwards, as if power
+// was lost. Calling nearby_platform_PersistenceInit() again "reboots".
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+
+#include "nearby_platform_persistence.h"
+
+static constexpr const char* stored_key_names[] = {
+  "KeyList",
+  "Name"
+};
+static constexpr size_t num_stored_keys = std::size(stored_key_names);
+
+// Largest value a key can hold.
+static constexpr size_t kMaxValueBytes = 1024;
+static constexpr uint32_t kFileMagic = 0x48504647; // "GFPH"
+static constexpr uint32_t kFileVersion = 1;
+
+struct SlotHeader {
+  uint32_t seq; // 0 = never written
+  uint32_t length;
+  uint32_t crc; // over seq, length and the value
+};
+
+struct Slot {
+  SlotHeader header;
+  uint8_t data[kMaxValueBytes];
+};
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_keys;
+  uint32_t max_value_bytes;
+};
+
+struct File {
+  FileHeader header;
+  Slot slots[num_stored_keys][2];
+};
+
+static File* s_file = nullptr;
+static int s_fd = -1;
+// bytes of a save which still reach the file before the simulated power
+// loss, negative when no fault is armed
+static long s_fault_after_bytes = -1;
+static unsigned s_fault_countdown = 0;
+static bool s_powered_off = false;
+
+static uint32_t crc32(uint32_t crc, const void* data, size_t length) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  while (length--) {
+    crc ^= *p++;
+    for (int i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static uint32_t slot_crc(uint32_t seq, uint32_t length, const uint8_t* data) {
+  uint32_t crc = crc32(0, &seq, sizeof(seq));
+  crc = crc32(crc, &length, sizeof(length));
+  return crc32(crc, data, length);
+}
+
+static bool slot_valid(const Slot& slot) {
+  return slot.header.seq != 0 && slot.header.length <= kMaxValueBytes &&
+         slot.header.crc == slot_crc(slot.header.seq, slot.header.length, slot.data);
+}
+
+// Index of the slot holding the current value of `key`, -1 if none.
+static int current_slot(size_t key) {
+  const Slot* slots = s_file->slots[key];
+  bool valid0 = slot_valid(slots[0]);
+  bool valid1 = slot_valid(slots[1]);
+  if (valid0 && valid1)
+    return slots[1].header.seq > slots[0].header.seq ? 1 : 0;
+  return valid0 ? 0 : valid1 ? 1 : -1;
+}
+
+static void unmap() {
+  if (s_file) {
+    munmap(s_file, sizeof(File));
+    s_file = nullptr;
+  }
+  if (s_fd >= 0) {
+    close(s_fd);
+    s_fd = -1;
+  }
+}
+
+// Arms a simulated power loss: the `nth_save` save from now (1 = the next
+// one) only writes its first `bytes` bytes, then every access fails until
+// nearby_platform_PersistenceInit() is called again.
+void nearby_platform_HostPersistenceInjectPowerLoss(unsigned nth_save, size_t bytes) {
+  s_fault_countdown = nth_save;
+  s_fault_after_bytes = bytes;
+}
+
+// Loads stored key
+//
+// key    - Type of key to fetch.
+// output - Buffer to contain retrieved key.
+// length - On input, contains the size of the output buffer.
+//          On output, contains the Length of key.
+nearby_platform_status nearby_platform_LoadValue(nearby_fp_StoredKey key,
+                                                 uint8_t* output,
+                                                 size_t* length) {
+  if (!s_file || s_powered_off || (size_t)key >= num_stored_keys) {
+    return kNearbyStatusError;
+  }
+  int index = current_slot(key);
+  if (index < 0) {
+    return kNearbyStatusError;
+  }
+  const Slot& slot = s_file->slots[key][index];
+  if (*length < slot.header.length) {
+    return kNearbyStatusError;
+  }
+  memcpy(output, slot.data, slot.header.length);
+  *length = slot.header.length;
+  return kNearbyStatusOK;
+}
+
+// Saves stored key
+//
+// key    - Type of key to store.
+// output - Buffer containing key to store.
+// length - Length of key.
+nearby_platform_status nearby_platform_SaveValue(nearby_fp_StoredKey key,
+                                                 const uint8_t* input,
+                                                 size_t length) {
+  if (!s_file || s_powered_off || (size_t)key >= num_stored_keys ||
+      length > kMaxValueBytes) {
+    return kNearbyStatusError;
+  }
+  int current = current_slot(key);
+  uint32_t seq = current < 0 ? 1 : s_file->slots[key][current].header.seq + 1;
+  Slot& slot = s_file->slots[key][current == 0 ? 1 : 0];
+
+  // the new slot contents, in the order they are written to the file
+  static Slot image;
+  image.header = {seq, (uint32_t)length, slot_crc(seq, length, input)};
+  memcpy(image.data, input, length);
+  size_t image_bytes = offsetof(Slot, data) + length;
+
+  if (s_fault_after_bytes >= 0 && s_fault_countdown && --s_fault_countdown == 0) {
+    size_t torn = (size_t)s_fault_after_bytes < image_bytes ? s_fault_after_bytes : image_bytes;
+    memcpy(&slot, &image, torn);
+    msync(s_file, sizeof(File), MS_SYNC);
+    s_fault_after_bytes = -1;
+    s_powered_off = true;
+    return kNearbyStatusError;
+  }
+  memcpy(&slot, &image, image_bytes);
+  if (msync(s_file, sizeof(File), MS_SYNC) != 0) {
+    return kNearbyStatusError;
+  }
+  return kNearbyStatusOK;
+}
+
+// Initializes persistence module
+nearby_platform_status nearby_platform_PersistenceInit() {
+  unmap();
+  s_powered_off = false;
+  const char* path = getenv("NEARBY_PERSISTENCE_FILE");
+  if (!path) {
+    path = "nearby_persistence.bin";
+  }
+  s_fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (s_fd < 0) {
+    perror(path);
+    return kNearbyStatusError;
+  }
+  struct stat st;
+  if (fstat(s_fd, &st) != 0 || (st.st_size != sizeof(File) && ftruncate(s_fd, sizeof(File)) != 0)) {
+    perror(path);
+    unmap();
+    return kNearbyStatusError;
+  }
+  void* addr = mmap(nullptr, sizeof(File), PROT_READ | PROT_WRITE, MAP_SHARED, s_fd, 0);
+  if (addr == MAP_FAILED) {
+    perror(path);
+    s_fd = (close(s_fd), -1);
+    return kNearbyStatusError;
+  }
+  s_file = static_cast<File*>(addr);
+  const FileHeader& header = s_file->header;
+  if (header.magic != kFileMagic || header.version != kFileVersion ||
+      header.num_keys != num_stored_keys || header.max_value_bytes != kMaxValueBytes) {
+    // new or incompatible file: start empty, like an erased NVS partition
+    memset(s_file, 0, sizeof(File));
+    s_file->header = {kFileMagic, kFileVersion, num_stored_keys, kMaxValueBytes};
+    msync(s_file, sizeof(File), MS_SYNC);
+  }
+  return kNearbyStatusOK;
+}
+
+#if defined(NEARBY_PERSISTENCE_HOST_BENCHMARK)
+
+#include <chrono>
+
+// Measures load / save throughput of account key list sized values, then
+// checks that a torn save at every possible byte keeps the previous value.
+int main() {
+  using clock = std::chrono::steady_clock;
+  if (nearby_platform_PersistenceInit() != kNearbyStatusOK) {
+    return 1;
+  }
+  uint8_t value[16 * 5 + 1];
+  uint8_t loaded[sizeof(value)];
+  constexpr int kIterations = 20000;
+
+  auto start = clock::now();
+  for (int i = 0; i < kIterations; i++) {
+    memset(value, i, sizeof(value));
+    if (nearby_platform_SaveValue(kStoredKeyAccountKeyList, value, sizeof(value)) != kNearbyStatusOK) {
+      fprintf(stderr, "save %d failed\n", i);
+      return 1;
+    }
+  }
+  double save_s = std::chrono::duration<double>(clock::now() - start).count();
+
+  start = clock::now();
+  for (int i = 0; i < kIterations; i++) {
+    size_t length = sizeof(loaded);
+    if (nearby_platform_LoadValue(kStoredKeyAccountKeyList, loaded, &length) != kNearbyStatusOK) {
+      fprintf(stderr, "load %d failed\n", i);
+      return 1;
+    }
+  }
+  double load_s = std::chrono::duration<double>(clock::now() - start).count();
+  printf("save: %.0f ops/s\nload: %.0f ops/s\n", kIterations / save_s, kIterations / load_s);
+
+  size_t image_bytes = offsetof(Slot, data) + sizeof(value);
+  for (size_t torn = 0; torn < image_bytes; torn++) {
+    memset(value, 0xA5, sizeof(value));
+    nearby_platform_SaveValue(kStoredKeyAccountKeyList, value, sizeof(value));
+    nearby_platform_HostPersistenceInjectPowerLoss(1, torn);
+    memset(value, 0x5A, sizeof(value));
+    nearby_platform_SaveValue(kStoredKeyAccountKeyList, value, sizeof(value));
+    nearby_platform_PersistenceInit();
+    size_t length = sizeof(loaded);
+    if (nearby_platform_LoadValue(kStoredKeyAccountKeyList, loaded, &length) != kNearbyStatusOK ||
+        length != sizeof(value) || loaded[0] != 0xA5) {
+      fprintf(stderr, "power loss after %zu bytes lost the previous value\n", torn);
+      return 1;
+    }
+  }
+  printf("power loss: ok (%zu cut points)\n", image_bytes);
+  unmap();
+  return 0;
+}
+
+#endif // NEARBY_PERSISTENCE_HOST_BENCHMARK
@@ -0,0 +1,89 @@
+// Host (Linux) benchmark of the CTR_DRBG behind nearby_platform_Rand. Not
+// part of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -I../include nearby_random_host.cpp -o random_bench
+//
+// The generator is seeded with a fixed seed, so every run produces the same
+// bytes (the printed checksum) and the numbers are comparable across runs
+// and machines. It compares taking one byte per generate call, as a pool-less
+// nearby_platform_Rand would, with refilling a pool in bulk. A NIST CAVS
+// known answer test runs first; exits non-zero if it fails.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "nearby_random.hpp"
+
+static constexpr size_t kPoolBytes = 128;
+static constexpr size_t kTotalBytes = 1 << 20;
+static constexpr uint32_t kDefaultChecksum = 0xebd6948e;
+
+// CAVS 14.3 drbgvectors_no_reseed, CTR_DRBG AES-128 no df, no prediction
+// resistance, COUNT = 0: instantiate, generate 512 bits twice, check the
+// second output.
+static bool known_answer_test() {
+  static constexpr uint8_t kEntropy[gfps::CtrDrbg::kSeedBytes] = {
+      0xce, 0x50, 0xf3, 0x3d, 0xa5, 0xd4, 0xc1, 0xd3, 0xd4, 0x00, 0x4e, 0xb3, 0x52, 0x44, 0xb7, 0xf2,
+      0xcd, 0x7f, 0x2e, 0x50, 0x76, 0xfb, 0xf6, 0x78, 0x0a, 0x7f, 0xf6, 0x34, 0xb2, 0x49, 0xa5, 0xfc};
+  static constexpr uint8_t kReturned[64] = {
+      0x65, 0x45, 0xc0, 0x52, 0x9d, 0x37, 0x24, 0x43, 0xb3, 0x92, 0xce, 0xb3, 0xae, 0x3a, 0x99, 0xa3,
+      0x0f, 0x96, 0x3e, 0xaf, 0x31, 0x32, 0x80, 0xf1, 0xd1, 0xa1, 0xe8, 0x7f, 0x9d, 0xb3, 0x73, 0xd3,
+      0x61, 0xe7, 0x5d, 0x18, 0x01, 0x82, 0x66, 0x49, 0x9c, 0xcc, 0xd6, 0x4d, 0x9b, 0xbb, 0x8d, 0xe0,
+      0x18, 0x5f, 0x21, 0x33, 0x83, 0x08, 0x0f, 0xad, 0xde, 0xc4, 0x6b, 0xae, 0x1f, 0x78, 0x4e, 0x5a};
+  gfps::CtrDrbg drbg(kEntropy);
+  uint8_t out[sizeof(kReturned)];
+  drbg.generate(out, sizeof(out));
+  drbg.generate(out, sizeof(out));
+  if (memcmp(out, kReturned, sizeof(out)) != 0) {
+    printf("FAIL: CTR_DRBG known answer test\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (!known_answer_test()) {
+    printf("FAILED\n");
+    return 1;
+  }
+  using clock = std::chrono::steady_clock;
+  uint8_t seed[gfps::CtrDrbg::kSeedBytes] = {};
+  if (argc > 1) {
+    // a different (still fixed) seed
+    seed[0] = (uint8_t)atoi(argv[1]);
+  }
+  uint32_t checksum = 0;
+
+  gfps::CtrDrbg per_byte(seed);
+  auto start = clock::now();
+  for (size_t i = 0; i < kTotalBytes; i++) {
+    uint8_t value;
+    per_byte.generate(&value, 1);
+    checksum = checksum * 31 + value;
+  }
+  double per_byte_us = std::chrono::duration<double, std::micro>(clock::now() - start).count();
+
+  gfps::CtrDrbg pooled(seed);
+  uint8_t pool[kPoolBytes];
+  start = clock::now();
+  for (size_t i = 0; i < kTotalBytes; i += kPoolBytes) {
+    pooled.generate(pool, sizeof(pool));
+    for (uint8_t value : pool) {
+      checksum = checksum * 31 + value;
+    }
+  }
+  double pooled_us = std::chrono::duration<double, std::micro>(clock::now() - start).count();
+
+  printf("per byte: %8.2f bytes/us\n", kTotalBytes / per_byte_us);
+  printf("pool %zu: %8.2f bytes/us\n", kPoolBytes, kTotalBytes / pooled_us);
+  printf("checksum: %08x\n", (unsigned)checksum);
+  // the bytes of the default seed, from a run which passed the test above
+  if (argc <= 1 && checksum != kDefaultChecksum) {
+    printf("FAIL: checksum, expected %08x\nFAILED\n", (unsigned)kDefaultChecksum);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,171 @@
+// Host (Linux) test of the timer service in nearby_timer_service.hpp on the
+// virtual clock, which is what nearby_platform_AdvanceTimeMs runs. Not part
+// of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -pthread -I../include nearby_timer_service_host.cpp -o timer_service
+//
+// Fast-forwards the timeouts of a key based pairing exchange (the provider
+// gives up on a seeker which stops halfway) through the service the firmware
+// uses, and checks every timeout fires at exactly the virtual time it is due,
+// in order, and never after it was cancelled; that callbacks can start and
+// cancel timers, including their own; and that a day of a once a second
+// timer fast-forwards in well under a second. Exits non-zero if a check
+// fails.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "nearby_timer_service.hpp"
+
+using gfps::Clock;
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, unsigned long a = 0, unsigned long b = 0) {
+  if (!ok && failures++ < 20)
+    printf("FAIL: %s (%lu, %lu)\n", what, a, b);
+}
+
+// the firmware's pool size
+typedef gfps::TimerService<16> TimerService;
+static TimerService timers;
+
+static uint64_t elapsed_since(uint64_t start) { return Clock::now_ms() - start; }
+
+// A key based pairing exchange as the provider sees it: the seeker writes the
+// key based pairing request, then its passkey, then an account key, and has
+// 10 s for each step; a timeout abandons the pairing.
+struct Pairing {
+  enum State { kIdle, kWaitPasskey, kWaitAccountKey, kPaired } state = kIdle;
+  TimerService::Handle timer = 0;
+  uint32_t timeouts = 0;
+  uint64_t timed_out_at = 0;
+};
+static Pairing pairing;
+static constexpr uint32_t kStepTimeoutMs = 10000;
+
+static void pairing_timeout() {
+  pairing.state = Pairing::kIdle;
+  pairing.timeouts++;
+  pairing.timed_out_at = Clock::now_ms();
+  // the library cancels its timer when it resets, which is a stale handle
+  // from inside the callback
+  expect(!timers.cancel_timer(pairing.timer), "own handle is stale in its callback");
+  pairing.timer = 0;
+}
+
+static void pairing_step(Pairing::State next) {
+  if (pairing.timer)
+    timers.cancel_timer(pairing.timer);
+  pairing.state = next;
+  pairing.timer =
+      next == Pairing::kPaired ? 0 : timers.start_timer(pairing_timeout, kStepTimeoutMs);
+}
+
+static void check_pairing() {
+  // a seeker that goes all the way, taking its time over each step
+  uint64_t start = Clock::now_ms();
+  pairing_step(Pairing::kWaitPasskey);
+  timers.advance(9000);
+  pairing_step(Pairing::kWaitAccountKey);
+  timers.advance(9999);
+  pairing_step(Pairing::kPaired);
+  timers.advance(60000);
+  expect(pairing.state == Pairing::kPaired && pairing.timeouts == 0, "paired without a timeout",
+         pairing.timeouts);
+  expect(timers.armed() == 0, "no timer left behind", timers.armed());
+  expect(elapsed_since(start) == 9000 + 9999 + 60000, "virtual time", elapsed_since(start));
+
+  // a seeker that never sends its passkey
+  start = Clock::now_ms();
+  pairing_step(Pairing::kWaitPasskey);
+  timers.advance(kStepTimeoutMs - 1);
+  expect(pairing.state == Pairing::kWaitPasskey, "still waiting a tick before the timeout");
+  timers.advance(1);
+  expect(pairing.state == Pairing::kIdle && pairing.timeouts == 1, "passkey timeout");
+  expect(pairing.timed_out_at - start == kStepTimeoutMs, "passkey timeout time",
+         pairing.timed_out_at - start);
+
+  // one that sends the passkey at 3 s, then goes quiet; the callback sees
+  // the time it was due even though the test jumps far past it
+  start = Clock::now_ms();
+  pairing_step(Pairing::kWaitPasskey);
+  timers.advance(3000);
+  pairing_step(Pairing::kWaitAccountKey);
+  timers.advance(3600 * 1000);
+  expect(pairing.timeouts == 2 && pairing.timed_out_at - start == 3000 + kStepTimeoutMs,
+         "account key timeout time", pairing.timed_out_at - start);
+}
+
+// A callback which retries every 500 ms, five times, as a notification
+// retry would.
+static std::vector<uint64_t> retry_times;
+static void retry() {
+  retry_times.push_back(Clock::now_ms());
+  if (retry_times.size() < 5)
+    expect(timers.start_timer(retry, 500) != 0, "start from a callback");
+}
+
+// Timers with assorted delays, some many times round the 256 slot wheel,
+// must fire in order of expiry and at their due time.
+static std::vector<uint64_t> fired_at;
+static void record() { fired_at.push_back(Clock::now_ms()); }
+
+static uint32_t ticks;
+static void tick() {
+  ticks++;
+  timers.start_timer(tick, 1000);
+}
+
+static void check_callbacks() {
+  uint64_t start = Clock::now_ms();
+  timers.start_timer(retry, 500);
+  timers.advance(10000);
+  expect(retry_times.size() == 5, "every retry ran", retry_times.size());
+  for (size_t i = 0; i < retry_times.size(); i++)
+    expect(retry_times[i] - start == 500 * (i + 1), "retry time", i, retry_times[i] - start);
+
+  start = Clock::now_ms();
+  const uint32_t delays[] = {7000, 3, 255, 256, 257, 0, 90000, 1, 511, 12345};
+  std::vector<uint64_t> due;
+  for (uint32_t delay : delays) {
+    timers.start_timer(record, delay);
+    due.push_back(start + (delay ? delay : 1));
+  }
+  std::sort(due.begin(), due.end());
+  timers.advance(100000);
+  expect(fired_at == due, "fired in order at the due time", fired_at.size(), due.size());
+
+  // pool exhaustion, then recovery once the timers fire
+  std::vector<TimerService::Handle> handles;
+  while (TimerService::Handle handle = timers.start_timer(record, 50))
+    handles.push_back(handle);
+  expect(handles.size() == TimerService::capacity(), "the whole pool can be armed",
+         handles.size());
+  timers.advance(50);
+  expect(timers.start_timer(record, 50) != 0, "timers are free again after firing");
+  timers.advance(50);
+  expect(timers.armed() == 0, "nothing armed");
+}
+
+static void check_fast_forward() {
+  timers.start_timer(tick, 1000);
+  auto start = std::chrono::steady_clock::now();
+  timers.advance(24 * 3600 * 1000);
+  double ms =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  expect(ticks == 24 * 3600, "a day of ticks", ticks);
+  expect(ms < 1000, "a day fast-forwards in under a second", (unsigned long)ms);
+  printf("fast-forward: a day of a 1 s timer (%u callbacks) in %.1f ms\n", ticks, ms);
+}
+
+int main() {
+  timers.start();
+  check_pairing();
+  check_callbacks();
+  check_fast_forward();
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
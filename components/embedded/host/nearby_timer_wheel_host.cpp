@@ -0,0 +1,227 @@
+// Host (Linux) check and benchmark of the timer wheel in
+// nearby_timer_wheel.hpp. Not part of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -pthread -I../include nearby_timer_wheel_host.cpp -o timer_wheel
+//
+// Starts, cancels and expires timers in random order against a simple model
+// (a list of due times) and checks each one fires exactly once, never early,
+// and never after it was cancelled. Then times start + cancel pairs on a busy
+// wheel, and runs the wheel from a thread the way the firmware's timer task
+// does (sleeping on a condition variable until the next expiry, woken by new
+// timers) to measure how late timers fire. Exits non-zero if a check fails.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "nearby_timer_wheel.hpp"
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, unsigned long a = 0, unsigned long b = 0) {
+  if (!ok && failures++ < 20)
+    printf("FAIL: %s (%lu, %lu)\n", what, a, b);
+}
+
+// the firmware's configuration
+using Wheel = gfps::TimerWheel<16, 256>;
+
+static void nop() {}
+
+static void check_model() {
+  static Wheel wheel;
+  struct Model {
+    Wheel::Handle handle;
+    uint64_t due;
+  };
+  std::vector<Model> armed;
+  std::mt19937 rng(5);
+  uint64_t now = 0;
+  size_t fired = 0, cancelled = 0;
+  for (int step = 0; step < 200000; step++) {
+    switch (rng() % 4) {
+    case 0:
+    case 1: {
+      // delays past the wheel's 256 slots go round it more than once
+      uint64_t delay = rng() % 4 ? rng() % 300 : rng() % 5000;
+      Wheel::Handle handle = wheel.start(nop, delay, now);
+      expect((handle != 0) == (armed.size() < Wheel::capacity()), "start fails only when full",
+             armed.size());
+      if (handle)
+        armed.push_back({handle, now + (delay ? delay : 1)});
+      break;
+    }
+    case 2:
+      if (!armed.empty()) {
+        size_t i = rng() % armed.size();
+        expect(wheel.cancel(armed[i].handle), "cancel an armed timer", step);
+        expect(!wheel.cancel(armed[i].handle), "cancel twice", step);
+        armed.erase(armed.begin() + i);
+        cancelled++;
+      }
+      break;
+    case 3: {
+      now += rng() % 4 ? rng() % 20 : rng() % 2000;
+      Wheel::Expired expired[4];
+      size_t n;
+      do {
+        n = wheel.expire(now, expired, std::size(expired));
+        for (size_t i = 0; i < n; i++) {
+          auto it = std::find_if(armed.begin(), armed.end(),
+                                 [&](const Model &m) { return m.handle == expired[i].handle; });
+          expect(it != armed.end(), "fired timer was armed", step);
+          if (it == armed.end())
+            continue;
+          expect(it->due <= now, "timer fired early", it->due, now);
+          armed.erase(it);
+          fired++;
+        }
+      } while (n == std::size(expired));
+      for (const auto &m : armed)
+        expect(m.due > now, "due timer left on the wheel", m.due, now);
+      break;
+    }
+    }
+    expect(wheel.armed() == armed.size(), "armed count", wheel.armed(), armed.size());
+    uint64_t next = Wheel::kNever;
+    for (const auto &m : armed)
+      next = std::min(next, m.due);
+    expect(wheel.next_expiry() == next, "next expiry", wheel.next_expiry(), next);
+  }
+  printf("model: %zu fired, %zu cancelled, high water %zu\n", fired, cancelled,
+         wheel.high_water());
+}
+
+// Start + cancel of one timer with `busy` others armed, which is what the
+// pairing flow does for every message it waits on.
+template <size_t PoolSize> static double start_cancel_ns(size_t busy) {
+  static gfps::TimerWheel<PoolSize, 256> wheel;
+  std::mt19937 rng(3);
+  for (size_t i = 0; i < busy; i++)
+    wheel.start(nop, 1000 + rng() % 10000, 0);
+  constexpr int kOps = 2000000;
+  volatile uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kOps; i++) {
+    auto handle = wheel.start(nop, 100 + (i & 1023), 0);
+    sink = sink + handle;
+    wheel.cancel(handle);
+  }
+  double ns =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return ns / kOps;
+}
+
+// The firmware's timer task, on the host clock: expires due timers, then
+// waits on its condition variable until the next one is due. Timers started
+// from another thread wake it.
+static void measure_jitter() {
+  using clock = std::chrono::steady_clock;
+  static Wheel wheel;
+  static std::mutex wheel_mutex;
+  static std::mutex task_m;
+  static std::condition_variable task_cv;
+  static const auto epoch = clock::now();
+  static clock::time_point due[16];
+  static std::vector<double> late_us;
+  static bool stop = false;
+  auto now_ms = [] {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - epoch)
+        .count();
+  };
+
+  std::thread task([&] {
+    for (;;) {
+      Wheel::Expired expired[4];
+      clock::time_point expired_due[4];
+      size_t n;
+      {
+        std::unique_lock<std::mutex> task_lk(task_m);
+        if (stop)
+          return;
+        uint64_t wait_ms = 0;
+        {
+          std::lock_guard<std::mutex> lk(wheel_mutex);
+          uint64_t now = now_ms();
+          n = wheel.expire(now, expired, std::size(expired));
+          // copied now: the slot can be reused as soon as the lock is released
+          for (size_t i = 0; i < n; i++)
+            expired_due[i] = due[Wheel::index_of(expired[i].handle)];
+          if (n == 0) {
+            uint64_t next = wheel.next_expiry();
+            wait_ms = next > now + 1000 ? 1000 : next - now;
+          }
+        }
+        if (n == 0) {
+          task_cv.wait_for(task_lk, std::chrono::milliseconds(wait_ms));
+          continue;
+        }
+      }
+      auto fired = clock::now();
+      for (size_t i = 0; i < n; i++)
+        late_us.push_back(
+            std::chrono::duration<double, std::micro>(fired - expired_due[i]).count());
+    }
+  });
+
+  auto armed = [] {
+    std::lock_guard<std::mutex> lk(wheel_mutex);
+    return wheel.armed();
+  };
+  std::mt19937 rng(9);
+  constexpr int kTimers = 400;
+  for (int i = 0; i < kTimers; i++) {
+    unsigned delay_ms = 1 + rng() % 20;
+    {
+      std::lock_guard<std::mutex> lk(wheel_mutex);
+      auto handle = wheel.start(nop, delay_ms, now_ms());
+      // the wheel counts whole milliseconds from the tick the timer started in
+      due[Wheel::index_of(handle)] = clock::now() + std::chrono::milliseconds(delay_ms);
+    }
+    { std::lock_guard<std::mutex> lk(task_m); }
+    task_cv.notify_one();
+    std::this_thread::sleep_for(std::chrono::microseconds(rng() % 3000));
+    while (armed() >= 12)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  while (armed() > 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  auto stop_start = clock::now();
+  {
+    std::lock_guard<std::mutex> lk(task_m);
+    stop = true;
+  }
+  task_cv.notify_all();
+  task.join();
+  double stop_ms =
+      std::chrono::duration<double, std::milli>(clock::now() - stop_start).count();
+
+  expect(late_us.size() == kTimers, "every timer fired", late_us.size());
+  std::sort(late_us.begin(), late_us.end());
+  auto at = [&](double q) {
+    return late_us[std::min(late_us.size() - 1, (size_t)(q * late_us.size()))];
+  };
+  printf("firing jitter: p50 %.0f us, p99 %.0f us, max %.0f us late (%zu timers); stopped in "
+         "%.2f ms\n",
+         at(0.5), at(0.99), late_us.back(), late_us.size(), stop_ms);
+  // the wheel has millisecond ticks, so firing up to a tick early is
+  // rounding; anything more is a bug
+  expect(late_us.front() > -1000, "timer fired more than a tick early",
+         (unsigned long)-late_us.front());
+  // stopping must not wait out the one second idle wait
+  expect(stop_ms < 100, "stopping the task is prompt", (unsigned long)stop_ms);
+}
+
+int main() {
+  check_model();
+  printf("start + cancel: 16 pool %.1f ns (12 armed), 1024 pool %.1f ns (900 armed)\n",
+         start_cancel_ns<16>(12), start_cancel_ns<1024>(900));
+  measure_jitter();
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+// Host (Linux) test and benchmark of the deferred trace ring in
+// nearby_trace_ring.hpp. Not part of the ESP-IDF component; build it with
+//
+//   g++ -std=c++20 -O2 -pthread -I../include nearby_trace_host.cpp -o trace
+//
+// Checks that a captured record renders exactly as vsnprintf would print the
+// same call, including truncation, that the tokenized encoding of long
+// arguments is what tools/trace_tokens.py expects, and that four producer threads racing a
+// consumer get every record through exactly once, with each refused push
+// counted as dropped. Then compares the
+// per-call cost of capturing into the ring with formatting in place, which is
+// what the calling task pays instead of the UART. Exits non-zero if a check
+// fails.
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "nearby_trace_ring.hpp"
+#include "nearby_trace_tokens.hpp"
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, const char *detail = "") {
+  if (!ok && failures++ < 20)
+    printf("FAIL: %s %s\n", what, detail);
+}
+
+static void capture(gfps::TraceRecord &record, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  record.capture(fmt, args);
+  va_end(args);
+}
+
+// Captures and renders the call, and compares with vsnprintf.
+static void check_render(const char *fmt, ...) {
+  char expected[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(expected, sizeof(expected), fmt, args);
+  va_end(args);
+  gfps::TraceRecord record;
+  va_start(args, fmt);
+  record.capture(fmt, args);
+  va_end(args);
+  char rendered[256];
+  record.render(rendered, sizeof(rendered));
+  if (strcmp(expected, rendered) != 0) {
+    char detail[600];
+    snprintf(detail, sizeof(detail), "\"%s\": \"%s\" != \"%s\"", fmt, rendered, expected);
+    expect(false, "render", detail);
+  }
+}
+
+static void check_formats() {
+  check_render("no arguments");
+  check_render("100%% done");
+  check_render("%d %i %c|%5d|%-5d|%+d", -42, 7, 'x', 12, 12, 3);
+  check_render("%u %x %X %o %08x", 4000000000u, 0xbeefu, 0xbeefu, 8u, 0x1234u);
+  check_render("%ld %lu %lx", -5l, 4000000000ul, 0xdeadbeeful);
+  check_render("%lu %lx", (unsigned long)0x80000000ul, (unsigned long)0xffffffff00000000ul);
+  check_render("%lld %llu %llx", -1234567890123ll, 18446744073709551615ull, 0x1122334455667788ull);
+  check_render("%zu %jd", (size_t)99, (intmax_t)-99);
+  check_render("%f %.2f %e %g", 3.5, 2.125, 1e-7, 0.1);
+  check_render("%s, %10s, %-4s|", "hello", "right", "l");
+  check_render("%*d|%-*d|%.*s", 6, 42, 4, 7, 3, "abcdef");
+  check_render("%p", (void *)0x1234);
+  check_render("%s", (const char *)nullptr);
+  check_render("peer %llx characteristic %d length %u status %d", 0xa0b0c0d0e0f0ull, 1, 80u, 0);
+
+  // more arguments than the record keeps: the first kMaxArgs survive
+  gfps::TraceRecord record;
+  capture(record, "%d %d %d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8, 9, 10);
+  char rendered[256];
+  record.render(rendered, sizeof(rendered));
+  expect(record.truncated && strcmp(rendered, "1 2 3 4 5 6 7 8 %d %d ...") == 0,
+         "argument truncation", rendered);
+  // strings beyond kStringBytes are cut, and flagged
+  char long_string[100];
+  memset(long_string, 'a', sizeof(long_string) - 1);
+  long_string[sizeof(long_string) - 1] = 0;
+  capture(record, "%s", long_string);
+  record.render(rendered, sizeof(rendered));
+  expect(record.truncated && strlen(rendered) == gfps::TraceRecord::kStringBytes - 1 + 4,
+         "string truncation", rendered);
+  // a small output buffer is still terminated
+  capture(record, "%s %d", "abc", 12345);
+  size_t length = record.render(rendered, 5);
+  expect(length == 4 && strcmp(rendered, "abc ") == 0, "short output buffer", rendered);
+}
+
+// Tokenized records: unsigned long arguments are plain varints, so a 32 bit
+// %lu / %lx with the top bit set decodes as itself rather than as a sign
+// extended 64 bit number; tokens are the same whether cached or not.
+static void check_tokens() {
+  gfps::TraceRecord record;
+  record.filename = "components/embedded/src/nearby_ble.cpp";
+  record.lineno = 300;
+  record.level = 3;
+  capture(record, "%lx %ld", (unsigned long)0x80000000ul, -2l);
+  uint8_t out[gfps::TraceTokenEncoder::kMaxRecordBytes];
+  size_t length = gfps::TraceTokenEncoder::encode(record, out);
+  // level, fmt token, file token, line (2 byte varint), then the args
+  const uint8_t expected_args[] = {0x80, 0x80, 0x80, 0x80, 0x08, 0x03};
+  expect(length == 1 + 4 + 4 + 2 + sizeof(expected_args) &&
+             memcmp(out + 11, expected_args, sizeof(expected_args)) == 0,
+         "long arguments encoding");
+  uint32_t fmt_token = out[1] | out[2] << 8 | out[3] << 16 | (uint32_t)out[4] << 24;
+  uint32_t file_token = out[5] | out[6] << 8 | out[7] << 16 | (uint32_t)out[8] << 24;
+  expect(fmt_token == gfps::trace_token("%lx %ld"), "format token");
+  expect(file_token == gfps::trace_token("nearby_ble.cpp"), "file token");
+  // second time round the tokens come from the cache
+  length = gfps::TraceTokenEncoder::encode(record, out);
+  expect(gfps::TraceTokenEncoder::cached_token(record.fmt, false) == fmt_token &&
+             gfps::TraceTokenEncoder::cached_token(record.filename, true) == file_token,
+         "cached tokens");
+}
+
+// Producers push numbered records, retrying when the ring is full, while
+// the consumer pops; every number must come out exactly once and in order
+// per producer, and every refused push must be counted as a drop.
+static void check_concurrency() {
+  static gfps::TraceRing<32> ring;
+  constexpr int kProducers = 4;
+  constexpr int kPerProducer = 100000;
+  std::atomic<uint32_t> refused{0};
+  std::atomic<int> running{kProducers};
+  int64_t last[kProducers];
+  for (auto &l : last)
+    l = -1;
+  int popped = 0;
+  bool ordered = true;
+  std::thread consumer([&] {
+    auto consume = [&](const gfps::TraceRecord &record) {
+      int p = record.lineno;
+      if ((int64_t)record.args[0] != last[p] + 1)
+        ordered = false;
+      last[p] = record.args[0];
+      popped++;
+    };
+    while (running.load() > 0) {
+      while (ring.pop(consume)) {
+      }
+    }
+    while (ring.pop(consume)) {
+    }
+  });
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; p++) {
+    producers.emplace_back([&, p] {
+      for (int i = 0; i < kPerProducer; i++) {
+        while (!ring.push([&](gfps::TraceRecord &record) {
+          record.lineno = p;
+          record.num_args = 1;
+          record.args[0] = i;
+        })) {
+          refused++;
+          std::this_thread::yield();
+        }
+      }
+      running--;
+    });
+  }
+  for (auto &t : producers)
+    t.join();
+  consumer.join();
+  expect(ordered, "records of one producer come out once and in order");
+  expect(popped == kProducers * kPerProducer, "every published record is consumed");
+  expect(refused.load() == ring.dropped(), "every refused push is counted as dropped");
+  printf("concurrency: %d records through a %zu slot ring, %u pushes refused\n", popped,
+         ring.capacity(), ring.dropped());
+}
+
+static gfps::TraceRing<1024> bench_ring;
+
+static void trace_deferred(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  bench_ring.push([&](gfps::TraceRecord &record) {
+    record.timestamp_us = 0;
+    record.filename = __FILE__;
+    record.lineno = __LINE__;
+    record.level = 4;
+    record.capture(fmt, args);
+  });
+  va_end(args);
+}
+
+static char sink_line[256];
+
+static void trace_formatted(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(sink_line, sizeof(sink_line), fmt, args);
+  va_end(args);
+}
+
+template <typename F> static double ns_per_call(F &&f) {
+  using clock = std::chrono::steady_clock;
+  constexpr int kCalls = 1000000;
+  auto start = clock::now();
+  for (int i = 0; i < kCalls; i++)
+    f(i);
+  return std::chrono::duration<double, std::nano>(clock::now() - start).count() / kCalls;
+}
+
+static void benchmark() {
+  static const char *kFormat = "peer %llx characteristic %d length %u: %s";
+  double deferred = ns_per_call([](int i) {
+    trace_deferred(kFormat, 0xa0b0c0d0e0f0ull + i, i & 7, 80u, "key based pairing");
+    // drain now and then, as the trace task would
+    if ((i & 511) == 511)
+      while (bench_ring.pop([](const gfps::TraceRecord &) {})) {
+      }
+  });
+  double formatted = ns_per_call([](int i) {
+    trace_formatted(kFormat, 0xa0b0c0d0e0f0ull + i, i & 7, 80u, "key based pairing");
+  });
+  printf("per call: capture into the ring %.1f ns, vsnprintf %.1f ns (%u dropped)\n", deferred,
+         formatted, bench_ring.dropped());
+}
+
+int main() {
+  check_formats();
+  check_tokens();
+  check_concurrency();
+  benchmark();
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 
 #include "nearby_platform_audio.h"
@@ -22,6 +23,7 @@
 #include <esp_bt_main.h>
 #include <esp_gatt_common_api.h>
 #include <esp_random.h>
+#include <esp_timer.h>
 #include <nvs_flash.h>
 
 #include "freertos/FreeRTOS.h"
@@ -31,3 +33,25 @@
 #include "logger.hpp"
 #include "task.hpp"
 #include "timer.hpp"
+
+#include "nearby_trace_ring.hpp"
+#include "nearby_trace_tokens.hpp"
+#include "nearby_latency.hpp"
+#include "nearby_flight_recorder.hpp"
+#include "nearby_clock.hpp"
+#include "nearby_timer_service.hpp"
+#include "nearby_persistence_cache.hpp"
+#include "nearby_keylog.hpp"
+#include "nearby_base64.hpp"
+#include "nearby_soft_crypto.hpp"
+#include "nearby_random.hpp"
+#include "nearby_aes_multi.hpp"
+#include "nearby_crypto_bench.hpp"
+#include "nearby_p256.hpp"
+#include "nearby_ecdh.hpp"
+#include "nearby_mbedtls_arena.hpp"
+#include "nearby_device_name.hpp"
+#include "nearby_gatt_db.hpp"
+#include "nearby_connections.hpp"
+#include "nearby_notify_queue.hpp"
+#include "nearby_ble_stats.hpp"
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Trial decryption of one block under many AES-128 keys, as matching a key
+// based pairing request against the stored account keys does. With the
+// software backend the expanded schedules of the keys handed to
+// nearby_platform_Aes128CacheKeys are cached, and the block is run through up
+// to gfps::Aes128Decryptor::kLanes keys at once.
+//
+// The Fast Pair library tries each account key through
+// nearby_platform_Aes128Decrypt, so the firmware has no caller for these: they
+// are built with NEARBY_PLATFORM_CRYPTO_BENCHMARK only, for
+// nearby_crypto_bench.cpp to measure against the per key call.
+
+struct nearby_platform_AesKeyCacheStats {
+  uint32_t hits;       // keys whose schedule was cached
+  uint32_t misses;     // keys expanded on use, as they were not cached
+  uint32_t evictions;  // schedules dropped by a new key list or a clear
+  uint32_t batches;    // nearby_platform_Aes128DecryptMulti calls
+  uint32_t blocks;     // blocks decrypted by those calls
+};
+
+// Replaces the cached schedules with those of `keys`. An empty list clears
+// the cache.
+void nearby_platform_Aes128CacheKeys(const uint8_t keys[][16], size_t num_keys);
+
+// Wipes every cached key schedule.
+void nearby_platform_Aes128ClearKeyCache();
+
+// Decrypts `input` with each of `num_keys` keys. outputs[i] is `input`
+// decrypted with keys[i]. Keys which are not cached are expanded and
+// dropped again.
+nearby_platform_status nearby_platform_Aes128DecryptMulti(const uint8_t input[16],
+                                                          const uint8_t keys[][16],
+                                                          size_t num_keys,
+                                                          uint8_t outputs[][16]);
+
+// Returns a snapshot of the key schedule cache counters.
+nearby_platform_AesKeyCacheStats nearby_platform_GetAesKeyCacheStats();
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Compile time base64 decoding, so keys configured through Kconfig end up
+// in flash as bytes and a malformed one fails the build:
+//
+//   static constexpr auto kKey = gfps::base64_decode<32>(CONFIG_SOME_KEY);
+//   static_assert(kKey.valid && kKey.length == 32);
+
+namespace gfps {
+
+template <size_t N> struct Base64Decoded {
+  std::array<uint8_t, N> bytes{};
+  size_t length = 0; // decoded length, may be larger than N (then !valid)
+  bool valid = true;
+};
+
+namespace detail {
+
+// Standard and URL safe alphabets; -1 for anything else.
+constexpr int base64_value(char c) {
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+' || c == '-')
+    return 62;
+  if (c == '/' || c == '_')
+    return 63;
+  return -1;
+}
+
+} // namespace detail
+
+// Decodes the string literal `in` into at most N bytes. Padding is optional,
+// but if present it must be at the end and complete the last quantum.
+template <size_t N, size_t M> constexpr Base64Decoded<N> base64_decode(const char (&in)[M]) {
+  Base64Decoded<N> out;
+  uint32_t bits = 0;
+  int bit_count = 0;
+  size_t characters = 0;
+  size_t padding = 0;
+  // M includes the terminating NUL
+  for (size_t i = 0; i + 1 < M; i++) {
+    if (in[i] == '=') {
+      padding++;
+      continue;
+    }
+    int value = detail::base64_value(in[i]);
+    if (value < 0 || padding) {
+      out.valid = false;
+      return out;
+    }
+    characters++;
+    bits = ((bits << 6) | value) & 0xffff;
+    bit_count += 6;
+    if (bit_count >= 8) {
+      bit_count -= 8;
+      if (out.length < N)
+        out.bytes[out.length] = bits >> bit_count;
+      out.length++;
+    }
+  }
+  // a single character left over can't encode a byte, and the unused low
+  // bits of the last character must be zero
+  if (bit_count >= 6 || (bits & ((1u << bit_count) - 1)) != 0)
+    out.valid = false;
+  if (padding && (padding > 2 || (characters + padding) % 4 != 0))
+    out.valid = false;
+  if (out.length > N)
+    out.valid = false;
+  return out;
+}
+
+} // namespace gfps
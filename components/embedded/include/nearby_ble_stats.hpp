@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+#include "nearby_connections.hpp"
+#include "nearby_kbp_admission.hpp"
+#include "nearby_notify_queue.hpp"
+
+// Counters kept by the BLE platform layer.
+
+struct nearby_platform_AdvertisementStats {
+  uint32_t hits;     // SetAdvertisement calls skipped: unchanged and still advertising
+  uint32_t misses;   // calls which reconfigured the controller
+  uint64_t miss_us;  // total time from reconfiguring until the controller confirmed
+                     // the advertising data and scan response
+  uint64_t saved_us; // estimated controller time saved by hits (hits * mean miss time)
+};
+
+// Returns a snapshot of the advertisement memoization counters.
+nearby_platform_AdvertisementStats nearby_platform_GetAdvertisementStats();
+
+// Key based pairing admission control counters (see nearby_kbp_admission.hpp).
+using nearby_platform_KbpAdmissionStats = gfps::KbpAdmission::Stats;
+
+// Returns a snapshot of the key based pairing admission counters.
+nearby_platform_KbpAdmissionStats nearby_platform_GetKbpAdmissionStats();
+
+// Connection table counters (see nearby_connections.hpp).
+using nearby_platform_ConnectionStats = gfps::ConnectionStats;
+
+// Returns a snapshot of the connection table counters.
+nearby_platform_ConnectionStats nearby_platform_GetConnectionStats();
+
+// Notification queue counters (see nearby_notify_queue.hpp).
+using nearby_platform_NotifyStats = gfps::NotifyStats;
+
+// Returns a snapshot of the notification queue counters.
+nearby_platform_NotifyStats nearby_platform_GetNotifyStats();
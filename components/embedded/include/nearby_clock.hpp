@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Monotonic time source for the OS layer and the timer service.
+//
+// On target it reads esp_timer, which counts from boot and never jumps. With
+// NEARBY_PLATFORM_VIRTUAL_CLOCK (the default for host builds) time only moves
+// when a test calls nearby_platform_AdvanceTimeMs(), so timeouts of many
+// seconds can be simulated in microseconds.
+
+#if !defined(NEARBY_PLATFORM_VIRTUAL_CLOCK)
+#if defined(ESP_PLATFORM)
+#define NEARBY_PLATFORM_VIRTUAL_CLOCK 0
+#else
+#define NEARBY_PLATFORM_VIRTUAL_CLOCK 1
+#endif
+#endif
+
+#if !NEARBY_PLATFORM_VIRTUAL_CLOCK
+#include <esp_timer.h>
+#endif
+
+namespace gfps {
+
+class Clock {
+public:
+  // Milliseconds of monotonic time.
+  static uint64_t now_ms() {
+#if NEARBY_PLATFORM_VIRTUAL_CLOCK
+    return virtual_ms_.load(std::memory_order_acquire);
+#else
+    return esp_timer_get_time() / 1000;
+#endif
+  }
+
+  static constexpr bool is_virtual() { return NEARBY_PLATFORM_VIRTUAL_CLOCK; }
+
+#if NEARBY_PLATFORM_VIRTUAL_CLOCK
+  // Sets virtual time. Going backwards is not allowed and is ignored.
+  static void set_ms(uint64_t ms) {
+    uint64_t current = virtual_ms_.load(std::memory_order_relaxed);
+    while (ms > current &&
+           !virtual_ms_.compare_exchange_weak(current, ms, std::memory_order_release))
+      ;
+  }
+
+private:
+  static inline std::atomic<uint64_t> virtual_ms_{0};
+#endif
+};
+
+} // namespace gfps
+
+#if NEARBY_PLATFORM_VIRTUAL_CLOCK
+// Moves virtual time forward by `ms`, running the callback of every timer
+// that falls due on the way, in expiry order, on the calling thread.
+void nearby_platform_AdvanceTimeMs(unsigned int ms);
+#endif
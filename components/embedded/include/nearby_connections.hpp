@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Fixed capacity table of the open connections and their session state.
+//
+// Connections live in a slab of kCapacity entries; a free list hands out the
+// most recently released entry first, and closing a connection wipes its
+// entry for the next one. Two indices point into the slab:
+//
+// - conn_id -> entry, a direct map. Bluedroid's GATT server numbers its
+//   connections by link index, which stays below the number of links.
+// - address -> entry, an open addressed hash with linear probing and twice
+//   as many buckets as entries, so a lookup is one or two probes. Entries are
+//   removed by shifting the rest of the probe run back, so there are no
+//   tombstones to clean up.
+//
+// Nothing here depends on the BLE stack, so host/nearby_connections_host.cpp
+// checks it and measures lookups.
+
+namespace gfps {
+
+struct ConnectionStats {
+  uint32_t opened;
+  uint32_t closed;
+  uint32_t rejected; // table full or conn_id out of range
+  uint32_t replaced; // an address reconnected before its old link closed
+  uint32_t peak;     // most connections open at once
+};
+
+template <class Session, size_t kCapacity, size_t kMaxConnId = 16> class ConnectionTable {
+public:
+  static constexpr uint8_t kNone = 0xff;
+  static_assert(kCapacity > 0 && kCapacity < kNone, "entry indices are stored in a byte");
+
+  struct Connection {
+    uint64_t address;
+    uint16_t conn_id;
+    Session session;
+  };
+
+  using Stats = ConnectionStats;
+
+  ConnectionTable() {
+    for (auto &index : by_conn_id_)
+      index = kNone;
+    for (auto &bucket : buckets_)
+      bucket = kNone;
+    for (size_t i = 0; i < kCapacity; i++)
+      free_[i] = kCapacity - 1 - i;
+    free_count_ = kCapacity;
+  }
+
+  // Opens `conn_id` to `address` with a fresh session. An address still in
+  // the table from an earlier link loses that entry. Returns nullptr if the
+  // table is full, the conn_id is out of range or already open.
+  Connection *open(uint16_t conn_id, uint64_t address) {
+    if (conn_id >= kMaxConnId || by_conn_id_[conn_id] != kNone) {
+      stats_.rejected++;
+      return nullptr;
+    }
+    if (Connection *stale = find(address)) {
+      close(stale->conn_id);
+      stats_.replaced++;
+    }
+    if (free_count_ == 0) {
+      stats_.rejected++;
+      return nullptr;
+    }
+    uint8_t index = free_[--free_count_];
+    Connection &connection = slab_[index];
+    connection.address = address;
+    connection.conn_id = conn_id;
+    by_conn_id_[conn_id] = index;
+    insert(index);
+    stats_.opened++;
+    if (size() > stats_.peak)
+      stats_.peak = size();
+    return &connection;
+  }
+
+  // Closes `conn_id` and wipes its session; false if it wasn't open.
+  bool close(uint16_t conn_id) {
+    if (conn_id >= kMaxConnId || by_conn_id_[conn_id] == kNone)
+      return false;
+    uint8_t index = by_conn_id_[conn_id];
+    by_conn_id_[conn_id] = kNone;
+    erase(index);
+    slab_[index] = Connection{};
+    free_[free_count_++] = index;
+    stats_.closed++;
+    return true;
+  }
+
+  Connection *find_conn_id(uint16_t conn_id) {
+    if (conn_id >= kMaxConnId || by_conn_id_[conn_id] == kNone)
+      return nullptr;
+    return &slab_[by_conn_id_[conn_id]];
+  }
+
+  Connection *find(uint64_t address) {
+    for (size_t b = bucket_of(address);; b = (b + 1) & kBucketMask) {
+      if (buckets_[b] == kNone)
+        return nullptr;
+      if (slab_[buckets_[b]].address == address)
+        return &slab_[buckets_[b]];
+    }
+  }
+
+  // Calls f(Connection &) for each open connection.
+  template <class F> void for_each(F &&f) {
+    for (size_t conn_id = 0; conn_id < kMaxConnId; conn_id++)
+      if (by_conn_id_[conn_id] != kNone)
+        f(slab_[by_conn_id_[conn_id]]);
+  }
+
+  size_t size() const { return kCapacity - free_count_; }
+  bool full() const { return free_count_ == 0; }
+  static constexpr size_t capacity() { return kCapacity; }
+
+  const Stats &stats() const { return stats_; }
+
+private:
+  static constexpr size_t bucket_count() {
+    size_t count = 1;
+    while (count < 2 * kCapacity)
+      count *= 2;
+    return count;
+  }
+  static constexpr size_t kBuckets = bucket_count();
+  static constexpr size_t kBucketMask = kBuckets - 1;
+
+  static size_t bucket_of(uint64_t address) {
+    // fibonacci hashing; the low bits of a random address are already
+    // spread, but public addresses share their vendor half
+    return (size_t)((address * 0x9E3779B97F4A7C15ull) >> 40) & kBucketMask;
+  }
+
+  void insert(uint8_t index) {
+    size_t b = bucket_of(slab_[index].address);
+    while (buckets_[b] != kNone)
+      b = (b + 1) & kBucketMask;
+    buckets_[b] = index;
+  }
+
+  void erase(uint8_t index) {
+    size_t hole = bucket_of(slab_[index].address);
+    while (buckets_[hole] != index)
+      hole = (hole + 1) & kBucketMask;
+    buckets_[hole] = kNone;
+    // move back any later entry of the run whose home bucket is at or before
+    // the hole, so every entry stays reachable from its home bucket
+    for (size_t b = (hole + 1) & kBucketMask; buckets_[b] != kNone; b = (b + 1) & kBucketMask) {
+      size_t home = bucket_of(slab_[buckets_[b]].address);
+      if (((b - home) & kBucketMask) >= ((b - hole) & kBucketMask)) {
+        buckets_[hole] = buckets_[b];
+        buckets_[b] = kNone;
+        hole = b;
+      }
+    }
+  }
+
+  Connection slab_[kCapacity]{};
+  uint8_t free_[kCapacity];
+  size_t free_count_;
+  uint8_t by_conn_id_[kMaxConnId];
+  uint8_t buckets_[kBuckets];
+  Stats stats_{};
+};
+
+} // namespace gfps
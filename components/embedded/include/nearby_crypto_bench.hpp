@@ -0,0 +1,7 @@
+#pragma once
+
+// Measures the cost of the AES-128 / SHA-256 implementations available on
+// the target (the one the platform functions use, the portable software one,
+// the ESP32 peripherals and mbedtls) and logs the results. Only compiled in
+// when NEARBY_PLATFORM_CRYPTO_BENCHMARK is non-zero; a no-op otherwise.
+void nearby_platform_RunCryptoBenchmark();
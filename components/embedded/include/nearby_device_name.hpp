@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// longest personalized name kept, in bytes of UTF-8
+#if !defined(NEARBY_PLATFORM_PERSONALIZED_NAME_MAX)
+#define NEARBY_PLATFORM_PERSONALIZED_NAME_MAX 64
+#endif
+
+// hmac and nonce ahead of the encrypted name in an additional data packet
+// (see host/nearby_additional_data.hpp)
+#define NEARBY_PLATFORM_ADDITIONAL_DATA_HEADER_BYTES 16
+
+// Counters for the personalized name.
+struct nearby_platform_DeviceNameStats {
+  uint32_t name_loads;     // names read from persistence (once per boot)
+  uint32_t name_reads;     // GetDeviceName calls, served from RAM
+  uint32_t name_saves;     // SetDeviceName calls which changed the name
+};
+
+// Copies the personalized name (or CONFIG_DEVICE_NAME if none was set) into
+// `name` with its terminator; `length` is the buffer size on input and the
+// name length on output. Only the first call reads flash.
+nearby_platform_status nearby_platform_LoadDeviceName(char *name, size_t *length);
+
+// Replaces the cached name and saves it under the "Name" persistence key.
+nearby_platform_status nearby_platform_StoreDeviceName(const char *name);
+
+// Returns a snapshot of the counters.
+nearby_platform_DeviceNameStats nearby_platform_GetDeviceNameStats();
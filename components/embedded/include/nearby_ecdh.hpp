@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+// Anti-spoofing ECDH behind NEARBY_PLATFORM_HAS_SE. The private key is
+// parsed once by nearby_platform_EcdhInit (called from SecureElementInit);
+// the engine doing the P-256 math is picked with NEARBY_PLATFORM_ECDH_ENGINE.
+// Recent shared secrets are kept in a small LRU cache keyed by the remote
+// public key (NEARBY_PLATFORM_ECDH_CACHE_ENTRIES, 0 disables it) for
+// NEARBY_PLATFORM_ECDH_CACHE_MS and wiped when they leave it; a platform
+// timer wipes each one as it expires.
+
+struct nearby_platform_EcdhStats {
+  const char *engine;
+  uint32_t calls;
+  uint32_t failures;
+  uint32_t last_cycles;
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+  uint32_t peak_stack_bytes; // deepest stack use seen during a call, measured
+                             // with NEARBY_PLATFORM_ECDH_STACK_STATS only
+  uint32_t peak_heap_bytes;  // most heap in use during a call; with the
+                             // mbedtls engine, the arena's high-water mark
+  uint32_t state_bytes;      // RAM kept between calls (parsed key, curve)
+  // shared secret cache, for seekers retrying with the same ephemeral key
+  uint32_t cache_hits;
+  uint32_t cache_misses;
+  uint32_t cache_evictions;  // entries dropped for room or after expiring
+  uint64_t cache_saved_cycles; // hits times the mean cost of a computed secret
+};
+
+// Parses the anti-spoofing private key for the selected engine. The key must
+// stay valid for as long as ECDH is used (it is the constant in flash).
+nearby_platform_status nearby_platform_EcdhInit(const uint8_t private_key[32]);
+
+// Returns a snapshot of the ECDH counters.
+nearby_platform_EcdhStats nearby_platform_GetEcdhStats();
+
+// Wipes every cached shared secret.
+void nearby_platform_EcdhClearCache();
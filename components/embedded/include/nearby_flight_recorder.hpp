@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Crash-surviving flight recorder. The last N platform events are kept as
+// fixed 16 byte binary entries in memory that is not initialized on reset
+// (RTC no-init memory on target), so the history that led up to an abort()
+// can be decoded and dumped on the next boot. The log format and decoder have
+// no ESP-IDF dependency.
+
+namespace gfps {
+
+enum FlightEvent : uint8_t {
+  kFlightBoot,          // arg = reset reason
+  kFlightGapEvent,      // code = esp_gap_ble_cb_event_t
+  kFlightGattsEvent,    // code = esp_gatts_cb_event_t, arg16 = gatts_if
+  kFlightGattWrite,     // code = characteristic, arg16 = handle, arg = length
+  kFlightGattNotify,    // code = characteristic, arg16 = status, arg = length
+  kFlightTimerStart,    // code, arg16 = timer id (see below), arg = delay in ms
+  kFlightTimerCancel,   // code, arg16 = timer id
+  kFlightTimerFire,     // code, arg16 = timer id, arg = callback address
+  kFlightPersistLoad,   // code = stored key, arg16 = status, arg = length
+  kFlightPersistSave,   // code = stored key, arg16 = status, arg = length
+  kFlightAssert,        // arg16 = line, arg = token of the file name
+  kFlightNumEvents,
+};
+
+// A timer handle is a 16 bit pool index and a 16 bit generation. Timer events
+// keep the whole index in arg16 (TimerWheel pools are smaller than 0xffff) and
+// the low byte of the generation in code, so a start, cancel and fire belong
+// to the same timer when both fields match.
+
+// Stored as whole words: the CPU can only access RTC slow memory 32 bits at
+// a time on some targets.
+struct FlightEntry {
+  uint32_t seq;    // 1-based sequence number, 0 = empty slot
+  uint32_t cycles; // CPU cycle counter when the entry was written
+  uint32_t info;   // type | code << 8 | arg16 << 16
+  uint32_t arg;
+
+  uint8_t type() const { return info & 0xff; }
+  uint8_t code() const { return (info >> 8) & 0xff; }
+  uint16_t arg16() const { return info >> 16; }
+};
+static_assert(sizeof(FlightEntry) == 16);
+
+template <size_t N> struct FlightLog {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "FlightLog size must be a power of two");
+  static constexpr uint32_t kMagic = 0x47465052; // "GFPR"
+
+  uint32_t magic;
+  uint32_t capacity;
+  FlightEntry entries[N];
+
+  // False after a power-on reset (memory holds garbage) or a layout change.
+  bool valid() const { return magic == kMagic && capacity == N; }
+
+  void clear() {
+    for (auto &entry : entries)
+      entry = FlightEntry{};
+    capacity = N;
+    magic = kMagic;
+  }
+
+  // One past the newest sequence number in the log.
+  uint32_t next_seq() const {
+    uint32_t newest = 0;
+    for (const auto &entry : entries)
+      if (entry.seq > newest)
+        newest = entry.seq;
+    return newest + 1;
+  }
+
+  // Writes entry `seq`, overwriting the oldest one. The slot is marked empty
+  // before the fields change and gets its sequence number last, so a slot
+  // torn by a reset reads as empty rather than as the old entry with some of
+  // the new fields.
+  void write(uint32_t seq, uint32_t cycles, uint8_t type, uint8_t code, uint16_t arg16,
+             uint32_t arg) {
+    FlightEntry &entry = entries[seq & (N - 1)];
+    entry.seq = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    entry.cycles = cycles;
+    entry.info = type | (code << 8) | (static_cast<uint32_t>(arg16) << 16);
+    entry.arg = arg;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    entry.seq = seq;
+  }
+
+  // Calls `f(entry)` for every valid entry, oldest first.
+  template <typename F> void for_each(F &&f) const {
+    uint32_t newest = next_seq() - 1;
+    uint32_t oldest = newest >= N ? newest - N + 1 : 1;
+    for (uint32_t seq = oldest; seq <= newest && seq != 0; seq++) {
+      const FlightEntry &entry = entries[seq & (N - 1)];
+      if (entry.seq == seq)
+        f(entry);
+    }
+  }
+};
+
+inline const char *flight_event_name(uint8_t type) {
+  static const char *names[] = {
+      "BOOT",        "GAP",          "GATTS",       "GATT_WRITE",   "GATT_NOTIFY", "TIMER_START",
+      "TIMER_CANCEL", "TIMER_FIRE",  "PERSIST_LOAD", "PERSIST_SAVE", "ASSERT",
+  };
+  static_assert(sizeof(names) / sizeof(*names) == kFlightNumEvents);
+  return type < kFlightNumEvents ? names[type] : "UNKNOWN";
+}
+
+// Decodes `entry` into a line of text. `prev_cycles` is the cycle count of
+// the previous entry (for the relative timestamp), `cpu_mhz` the CPU clock.
+inline int format_flight_entry(const FlightEntry &entry, uint32_t prev_cycles, uint32_t cpu_mhz,
+                               char *out, size_t size) {
+  uint32_t delta_us = cpu_mhz ? (entry.cycles - prev_cycles) / cpu_mhz : 0;
+  return snprintf(out, size, "#%lu +%luus %s code=%u arg16=%u arg=%lu (0x%lx)",
+                  static_cast<unsigned long>(entry.seq), static_cast<unsigned long>(delta_us),
+                  flight_event_name(entry.type()), entry.code(), entry.arg16(),
+                  static_cast<unsigned long>(entry.arg), static_cast<unsigned long>(entry.arg));
+}
+
+} // namespace gfps
+
+// Sets up the recorder: dumps whatever the previous boot left behind and
+// starts a new log. Safe to call more than once; call it as early as possible.
+void nearby_platform_FlightRecorderInit();
+
+// Appends an event to the flight recorder.
+void nearby_platform_FlightRecord(gfps::FlightEvent type, uint8_t code, uint16_t arg16,
+                                  uint32_t arg);
+
+// Logs the current contents of the flight recorder.
+void nearby_platform_FlightRecorderDump();
+
+#if NEARBY_PLATFORM_FLIGHT_RECORDER
+#define GFPS_FLIGHT_RECORD(type, code, arg16, arg)                             \
+  nearby_platform_FlightRecord(gfps::type, (uint8_t)(code), (uint16_t)(arg16), \
+                               (uint32_t)(arg))
+#else
+#define GFPS_FLIGHT_RECORD(type, code, arg16, arg)
+#endif
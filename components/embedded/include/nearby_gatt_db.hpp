@@ -0,0 +1,220 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+// Compile-time description of a GATT service. Each characteristic is listed
+// once; GattLayout turns the list into the attribute order handed to the
+// stack (the service, then per characteristic its declaration, its value and,
+// if it notifies, a client characteristic configuration descriptor) and into
+// dense tables between attribute indices and characteristic ids. GattHandles
+// adds the handles the stack assigned, so a handle maps to a characteristic
+// (and back) with a subtraction and a table lookup. Nothing here depends on
+// the BLE stack, so host/nearby_gatt_layout_host.cpp checks the layout.
+
+namespace gfps {
+
+struct GattCharacteristic {
+  // characteristic properties, as in the declaration
+  static constexpr uint8_t kRead = 0x02;
+  static constexpr uint8_t kWrite = 0x08;
+  static constexpr uint8_t kNotify = 0x10;
+
+  uint8_t id;           // nearby_fp_Characteristic
+  const uint8_t *uuid;  // little endian, 2 or 16 bytes
+  uint8_t uuid_length;
+  uint8_t properties;
+  uint16_t max_length;  // longest value read or written
+  // a value served by the stack; without one reads are answered by the app
+  const uint8_t *value = nullptr;
+  uint16_t length = 0;
+
+  constexpr bool readable() const { return properties & kRead; }
+  constexpr bool writable() const { return properties & kWrite; }
+  constexpr bool notifies() const { return properties & kNotify; }
+  constexpr bool app_response() const { return value == nullptr; }
+};
+
+enum class GattAttributeKind : uint8_t {
+  Service,
+  Declaration,
+  Value,
+  Ccc,
+};
+
+struct GattAttribute {
+  GattAttributeKind kind;
+  uint8_t slot; // index into the characteristic list, 0 for the service
+};
+
+template <const auto &kCharacteristics> class GattLayout {
+public:
+  static constexpr uint8_t kNone = 0xff;
+  static constexpr size_t kNumCharacteristics = std::size(kCharacteristics);
+
+  static constexpr size_t count_attributes() {
+    size_t count = 1;
+    for (const auto &c : kCharacteristics)
+      count += c.notifies() ? 3 : 2;
+    return count;
+  }
+
+  static constexpr size_t max_id() {
+    size_t id = 0;
+    for (const auto &c : kCharacteristics)
+      id = c.id > id ? c.id : id;
+    return id;
+  }
+
+  static constexpr size_t kNumAttributes = count_attributes();
+  static_assert(kNumAttributes < kNone, "attribute indices are stored in a byte");
+
+  // attribute index -> what the attribute is
+  static constexpr std::array<GattAttribute, kNumAttributes> attributes = [] {
+    std::array<GattAttribute, kNumAttributes> table{};
+    size_t index = 0;
+    table[index++] = {GattAttributeKind::Service, 0};
+    for (size_t slot = 0; slot < kNumCharacteristics; slot++) {
+      table[index++] = {GattAttributeKind::Declaration, (uint8_t)slot};
+      table[index++] = {GattAttributeKind::Value, (uint8_t)slot};
+      if (kCharacteristics[slot].notifies())
+        table[index++] = {GattAttributeKind::Ccc, (uint8_t)slot};
+    }
+    return table;
+  }();
+
+  // slot -> attribute index of its value and of its descriptor (kNone if it
+  // doesn't notify)
+  static constexpr std::array<uint8_t, kNumCharacteristics> value_index = [] {
+    std::array<uint8_t, kNumCharacteristics> table{};
+    for (size_t i = 0; i < kNumAttributes; i++)
+      if (attributes[i].kind == GattAttributeKind::Value)
+        table[attributes[i].slot] = i;
+    return table;
+  }();
+  static constexpr std::array<uint8_t, kNumCharacteristics> ccc_index = [] {
+    std::array<uint8_t, kNumCharacteristics> table{};
+    table.fill(kNone);
+    for (size_t i = 0; i < kNumAttributes; i++)
+      if (attributes[i].kind == GattAttributeKind::Ccc)
+        table[attributes[i].slot] = i;
+    return table;
+  }();
+
+  // characteristic id -> slot, kNone if it is not in the service
+  static constexpr std::array<uint8_t, max_id() + 1> slot_of_id = [] {
+    std::array<uint8_t, max_id() + 1> table{};
+    table.fill(kNone);
+    for (size_t slot = 0; slot < kNumCharacteristics; slot++)
+      table[kCharacteristics[slot].id] = slot;
+    return table;
+  }();
+
+  // Readable characteristics answered by the app each get a buffer for the
+  // value being read; slot -> buffer index, kNone for the others.
+  static constexpr std::array<uint8_t, kNumCharacteristics> read_buffer = [] {
+    std::array<uint8_t, kNumCharacteristics> table{};
+    uint8_t next = 0;
+    for (size_t slot = 0; slot < kNumCharacteristics; slot++) {
+      const auto &c = kCharacteristics[slot];
+      table[slot] = c.readable() && c.app_response() ? next++ : kNone;
+    }
+    return table;
+  }();
+
+  static constexpr size_t count_read_buffers() {
+    size_t count = 0;
+    for (auto buffer : read_buffer)
+      count += buffer != kNone;
+    return count;
+  }
+
+  static constexpr size_t max_read_length() {
+    size_t length = 0;
+    for (size_t slot = 0; slot < kNumCharacteristics; slot++)
+      if (read_buffer[slot] != kNone && kCharacteristics[slot].max_length > length)
+        length = kCharacteristics[slot].max_length;
+    return length;
+  }
+
+  static constexpr size_t max_write_length() {
+    size_t length = 0;
+    for (const auto &c : kCharacteristics)
+      if (c.writable() && c.max_length > length)
+        length = c.max_length;
+    return length;
+  }
+
+  static constexpr size_t max_notify_length() {
+    size_t length = 0;
+    for (const auto &c : kCharacteristics)
+      if (c.notifies() && c.max_length > length)
+        length = c.max_length;
+    return length;
+  }
+
+  static constexpr size_t kNumReadBuffers = count_read_buffers();
+  static constexpr size_t kMaxReadLength = max_read_length();
+  static constexpr size_t kMaxWriteLength = max_write_length();
+  static constexpr size_t kMaxNotifyLength = max_notify_length();
+
+  static constexpr uint8_t slot(size_t id) {
+    return id < slot_of_id.size() ? slot_of_id[id] : kNone;
+  }
+};
+
+// The handles of a GattLayout once the stack has created the table. Tables
+// are given consecutive handles, so only the first is kept.
+template <class Layout> class GattHandles {
+public:
+  static constexpr uint8_t kNone = Layout::kNone;
+
+  // Takes the handles in attribute order; false unless there are as many as
+  // attributes and they are consecutive.
+  bool assign(const uint16_t *handles, size_t count) {
+    base_ = 0;
+    if (count != Layout::kNumAttributes || handles[0] == 0)
+      return false;
+    for (size_t i = 1; i < count; i++)
+      if (handles[i] != handles[0] + i)
+        return false;
+    base_ = handles[0];
+    return true;
+  }
+
+  bool assigned() const { return base_ != 0; }
+
+  uint16_t handle(size_t attribute) const { return base_ ? base_ + attribute : 0; }
+
+  // attribute index of `handle`, kNone if it isn't one of ours
+  uint8_t attribute(uint16_t handle) const {
+    uint16_t index = handle - base_;
+    return base_ && index < Layout::kNumAttributes ? index : kNone;
+  }
+
+  // the slot of the characteristic whose value has `handle`, kNone otherwise
+  uint8_t value_slot(uint16_t handle) const { return slot_if(handle, GattAttributeKind::Value); }
+
+  // the slot of the characteristic whose descriptor has `handle`
+  uint8_t ccc_slot(uint16_t handle) const { return slot_if(handle, GattAttributeKind::Ccc); }
+
+  // the value handle of characteristic `id`, 0 if it is not in the service
+  uint16_t value_handle(size_t id) const {
+    uint8_t slot = Layout::slot(id);
+    return slot == kNone ? 0 : handle(Layout::value_index[slot]);
+  }
+
+private:
+  uint8_t slot_if(uint16_t handle, GattAttributeKind kind) const {
+    uint8_t index = attribute(handle);
+    if (index == kNone || Layout::attributes[index].kind != kind)
+      return kNone;
+    return Layout::attributes[index].slot;
+  }
+
+  uint16_t base_ = 0;
+};
+
+} // namespace gfps
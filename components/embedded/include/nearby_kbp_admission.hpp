@@ -0,0 +1,287 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Admission control in front of key based pairing. A KBP write with a public
+// key costs an ECDH (milliseconds of CPU in the BTC task), so before it is
+// handed to the library a write has to pass, cheapest first:
+//
+// 1. structural checks: 16 bytes (no public key) or 80 bytes with a public
+//    key whose coordinates are field elements and not all zero;
+// 2. the peer's backoff: every failed handshake doubles the time the peer
+//    has to wait before the next attempt;
+// 3. a token bucket per peer and one shared by all peers, for writes which
+//    carry a public key. Peers whose last handshake succeeded skip the shared
+//    bucket and are the last to lose their entry, so a flood from rotating
+//    addresses can't lock out a seeker which has paired before.
+// 4. a new seeker can't be told from a rotating address on its first write,
+//    but it comes back from the same address, which a rotating flood does
+//    not. Peers turned away by the shared bucket before ever failing are
+//    remembered, and when they return they draw from a small bucket of their
+//    own, which the flood can't drain without retrying its addresses. The
+//    memory is a ring of address hashes filled at a limited rate, so it
+//    spans retry_memory_ms however fast the flood; past about 20 addresses
+//    a second, only some of the seekers turned away make it in.
+//
+// Time is passed in, so the same code runs on the host for the load
+// benchmark.
+
+namespace gfps {
+
+class KbpAdmission {
+public:
+  enum class Verdict : uint8_t {
+    Admit,
+    Malformed,
+    Backoff,
+    PeerRate,
+    GlobalRate,
+  };
+
+  struct Config {
+    // per peer: burst of ecdh writes, and one more per period
+    uint32_t peer_burst = 3;
+    uint32_t peer_period_ms = 1000;
+    // shared by all peers
+    uint32_t global_burst = 6;
+    uint32_t global_period_ms = 250;
+    // for peers coming back after the shared bucket turned them away
+    uint32_t retry_burst = 2;
+    uint32_t retry_period_ms = 1000;
+    // how long a turned away peer is remembered at least
+    uint32_t retry_memory_ms = 6000;
+    // backoff after the first failure, doubled per further failure
+    uint32_t backoff_ms = 500;
+    uint32_t max_backoff_ms = 30000;
+  };
+
+  struct Stats {
+    uint32_t admitted;
+    uint32_t malformed;
+    uint32_t backoff;
+    uint32_t peer_rate;
+    uint32_t global_rate;
+    uint32_t retries;  // admitted from the retry bucket
+    uint32_t failures; // handshakes reported as failed
+  };
+
+  static constexpr size_t kMaxPeers = 8;
+  static constexpr size_t kRetryMemory = 128;
+  static constexpr uint32_t kRememberBurst = 8;
+  static constexpr size_t kRequestBytes = 16;
+  static constexpr size_t kRequestWithKeyBytes = 80;
+
+  KbpAdmission() : KbpAdmission(Config{}) {}
+  explicit KbpAdmission(const Config &config) : config_(config) {
+    global_.credit_ms = config_.global_burst * config_.global_period_ms;
+    retry_.credit_ms = config_.retry_burst * config_.retry_period_ms;
+    remember_period_ms_ = config_.retry_memory_ms / kRetryMemory;
+    remember_.credit_ms = kRememberBurst * remember_period_ms_;
+  }
+
+  Verdict admit(uint64_t peer, const uint8_t *value, size_t length, uint64_t now_ms) {
+    Verdict verdict = check(peer, value, length, now_ms);
+    count(verdict);
+    return verdict;
+  }
+
+  // Reports how the admitted request from `peer` went.
+  void report(uint64_t peer, bool success, uint64_t now_ms) {
+    Peer &p = find_peer(peer, now_ms);
+    p.trusted = success;
+    if (success) {
+      p.failures = 0;
+      p.blocked_until_ms = 0;
+      return;
+    }
+    stats_.failures++;
+    uint32_t backoff = config_.backoff_ms;
+    for (uint32_t i = 0; i < p.failures && backoff < config_.max_backoff_ms; i++)
+      backoff *= 2;
+    if (backoff > config_.max_backoff_ms)
+      backoff = config_.max_backoff_ms;
+    p.failures++;
+    p.blocked_until_ms = now_ms + backoff;
+  }
+
+  const Stats &stats() const { return stats_; }
+
+  static const char *to_string(Verdict verdict) {
+    switch (verdict) {
+    case Verdict::Admit:
+      return "admit";
+    case Verdict::Malformed:
+      return "malformed";
+    case Verdict::Backoff:
+      return "backoff";
+    case Verdict::PeerRate:
+      return "peer rate";
+    case Verdict::GlobalRate:
+      return "global rate";
+    }
+    return "?";
+  }
+
+  // True if the 64 byte big endian x || y are both below the P-256 prime and
+  // not both zero. The library (or the ECDH engine) still checks the curve
+  // equation; this only weeds out junk without any field arithmetic.
+  static bool plausible_public_key(const uint8_t key[64]) {
+    static constexpr uint8_t kPrime[32] = {
+        0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    uint8_t any = 0;
+    for (int i = 0; i < 64; i++)
+      any |= key[i];
+    return any && memcmp(key, kPrime, 32) < 0 && memcmp(key + 32, kPrime, 32) < 0;
+  }
+
+private:
+  struct Bucket {
+    uint64_t last_ms;
+    uint32_t credit_ms; // tokens, scaled by the refill period
+  };
+
+  struct Peer {
+    uint64_t address;
+    uint64_t last_seen_ms;
+    uint64_t blocked_until_ms;
+    uint32_t failures;
+    Bucket bucket;
+    bool used;
+    bool trusted; // the last handshake succeeded
+  };
+
+  Verdict check(uint64_t peer, const uint8_t *value, size_t length, uint64_t now_ms) {
+    bool with_key = length == kRequestWithKeyBytes;
+    if (!value || (length != kRequestBytes && !with_key) ||
+        (with_key && !plausible_public_key(value + kRequestBytes)))
+      return Verdict::Malformed;
+    Peer &p = find_peer(peer, now_ms);
+    if (now_ms < p.blocked_until_ms)
+      return Verdict::Backoff;
+    if (!with_key)
+      return Verdict::Admit;
+    // the global bucket is only charged once the peer's own allows it, so a
+    // flooding peer can't use up everyone else's tokens
+    if (!has_token(p.bucket, config_.peer_burst, config_.peer_period_ms, now_ms))
+      return Verdict::PeerRate;
+    if (!p.trusted) {
+      if (has_token(global_, config_.global_burst, config_.global_period_ms, now_ms)) {
+        take_token(global_, config_.global_period_ms);
+      } else if (p.failures == 0 && forget_turned_away(peer) &&
+                 has_token(retry_, config_.retry_burst, config_.retry_period_ms, now_ms)) {
+        take_token(retry_, config_.retry_period_ms);
+        stats_.retries++;
+      } else {
+        if (p.failures == 0)
+          remember_turned_away(peer, now_ms);
+        return Verdict::GlobalRate;
+      }
+    }
+    take_token(p.bucket, config_.peer_period_ms);
+    return Verdict::Admit;
+  }
+
+  static bool has_token(Bucket &bucket, uint32_t burst, uint32_t period_ms, uint64_t now_ms) {
+    uint64_t limit = (uint64_t)burst * period_ms;
+    uint64_t credit = bucket.credit_ms + (now_ms - bucket.last_ms);
+    bucket.credit_ms = credit > limit ? limit : credit;
+    bucket.last_ms = now_ms;
+    return bucket.credit_ms >= period_ms;
+  }
+
+  static void take_token(Bucket &bucket, uint32_t period_ms) { bucket.credit_ms -= period_ms; }
+
+  // 0 marks a free slot
+  static uint32_t address_hash(uint64_t address) {
+    address ^= address >> 29;
+    address *= 0xbf58476d1ce4e5b9ull;
+    address ^= address >> 32;
+    return (uint32_t)address ? (uint32_t)address : 1;
+  }
+
+  void remember_turned_away(uint64_t address, uint64_t now_ms) {
+    if (!has_token(remember_, kRememberBurst, remember_period_ms_, now_ms))
+      return;
+    take_token(remember_, remember_period_ms_);
+    turned_away_[turned_away_next_] = address_hash(address);
+    turned_away_next_ = (turned_away_next_ + 1) % kRetryMemory;
+  }
+
+  // True (and forgets it, one retry per turn away) if `address` was turned
+  // away recently.
+  bool forget_turned_away(uint64_t address) {
+    uint32_t hash = address_hash(address);
+    for (auto &entry : turned_away_) {
+      if (entry == hash) {
+        entry = 0;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Finds the entry for `address`. A new peer replaces a free entry, or
+  // else the least recently seen untrusted one, or else the least recently
+  // seen; it starts with a full bucket and no failures.
+  Peer &find_peer(uint64_t address, uint64_t now_ms) {
+    Peer *victim = &peers_[0];
+    for (auto &p : peers_) {
+      if (p.used && p.address == address) {
+        p.last_seen_ms = now_ms;
+        return p;
+      }
+      if (evict_before(p, *victim))
+        victim = &p;
+    }
+    *victim = Peer{};
+    victim->address = address;
+    victim->last_seen_ms = now_ms;
+    victim->bucket = {now_ms, config_.peer_burst * config_.peer_period_ms};
+    victim->used = true;
+    return *victim;
+  }
+
+  static bool evict_before(const Peer &a, const Peer &b) {
+    if (a.used != b.used)
+      return !a.used;
+    if (a.trusted != b.trusted)
+      return !a.trusted;
+    return a.last_seen_ms < b.last_seen_ms;
+  }
+
+  void count(Verdict verdict) {
+    switch (verdict) {
+    case Verdict::Admit:
+      stats_.admitted++;
+      break;
+    case Verdict::Malformed:
+      stats_.malformed++;
+      break;
+    case Verdict::Backoff:
+      stats_.backoff++;
+      break;
+    case Verdict::PeerRate:
+      stats_.peer_rate++;
+      break;
+    case Verdict::GlobalRate:
+      stats_.global_rate++;
+      break;
+    }
+  }
+
+  Config config_;
+  Bucket global_{};
+  Bucket retry_{};
+  Peer peers_[kMaxPeers]{};
+  Bucket remember_{};
+  uint32_t remember_period_ms_;
+  uint32_t turned_away_[kRetryMemory]{};
+  size_t turned_away_next_ = 0;
+  Stats stats_{};
+};
+
+} // namespace gfps
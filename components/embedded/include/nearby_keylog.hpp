@@ -0,0 +1,390 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Log-structured store for the account key list. Instead of rewriting the
+// whole blob on every change, a save appends one CRC protected record per
+// 16 byte chunk that differs from what is already in flash. The last record
+// of a save carries a commit flag and the first a begin flag, so a save
+// interrupted by a reset is dropped as a whole on replay. When a bank fills
+// up, the other bank is erased and the current value written to it
+// (compaction); the full bank stays as it is until the next compaction.
+//
+// A program cut short by a reset can leave any subset of a slot's bits
+// programmed, so only a slot which reads 0xff throughout counts as free:
+// replay skips torn slots, and appending resumes after the last one which
+// isn't blank.
+//
+// The record format, replay and compaction below have no ESP-IDF dependency;
+// nearby_keylog.cpp supplies the partition and the locking, and
+// host/nearby_keylog_host.cpp runs the same code on simulated flash, cutting
+// the power at every byte of a save, in order and out of order.
+
+namespace gfps {
+
+struct KeyLogRecord {
+  static constexpr size_t kChunkBytes = 16;
+  static constexpr uint8_t kNoChunk = 0xff; // record only sets the length
+  static constexpr uint8_t kFlagCommit = 0x01;
+  static constexpr uint8_t kFlagBegin = 0x02;
+
+  uint32_t seq;
+  uint16_t value_length;
+  uint8_t chunk;
+  uint8_t flags;
+  uint8_t data[kChunkBytes];
+  uint32_t crc; // over everything before it
+  uint32_t reserved;
+};
+static_assert(sizeof(KeyLogRecord) == 32);
+
+// Header in the first record slot of a bank; written after the rest of the
+// bank during compaction, so a bank without one is never replayed.
+struct KeyLogBankHeader {
+  static constexpr uint32_t kMagic = 0x4b4c4647; // "GFLK"
+
+  uint32_t magic;
+  uint32_t generation; // higher = newer bank
+  uint32_t crc;        // over magic and generation
+  uint8_t reserved[20];
+};
+static_assert(sizeof(KeyLogBankHeader) == sizeof(KeyLogRecord));
+
+// RAM image of the stored value, built by replaying records.
+template <size_t MaxBytes> class KeyLogImage {
+  static_assert(MaxBytes % KeyLogRecord::kChunkBytes == 0);
+  static_assert(MaxBytes / KeyLogRecord::kChunkBytes < KeyLogRecord::kNoChunk);
+
+public:
+  static constexpr size_t kMaxBytes = MaxBytes;
+  static constexpr size_t kMaxChunks = MaxBytes / KeyLogRecord::kChunkBytes;
+
+  bool present() const { return present_; }
+  size_t length() const { return length_; }
+  const uint8_t *data() const { return data_; }
+
+  void clear() {
+    memset(data_, 0, sizeof(data_));
+    memset(pending_, 0, sizeof(pending_));
+    length_ = pending_length_ = 0;
+    present_ = false;
+  }
+
+  // Applies a record which passed its CRC check. Changes only become visible
+  // once a record with the commit flag is applied.
+  void apply(const KeyLogRecord &record) {
+    if (record.flags & KeyLogRecord::kFlagBegin) {
+      // whatever an earlier, interrupted save left behind is discarded
+      rollback();
+    }
+    if (record.chunk < kMaxChunks) {
+      memcpy(pending_ + record.chunk * KeyLogRecord::kChunkBytes, record.data,
+             KeyLogRecord::kChunkBytes);
+    }
+    pending_length_ = record.value_length <= MaxBytes ? record.value_length : MaxBytes;
+    if (record.flags & KeyLogRecord::kFlagCommit) {
+      memcpy(data_, pending_, sizeof(data_));
+      length_ = pending_length_;
+      present_ = true;
+    }
+  }
+
+  // Drops changes of a save which never committed.
+  void rollback() {
+    memcpy(pending_, data_, sizeof(pending_));
+    pending_length_ = length_;
+  }
+
+  // Calls `f(chunk, bytes)` for every chunk of `value` which differs from
+  // the image (chunks past the end are zero padded), returns how many. Chunks
+  // past the end of the current value always count as different: compaction
+  // drops them, so their old contents can't be relied on.
+  template <typename F> size_t diff(const uint8_t *value, size_t length, F &&f) const {
+    size_t count = 0;
+    size_t chunks = (length + KeyLogRecord::kChunkBytes - 1) / KeyLogRecord::kChunkBytes;
+    for (size_t i = 0; i < chunks; i++) {
+      uint8_t chunk[KeyLogRecord::kChunkBytes] = {0};
+      size_t offset = i * KeyLogRecord::kChunkBytes;
+      size_t n = length - offset < sizeof(chunk) ? length - offset : sizeof(chunk);
+      memcpy(chunk, value + offset, n);
+      if (!present_ || offset >= length_ || memcmp(chunk, data_ + offset, sizeof(chunk)) != 0) {
+        f(i, chunk);
+        count++;
+      }
+    }
+    return count;
+  }
+
+private:
+  uint8_t data_[MaxBytes];
+  uint8_t pending_[MaxBytes];
+  size_t length_{0};
+  size_t pending_length_{0};
+  bool present_{false};
+};
+
+struct KeyLogStats {
+  uint32_t saves;             // saves which appended records
+  uint32_t records_written;   // records appended, compaction included
+  uint32_t last_save_records; // records (flash writes) of the latest save
+  uint32_t compactions;
+  uint32_t replay_records;    // records replayed at boot
+  uint32_t replay_us;         // time the boot replay took
+  uint32_t bank_used_bytes;
+  uint32_t bank_bytes;
+};
+
+// The log on a region of flash made of two banks of `bank_bytes` each, both
+// a multiple of the erase size. Records are appended to the active bank and
+// compaction moves the current value to the other. `Flash` provides
+//
+//   bool read(size_t offset, void *data, size_t size);
+//   bool write(size_t offset, const void *data, size_t size);
+//   bool erase(size_t offset, size_t size);
+//   static uint32_t crc32(const void *data, size_t size);
+//
+// with NOR semantics: erased bytes read 0xff and a write only clears bits.
+// Not thread safe.
+template <class Flash, size_t MaxBytes> class KeyLog {
+public:
+  typedef KeyLogImage<MaxBytes> Image;
+  static constexpr size_t kRecordBytes = sizeof(KeyLogRecord);
+
+  KeyLog(Flash &flash, size_t bank_bytes) : flash_(flash), bank_bytes_(bank_bytes) {
+    stats_.bank_bytes = bank_bytes;
+  }
+
+  // Replays the newer of the two banks, or formats the region if neither has
+  // a valid header (then formatted() is true). False if the flash fails; a
+  // read error leaves the region alone, as formatting would lose the value,
+  // and loads and saves fail until a later mount() succeeds.
+  bool mount() {
+    mounted_ = false;
+    formatted_ = false;
+    KeyLogBankHeader headers[2];
+    bool valid[2];
+    for (int bank = 0; bank < 2; bank++) {
+      if (!flash_.read(bank_address(bank), &headers[bank], sizeof(headers[bank])))
+        return false;
+      valid[bank] = header_valid(headers[bank]);
+    }
+    formatted_ = !valid[0] && !valid[1];
+    if (formatted_) {
+      bank_ = 0;
+      generation_ = 1;
+      write_offset_ = kRecordBytes;
+      image_.clear();
+      mounted_ = flash_.erase(bank_address(0), bank_bytes_) && write_header(0, generation_);
+      return mounted_;
+    }
+    bank_ = (valid[1] && (!valid[0] || headers[1].generation > headers[0].generation)) ? 1 : 0;
+    generation_ = headers[bank_].generation;
+    mounted_ = replay();
+    return mounted_;
+  }
+
+  bool mounted() const { return mounted_; }
+  // Whether a value was saved, and its length.
+  bool present() const { return mounted_ && image_.present(); }
+  size_t length() const { return image_.length(); }
+
+  // Copies the value. False if it is not mounted, was never saved or
+  // `*length` is too small.
+  bool load(uint8_t *output, size_t *length) const {
+    if (!present() || *length < image_.length())
+      return false;
+    memcpy(output, image_.data(), image_.length());
+    *length = image_.length();
+    return true;
+  }
+
+  // Appends the chunks of `input` which changed since the last save,
+  // compacting first if they don't fit. False if the value is too long or
+  // the flash fails; the previous value is then still the one replayed.
+  bool save(const uint8_t *input, size_t length) {
+    if (!mounted_ || length > MaxBytes)
+      return false;
+    KeyLogRecord records[Image::kMaxChunks + 1];
+    size_t count = 0;
+    image_.diff(input, length, [&](size_t chunk, const uint8_t *data) {
+      records[count++] = make_record(length, chunk, data);
+    });
+    if (count == 0) {
+      if (image_.present() && image_.length() == length)
+        return true;
+      records[count++] = make_record(length, KeyLogRecord::kNoChunk, nullptr);
+    }
+    records[0].flags |= KeyLogRecord::kFlagBegin;
+    records[count - 1].flags |= KeyLogRecord::kFlagCommit;
+
+    uint32_t records_before = stats_.records_written;
+    if (write_offset_ + count * kRecordBytes > bank_bytes_) {
+      // no room left: the new value becomes the content of the other bank
+      if (!compact(input, length))
+        return false;
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        bool ok = write_record(bank_, write_offset_, records[i]);
+        // a failed write may still have programmed part of the slot
+        write_offset_ += kRecordBytes;
+        if (!ok)
+          return false;
+      }
+    }
+    for (size_t i = 0; i < count; i++)
+      image_.apply(records[i]);
+    stats_.saves++;
+    stats_.last_save_records = stats_.records_written - records_before;
+    return true;
+  }
+
+  // Compacts if the active bank is at least three quarters full. False if
+  // the flash fails.
+  bool maintain() {
+    if (!present() || write_offset_ < bank_bytes_ * 3 / 4)
+      return true;
+    return compact(image_.data(), image_.length());
+  }
+
+  bool formatted() const { return formatted_; }
+  int bank() const { return bank_; }
+  uint32_t generation() const { return generation_; }
+  size_t write_offset() const { return write_offset_; }
+
+  KeyLogStats stats() const {
+    KeyLogStats stats = stats_;
+    stats.bank_used_bytes = write_offset_;
+    return stats;
+  }
+  void set_replay_us(uint32_t us) { stats_.replay_us = us; }
+
+private:
+  static uint32_t record_crc(const KeyLogRecord &record) {
+    return Flash::crc32(&record, offsetof(KeyLogRecord, crc));
+  }
+
+  static uint32_t header_crc(const KeyLogBankHeader &header) {
+    return Flash::crc32(&header, offsetof(KeyLogBankHeader, crc));
+  }
+
+  size_t bank_address(int bank) const { return bank * bank_bytes_; }
+
+  static bool header_valid(const KeyLogBankHeader &header) {
+    return header.magic == KeyLogBankHeader::kMagic && header.crc == header_crc(header);
+  }
+
+  bool write_header(int bank, uint32_t generation) {
+    KeyLogBankHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = KeyLogBankHeader::kMagic;
+    header.generation = generation;
+    header.crc = header_crc(header);
+    return flash_.write(bank_address(bank), &header, sizeof(header));
+  }
+
+  bool write_record(int bank, size_t offset, KeyLogRecord &record) {
+    record.seq = seq_++;
+    record.crc = record_crc(record);
+    record.reserved = 0;
+    if (!flash_.write(bank_address(bank) + offset, &record, sizeof(record)))
+      return false;
+    stats_.records_written++;
+    return true;
+  }
+
+  static KeyLogRecord make_record(size_t value_length, uint8_t chunk, const uint8_t *data) {
+    KeyLogRecord record;
+    memset(&record, 0, sizeof(record));
+    record.value_length = value_length;
+    record.chunk = chunk;
+    if (data)
+      memcpy(record.data, data, sizeof(record.data));
+    return record;
+  }
+
+  // Writes `value` as the only content of the inactive bank and makes that
+  // bank the active one. The header goes last, so a reset part way through
+  // leaves the old bank in charge.
+  bool compact(const uint8_t *value, size_t length) {
+    int target = !bank_;
+    if (!flash_.erase(bank_address(target), bank_bytes_))
+      return false;
+    size_t offset = kRecordBytes;
+    size_t chunks = (length + KeyLogRecord::kChunkBytes - 1) / KeyLogRecord::kChunkBytes;
+    for (size_t i = 0; i < chunks || i == 0; i++) {
+      uint8_t chunk[KeyLogRecord::kChunkBytes] = {0};
+      size_t chunk_offset = i * sizeof(chunk);
+      if (chunk_offset < length)
+        memcpy(chunk, value + chunk_offset,
+               length - chunk_offset < sizeof(chunk) ? length - chunk_offset : sizeof(chunk));
+      KeyLogRecord record = make_record(length, chunks ? i : KeyLogRecord::kNoChunk, chunk);
+      record.flags = (i == 0 ? KeyLogRecord::kFlagBegin : 0) |
+                     (i + 1 >= chunks ? KeyLogRecord::kFlagCommit : 0);
+      if (!write_record(target, offset, record))
+        return false;
+      offset += kRecordBytes;
+    }
+    if (!write_header(target, generation_ + 1))
+      return false;
+    bank_ = target;
+    generation_++;
+    write_offset_ = offset;
+    stats_.compactions++;
+    return true;
+  }
+
+  static bool blank(const KeyLogRecord &record) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&record);
+    for (size_t i = 0; i < sizeof(record); i++)
+      if (bytes[i] != 0xff)
+        return false;
+    return true;
+  }
+
+  // Replays the active bank into the image. Reads the whole bank, as a slot
+  // a failed write left blank may have records after it. False if the flash
+  // fails.
+  bool replay() {
+    image_.clear();
+    stats_.replay_records = 0;
+    size_t end = kRecordBytes;
+    KeyLogRecord records[8];
+    for (size_t offset = kRecordBytes; offset + kRecordBytes <= bank_bytes_;) {
+      size_t count = (bank_bytes_ - offset) / kRecordBytes;
+      if (count > sizeof(records) / sizeof(*records))
+        count = sizeof(records) / sizeof(*records);
+      if (!flash_.read(bank_address(bank_) + offset, records, count * kRecordBytes))
+        return false;
+      for (size_t i = 0; i < count; i++, offset += kRecordBytes) {
+        if (blank(records[i]))
+          continue;
+        end = offset + kRecordBytes;
+        // records torn by a reset fail the check and are skipped; the save
+        // they belonged to never committed
+        if (records[i].crc == record_crc(records[i])) {
+          image_.apply(records[i]);
+          seq_ = records[i].seq + 1;
+          stats_.replay_records++;
+        }
+      }
+    }
+    image_.rollback();
+    write_offset_ = end;
+    return true;
+  }
+
+  Flash &flash_;
+  size_t bank_bytes_;
+  int bank_ = 0;
+  uint32_t generation_ = 0;
+  size_t write_offset_ = 0;
+  uint32_t seq_ = 0;
+  bool mounted_ = false;
+  bool formatted_ = false;
+  Image image_;
+  KeyLogStats stats_{};
+};
+
+} // namespace gfps
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Latency instrumentation for the GATT hot path. Each stage / characteristic
+// pair owns a fixed-bucket histogram in RAM. Recording is only compiled in
+// when NEARBY_PLATFORM_LATENCY_STATS is non-zero; otherwise the GFPS_LATENCY_*
+// macros expand to nothing.
+
+namespace gfps {
+
+// Histogram of durations in microseconds with power-of-two buckets: bucket 0
+// holds [0, 2) us, bucket i holds [2^i, 2^(i+1)) us and the last bucket holds
+// everything larger. Does no locking of its own.
+class LatencyHistogram {
+public:
+  static constexpr size_t kNumBuckets = 20; // last bucket starts at ~0.5 s
+
+  void record(uint32_t us) {
+    buckets_[bucket_for(us)]++;
+    count_++;
+    sum_us_ += us;
+    if (count_ == 1 || us < min_us_)
+      min_us_ = us;
+    if (us > max_us_)
+      max_us_ = us;
+  }
+
+  void reset() { *this = LatencyHistogram(); }
+
+  uint32_t count() const { return count_; }
+  uint32_t min_us() const { return min_us_; }
+  uint32_t max_us() const { return max_us_; }
+  uint32_t mean_us() const { return count_ ? static_cast<uint32_t>(sum_us_ / count_) : 0; }
+  uint32_t bucket(size_t i) const { return buckets_[i]; }
+
+  // Lower bound (inclusive) of bucket `i` in microseconds.
+  static constexpr uint32_t bucket_floor_us(size_t i) { return i == 0 ? 0 : 1u << i; }
+
+  static constexpr size_t bucket_for(uint32_t us) {
+    size_t i = 0;
+    while (us > 1 && i < kNumBuckets - 1) {
+      us >>= 1;
+      i++;
+    }
+    return i;
+  }
+
+  // Upper bound of the bucket containing the `percent`th percentile, clamped
+  // to the observed maximum.
+  uint32_t percentile_us(uint32_t percent) const {
+    if (count_ == 0)
+      return 0;
+    uint64_t target = (static_cast<uint64_t>(count_) * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      seen += buckets_[i];
+      if (seen >= target && seen > 0) {
+        if (i == kNumBuckets - 1)
+          return max_us_;
+        uint32_t upper = bucket_floor_us(i + 1) - 1;
+        return upper < max_us_ ? upper : max_us_;
+      }
+    }
+    return max_us_;
+  }
+
+private:
+  uint32_t buckets_[kNumBuckets]{};
+  uint32_t count_{0};
+  uint32_t min_us_{0};
+  uint32_t max_us_{0};
+  uint64_t sum_us_{0};
+};
+
+static_assert(LatencyHistogram::bucket_for(0) == 0);
+static_assert(LatencyHistogram::bucket_for(1) == 0);
+static_assert(LatencyHistogram::bucket_for(2) == 1);
+static_assert(LatencyHistogram::bucket_for(1023) == 9);
+static_assert(LatencyHistogram::bucket_for(1024) == 10);
+static_assert(LatencyHistogram::bucket_for(0xffffffff) == LatencyHistogram::kNumBuckets - 1);
+
+} // namespace gfps
+
+// Instrumented stages of the GATT hot path.
+typedef enum {
+  kLatencyGattRead,        // READ_EVT received -> on_gatt_read returned
+  kLatencyGattWrite,       // WRITE_EVT received -> on_gatt_write returned
+  kLatencyGattWriteNotify, // WRITE_EVT received -> GattNotify sent the response
+  kLatencyNumStages,
+} nearby_platform_LatencyStage;
+
+// Size of the per-characteristic dimension, covers every nearby_fp_Characteristic.
+static constexpr size_t kLatencyNumCharacteristics = 8;
+
+// Records `us` for the given stage and characteristic.
+void nearby_platform_RecordLatency(nearby_platform_LatencyStage stage,
+                                   int characteristic, uint32_t us);
+
+// Remembers when a write to `characteristic` arrived so that the matching
+// GattNotify can be timed.
+void nearby_platform_MarkLatencyWrite(int characteristic, int64_t start_us);
+
+// Records the write -> notify latency for `characteristic` if a write is
+// pending.
+void nearby_platform_RecordLatencyNotify(int characteristic, int64_t now_us);
+
+// Returns a copy of the histogram for the stage and characteristic.
+gfps::LatencyHistogram nearby_platform_GetLatencyHistogram(
+    nearby_platform_LatencyStage stage, int characteristic);
+
+// Logs every non-empty histogram.
+void nearby_platform_DumpLatencyStats();
+
+// Clears all histograms.
+void nearby_platform_ResetLatencyStats();
+
+#if NEARBY_PLATFORM_LATENCY_STATS
+#define GFPS_LATENCY_START(var) const int64_t var = esp_timer_get_time()
+#define GFPS_LATENCY_RECORD(stage, characteristic, start)                      \
+  nearby_platform_RecordLatency(stage, characteristic,                        \
+                                (uint32_t)(esp_timer_get_time() - (start)))
+#define GFPS_LATENCY_MARK_WRITE(characteristic, start)                         \
+  nearby_platform_MarkLatencyWrite(characteristic, start)
+#define GFPS_LATENCY_NOTIFY(characteristic)                                    \
+  nearby_platform_RecordLatencyNotify(characteristic, esp_timer_get_time())
+#define GFPS_LATENCY_DUMP() nearby_platform_DumpLatencyStats()
+#else
+#define GFPS_LATENCY_START(var)
+#define GFPS_LATENCY_RECORD(stage, characteristic, start)
+#define GFPS_LATENCY_MARK_WRITE(characteristic, start)
+#define GFPS_LATENCY_NOTIFY(characteristic)
+#define GFPS_LATENCY_DUMP()
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// mbedtls allocations (bignums during ECDH, contexts) are served from a
+// preallocated arena of NEARBY_PLATFORM_MBEDTLS_ARENA_BYTES instead of the
+// heap Bluedroid shares, so a handshake doesn't fragment it. Allocations are
+// bumped off the top and given back in LIFO order; the arena starts over
+// whenever nothing in it is live, and is reset at the end of each pairing.
+// Requests that don't fit fall back to the system heap.
+
+struct nearby_platform_MbedtlsArenaStats {
+  uint32_t arena_bytes;      // size of the arena
+  uint32_t high_water_bytes; // most of the arena ever in use
+  uint32_t used_bytes;       // in use now, including freed blocks below live ones
+  uint32_t live;             // allocations not yet freed, arena and heap
+  uint32_t peak_live;
+  uint32_t allocations;      // total served from the arena
+  uint32_t fallbacks;        // total served from the heap because the arena was full
+  uint32_t fallback_peak_bytes; // largest single heap fallback
+  uint32_t resets;           // times the arena started over
+};
+
+// Installs the arena as the mbedtls calloc / free. Call before anything
+// else uses mbedtls.
+nearby_platform_status nearby_platform_MbedtlsArenaInit();
+
+// Called when a pairing handshake ends: wipes the unused part of the arena
+// and logs the high-water mark. Allocations which outlive handshakes (like
+// the key parsed by the mbedtls ECDH engine) keep the bottom of the arena.
+void nearby_platform_MbedtlsArenaReset();
+
+// Returns a snapshot of the arena counters.
+nearby_platform_MbedtlsArenaStats nearby_platform_GetMbedtlsArenaStats();
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Bounded queue of notifications waiting for one connection. GattNotify
+// copies the value in and returns; the BLE layer sends from the front while
+// the link is not congested, a batch at a time, so a burst of pairing
+// responses goes out back to back in as few connection events as the
+// controller can manage instead of failing once the stack pushes back.
+//
+// The queue is guarded by the caller's lock, but the stack is called without
+// it: next() copies the front out and marks it as being sent, and sent() or
+// failed() settles it afterwards. While one sender has the front, next()
+// gives nothing to anyone else, so notifications leave in order and the
+// front stays put (and keeps its slot) until the send is settled.
+//
+// Nothing here depends on the BLE stack, so host/nearby_notify_queue_host.cpp
+// checks it.
+
+namespace gfps {
+
+struct NotifyStats {
+  uint32_t queued;      // notifications accepted by GattNotify
+  uint32_t sent;        // handed to the stack
+  uint32_t dropped;     // refused with the queue full, lost on disconnect, or
+                        // confirmed with an error
+  uint32_t retries;     // times a send the stack refused was retried from a timer
+  uint32_t congestions; // times a link reported congestion
+  uint32_t batches;     // drains which sent at least one notification
+  uint32_t depth;       // notifications waiting, over all connections
+  uint32_t max_depth;   // most waiting on one connection
+};
+
+template <size_t kDepth, size_t kBytes> class NotifyQueue {
+public:
+  struct Entry {
+    uint16_t handle;
+    uint8_t characteristic;
+    uint16_t length;
+    uint8_t data[kBytes];
+  };
+
+  // False if the queue is full or the value is too long.
+  bool push(uint16_t handle, uint8_t characteristic, const uint8_t *data, size_t length) {
+    if (count_ == kDepth || length > kBytes)
+      return false;
+    Entry &entry = entries_[(head_ + count_) % kDepth];
+    entry.handle = handle;
+    entry.characteristic = characteristic;
+    entry.length = length;
+    memcpy(entry.data, data, length);
+    count_++;
+    return true;
+  }
+
+  // Copies the front into `entry` for sending if the link takes it now: not
+  // congested, fewer than `batch` sent and unconfirmed, and no other send in
+  // progress. The caller must then call sent() or failed().
+  bool next(Entry &entry, size_t batch) {
+    if (sending_ || congested_ || count_ == 0 || in_flight_ >= batch)
+      return false;
+    entry = entries_[head_];
+    sending_ = true;
+    return true;
+  }
+
+  // The stack took the front: it leaves the queue and waits for confirmation.
+  void sent() {
+    if (!sending_)
+      return;
+    sending_ = false;
+    head_ = (head_ + 1) % kDepth;
+    count_--;
+    in_flight_++;
+  }
+
+  // The stack refused the front: it stays first in the queue.
+  void failed() { sending_ = false; }
+
+  // A notification sent earlier was confirmed, successfully or not.
+  void confirmed() {
+    if (in_flight_ > 0)
+      in_flight_--;
+  }
+
+  void set_congested(bool congested) { congested_ = congested; }
+  bool congested() const { return congested_; }
+
+  // Waiting with nothing in flight or congested to restart the queue: only a
+  // new notification or a retry gets it moving again.
+  bool stalled() const { return count_ > 0 && in_flight_ == 0 && !congested_ && !sending_; }
+
+  size_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+  size_t in_flight() const { return in_flight_; }
+  static constexpr size_t capacity() { return kDepth; }
+
+private:
+  Entry entries_[kDepth];
+  size_t head_ = 0;
+  size_t count_ = 0;
+  size_t in_flight_ = 0; // sent and not yet confirmed
+  bool congested_ = false;
+  bool sending_ = false; // the front is with a sender
+};
+
+} // namespace gfps
@@ -0,0 +1,353 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Compact P-256 (secp256r1) ECDH for the anti-spoofing handshake, in the
+// spirit of p256-m: 32 bit limbs, Montgomery field arithmetic, the complete
+// projective formulas of Renes, Costello and Batina (2016) and a fixed 4 bit
+// window with constant time table lookups, so the run time does not depend
+// on the private key. Needs no heap and about 2 KB of stack.
+
+namespace gfps {
+
+class P256 {
+public:
+  // Computes the x coordinate of private_key * public_key. Keys are big
+  // endian; public_key is x || y. Returns false if the private key is not in
+  // [1, n - 1], the public key is not on the curve, or the result is the
+  // point at infinity.
+  static bool ecdh(const uint8_t private_key[32], const uint8_t public_key[64],
+                   uint8_t secret[32]) {
+    if (!valid_scalar(private_key))
+      return false;
+    Point point;
+    if (!load_point(public_key, point))
+      return false;
+    Point result;
+    scalar_mul(private_key, point, result);
+    Fe x;
+    bool ok = affine_x(result, x);
+    store(secret, x);
+    wipe(&result, sizeof(result));
+    wipe(x, sizeof(x));
+    return ok;
+  }
+
+  // True if `private_key` is a valid scalar, i.e. in [1, n - 1].
+  static bool valid_scalar(const uint8_t private_key[32]) {
+    Fe d;
+    load(d, private_key);
+    bool nonzero = false;
+    for (uint32_t limb : d)
+      nonzero |= limb != 0;
+    uint32_t borrow = sub_raw(d, d, kN);
+    wipe(d, sizeof(d));
+    // d - n borrows iff d < n
+    return nonzero && borrow;
+  }
+
+private:
+  typedef uint32_t Fe[8];
+  struct Point {
+    Fe x, y, z;
+  };
+
+  // little endian 32 bit limbs
+  static constexpr Fe kP = {0xffffffff, 0xffffffff, 0xffffffff, 0x00000000,
+                            0x00000000, 0x00000000, 0x00000001, 0xffffffff};
+  static constexpr Fe kN = {0xfc632551, 0xf3b9cac2, 0xa7179e84, 0xbce6faad,
+                            0xffffffff, 0xffffffff, 0x00000000, 0xffffffff};
+  // R^2 mod p, R = 2^256
+  static constexpr Fe kR2 = {0x00000003, 0x00000000, 0xffffffff, 0xfffffffb,
+                             0xfffffffe, 0xffffffff, 0xfffffffd, 0x00000004};
+  // R mod p, i.e. 1 in Montgomery form
+  static constexpr Fe kOne = {0x00000001, 0x00000000, 0x00000000, 0xffffffff,
+                              0xffffffff, 0xffffffff, 0xfffffffe, 0x00000000};
+  // curve constant b in Montgomery form
+  static constexpr Fe kB = {0x29c4bddf, 0xd89cdf62, 0x78843090, 0xacf005cd,
+                            0xf7212ed6, 0xe5a220ab, 0x04874834, 0xdc30061d};
+
+  static void wipe(void *p, size_t size) {
+    volatile uint8_t *bytes = static_cast<volatile uint8_t *>(p);
+    while (size--)
+      *bytes++ = 0;
+  }
+
+  static void load(Fe r, const uint8_t in[32]) {
+    for (int i = 0; i < 8; i++) {
+      const uint8_t *p = in + 28 - 4 * i;
+      r[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+  }
+
+  static void store(uint8_t out[32], const Fe a) {
+    for (int i = 0; i < 8; i++) {
+      uint8_t *p = out + 28 - 4 * i;
+      p[0] = a[i] >> 24;
+      p[1] = a[i] >> 16;
+      p[2] = a[i] >> 8;
+      p[3] = a[i];
+    }
+  }
+
+  // r = a - b, returns the borrow
+  static uint32_t sub_raw(Fe r, const Fe a, const Fe b) {
+    int64_t borrow = 0;
+    for (int i = 0; i < 8; i++) {
+      borrow += (int64_t)a[i] - b[i];
+      r[i] = (uint32_t)borrow;
+      borrow >>= 32;
+    }
+    return (uint32_t)-borrow;
+  }
+
+  // r = mask ? a : b
+  static void select(Fe r, uint32_t mask, const Fe a, const Fe b) {
+    for (int i = 0; i < 8; i++)
+      r[i] = (a[i] & mask) | (b[i] & ~mask);
+  }
+
+  static void add(Fe r, const Fe a, const Fe b) {
+    Fe sum, reduced;
+    uint64_t carry = 0;
+    for (int i = 0; i < 8; i++) {
+      carry += (uint64_t)a[i] + b[i];
+      sum[i] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    uint32_t borrow = sub_raw(reduced, sum, kP);
+    // keep the sum only if it was below p
+    select(r, -(uint32_t)(borrow & (1 - (uint32_t)carry)), sum, reduced);
+  }
+
+  static void sub(Fe r, const Fe a, const Fe b) {
+    Fe diff;
+    uint32_t mask = -sub_raw(diff, a, b);
+    uint64_t carry = 0;
+    for (int i = 0; i < 8; i++) {
+      carry += (uint64_t)diff[i] + (kP[i] & mask);
+      r[i] = (uint32_t)carry;
+      carry >>= 32;
+    }
+  }
+
+  // Montgomery multiplication: r = a * b / R mod p. -p^-1 mod 2^32 is 1.
+  static void mul(Fe r, const Fe a, const Fe b) {
+    uint32_t t[10] = {0};
+    for (int i = 0; i < 8; i++) {
+      uint64_t carry = 0;
+      for (int j = 0; j < 8; j++) {
+        carry += (uint64_t)a[j] * b[i] + t[j];
+        t[j] = (uint32_t)carry;
+        carry >>= 32;
+      }
+      carry += t[8];
+      t[8] = (uint32_t)carry;
+      t[9] = (uint32_t)(carry >> 32);
+      uint32_t m = t[0];
+      carry = ((uint64_t)m * kP[0] + t[0]) >> 32;
+      for (int j = 1; j < 8; j++) {
+        carry += (uint64_t)m * kP[j] + t[j];
+        t[j - 1] = (uint32_t)carry;
+        carry >>= 32;
+      }
+      carry += t[8];
+      t[7] = (uint32_t)carry;
+      t[8] = t[9] + (uint32_t)(carry >> 32);
+    }
+    Fe reduced;
+    uint32_t borrow = sub_raw(reduced, t, kP);
+    select(r, -(uint32_t)(borrow & (1 - t[8])), t, reduced);
+  }
+
+  static void sqr(Fe r, const Fe a) { mul(r, a, a); }
+
+  // r = a^(p - 2) = 1 / a
+  static void invert(Fe r, const Fe a) {
+    Fe result;
+    memcpy(result, kOne, sizeof(result));
+    for (int bit = 255; bit >= 0; bit--) {
+      sqr(result, result);
+      uint32_t e = (kP[bit / 32] - (bit / 32 == 0 ? 2 : 0)) >> (bit % 32);
+      // the exponent is public, branching on it is fine
+      if (e & 1)
+        mul(result, result, a);
+    }
+    memcpy(r, result, sizeof(result));
+  }
+
+  static bool is_zero(const Fe a) {
+    uint32_t bits = 0;
+    for (int i = 0; i < 8; i++)
+      bits |= a[i];
+    return bits == 0;
+  }
+
+  static bool equal(const Fe a, const Fe b) {
+    uint32_t bits = 0;
+    for (int i = 0; i < 8; i++)
+      bits |= a[i] ^ b[i];
+    return bits == 0;
+  }
+
+  // Loads an affine public key into Montgomery form and checks that it is
+  // on the curve: y^2 = x^3 - 3x + b.
+  static bool load_point(const uint8_t in[64], Point &point) {
+    Fe x, y, tmp;
+    load(x, in);
+    load(y, in + 32);
+    // coordinates must be reduced
+    if (!sub_raw(tmp, x, kP) || !sub_raw(tmp, y, kP))
+      return false;
+    mul(point.x, x, kR2);
+    mul(point.y, y, kR2);
+    memcpy(point.z, kOne, sizeof(Fe));
+    Fe lhs, rhs;
+    sqr(lhs, point.y);
+    sqr(rhs, point.x);
+    mul(rhs, rhs, point.x);
+    sub(rhs, rhs, point.x);
+    sub(rhs, rhs, point.x);
+    sub(rhs, rhs, point.x);
+    add(rhs, rhs, kB);
+    return equal(lhs, rhs);
+  }
+
+  // Complete addition for a = -3 (RCB16, algorithm 4). Handles doubling and
+  // the point at infinity, so no branches on secret data are needed.
+  static void point_add(Point &r, const Point &p, const Point &q) {
+    Fe t0, t1, t2, t3, t4, x3, y3, z3;
+    mul(t0, p.x, q.x);
+    mul(t1, p.y, q.y);
+    mul(t2, p.z, q.z);
+    add(t3, p.x, p.y);
+    add(t4, q.x, q.y);
+    mul(t3, t3, t4);
+    add(t4, t0, t1);
+    sub(t3, t3, t4);
+    add(t4, p.y, p.z);
+    add(x3, q.y, q.z);
+    mul(t4, t4, x3);
+    add(x3, t1, t2);
+    sub(t4, t4, x3);
+    add(x3, p.x, p.z);
+    add(y3, q.x, q.z);
+    mul(x3, x3, y3);
+    add(y3, t0, t2);
+    sub(y3, x3, y3);
+    mul(z3, kB, t2);
+    sub(x3, y3, z3);
+    add(z3, x3, x3);
+    add(x3, x3, z3);
+    sub(z3, t1, x3);
+    add(x3, t1, x3);
+    mul(y3, kB, y3);
+    add(t1, t2, t2);
+    add(t2, t1, t2);
+    sub(y3, y3, t2);
+    sub(y3, y3, t0);
+    add(t1, y3, y3);
+    add(y3, t1, y3);
+    add(t1, t0, t0);
+    add(t0, t1, t0);
+    sub(t0, t0, t2);
+    mul(t1, t4, y3);
+    mul(t2, t0, y3);
+    mul(y3, x3, z3);
+    add(y3, y3, t2);
+    mul(x3, x3, t3);
+    sub(x3, x3, t1);
+    mul(z3, t4, z3);
+    mul(t1, t3, t0);
+    add(z3, z3, t1);
+    memcpy(r.x, x3, sizeof(Fe));
+    memcpy(r.y, y3, sizeof(Fe));
+    memcpy(r.z, z3, sizeof(Fe));
+  }
+
+  // Doubling for a = -3 (RCB16, algorithm 6).
+  static void point_double(Point &r, const Point &p) {
+    Fe t0, t1, t2, t3, x3, y3, z3;
+    sqr(t0, p.x);
+    sqr(t1, p.y);
+    sqr(t2, p.z);
+    mul(t3, p.x, p.y);
+    add(t3, t3, t3);
+    mul(z3, p.x, p.z);
+    add(z3, z3, z3);
+    mul(y3, kB, t2);
+    sub(y3, y3, z3);
+    add(x3, y3, y3);
+    add(y3, x3, y3);
+    sub(x3, t1, y3);
+    add(y3, t1, y3);
+    mul(y3, x3, y3);
+    mul(x3, x3, t3);
+    add(t3, t2, t2);
+    add(t2, t2, t3);
+    mul(z3, kB, z3);
+    sub(z3, z3, t2);
+    sub(z3, z3, t0);
+    add(t3, z3, z3);
+    add(z3, z3, t3);
+    add(t3, t0, t0);
+    add(t0, t3, t0);
+    sub(t0, t0, t2);
+    mul(t0, t0, z3);
+    add(y3, y3, t0);
+    mul(t0, p.y, p.z);
+    add(t0, t0, t0);
+    mul(z3, t0, z3);
+    sub(x3, x3, z3);
+    mul(z3, t0, t1);
+    add(z3, z3, z3);
+    add(z3, z3, z3);
+    memcpy(r.x, x3, sizeof(Fe));
+    memcpy(r.y, y3, sizeof(Fe));
+    memcpy(r.z, z3, sizeof(Fe));
+  }
+
+  // r = k * p with a fixed 4 bit window; every window costs four doublings,
+  // one table scan and one addition whatever its value.
+  static void scalar_mul(const uint8_t k[32], const Point &p, Point &r) {
+    Point table[16];
+    memset(&table[0], 0, sizeof(Point));
+    memcpy(table[0].y, kOne, sizeof(Fe));
+    table[1] = p;
+    for (int i = 2; i < 16; i++)
+      point_add(table[i], table[i - 1], p);
+
+    r = table[0];
+    for (int i = 0; i < 64; i++) {
+      for (int j = 0; j < 4; j++)
+        point_double(r, r);
+      uint32_t nibble = (k[i / 2] >> (i % 2 ? 0 : 4)) & 0xf;
+      Point entry;
+      memset(&entry, 0, sizeof(entry));
+      for (uint32_t t = 0; t < 16; t++) {
+        uint32_t mask = -(uint32_t)(t == nibble);
+        select(entry.x, mask, table[t].x, entry.x);
+        select(entry.y, mask, table[t].y, entry.y);
+        select(entry.z, mask, table[t].z, entry.z);
+      }
+      point_add(r, r, entry);
+    }
+    wipe(table, sizeof(table));
+  }
+
+  // Affine x coordinate, out of Montgomery form. False for infinity.
+  static bool affine_x(const Point &p, Fe x) {
+    if (is_zero(p.z))
+      return false;
+    Fe z_inverse;
+    invert(z_inverse, p.z);
+    mul(x, p.x, z_inverse);
+    static constexpr Fe kOneRaw = {1, 0, 0, 0, 0, 0, 0, 0};
+    mul(x, x, kOneRaw);
+    return true;
+  }
+};
+
+} // namespace gfps
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "nearby_keylog.hpp"
+
+// Write-back RAM cache in front of NVS for nearby_platform_LoadValue /
+// SaveValue. Each stored key is read from flash once and then served from
+// RAM. Saves only update RAM and are written (and committed) by a flush task
+// at most NEARBY_PLATFORM_PERSISTENCE_FLUSH_MS after the first unflushed
+// save, so bursts of saves cost one flash write.
+
+struct nearby_platform_PersistenceStats {
+  uint32_t hits;         // loads served from RAM
+  uint32_t misses;       // loads which had to read flash
+  uint32_t flash_writes; // blobs written to flash
+  uint32_t writes_saved; // saves coalesced into a pending write or unchanged
+  uint32_t commits;      // nvs_commit calls
+  uint32_t errors;       // failed flash reads / writes / commits
+};
+
+// Writes every pending value to flash and commits, blocking until done.
+nearby_platform_status nearby_platform_PersistenceFlush();
+
+// Returns a snapshot of the cache counters.
+nearby_platform_PersistenceStats nearby_platform_GetPersistenceStats();
+
+// Key log counters (see gfps::KeyLogStats).
+using nearby_platform_KeyLogStats = gfps::KeyLogStats;
+
+// Finds the key log partition and replays it into RAM. Returns an error if
+// there is no partition, in which case the account key list stays in NVS.
+nearby_platform_status nearby_platform_KeyLogInit();
+
+// Copies the account key list. Returns errors like nvs_get_blob:
+// ESP_ERR_NVS_NOT_FOUND if it was never saved, ESP_ERR_NVS_INVALID_LENGTH if
+// `*length` is too small, and ESP_FAIL if the log can't be read.
+esp_err_t nearby_platform_KeyLogLoad(uint8_t *output, size_t *length);
+
+// Appends the chunks of `input` which changed since the last save.
+nearby_platform_status nearby_platform_KeyLogSave(const uint8_t *input, size_t length);
+
+// Compacts the log if the active bank is mostly full. Meant to be called
+// from a background task so that saves rarely have to compact.
+void nearby_platform_KeyLogMaintain();
+
+// Returns a snapshot of the key log counters.
+nearby_platform_KeyLogStats nearby_platform_GetKeyLogStats();
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "nearby_soft_crypto.hpp"
+
+namespace gfps {
+
+// CTR_DRBG (NIST SP 800-90A) with AES-128 and no derivation function: the
+// seed material is used as is, so it must be full entropy (the hardware
+// RNG) or a fixed seed for reproducible runs.
+class CtrDrbg {
+public:
+  static constexpr size_t kSeedBytes = 32; // key + block
+
+  CtrDrbg() = default;
+  explicit CtrDrbg(const uint8_t seed[kSeedBytes]) { instantiate(seed); }
+  ~CtrDrbg() { wipe(); }
+
+  void instantiate(const uint8_t seed[kSeedBytes]) {
+    uint8_t zero[16] = {};
+    aes_.set_key(zero);
+    memset(v_, 0, sizeof(v_));
+    update(seed);
+  }
+
+  void reseed(const uint8_t entropy[kSeedBytes]) { update(entropy); }
+
+  void generate(uint8_t *out, size_t length) {
+    uint8_t block[16];
+    while (length) {
+      increment();
+      aes_.encrypt(v_, block);
+      size_t n = length < sizeof(block) ? length : sizeof(block);
+      memcpy(out, block, n);
+      out += n;
+      length -= n;
+    }
+    wipe_bytes(block, sizeof(block));
+    // backtracking resistance: the state that produced `out` is gone
+    update(nullptr);
+  }
+
+  void wipe() {
+    aes_.wipe();
+    wipe_bytes(v_, sizeof(v_));
+  }
+
+private:
+  static void wipe_bytes(void *p, size_t size) {
+    volatile uint8_t *bytes = static_cast<volatile uint8_t *>(p);
+    for (size_t i = 0; i < size; i++)
+      bytes[i] = 0;
+  }
+
+  void increment() {
+    for (int i = 15; i >= 0 && ++v_[i] == 0; i--) {
+    }
+  }
+
+  void update(const uint8_t provided[kSeedBytes]) {
+    uint8_t temp[kSeedBytes];
+    for (size_t i = 0; i < kSeedBytes; i += 16) {
+      increment();
+      aes_.encrypt(v_, temp + i);
+    }
+    if (provided) {
+      for (size_t i = 0; i < kSeedBytes; i++)
+        temp[i] ^= provided[i];
+    }
+    aes_.set_key(temp);
+    memcpy(v_, temp + 16, sizeof(v_));
+    wipe_bytes(temp, sizeof(temp));
+  }
+
+  Aes128 aes_;
+  uint8_t v_[16];
+};
+
+} // namespace gfps
+
+// Random bytes for nearby_platform_Rand come from a pool which a CTR_DRBG
+// seeded from the hardware RNG refills in bulk. Once the pool drops below
+// its low watermark a background task tops it up; a request that finds it
+// empty refills it inline (a stall).
+
+struct nearby_platform_RandomStats {
+  uint64_t bytes;     // bytes handed out
+  uint32_t refills;   // pool refills, background and inline
+  uint32_t stalls;    // requests which had to refill inline
+  uint32_t reseeds;   // reseeds from the hardware RNG
+  uint64_t refill_us; // total time spent generating
+  bool deterministic; // seeded by nearby_platform_RandomSeed
+};
+
+// Starts the background refill task.
+void nearby_platform_RandomInit();
+
+// Reseeds the generator with `seed` (32 bytes) and stops reseeding from the
+// hardware, so the byte sequence repeats from run to run. For benchmarks
+// and tests only.
+void nearby_platform_RandomSeed(const uint8_t seed[32]);
+
+// Fills `output` with `length` random bytes from the pool.
+void nearby_platform_RandomFill(uint8_t *output, size_t length);
+
+// Returns a snapshot of the random pool counters.
+nearby_platform_RandomStats nearby_platform_GetRandomStats();
@@ -0,0 +1,475 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+// Portable AES-128, SHA-256 and HMAC / HKDF-SHA256, used as the software
+// crypto backend and on hosts without the ESP32 crypto peripherals. Table
+// based and straight forward rather than fast; none of it is constant time
+// with respect to cache timing, which is acceptable for the Fast Pair
+// handshake on a device without other tenants.
+
+namespace gfps {
+
+namespace detail {
+
+inline constexpr uint8_t kAesSbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+constexpr auto make_inverse_sbox() {
+  struct {
+    uint8_t table[256];
+  } inverse{};
+  for (int i = 0; i < 256; i++)
+    inverse.table[kAesSbox[i]] = i;
+  return inverse;
+}
+inline constexpr auto kAesInverseSbox = make_inverse_sbox();
+
+constexpr uint8_t xtime(uint8_t x) { return (x << 1) ^ ((x & 0x80) ? 0x1b : 0); }
+
+constexpr uint8_t gmul(uint8_t a, uint8_t b) {
+  uint8_t result = 0;
+  while (b) {
+    if (b & 1)
+      result ^= a;
+    a = xtime(a);
+    b >>= 1;
+  }
+  return result;
+}
+
+// InvSubBytes followed by InvMixColumns for one byte, as a big endian column
+// {14s, 9s, 13s, 11s}. The other three row positions are rotations of it.
+constexpr auto make_inverse_table() {
+  struct {
+    uint32_t table[256];
+  } inverse{};
+  for (int i = 0; i < 256; i++) {
+    uint8_t s = kAesInverseSbox.table[i];
+    inverse.table[i] = (uint32_t)gmul(s, 14) << 24 | (uint32_t)gmul(s, 9) << 16 |
+                       (uint32_t)gmul(s, 13) << 8 | gmul(s, 11);
+  }
+  return inverse;
+}
+inline constexpr auto kAesInverseTable = make_inverse_table();
+
+constexpr uint32_t rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+inline uint32_t load_be32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+inline void store_be32(uint8_t *p, uint32_t x) {
+  p[0] = x >> 24;
+  p[1] = x >> 16;
+  p[2] = x >> 8;
+  p[3] = x;
+}
+
+} // namespace detail
+
+// AES-128 with the key schedule expanded once.
+class Aes128 {
+public:
+  static constexpr size_t kBlockBytes = 16;
+  static constexpr size_t kRounds = 10;
+
+  Aes128() = default;
+  explicit Aes128(const uint8_t key[16]) { set_key(key); }
+  ~Aes128() { wipe(); }
+
+  void set_key(const uint8_t key[16]) {
+    using detail::kAesSbox;
+    memcpy(round_keys_, key, 16);
+    uint8_t rcon = 1;
+    for (size_t i = 16; i < sizeof(round_keys_); i += 4) {
+      uint8_t t[4];
+      memcpy(t, round_keys_ + i - 4, 4);
+      if (i % 16 == 0) {
+        uint8_t first = t[0];
+        t[0] = kAesSbox[t[1]] ^ rcon;
+        t[1] = kAesSbox[t[2]];
+        t[2] = kAesSbox[t[3]];
+        t[3] = kAesSbox[first];
+        rcon = detail::xtime(rcon);
+      }
+      for (int j = 0; j < 4; j++)
+        round_keys_[i + j] = round_keys_[i - 16 + j] ^ t[j];
+    }
+  }
+
+  void encrypt(const uint8_t in[16], uint8_t out[16]) const {
+    using detail::kAesSbox;
+    uint8_t s[16];
+    add_round_key(s, in, 0);
+    for (size_t round = 1; round <= kRounds; round++) {
+      uint8_t t[16];
+      // SubBytes and ShiftRows
+      for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 4; r++)
+          t[c * 4 + r] = kAesSbox[s[((c + r) % 4) * 4 + r]];
+      if (round != kRounds) {
+        // MixColumns
+        for (int c = 0; c < 4; c++) {
+          uint8_t *col = t + c * 4;
+          uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+          uint8_t first = col[0];
+          col[0] ^= all ^ detail::xtime(col[0] ^ col[1]);
+          col[1] ^= all ^ detail::xtime(col[1] ^ col[2]);
+          col[2] ^= all ^ detail::xtime(col[2] ^ col[3]);
+          col[3] ^= all ^ detail::xtime(col[3] ^ first);
+        }
+      }
+      add_round_key(s, t, round);
+    }
+    memcpy(out, s, 16);
+  }
+
+  void decrypt(const uint8_t in[16], uint8_t out[16]) const {
+    using detail::gmul;
+    const uint8_t *inverse_sbox = detail::kAesInverseSbox.table;
+    uint8_t s[16];
+    add_round_key(s, in, kRounds);
+    for (size_t round = kRounds; round-- > 0;) {
+      uint8_t t[16];
+      // InvShiftRows and InvSubBytes
+      for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 4; r++)
+          t[((c + r) % 4) * 4 + r] = inverse_sbox[s[c * 4 + r]];
+      add_round_key(s, t, round);
+      if (round != 0) {
+        // InvMixColumns
+        for (int c = 0; c < 4; c++) {
+          uint8_t *col = s + c * 4;
+          uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+          col[0] = gmul(a0, 14) ^ gmul(a1, 11) ^ gmul(a2, 13) ^ gmul(a3, 9);
+          col[1] = gmul(a0, 9) ^ gmul(a1, 14) ^ gmul(a2, 11) ^ gmul(a3, 13);
+          col[2] = gmul(a0, 13) ^ gmul(a1, 9) ^ gmul(a2, 14) ^ gmul(a3, 11);
+          col[3] = gmul(a0, 11) ^ gmul(a1, 13) ^ gmul(a2, 9) ^ gmul(a3, 14);
+        }
+      }
+    }
+    memcpy(out, s, 16);
+  }
+
+  // Clears the key schedule.
+  void wipe() {
+    volatile uint8_t *p = round_keys_;
+    for (size_t i = 0; i < sizeof(round_keys_); i++)
+      p[i] = 0;
+  }
+
+private:
+  void add_round_key(uint8_t out[16], const uint8_t in[16], size_t round) const {
+    for (int i = 0; i < 16; i++)
+      out[i] = in[i] ^ round_keys_[round * 16 + i];
+  }
+
+  uint8_t round_keys_[16 * (kRounds + 1)];
+};
+
+// AES-128 decryption only, with the key schedule prepared for the
+// equivalent inverse cipher so each round is four table lookups per column.
+// For trying one block against every stored account key: the schedules are
+// expanded once and decrypt_multi() runs several keys through each round
+// together, which keeps the loads of independent keys in flight at once.
+class Aes128Decryptor {
+public:
+  static constexpr size_t kRounds = Aes128::kRounds;
+  // keys decrypted side by side in decrypt_multi()
+  static constexpr size_t kLanes = 4;
+
+  Aes128Decryptor() = default;
+  explicit Aes128Decryptor(const uint8_t key[16]) { set_key(key); }
+  ~Aes128Decryptor() { wipe(); }
+
+  void set_key(const uint8_t key[16]) {
+    using detail::kAesSbox;
+    uint32_t w[4 * (kRounds + 1)];
+    for (int i = 0; i < 4; i++)
+      w[i] = detail::load_be32(key + 4 * i);
+    uint8_t rcon = 1;
+    for (size_t i = 4; i < 4 * (kRounds + 1); i++) {
+      uint32_t t = w[i - 1];
+      if (i % 4 == 0) {
+        t = (uint32_t)(kAesSbox[(t >> 16) & 0xff] ^ rcon) << 24 |
+            (uint32_t)kAesSbox[(t >> 8) & 0xff] << 16 | (uint32_t)kAesSbox[t & 0xff] << 8 |
+            kAesSbox[t >> 24];
+        rcon = detail::xtime(rcon);
+      }
+      w[i] = w[i - 4] ^ t;
+    }
+    // reverse the round order and run InvMixColumns over the inner round keys
+    for (size_t round = 0; round <= kRounds; round++) {
+      for (int c = 0; c < 4; c++) {
+        uint32_t k = w[(kRounds - round) * 4 + c];
+        if (round != 0 && round != kRounds)
+          k = inv_mix_column(k);
+        round_keys_[round * 4 + c] = k;
+      }
+    }
+    volatile uint32_t *p = w;
+    for (size_t i = 0; i < std::size(w); i++)
+      p[i] = 0;
+  }
+
+  void decrypt(const uint8_t in[16], uint8_t out[16]) const { decrypt_multi(this, 1, in, &out); }
+
+  // Decrypts `in` under each of `count` keys into out[0] .. out[count - 1].
+  static void decrypt_multi(const Aes128Decryptor *keys, size_t count, const uint8_t in[16],
+                            uint8_t *const out[]) {
+    uint32_t block[4];
+    for (int c = 0; c < 4; c++)
+      block[c] = detail::load_be32(in + 4 * c);
+    for (size_t first = 0; first < count; first += kLanes) {
+      // a short last group repeats its final key rather than branching per lane
+      const uint32_t *rk[kLanes];
+      for (size_t lane = 0; lane < kLanes; lane++)
+        rk[lane] = keys[std::min(first + lane, count - 1)].round_keys_;
+      uint32_t s[kLanes][4];
+      for (size_t lane = 0; lane < kLanes; lane++)
+        for (int c = 0; c < 4; c++)
+          s[lane][c] = block[c] ^ rk[lane][c];
+      for (size_t round = 1; round < kRounds; round++) {
+        for (size_t lane = 0; lane < kLanes; lane++) {
+          uint32_t t[4];
+          for (int c = 0; c < 4; c++)
+            t[c] = inv_round_column(s[lane], c) ^ rk[lane][round * 4 + c];
+          memcpy(s[lane], t, sizeof(t));
+        }
+      }
+      for (size_t lane = 0; lane < kLanes && first + lane < count; lane++) {
+        const uint8_t *inverse_sbox = detail::kAesInverseSbox.table;
+        const uint32_t *s_ = s[lane];
+        for (int c = 0; c < 4; c++) {
+          uint32_t column = (uint32_t)inverse_sbox[s_[c] >> 24] << 24 |
+                            (uint32_t)inverse_sbox[(s_[(c + 3) % 4] >> 16) & 0xff] << 16 |
+                            (uint32_t)inverse_sbox[(s_[(c + 2) % 4] >> 8) & 0xff] << 8 |
+                            inverse_sbox[s_[(c + 1) % 4] & 0xff];
+          detail::store_be32(out[first + lane] + 4 * c, column ^ rk[lane][kRounds * 4 + c]);
+        }
+      }
+    }
+  }
+
+  // Clears the key schedule.
+  void wipe() {
+    volatile uint32_t *p = round_keys_;
+    for (size_t i = 0; i < std::size(round_keys_); i++)
+      p[i] = 0;
+  }
+
+private:
+  // InvShiftRows, InvSubBytes and InvMixColumns for output column c.
+  static uint32_t inv_round_column(const uint32_t s[4], int c) {
+    const uint32_t *td = detail::kAesInverseTable.table;
+    return td[s[c] >> 24] ^ detail::rotr32(td[(s[(c + 3) % 4] >> 16) & 0xff], 8) ^
+           detail::rotr32(td[(s[(c + 2) % 4] >> 8) & 0xff], 16) ^
+           detail::rotr32(td[s[(c + 1) % 4] & 0xff], 24);
+  }
+
+  // InvMixColumns alone, by undoing the InvSubBytes folded into the table.
+  static uint32_t inv_mix_column(uint32_t k) {
+    using detail::kAesSbox;
+    const uint32_t *td = detail::kAesInverseTable.table;
+    return td[kAesSbox[k >> 24]] ^ detail::rotr32(td[kAesSbox[(k >> 16) & 0xff]], 8) ^
+           detail::rotr32(td[kAesSbox[(k >> 8) & 0xff]], 16) ^
+           detail::rotr32(td[kAesSbox[k & 0xff]], 24);
+  }
+
+  uint32_t round_keys_[4 * (kRounds + 1)];
+};
+
+// Incremental SHA-256.
+class Sha256 {
+public:
+  static constexpr size_t kDigestBytes = 32;
+
+  Sha256() { start(); }
+
+  void start() {
+    static constexpr uint32_t kInitial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(state_, kInitial, sizeof(state_));
+    total_bytes_ = 0;
+    buffered_ = 0;
+  }
+
+  void update(const void *data, size_t length) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    total_bytes_ += length;
+    if (buffered_) {
+      size_t n = length < 64 - buffered_ ? length : 64 - buffered_;
+      memcpy(buffer_ + buffered_, p, n);
+      buffered_ += n;
+      p += n;
+      length -= n;
+      if (buffered_ < 64)
+        return;
+      compress(buffer_);
+      buffered_ = 0;
+    }
+    for (; length >= 64; p += 64, length -= 64)
+      compress(p);
+    memcpy(buffer_, p, length);
+    buffered_ = length;
+  }
+
+  void finish(uint8_t out[32]) {
+    uint64_t bits = total_bytes_ * 8;
+    uint8_t pad[72] = {0x80};
+    size_t pad_bytes = (buffered_ < 56 ? 56 : 120) - buffered_;
+    for (int i = 0; i < 8; i++)
+      pad[pad_bytes + i] = bits >> (56 - 8 * i);
+    update(pad, pad_bytes + 8);
+    for (int i = 0; i < 8; i++) {
+      out[i * 4 + 0] = state_[i] >> 24;
+      out[i * 4 + 1] = state_[i] >> 16;
+      out[i * 4 + 2] = state_[i] >> 8;
+      out[i * 4 + 3] = state_[i];
+    }
+  }
+
+private:
+  static constexpr uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+  void compress(const uint8_t block[64]) {
+    static constexpr uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+        0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+        0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+        0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+        0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+        0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+        0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+        0xc67178f2};
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+      w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+             (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+      uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+    state_[5] += f;
+    state_[6] += g;
+    state_[7] += h;
+  }
+
+  uint32_t state_[8];
+  uint64_t total_bytes_;
+  uint8_t buffer_[64];
+  size_t buffered_;
+};
+
+// HMAC-SHA256 (RFC 2104).
+class HmacSha256 {
+public:
+  static constexpr size_t kDigestBytes = Sha256::kDigestBytes;
+
+  HmacSha256(const uint8_t *key, size_t key_length) {
+    uint8_t block[64] = {};
+    if (key_length > sizeof(block)) {
+      Sha256 hash;
+      hash.update(key, key_length);
+      hash.finish(block);
+    } else {
+      memcpy(block, key, key_length);
+    }
+    for (auto &b : block)
+      b ^= 0x36;
+    inner_.update(block, sizeof(block));
+    // 0x36 ^ 0x5c turns the inner pad into the outer one
+    for (auto &b : block)
+      b ^= 0x36 ^ 0x5c;
+    outer_.update(block, sizeof(block));
+    volatile uint8_t *p = block;
+    for (size_t i = 0; i < sizeof(block); i++)
+      p[i] = 0;
+  }
+
+  void update(const void *data, size_t length) { inner_.update(data, length); }
+
+  void finish(uint8_t out[32]) {
+    uint8_t inner_digest[32];
+    inner_.finish(inner_digest);
+    outer_.update(inner_digest, sizeof(inner_digest));
+    outer_.finish(out);
+  }
+
+private:
+  Sha256 inner_;
+  Sha256 outer_;
+};
+
+// HKDF-SHA256 (RFC 5869) extract and expand; `length` is at most 255 * 32.
+inline void hkdf_sha256(const uint8_t *salt, size_t salt_length, const uint8_t *ikm,
+                        size_t ikm_length, const uint8_t *info, size_t info_length,
+                        uint8_t *out, size_t length) {
+  uint8_t prk[32];
+  HmacSha256 extract(salt, salt_length);
+  extract.update(ikm, ikm_length);
+  extract.finish(prk);
+  uint8_t t[32];
+  for (uint8_t counter = 1; length; counter++) {
+    HmacSha256 expand(prk, sizeof(prk));
+    if (counter > 1)
+      expand.update(t, sizeof(t));
+    expand.update(info, info_length);
+    expand.update(&counter, 1);
+    expand.finish(t);
+    size_t n = length < sizeof(t) ? length : sizeof(t);
+    memcpy(out, t, n);
+    out += n;
+    length -= n;
+  }
+  volatile uint8_t *p = prk, *q = t;
+  for (size_t i = 0; i < sizeof(prk); i++) {
+    p[i] = 0;
+    q[i] = 0;
+  }
+}
+
+} // namespace gfps
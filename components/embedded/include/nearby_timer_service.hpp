@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+
+#include "nearby_clock.hpp"
+#include "nearby_timer_wheel.hpp"
+
+// The timer service behind nearby_platform_StartTimer / CancelTimer: one
+// timing wheel with 1 ms ticks on gfps::Clock, and a lock around it. Timers
+// are run either by a task (run_once() in its loop, on the real clock) or,
+// with the virtual clock, by advance() on the calling thread. Callbacks are
+// always called without the lock held, so they can start and cancel timers.
+//
+// Nothing here depends on ESP-IDF, so host/nearby_timer_service_host.cpp
+// fast-forwards pairing and timeout flows through the same code the firmware
+// runs.
+
+namespace gfps {
+
+template <size_t PoolSize> class TimerService {
+public:
+  typedef TimerWheel<PoolSize, 256> Wheel;
+  typedef typename Wheel::Handle Handle;
+  typedef typename Wheel::Callback Callback;
+  // Called for each timer as it fires, just before its callback.
+  typedef void (*FireHook)(Handle handle, Callback callback);
+
+  explicit TimerService(FireHook on_fire = nullptr) : on_fire_(on_fire) {}
+
+  // Starts counting ticks from now; later calls do nothing.
+  void start() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (started_)
+      return;
+    wheel_ = Wheel(Clock::now_ms());
+    started_ = true;
+  }
+
+  // Arms a one shot timer `delay_ms` from now. Returns 0 if the pool is
+  // exhausted.
+  Handle start_timer(Callback callback, uint32_t delay_ms) {
+    Handle handle;
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      handle = wheel_.start(callback, delay_ms, Clock::now_ms());
+    }
+    // the new timer may be due before the one the task is waiting for; taking
+    // the task's lock means it is either waiting or yet to look at the wheel
+    if (handle) {
+      if (std::mutex *m = task_m_.load()) {
+        { std::lock_guard<std::mutex> lk(*m); }
+        task_cv_.load()->notify_one();
+      }
+    }
+    return handle;
+  }
+
+  // False if the handle is stale: the timer already fired (this is called
+  // from its own callback too) or was cancelled.
+  bool cancel_timer(Handle handle) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    return wheel_.cancel(handle);
+  }
+
+  // One pass of the timer task: runs the callbacks of all due timers, or
+  // sleeps on the task's own `m` / `cv` until the next one is due, a new
+  // timer is started, or the task is stopped.
+  void run_once(std::mutex &m, std::condition_variable &cv) {
+    task_cv_ = &cv;
+    task_m_ = &m;
+    typename Wheel::Expired expired[4];
+    size_t num_expired = 0;
+    {
+      // held from looking at the wheel until waiting, so a timer started in
+      // between can't notify before the task waits
+      std::unique_lock<std::mutex> task_lk(m);
+      uint64_t wait_ms = 0;
+      {
+        std::lock_guard<std::mutex> lk(mutex_);
+        uint64_t now = Clock::now_ms();
+        num_expired = wheel_.expire(now, expired, std::size(expired));
+        if (num_expired == 0) {
+          uint64_t next = wheel_.next_expiry();
+          // wake up at least once a second so the wheel doesn't fall too far behind
+          wait_ms = next > now + 1000 ? 1000 : next - now;
+        }
+      }
+      if (num_expired == 0) {
+        cv.wait_for(task_lk, std::chrono::milliseconds(wait_ms));
+        return;
+      }
+    }
+    run_expired(expired, num_expired);
+  }
+
+#if NEARBY_PLATFORM_VIRTUAL_CLOCK
+  // Moves the virtual clock forward by `ms`, running every timer that falls
+  // due on the way, in expiry order, on the calling thread.
+  void advance(uint32_t ms) {
+    start();
+    uint64_t target = Clock::now_ms() + ms;
+    for (;;) {
+      typename Wheel::Expired expired[4];
+      size_t num_expired;
+      {
+        std::lock_guard<std::mutex> lk(mutex_);
+        // step straight to the next expiry so callbacks see the time they were
+        // due at, and timers they start are ordered correctly
+        uint64_t next = wheel_.next_expiry();
+        if (next > target)
+          break;
+        Clock::set_ms(next);
+        num_expired = wheel_.expire(next, expired, std::size(expired));
+      }
+      run_expired(expired, num_expired);
+    }
+    Clock::set_ms(target);
+  }
+#endif
+
+  size_t armed() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    return wheel_.armed();
+  }
+  static constexpr size_t capacity() { return PoolSize; }
+
+private:
+  void run_expired(const typename Wheel::Expired *expired, size_t num_expired) {
+    for (size_t i = 0; i < num_expired; i++) {
+      if (on_fire_)
+        on_fire_(expired[i].handle, expired[i].callback);
+      if (expired[i].callback)
+        expired[i].callback();
+    }
+  }
+
+  FireHook on_fire_;
+  std::mutex mutex_;
+  Wheel wheel_;
+  bool started_ = false;
+  // the timer task's own lock and condition variable, which espp::Task also
+  // uses to stop it; set by the task before it first looks at the wheel
+  std::atomic<std::mutex *> task_m_{nullptr};
+  std::atomic<std::condition_variable *> task_cv_{nullptr};
+};
+
+} // namespace gfps
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Hashed timing wheel over a fixed, preallocated pool of one-shot timers.
+// Start and cancel are O(1); nothing is allocated after construction. The
+// wheel does no locking and never calls callbacks itself: expire() hands the
+// due timers back so the owner can run them without holding its lock, which
+// makes it safe to start or cancel timers from inside a callback. Time is an
+// abstract tick count supplied by the caller.
+
+namespace gfps {
+
+template <size_t PoolSize, size_t NumSlots> class TimerWheel {
+  static_assert(PoolSize > 0 && PoolSize < 0xffff, "TimerWheel pool must fit a 16 bit index");
+  static_assert(NumSlots >= 2 && (NumSlots & (NumSlots - 1)) == 0,
+                "TimerWheel slot count must be a power of two");
+
+public:
+  typedef void (*Callback)();
+  // 0 is never a valid handle
+  typedef uint32_t Handle;
+
+  struct Expired {
+    Handle handle;
+    Callback callback;
+  };
+
+  static constexpr uint64_t kNever = ~0ull;
+
+  explicit TimerWheel(uint64_t now = 0) : current_tick_(now) {
+    for (auto &slot : slots_)
+      slot = kNone;
+    for (size_t i = 0; i < PoolSize; i++) {
+      nodes_[i].next = i + 1 < PoolSize ? i + 1 : kNone;
+      nodes_[i].armed = false;
+      nodes_[i].generation = 0;
+    }
+    free_ = 0;
+  }
+
+  // Arms a timer which expires `delay` ticks after `now`. Returns 0 if the
+  // pool is exhausted.
+  Handle start(Callback callback, uint64_t delay, uint64_t now) {
+    if (free_ == kNone)
+      return 0;
+    uint16_t index = free_;
+    Node &node = nodes_[index];
+    free_ = node.next;
+    node.callback = callback;
+    // never schedule into a tick which has already been processed
+    uint64_t base = now > current_tick_ ? now : current_tick_;
+    node.expiry = base + (delay ? delay : 1);
+    node.armed = true;
+    node.generation++;
+    link(index);
+    armed_++;
+    if (armed_ > high_water_)
+      high_water_ = armed_;
+    return make_handle(index, node.generation);
+  }
+
+  // Disarms the timer. Returns false if the handle is stale, i.e. the timer
+  // already expired (its callback may be running) or was cancelled.
+  bool cancel(Handle handle) {
+    uint16_t index;
+    if (!lookup(handle, index))
+      return false;
+    unlink(index);
+    release(index);
+    return true;
+  }
+
+  // Removes up to `max` timers which are due at `now` and copies them to
+  // `out`, returning how many were removed. Call again until it returns less
+  // than `max` to be sure everything due has been collected.
+  size_t expire(uint64_t now, Expired *out, size_t max) {
+    size_t count = 0;
+    if (now < current_tick_)
+      return 0;
+    // after a long gap every slot has to be looked at once anyway
+    uint64_t last = now - current_tick_ >= NumSlots ? current_tick_ + NumSlots : now;
+    for (uint64_t tick = current_tick_; tick <= last; tick++) {
+      uint16_t index = slots_[tick & (NumSlots - 1)];
+      while (index != kNone) {
+        uint16_t next = nodes_[index].next;
+        if (nodes_[index].expiry <= now) {
+          if (count == max)
+            return count;
+          out[count++] = {make_handle(index, nodes_[index].generation), nodes_[index].callback};
+          unlink(index);
+          release(index);
+        }
+        index = next;
+      }
+      if (tick < now)
+        current_tick_ = tick + 1;
+    }
+    current_tick_ = now;
+    return count;
+  }
+
+  // Tick of the earliest armed timer, kNever if none. O(PoolSize).
+  uint64_t next_expiry() const {
+    uint64_t next = kNever;
+    for (const auto &node : nodes_)
+      if (node.armed && node.expiry < next)
+        next = node.expiry;
+    return next;
+  }
+
+  size_t armed() const { return armed_; }
+  size_t high_water() const { return high_water_; }
+  static constexpr size_t capacity() { return PoolSize; }
+
+  // Pool index of a handle, useful as a short id in logs. Together with the
+  // generation it tells apart timers which reused the same slot.
+  static uint16_t index_of(Handle handle) { return (handle & 0xffff) - 1; }
+  static uint16_t generation_of(Handle handle) { return handle >> 16; }
+
+private:
+  static constexpr uint16_t kNone = 0xffff;
+
+  struct Node {
+    uint64_t expiry;
+    Callback callback;
+    uint16_t next;
+    uint16_t prev;
+    uint16_t generation;
+    bool armed;
+  };
+
+  static Handle make_handle(uint16_t index, uint16_t generation) {
+    return (static_cast<Handle>(generation) << 16) | (index + 1u);
+  }
+
+  bool lookup(Handle handle, uint16_t &index) const {
+    uint32_t i = (handle & 0xffff);
+    if (i == 0 || i > PoolSize)
+      return false;
+    index = i - 1;
+    const Node &node = nodes_[index];
+    return node.armed && node.generation == (handle >> 16);
+  }
+
+  void link(uint16_t index) {
+    Node &node = nodes_[index];
+    uint16_t &head = slots_[node.expiry & (NumSlots - 1)];
+    node.prev = kNone;
+    node.next = head;
+    if (head != kNone)
+      nodes_[head].prev = index;
+    head = index;
+  }
+
+  void unlink(uint16_t index) {
+    Node &node = nodes_[index];
+    if (node.prev != kNone)
+      nodes_[node.prev].next = node.next;
+    else
+      slots_[node.expiry & (NumSlots - 1)] = node.next;
+    if (node.next != kNone)
+      nodes_[node.next].prev = node.prev;
+  }
+
+  void release(uint16_t index) {
+    Node &node = nodes_[index];
+    node.armed = false;
+    node.next = free_;
+    free_ = index;
+    armed_--;
+  }
+
+  Node nodes_[PoolSize];
+  uint16_t slots_[NumSlots];
+  uint16_t free_;
+  // earliest tick whose slot may still hold due timers
+  uint64_t current_tick_;
+  size_t armed_{0};
+  size_t high_water_{0};
+};
+
+} // namespace gfps
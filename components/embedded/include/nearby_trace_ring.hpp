@@ -0,0 +1,400 @@
+#pragma once
+
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Deferred trace support for nearby_platform_Trace. Trace calls capture the
+// level, location, timestamp and the raw printf arguments into a preallocated
+// lock-free ring; a low-priority task later renders them with the original
+// format string. Nothing in here depends on ESP-IDF so it can be built and
+// exercised on the host.
+
+namespace gfps {
+
+// Classification of a single printf conversion.
+enum class TraceArgType : uint8_t {
+  NONE,    // literal text / "%%"
+  INT,     // d, i, c (promoted to int)
+  UINT,    // u, x, X, o
+  LONG,    // d, i with l / ll / j / z / t
+  ULONG,   // u, x, X, o with l / ll / j / z / t
+  DOUBLE,  // f, F, e, E, g, G, a, A
+  POINTER, // p
+  STRING,  // s (copied into the record, the caller's buffer may not outlive it)
+};
+
+// Walks a printf format string one conversion at a time. `spec` / `spec_len`
+// describe the conversion text (e.g. "%08lx"), `type` its argument class.
+class TraceFormatWalker {
+public:
+  explicit TraceFormatWalker(const char *fmt) : p_(fmt) {}
+
+  // Advances to the next conversion. Literal text before it is reported
+  // through `literal` / `literal_len`. Returns false at the end of the string
+  // (the trailing literal is still reported).
+  bool next(const char *&literal, size_t &literal_len, const char *&spec, size_t &spec_len,
+            TraceArgType &type, int &stars) {
+    literal = p_;
+    while (*p_ && *p_ != '%')
+      p_++;
+    literal_len = p_ - literal;
+    spec = p_;
+    spec_len = 0;
+    type = TraceArgType::NONE;
+    stars = 0;
+    if (*p_ == '\0')
+      return false;
+    const char *s = p_ + 1;
+    if (*s == '%') {
+      // escaped percent, report it as part of the literal
+      literal_len++;
+      p_ = s + 1;
+      return true;
+    }
+    // flags, width, precision
+    while (*s && strchr("-+ #0", *s))
+      s++;
+    while (*s && ((*s >= '0' && *s <= '9') || *s == '.' || *s == '*')) {
+      if (*s == '*')
+        stars++;
+      s++;
+    }
+    // length modifier
+    bool is_long = false;
+    while (*s && strchr("hlLqjzt", *s)) {
+      if (*s != 'h')
+        is_long = true;
+      s++;
+    }
+    switch (*s) {
+    case 'd':
+    case 'i':
+    case 'c':
+      type = is_long ? TraceArgType::LONG : TraceArgType::INT;
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      type = is_long ? TraceArgType::ULONG : TraceArgType::UINT;
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      type = TraceArgType::DOUBLE;
+      break;
+    case 'p':
+      type = TraceArgType::POINTER;
+      break;
+    case 's':
+      type = TraceArgType::STRING;
+      break;
+    default:
+      // unsupported (or %n): emit verbatim, consume nothing
+      type = TraceArgType::NONE;
+      break;
+    }
+    if (*s)
+      s++;
+    spec_len = s - p_;
+    p_ = s;
+    return true;
+  }
+
+private:
+  const char *p_;
+};
+
+// One captured trace call.
+struct TraceRecord {
+  static constexpr size_t kMaxArgs = 8;
+  static constexpr size_t kStringBytes = 48;
+
+  uint64_t timestamp_us;
+  const char *filename; // __FILE__ literal, static lifetime
+  const char *fmt;      // format literal, static lifetime
+  int lineno;
+  uint8_t level;
+  uint8_t num_args;
+  uint8_t string_bytes;
+  uint8_t truncated;
+  uint64_t args[kMaxArgs];
+  char strings[kStringBytes];
+
+  // Copies the arguments described by `fmt` out of `args`. Arguments beyond
+  // kMaxArgs and string bytes beyond kStringBytes are dropped and flagged.
+  void capture(const char *fmt_in, va_list args_in) {
+    fmt = fmt_in;
+    num_args = 0;
+    string_bytes = 0;
+    truncated = 0;
+    TraceFormatWalker walker(fmt_in);
+    const char *literal, *spec;
+    size_t literal_len, spec_len;
+    TraceArgType type;
+    int stars;
+    bool more = true;
+    while (more) {
+      more = walker.next(literal, literal_len, spec, spec_len, type, stars);
+      for (int i = 0; i < stars; i++)
+        push(static_cast<uint64_t>(va_arg(args_in, int)));
+      switch (type) {
+      case TraceArgType::INT:
+        push(static_cast<uint64_t>(va_arg(args_in, int)));
+        break;
+      case TraceArgType::UINT:
+        push(static_cast<uint64_t>(va_arg(args_in, unsigned int)));
+        break;
+      case TraceArgType::LONG:
+        // long long is the widest integer printf takes; on the supported
+        // targets every l / z / j / t argument fits in it
+        push(spec_is_long_long(spec, spec_len)
+                 ? static_cast<uint64_t>(va_arg(args_in, long long))
+                 : static_cast<uint64_t>(va_arg(args_in, long)));
+        break;
+      case TraceArgType::ULONG:
+        // unsigned, so a 32 bit long with the top bit set isn't sign extended
+        push(spec_is_long_long(spec, spec_len)
+                 ? static_cast<uint64_t>(va_arg(args_in, unsigned long long))
+                 : static_cast<uint64_t>(va_arg(args_in, unsigned long)));
+        break;
+      case TraceArgType::DOUBLE: {
+        double d = va_arg(args_in, double);
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        push(bits);
+        break;
+      }
+      case TraceArgType::POINTER:
+        push(reinterpret_cast<uintptr_t>(va_arg(args_in, void *)));
+        break;
+      case TraceArgType::STRING: {
+        const char *str = va_arg(args_in, const char *);
+        push(copy_string(str ? str : "(null)"));
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  }
+
+  // Renders the record (without any prefix) into `out`, always null
+  // terminated. Returns the number of characters written.
+  size_t render(char *out, size_t out_size) const {
+    if (out_size == 0)
+      return 0;
+    size_t pos = 0;
+    size_t arg = 0;
+    TraceFormatWalker walker(fmt);
+    const char *literal, *spec;
+    size_t literal_len, spec_len;
+    TraceArgType type;
+    int stars;
+    bool more = true;
+    while (more && pos + 1 < out_size) {
+      more = walker.next(literal, literal_len, spec, spec_len, type, stars);
+      // an escaped "%%" is reported as a single '%' at the end of the literal
+      for (size_t i = 0; i < literal_len && pos + 1 < out_size; i++)
+        out[pos++] = literal[i];
+      if (spec_len == 0)
+        continue;
+      if (type == TraceArgType::NONE || arg + stars + 1 > num_args) {
+        for (size_t i = 0; i < spec_len && pos + 1 < out_size; i++)
+          out[pos++] = spec[i];
+        continue;
+      }
+      int star_values[2] = {0, 0};
+      for (int i = 0; i < stars && i < 2; i++)
+        star_values[i] = static_cast<int>(args[arg++]);
+      // copy the spec so it can be passed to snprintf on its own
+      char one[24];
+      size_t n = spec_len < sizeof(one) - 1 ? spec_len : sizeof(one) - 1;
+      memcpy(one, spec, n);
+      one[n] = '\0';
+      uint64_t value = args[arg++];
+      int written = 0;
+      char *dst = out + pos;
+      size_t room = out_size - pos;
+      switch (type) {
+      case TraceArgType::INT:
+        written = print(dst, room, one, stars, star_values, static_cast<int>(value));
+        break;
+      case TraceArgType::UINT:
+        written = print(dst, room, one, stars, star_values, static_cast<unsigned int>(value));
+        break;
+      case TraceArgType::LONG:
+        if (spec_is_long_long(spec, spec_len))
+          written = print(dst, room, one, stars, star_values, static_cast<long long>(value));
+        else
+          written = print(dst, room, one, stars, star_values, static_cast<long>(value));
+        break;
+      case TraceArgType::ULONG:
+        if (spec_is_long_long(spec, spec_len))
+          written = print(dst, room, one, stars, star_values, static_cast<unsigned long long>(value));
+        else
+          written = print(dst, room, one, stars, star_values, static_cast<unsigned long>(value));
+        break;
+      case TraceArgType::DOUBLE: {
+        double d;
+        memcpy(&d, &value, sizeof(d));
+        written = print(dst, room, one, stars, star_values, d);
+        break;
+      }
+      case TraceArgType::POINTER:
+        written = print(dst, room, one, stars, star_values,
+                        reinterpret_cast<void *>(static_cast<uintptr_t>(value)));
+        break;
+      case TraceArgType::STRING:
+        written = print(dst, room, one, stars, star_values,
+                        static_cast<const char *>(strings + value));
+        break;
+      default:
+        break;
+      }
+      if (written > 0)
+        pos += static_cast<size_t>(written) < room ? written : room - 1;
+    }
+    if (truncated && pos + 4 < out_size) {
+      memcpy(out + pos, " ...", 4);
+      pos += 4;
+    }
+    out[pos] = '\0';
+    return pos;
+  }
+
+private:
+  static bool spec_is_long_long(const char *spec, size_t len) {
+    for (size_t i = 0; i + 1 < len; i++) {
+      if ((spec[i] == 'l' && spec[i + 1] == 'l') || spec[i] == 'j' || spec[i] == 'q' ||
+          spec[i] == 'L')
+        return true;
+    }
+    return false;
+  }
+
+  template <typename T>
+  static int print(char *dst, size_t room, const char *spec, int stars, const int *star_values,
+                   T value) {
+    switch (stars) {
+    case 0:
+      return snprintf(dst, room, spec, value);
+    case 1:
+      return snprintf(dst, room, spec, star_values[0], value);
+    default:
+      return snprintf(dst, room, spec, star_values[0], star_values[1], value);
+    }
+  }
+
+  void push(uint64_t value) {
+    if (num_args < kMaxArgs)
+      args[num_args++] = value;
+    else
+      truncated = 1;
+  }
+
+  // Returns the offset of the copied string within `strings`.
+  uint64_t copy_string(const char *str) {
+    if (string_bytes >= kStringBytes) {
+      truncated = 1;
+      return kStringBytes - 1;
+    }
+    size_t offset = string_bytes;
+    size_t room = kStringBytes - offset - 1;
+    size_t len = strnlen(str, room + 1);
+    if (len > room) {
+      len = room;
+      truncated = 1;
+    }
+    memcpy(strings + offset, str, len);
+    strings[offset + len] = '\0';
+    string_bytes = static_cast<uint8_t>(offset + len + 1);
+    return offset;
+  }
+};
+
+// Bounded multi-producer / single-consumer ring of trace records. Producers
+// never block: when the ring is full the record is dropped and counted.
+// Based on the sequence-numbered slot scheme of Dmitry Vyukov's bounded queue.
+template <size_t N> class TraceRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "TraceRing size must be a power of two");
+
+public:
+  TraceRing() {
+    for (size_t i = 0; i < N; i++)
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  // Reserves a slot, lets `fill` write the record in place and publishes it.
+  // Returns false (and counts a drop) if the ring is full.
+  template <typename Fill> bool push(Fill &&fill) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+      slot = &slots_[pos & (N - 1)];
+      size_t seq = slot->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    fill(slot->record);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Hands the oldest published record to `consume`. Must only be called from
+  // a single consumer. Returns false if the ring is empty.
+  template <typename Consume> bool pop(Consume &&consume) {
+    Slot *slot = &slots_[dequeue_pos_ & (N - 1)];
+    size_t seq = slot->sequence.load(std::memory_order_acquire);
+    if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(dequeue_pos_ + 1) < 0)
+      return false;
+    consume(slot->record);
+    slot->sequence.store(dequeue_pos_ + N, std::memory_order_release);
+    dequeue_pos_++;
+    return true;
+  }
+
+  // Total number of records dropped because the ring was full.
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  static constexpr size_t capacity() { return N; }
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    TraceRecord record;
+  };
+  Slot slots_[N];
+  std::atomic<size_t> enqueue_pos_{0};
+  size_t dequeue_pos_{0};
+  std::atomic<uint32_t> dropped_{0};
+};
+
+} // namespace gfps
+
+// Counters for the deferred trace backend.
+struct nearby_platform_TraceStats {
+  uint32_t captured; // records written into the ring
+  uint32_t dropped;  // records lost because the ring was full
+  uint32_t printed;  // records rendered by the drain task
+};
+
+// Returns the deferred trace counters (all zero in synchronous mode).
+nearby_platform_TraceStats nearby_platform_GetTraceStats();
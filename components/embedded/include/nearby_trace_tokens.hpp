@@ -0,0 +1,187 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "nearby_trace_ring.hpp"
+
+// Tokenized trace encoding. Instead of the formatted text, each trace call is
+// emitted as a compact binary record which names the format string and the
+// source file by their 32 bit FNV-1a hashes (tokens). tools/trace_tokens.py
+// builds the token database from the sources at build time and turns captured
+// output back into readable logs.
+//
+// Record layout (little endian):
+//   level      u8
+//   fmt token  u32
+//   file token u32  (hash of the basename of the file)
+//   line       varint
+//   args       one entry per conversion in the format string:
+//              d/i/c      zigzag varint (sign extended to 64 bits if long)
+//              u/x/X/o/p  varint
+//              f/e/g/a    float32
+//              s          u8 length followed by that many bytes
+//
+// To share the console with regular text logs, records are written as a
+// single line: '$' followed by the base64 encoded record.
+
+namespace gfps {
+
+// 32 bit FNV-1a, usable at compile time.
+constexpr uint32_t trace_token(std::string_view str) {
+  uint32_t hash = 0x811c9dc5u;
+  for (char c : str) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x01000193u;
+  }
+  return hash;
+}
+
+static_assert(trace_token("") == 0x811c9dc5u);
+static_assert(trace_token("a") == 0xe40c292cu);
+
+// Returns the part of `path` after the last '/'.
+constexpr std::string_view trace_basename(std::string_view path) {
+  auto slash = path.find_last_of('/');
+  return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+class TraceTokenEncoder {
+public:
+  // Worst case: every arg a 10 byte varint, plus a full copy of the strings.
+  static constexpr size_t kMaxRecordBytes =
+      1 + 4 + 4 + 5 + TraceRecord::kMaxArgs * 10 + TraceRecord::kStringBytes;
+  // '$', base64 of the record, '\n'
+  static constexpr size_t kMaxLineBytes = 1 + (kMaxRecordBytes + 2) / 3 * 4 + 1;
+
+  // Encodes `record` into `out` (at least kMaxRecordBytes). Returns the
+  // number of bytes used.
+  static size_t encode(const TraceRecord &record, uint8_t *out) {
+    size_t pos = 0;
+    out[pos++] = record.level;
+    pos += put_u32(out + pos, cached_token(record.fmt, false));
+    pos += put_u32(out + pos, cached_token(record.filename, true));
+    pos += put_varint(out + pos, static_cast<uint32_t>(record.lineno));
+    size_t arg = 0;
+    TraceFormatWalker walker(record.fmt);
+    const char *literal, *spec;
+    size_t literal_len, spec_len;
+    TraceArgType type;
+    int stars;
+    bool more = true;
+    while (more) {
+      more = walker.next(literal, literal_len, spec, spec_len, type, stars);
+      if (type == TraceArgType::NONE)
+        continue;
+      for (int i = 0; i < stars && arg < record.num_args; i++)
+        pos += put_varint(out + pos, zigzag(static_cast<int64_t>(static_cast<int32_t>(record.args[arg++]))));
+      if (arg >= record.num_args)
+        break;
+      uint64_t value = record.args[arg++];
+      switch (type) {
+      case TraceArgType::INT:
+        pos += put_varint(out + pos, zigzag(static_cast<int64_t>(static_cast<int32_t>(value))));
+        break;
+      case TraceArgType::LONG:
+        pos += put_varint(out + pos, zigzag(static_cast<int64_t>(value)));
+        break;
+      case TraceArgType::UINT:
+      case TraceArgType::ULONG:
+      case TraceArgType::POINTER:
+        pos += put_varint(out + pos, value);
+        break;
+      case TraceArgType::DOUBLE: {
+        double d;
+        memcpy(&d, &value, sizeof(d));
+        float f = static_cast<float>(d);
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        pos += put_u32(out + pos, bits);
+        break;
+      }
+      case TraceArgType::STRING: {
+        const char *str = record.strings + value;
+        size_t len = strnlen(str, TraceRecord::kStringBytes - value);
+        out[pos++] = static_cast<uint8_t>(len);
+        memcpy(out + pos, str, len);
+        pos += len;
+        break;
+      }
+      default:
+        break;
+      }
+    }
+    return pos;
+  }
+
+  // Encodes `record` as a '$'-prefixed base64 line into `out` (at least
+  // kMaxLineBytes). Returns the number of characters used, not null
+  // terminated.
+  static size_t encode_line(const TraceRecord &record, char *out) {
+    uint8_t bin[kMaxRecordBytes];
+    size_t len = encode(record, bin);
+    static constexpr char kAlphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t pos = 0;
+    out[pos++] = '$';
+    for (size_t i = 0; i < len; i += 3) {
+      uint32_t chunk = bin[i] << 16;
+      if (i + 1 < len)
+        chunk |= bin[i + 1] << 8;
+      if (i + 2 < len)
+        chunk |= bin[i + 2];
+      out[pos++] = kAlphabet[(chunk >> 18) & 0x3f];
+      out[pos++] = kAlphabet[(chunk >> 12) & 0x3f];
+      out[pos++] = i + 1 < len ? kAlphabet[(chunk >> 6) & 0x3f] : '=';
+      out[pos++] = i + 2 < len ? kAlphabet[chunk & 0x3f] : '=';
+    }
+    out[pos++] = '\n';
+    return pos;
+  }
+
+  // Returns the token of a format string or file name (of its basename).
+  // The library's trace calls pass string literals, so the tokens are
+  // remembered by address and each string is hashed only the first time it
+  // is traced. An entry packs the low 32 bits of the address (all of it on
+  // the target) with the token, so racing tracers can't tear it.
+  static uint32_t cached_token(const char *str, bool basename) {
+    static std::atomic<uint64_t> cache[kTokenCacheEntries];
+    uint32_t key = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(str));
+    auto &entry = cache[(key >> 2) % kTokenCacheEntries];
+    uint64_t cached = entry.load(std::memory_order_relaxed);
+    if (cached != 0 && static_cast<uint32_t>(cached >> 32) == key)
+      return static_cast<uint32_t>(cached);
+    uint32_t token = basename ? trace_token(trace_basename(str)) : trace_token(str);
+    entry.store(static_cast<uint64_t>(key) << 32 | token, std::memory_order_relaxed);
+    return token;
+  }
+
+private:
+  static constexpr size_t kTokenCacheEntries = 64;
+
+  static uint64_t zigzag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+  }
+
+  static size_t put_u32(uint8_t *out, uint32_t v) {
+    out[0] = v & 0xff;
+    out[1] = (v >> 8) & 0xff;
+    out[2] = (v >> 16) & 0xff;
+    out[3] = (v >> 24) & 0xff;
+    return 4;
+  }
+
+  static size_t put_varint(uint8_t *out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+      out[n++] = static_cast<uint8_t>(v) | 0x80;
+      v >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(v);
+    return n;
+  }
+};
+
+} // namespace gfps
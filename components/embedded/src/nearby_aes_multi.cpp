@@ -0,0 +1,132 @@
+#include "embedded.hpp"
+
+// only the crypto benchmark calls these (see nearby_aes_multi.hpp)
+#if NEARBY_PLATFORM_CRYPTO_BENCHMARK
+
+#if !defined(NEARBY_PLATFORM_CRYPTO_BACKEND) || !defined(ESP_PLATFORM)
+#undef NEARBY_PLATFORM_CRYPTO_BACKEND
+#define NEARBY_PLATFORM_CRYPTO_BACKEND 0
+#endif
+
+#if NEARBY_PLATFORM_CRYPTO_BACKEND
+#include <aes/esp_aes.h>
+#endif
+
+// number of expanded key schedules kept
+#if !defined(NEARBY_PLATFORM_AES_KEY_CACHE)
+#define NEARBY_PLATFORM_AES_KEY_CACHE 8
+#endif
+
+static constexpr size_t kDecryptorLanes = gfps::Aes128Decryptor::kLanes;
+
+struct CachedSchedule {
+  uint8_t key[16];
+  bool cached;
+  gfps::Aes128Decryptor schedule;
+};
+
+static CachedSchedule s_schedules[NEARBY_PLATFORM_AES_KEY_CACHE];
+static nearby_platform_AesKeyCacheStats s_stats;
+static std::mutex s_mutex;
+
+static void wipe(void *data, size_t length) {
+  volatile uint8_t *p = (volatile uint8_t *)data;
+  while (length--) {
+    *p++ = 0;
+  }
+}
+
+static void clear_schedules() {
+  for (auto &entry : s_schedules) {
+    if (entry.cached) {
+      s_stats.evictions++;
+    }
+    wipe(entry.key, sizeof(entry.key));
+    entry.schedule.wipe();
+    entry.cached = false;
+  }
+}
+
+// Returns the cached schedule for `key`, or nullptr if it is not cached.
+// Must be called with s_mutex held.
+static const gfps::Aes128Decryptor *find_schedule(const uint8_t key[16]) {
+  for (auto &entry : s_schedules) {
+    if (entry.cached && memcmp(entry.key, key, sizeof(entry.key)) == 0) {
+      return &entry.schedule;
+    }
+  }
+  return nullptr;
+}
+
+void nearby_platform_Aes128CacheKeys(const uint8_t keys[][16], size_t num_keys) {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  clear_schedules();
+#if !NEARBY_PLATFORM_CRYPTO_BACKEND
+  // keys beyond the cache size are expanded on every use
+  for (size_t i = 0; i < std::min<size_t>(num_keys, NEARBY_PLATFORM_AES_KEY_CACHE); i++) {
+    memcpy(s_schedules[i].key, keys[i], sizeof(s_schedules[i].key));
+    s_schedules[i].schedule.set_key(keys[i]);
+    s_schedules[i].cached = true;
+  }
+#endif
+}
+
+void nearby_platform_Aes128ClearKeyCache() {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  clear_schedules();
+}
+
+nearby_platform_status nearby_platform_Aes128DecryptMulti(const uint8_t input[16],
+                                                          const uint8_t keys[][16],
+                                                          size_t num_keys,
+                                                          uint8_t outputs[][16]) {
+#if NEARBY_PLATFORM_CRYPTO_BACKEND
+  // the peripheral takes the raw key, there is no schedule to keep
+  esp_aes_context context;
+  esp_aes_init(&context);
+  int ret = 0;
+  for (size_t i = 0; i < num_keys && ret == 0; i++) {
+    ret = esp_aes_setkey(&context, keys[i], 128);
+    if (ret == 0) {
+      ret = esp_aes_crypt_ecb(&context, ESP_AES_DECRYPT, input, outputs[i]);
+    }
+  }
+  esp_aes_free(&context);
+  std::lock_guard<std::mutex> lk(s_mutex);
+  s_stats.batches++;
+  s_stats.blocks += num_keys;
+  return ret == 0 ? kNearbyStatusOK : kNearbyStatusError;
+#else
+  // the input may alias an output, so keep a copy
+  uint8_t block[16];
+  memcpy(block, input, sizeof(block));
+  std::lock_guard<std::mutex> lk(s_mutex);
+  s_stats.batches++;
+  s_stats.blocks += num_keys;
+  for (size_t first = 0; first < num_keys; first += kDecryptorLanes) {
+    size_t count = std::min(kDecryptorLanes, num_keys - first);
+    // other keys are expanded here and not kept
+    gfps::Aes128Decryptor lanes[kDecryptorLanes];
+    uint8_t *lane_outputs[kDecryptorLanes];
+    for (size_t lane = 0; lane < count; lane++) {
+      if (const gfps::Aes128Decryptor *schedule = find_schedule(keys[first + lane])) {
+        s_stats.hits++;
+        lanes[lane] = *schedule;
+      } else {
+        s_stats.misses++;
+        lanes[lane].set_key(keys[first + lane]);
+      }
+      lane_outputs[lane] = outputs[first + lane];
+    }
+    gfps::Aes128Decryptor::decrypt_multi(lanes, count, block, lane_outputs);
+  }
+  return kNearbyStatusOK;
+#endif
+}
+
+nearby_platform_AesKeyCacheStats nearby_platform_GetAesKeyCacheStats() {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  return s_stats;
+}
+
+#endif // NEARBY_PLATFORM_CRYPTO_BENCHMARK
@@ -12,84 +12,80 @@ static const nearby_platform_BtInterface *g_bt_interface = nullptr;
 #endif
 
 
-/* Attributes State Machine */
-enum
-  {
-    IDX_SVC,
-    IDX_CHAR_MODEL_ID,
-    IDX_CHAR_VAL_MODEL_ID,
-
-    IDX_CHAR_KB_PAIRING,
-    IDX_CHAR_VAL_KB_PAIRING,
-    IDX_CHAR_CFG_KB_PAIRING,
-
-    IDX_CHAR_PASSKEY,
-    IDX_CHAR_VAL_PASSKEY,
-    IDX_CHAR_CFG_PASSKEY,
-
-    IDX_CHAR_ACCOUNT_KEY,
-    IDX_CHAR_VAL_ACCOUNT_KEY,
-
-    IDX_CHAR_FW_REVISION,
-    IDX_CHAR_VAL_FW_REVISION,
-
-    GFPS_IDX_NB,
-  };
-
 #define PROFILE_NUM                 1
 #define PROFILE_APP_IDX             0
 #define ESP_APP_ID                  0x55
 #define SVC_INST_ID                 0
 
 static const uint32_t MODEL_ID = CONFIG_MODEL_ID;
+// static passkey given to the stack, and the one reported until a seeker's
+// numeric comparison request brings its own
 static uint32_t PASSKEY  = 123456;
 
-static uint8_t REMOTE_PUBLIC_KEY[64] = {0};
 static uint8_t ENCRYPTED_PASSKEY_BLOCK[16] = {0};
 
 static std::vector<uint8_t> raw_adv_data;
-static std::vector<uint8_t> remote_bd_addr;
+// interval code of the advertisement in raw_adv_data, none until the first
+// one is configured
+static int raw_adv_interval = -1;
+static nearby_platform_AdvertisementStats adv_stats;
+static std::mutex adv_mutex;
+
+#if NEARBY_PLATFORM_KBP_ADMISSION
+// only touched from the BTC task
+static gfps::KbpAdmission kbp_admission;
+#endif
 
 /* Service */
-// NOTE: these UUIDs are specified at 16-bit, which means that 1) they are not
-// in reverse order, and 2) the rest of their full 128-bit UUIDs are the standard
-// Bluetooth SIG base UUID (0x0000XXXX-0000-1000-8000-00805F9B34FB), and the 16-bit
-// UUIDs are the last 2 bytes of the first 4 bytes of the full UUIDs (XXXX).
-static const uint16_t GATTS_SERVICE_UUID_GFPS            = 0xFE2C;
-static const uint16_t GATTS_CHAR_UUID_GFPS_FW_REVISION   = 0x2A26;
+// NOTE: these UUIDs are specified at 16-bit, which means that the rest of their
+// full 128-bit UUIDs are the standard Bluetooth SIG base UUID
+// (0x0000XXXX-0000-1000-8000-00805F9B34FB), and the 16-bit UUIDs are the last 2
+// bytes of the first 4 bytes of the full UUIDs (XXXX), stored LSB first.
+static constexpr uint8_t GATTS_SERVICE_UUID_GFPS[2]          = {0x2C, 0xFE};
+static constexpr uint8_t GATTS_CHAR_UUID_GFPS_FW_REVISION[2] = {0x26, 0x2A};
 
 // NOTE: the UUIDs are in reverse order
-static const uint8_t GATTS_CHAR_UUID_GFPS_MODEL_ID[16]      = {0xEA, 0x0B, 0x10, 0x32,
+static constexpr uint8_t GATTS_CHAR_UUID_GFPS_MODEL_ID[16]      = {0xEA, 0x0B, 0x10, 0x32,
                                                                0xDE, 0x01, 0xB0, 0x8E,
                                                                0x14, 0x48, 0x66, 0x83,
                                                                0x33, 0x12, 0x2C, 0xFE};
-static const uint8_t GATTS_CHAR_UUID_GFPS_KB_PAIRING[16]    = {0xEA, 0x0B, 0x10, 0x32,
+static constexpr uint8_t GATTS_CHAR_UUID_GFPS_KB_PAIRING[16]    = {0xEA, 0x0B, 0x10, 0x32,
                                                                0xDE, 0x01, 0xB0, 0x8E,
                                                                0x14, 0x48, 0x66, 0x83,
                                                                0x34, 0x12, 0x2C, 0xFE};
-static const uint8_t GATTS_CHAR_UUID_GFPS_PASSKEY[16]       = {0xEA, 0x0B, 0x10, 0x32,
+static constexpr uint8_t GATTS_CHAR_UUID_GFPS_PASSKEY[16]       = {0xEA, 0x0B, 0x10, 0x32,
                                                                0xDE, 0x01, 0xB0, 0x8E,
                                                                0x14, 0x48, 0x66, 0x83,
                                                                0x35, 0x12, 0x2C, 0xFE};
-static const uint8_t GATTS_CHAR_UUID_GFPS_ACCOUNT_KEY[16]   = {0xEA, 0x0B, 0x10, 0x32,
+static constexpr uint8_t GATTS_CHAR_UUID_GFPS_ACCOUNT_KEY[16]   = {0xEA, 0x0B, 0x10, 0x32,
                                                                0xDE, 0x01, 0xB0, 0x8E,
                                                                0x14, 0x48, 0x66, 0x83,
                                                                0x36, 0x12, 0x2C, 0xFE};
+static constexpr uint8_t GATTS_CHAR_UUID_GFPS_ADDITIONAL_DATA[16] = {0xEA, 0x0B, 0x10, 0x32,
+                                                               0xDE, 0x01, 0xB0, 0x8E,
+                                                               0x14, 0x48, 0x66, 0x83,
+                                                               0x37, 0x12, 0x2C, 0xFE};
+static constexpr uint8_t GATTS_CHAR_UUID_GFPS_MESSAGE_STREAM_PSM[16] = {0xEA, 0x0B, 0x10, 0x32,
+                                                               0xDE, 0x01, 0xB0, 0x8E,
+                                                               0x14, 0x48, 0x66, 0x83,
+                                                               0x39, 0x12, 0x2C, 0xFE};
 
 
-/* The max length of characteristic value. When the GATT client performs a write or prepare write operation,
- *  the data length must be less than GATTS_DEMO_CHAR_VAL_LEN_MAX.
- */
-#define GATTS_DEMO_CHAR_VAL_LEN_MAX 500
-#define PREPARE_BUF_MAX_SIZE        1024
-#define CHAR_DECLARATION_SIZE       (sizeof(uint8_t))
+// bytes set aside for reassembling prepared (long) writes, shared by all
+// connections
+#define PREPARE_BUF_MAX_SIZE        256
 
 #define ADV_CONFIG_FLAG             (1 << 0)
 #define SCAN_RSP_CONFIG_FLAG        (1 << 1)
 
 static uint8_t adv_config_done       = 0;
-
-static uint16_t gfps_handle_table[GFPS_IDX_NB];
+// set once the controller confirms advertising started, cleared when it
+// stops or a connection ends it
+static std::atomic<bool> advertising{false};
+// when the pending advertisement reconfiguration was issued
+static int64_t adv_config_start_us = 0;
+// reconfigurations the controller has confirmed, for the mean in miss_us
+static uint32_t adv_configs_completed = 0;
 
 static SemaphoreHandle_t ble_cb_semaphore = NULL;
 #define WAIT_BLE_CB() xSemaphoreTake(ble_cb_semaphore, portMAX_DELAY)
@@ -171,88 +167,194 @@ static struct gatts_profile_inst gfps_profile_tab[PROFILE_NUM] = {
   },
 };
 
-static const uint16_t primary_service_uuid         = ESP_GATT_UUID_PRI_SERVICE;
-static const uint16_t character_declaration_uuid   = ESP_GATT_UUID_CHAR_DECLARE;
-static const uint16_t character_client_config_uuid = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
-static const uint8_t char_prop_read                = ESP_GATT_CHAR_PROP_BIT_READ;
-static const uint8_t char_prop_write               = ESP_GATT_CHAR_PROP_BIT_WRITE;
-static const uint8_t char_prop_read_write_notify   = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static constexpr uint8_t primary_service_uuid[2]         = {ESP_GATT_UUID_PRI_SERVICE & 0xFF, ESP_GATT_UUID_PRI_SERVICE >> 8};
+static constexpr uint8_t character_declaration_uuid[2]   = {ESP_GATT_UUID_CHAR_DECLARE & 0xFF, ESP_GATT_UUID_CHAR_DECLARE >> 8};
+static constexpr uint8_t character_client_config_uuid[2] = {ESP_GATT_UUID_CHAR_CLIENT_CONFIG & 0xFF, ESP_GATT_UUID_CHAR_CLIENT_CONFIG >> 8};
 
 // TODO: update
-static const uint8_t ccc[2]           = {0x01, 0x00}; // LSb corresponds to notifications (1 if enabled, 0 if disabled), next bit (bit 1) corresponds to indications - 1 if enabled, 0 if disabled
-static const uint8_t fw_revision[4]   = {'1', '.', '0', 0x00};
-static const uint8_t char_value[16]    = {0x00};
+static constexpr uint8_t ccc[2]           = {0x01, 0x00}; // LSb corresponds to notifications (1 if enabled, 0 if disabled), next bit (bit 1) corresponds to indications - 1 if enabled, 0 if disabled
+static constexpr uint8_t fw_revision[4]   = {'1', '.', '0', 0x00};
+// the 24 bit model id, big endian as on_gatt_read would return it
+static constexpr uint8_t model_id_value[3] = {(MODEL_ID >> 16) & 0xFF, (MODEL_ID >> 8) & 0xFF, MODEL_ID & 0xFF};
+
+/* Full Database Description */
+// One line per characteristic; the attribute table, the value lengths and the
+// handle <-> characteristic lookups are generated from it (nearby_gatt_db.hpp).
+// Characteristics without a static value are answered by the app.
+using Gatt = gfps::GattCharacteristic;
+static constexpr gfps::GattCharacteristic gfps_characteristics[] = {
+  // characteristic, uuid, uuid length, properties, max length[, static value, length]
+  {kModelId, GATTS_CHAR_UUID_GFPS_MODEL_ID, ESP_UUID_LEN_128, Gatt::kRead, sizeof(model_id_value), model_id_value, sizeof(model_id_value)},
+  {kKeyBasedPairing, GATTS_CHAR_UUID_GFPS_KB_PAIRING, ESP_UUID_LEN_128, Gatt::kRead | Gatt::kWrite | Gatt::kNotify, 80},
+  {kPasskey, GATTS_CHAR_UUID_GFPS_PASSKEY, ESP_UUID_LEN_128, Gatt::kRead | Gatt::kWrite | Gatt::kNotify, 16},
+  {kAccountKey, GATTS_CHAR_UUID_GFPS_ACCOUNT_KEY, ESP_UUID_LEN_128, Gatt::kWrite, 16},
+  {kFirmwareRevision, GATTS_CHAR_UUID_GFPS_FW_REVISION, ESP_UUID_LEN_16, Gatt::kRead, sizeof(fw_revision), fw_revision, sizeof(fw_revision)},
+#if NEARBY_FP_ENABLE_ADDITIONAL_DATA
+  {kAdditionalData, GATTS_CHAR_UUID_GFPS_ADDITIONAL_DATA, ESP_UUID_LEN_128, Gatt::kWrite | Gatt::kNotify, NEARBY_PLATFORM_ADDITIONAL_DATA_HEADER_BYTES + NEARBY_PLATFORM_PERSONALIZED_NAME_MAX},
+#endif
+#if NEARBY_FP_MESSAGE_STREAM
+  {kMessageStreamPsm, GATTS_CHAR_UUID_GFPS_MESSAGE_STREAM_PSM, ESP_UUID_LEN_128, Gatt::kRead, 3},
+#endif
+};
 
-/* Full Database Description - Used to add attributes into the database */
-static const esp_gatts_attr_db_t gatt_db[GFPS_IDX_NB] =
-  {
-    // Service Declaration
-    [IDX_SVC]        =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&primary_service_uuid, ESP_GATT_PERM_READ,
-                           sizeof(uint16_t), sizeof(GATTS_SERVICE_UUID_GFPS), (uint8_t *)&GATTS_SERVICE_UUID_GFPS}},
-
-    /* Characteristic Declaration */
-    [IDX_CHAR_MODEL_ID]     =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
-                           CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read}},
-
-    /* Characteristic Value */
-    [IDX_CHAR_VAL_MODEL_ID] =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t *)GATTS_CHAR_UUID_GFPS_MODEL_ID, ESP_GATT_PERM_READ,
-                           GATTS_DEMO_CHAR_VAL_LEN_MAX, 3, (uint8_t *)&MODEL_ID}},
-
-    /* Characteristic Declaration */
-    [IDX_CHAR_KB_PAIRING]      =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
-                           CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_write_notify}},
-
-    /* Characteristic Value */
-    [IDX_CHAR_VAL_KB_PAIRING]  =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t *)GATTS_CHAR_UUID_GFPS_KB_PAIRING, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-                           GATTS_DEMO_CHAR_VAL_LEN_MAX, sizeof(char_value), (uint8_t *)char_value}},
-
-    /* Client Characteristic Configuration Descriptor */
-    [IDX_CHAR_CFG_KB_PAIRING]  =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-                           sizeof(uint16_t), sizeof(ccc), (uint8_t *)ccc}},
-
-    /* Characteristic Declaration */
-    [IDX_CHAR_PASSKEY]      =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
-                           CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_write_notify}},
-
-    /* Characteristic Value */
-    [IDX_CHAR_VAL_PASSKEY]  =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t *)GATTS_CHAR_UUID_GFPS_PASSKEY, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-                           GATTS_DEMO_CHAR_VAL_LEN_MAX, sizeof(ENCRYPTED_PASSKEY_BLOCK), (uint8_t *)ENCRYPTED_PASSKEY_BLOCK}},
-
-    /* Client Characteristic Configuration Descriptor */
-    [IDX_CHAR_CFG_PASSKEY]  =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-                           sizeof(uint16_t), sizeof(ccc), (uint8_t *)ccc}},
-
-    /* Characteristic Declaration */
-    [IDX_CHAR_ACCOUNT_KEY]      =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_WRITE,
-                           CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_write}},
-
-    /* Characteristic Value */
-    [IDX_CHAR_VAL_ACCOUNT_KEY]  =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t *)GATTS_CHAR_UUID_GFPS_ACCOUNT_KEY, ESP_GATT_PERM_WRITE,
-                           GATTS_DEMO_CHAR_VAL_LEN_MAX, sizeof(char_value), (uint8_t *)char_value}},
-
-    /* Characteristic Declaration */
-    [IDX_CHAR_FW_REVISION]      =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
-                           CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read}},
-
-    /* Characteristic Value */
-    [IDX_CHAR_VAL_FW_REVISION]  =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&GATTS_CHAR_UUID_GFPS_FW_REVISION, ESP_GATT_PERM_READ,
-                           GATTS_DEMO_CHAR_VAL_LEN_MAX, sizeof(fw_revision), (uint8_t *)fw_revision}},
-
-
-  };
+using GfpsLayout = gfps::GattLayout<gfps_characteristics>;
+
+// The attribute table handed to esp_ble_gatts_create_attr_tab.
+static constexpr auto gatt_db = [] {
+  std::array<esp_gatts_attr_db_t, GfpsLayout::kNumAttributes> db{};
+  for (size_t i = 0; i < db.size(); i++) {
+    const auto &attribute = GfpsLayout::attributes[i];
+    const auto &characteristic = gfps_characteristics[attribute.slot];
+    auto &desc = db[i].att_desc;
+    db[i].attr_control.auto_rsp = ESP_GATT_AUTO_RSP;
+    desc.uuid_length = ESP_UUID_LEN_16;
+    desc.perm = ESP_GATT_PERM_READ;
+    switch (attribute.kind) {
+    case gfps::GattAttributeKind::Service:
+      desc.uuid_p = const_cast<uint8_t *>(primary_service_uuid);
+      desc.max_length = desc.length = sizeof(GATTS_SERVICE_UUID_GFPS);
+      desc.value = const_cast<uint8_t *>(GATTS_SERVICE_UUID_GFPS);
+      break;
+    case gfps::GattAttributeKind::Declaration:
+      desc.uuid_p = const_cast<uint8_t *>(character_declaration_uuid);
+      desc.max_length = desc.length = sizeof(characteristic.properties);
+      desc.value = const_cast<uint8_t *>(&characteristic.properties);
+      break;
+    case gfps::GattAttributeKind::Value:
+      if (characteristic.app_response()) {
+        db[i].attr_control.auto_rsp = ESP_GATT_RSP_BY_APP;
+      }
+      desc.uuid_length = characteristic.uuid_length;
+      desc.uuid_p = const_cast<uint8_t *>(characteristic.uuid);
+      desc.perm = (characteristic.readable() ? ESP_GATT_PERM_READ : 0) |
+                  (characteristic.writable() ? ESP_GATT_PERM_WRITE : 0);
+      desc.max_length = characteristic.max_length;
+      desc.length = characteristic.length;
+      desc.value = const_cast<uint8_t *>(characteristic.value);
+      break;
+    case gfps::GattAttributeKind::Ccc:
+      desc.uuid_p = const_cast<uint8_t *>(character_client_config_uuid);
+      desc.perm = ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE;
+      desc.max_length = desc.length = sizeof(ccc);
+      desc.value = const_cast<uint8_t *>(ccc);
+      break;
+    }
+  }
+  return db;
+}();
+
+static gfps::GattHandles<GfpsLayout> gfps_handles;
+
+// Values read from the characteristics which are answered by the app, kept
+// so a long read continues from the value returned at offset 0.
+struct ReadValue {
+  uint16_t length;
+  uint8_t data[GfpsLayout::kMaxReadLength];
+};
+
+// notifications queued per connection, and how many are handed to the stack
+// at a time; the next batch goes when their confirmations come back
+#if !defined(NEARBY_PLATFORM_NOTIFY_QUEUE_DEPTH)
+#define NEARBY_PLATFORM_NOTIFY_QUEUE_DEPTH 4
+#endif
+#if !defined(NEARBY_PLATFORM_NOTIFY_BATCH)
+#define NEARBY_PLATFORM_NOTIFY_BATCH 2
+#endif
+// how long to wait before retrying a send the stack refused with nothing in
+// flight to bring a confirmation: about a connection interval
+#if !defined(NEARBY_PLATFORM_NOTIFY_RETRY_MS)
+#define NEARBY_PLATFORM_NOTIFY_RETRY_MS 20
+#endif
+
+using NotifyQueue = gfps::NotifyQueue<NEARBY_PLATFORM_NOTIFY_QUEUE_DEPTH, GfpsLayout::kMaxNotifyLength>;
+
+// State of one seeker's connection, recycled when its link closes so two
+// seekers pairing at once each keep their own.
+struct Session {
+  uint16_t mtu;
+  // numeric comparison passkey from the stack, checked against the one the
+  // seeker writes to the passkey characteristic
+  uint32_t passkey;
+  bool pairing; // from the security request until authentication completes
+  uint8_t remote_public_key[64];
+  ReadValue read_values[GfpsLayout::kNumReadBuffers];
+  // notifications not yet handed to the stack
+  NotifyQueue notify_queue;
+};
+
+// as many seekers as the controller has links
+#if !defined(NEARBY_PLATFORM_MAX_CONNECTIONS)
+#define NEARBY_PLATFORM_MAX_CONNECTIONS CONFIG_BT_ACL_CONNECTIONS
+#endif
+
+using ConnectionTable = gfps::ConnectionTable<Session, NEARBY_PLATFORM_MAX_CONNECTIONS>;
+using Connection = ConnectionTable::Connection;
+// Opened and closed from the BTC task, which also handles every request.
+// GattNotify queues from the library's task, so it, the changes and the
+// notification queues take the mutex. It is not held across calls into the
+// stack.
+static ConnectionTable connections;
+static std::mutex connections_mutex;
+static nearby_platform_NotifyStats notify_stats;
+// armed when a send was refused and no confirmation will restart the queue
+static void *notify_retry_timer = nullptr;
+// the connection whose write is with the library, so the platform calls it
+// makes (SetRemotePasskey) know which seeker they are about
+static Connection *serving = nullptr;
+
+// only touched from the BTC task
+static esp_gatt_rsp_t gatt_rsp;
+
+// MTU offered to seekers; a seeker which accepts it gets every request in a
+// single packet
+#if !defined(NEARBY_PLATFORM_GATT_MTU)
+#define NEARBY_PLATFORM_GATT_MTU ESP_GATT_MAX_MTU_SIZE
+#endif
+
+// A prepared write being reassembled. The pool is cut into buffers of the
+// longest value any characteristic accepts; a connection holds one from its
+// first prepare write until the execute (or cancel) write or disconnect.
+struct PreparedWrite {
+  bool used;
+  uint16_t conn_id;
+  uint16_t handle;
+  uint16_t length;
+  uint8_t *data;
+};
+static constexpr size_t kPrepareBufferBytes = GfpsLayout::kMaxWriteLength;
+static constexpr size_t kPrepareBuffers = PREPARE_BUF_MAX_SIZE / kPrepareBufferBytes;
+static_assert(kPrepareBuffers > 0, "PREPARE_BUF_MAX_SIZE is too small for a single write");
+static uint8_t prepare_pool[kPrepareBuffers][kPrepareBufferBytes];
+static PreparedWrite prepared_writes[kPrepareBuffers];
+
+static uint64_t peer_address_of(const esp_bd_addr_t bda) {
+  uint64_t peer_address = 0;
+  for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
+    peer_address += ((uint64_t)bda[i]) << (i * 8);
+  }
+  return peer_address;
+}
+
+static void bda_of(uint64_t peer_address, esp_bd_addr_t bda) {
+  for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
+    bda[i] = (peer_address >> (i * 8)) & 0xFF;
+  }
+}
+
+// The seeker going through pairing: the one whose write is being handled if
+// it is pairing, else any which is.
+static Connection *pairing_connection() {
+  if (serving != nullptr && serving->session.pairing) {
+    return serving;
+  }
+  Connection *pairing = nullptr;
+  connections.for_each([&](Connection &connection) {
+    if (connection.session.pairing && pairing == nullptr) {
+      pairing = &connection;
+    }
+  });
+  return pairing;
+}
 
 static const char *ble_gap_evt_names[] = {
   "ADV_DATA_SET_COMPLETE",
@@ -400,8 +502,25 @@ const char *esp_auth_req_to_str(esp_ble_auth_req_t auth_req)
    return auth_str;
 }
 
+// Called as the controller confirms the advertising data or scan response;
+// once both are in, records how long the reconfiguration took and starts
+// advertising with the new data.
+static void adv_config_complete(uint8_t flag) {
+  adv_config_done &= ~flag;
+  if (adv_config_done != 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lk(adv_mutex);
+    adv_stats.miss_us += esp_timer_get_time() - adv_config_start_us;
+    adv_configs_completed++;
+  }
+  esp_ble_gap_start_advertising(&adv_params);
+}
+
 static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
+  GFPS_FLIGHT_RECORD(kFlightGapEvent, event, 0, 0);
   switch (event) {
     /*
      * SCAN
@@ -424,35 +543,21 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
      * ADVERTISEMENT
      * */
   case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT:
-    adv_config_done &= (~ADV_CONFIG_FLAG);
-    if (adv_config_done == 0){
-      esp_ble_gap_start_advertising(&adv_params);
-    }
-    break;
   case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
-    adv_config_done &= (~ADV_CONFIG_FLAG);
-    if (adv_config_done == 0){
-      esp_ble_gap_start_advertising(&adv_params);
-    }
+    adv_config_complete(ADV_CONFIG_FLAG);
     break;
   case ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT:
-    adv_config_done &= (~SCAN_RSP_CONFIG_FLAG);
-    if (adv_config_done == 0){
-      esp_ble_gap_start_advertising(&adv_params);
-    }
-    break;
   case ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT:
-    adv_config_done &= (~SCAN_RSP_CONFIG_FLAG);
-    if (adv_config_done == 0){
-      esp_ble_gap_start_advertising(&adv_params);
-    }
+    adv_config_complete(SCAN_RSP_CONFIG_FLAG);
     break;
   case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
     /* advertising start complete event to indicate advertising start successfully or failed */
     if (param->adv_start_cmpl.status != ESP_BT_STATUS_SUCCESS) {
       logger.error("advertising start failed");
+      advertising = false;
     }else{
       logger.info("advertising start successfully");
+      advertising = true;
     }
     break;
   case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
@@ -461,6 +566,7 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
     }
     else {
       logger.info("Stop adv successfully");
+      advertising = false;
     }
     break;
   case ESP_GAP_BLE_ADV_TERMINATED_EVT:
@@ -501,23 +607,22 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
       logger.error("BLE GAP AUTH ERROR: {:#x}", param->ble_security.auth_cmpl.fail_reason);
       #if !defined(CONFIG_BT_CLASSIC_ENABLED)
       if (g_bt_interface != nullptr) {
-        // get the uint64_t peer_address from the param
-        uint64_t peer_address = 0;
-        memcpy(&peer_address, param->ble_security.auth_cmpl.bd_addr, sizeof(uint64_t));
-        g_bt_interface->on_pairing_failed(peer_address);
+        g_bt_interface->on_pairing_failed(peer_address_of(param->ble_security.auth_cmpl.bd_addr));
       }
       #endif
     } else {
       logger.info("BLE GAP AUTH SUCCESS");
       #if !defined(CONFIG_BT_CLASSIC_ENABLED)
       if (g_bt_interface != nullptr) {
-        // get the uint64_t peer_address from the param
-        uint64_t peer_address = 0;
-        memcpy(&peer_address, param->ble_security.auth_cmpl.bd_addr, sizeof(uint64_t));
-        g_bt_interface->on_paired(peer_address);
+        g_bt_interface->on_paired(peer_address_of(param->ble_security.auth_cmpl.bd_addr));
       }
       #endif
     }
+    if (auto *connection = connections.find(peer_address_of(param->ble_security.auth_cmpl.bd_addr))) {
+      connection->session.pairing = false;
+    }
+    // the handshake is over either way
+    nearby_platform_MbedtlsArenaReset();
     break;
 
   case ESP_GAP_BLE_KEY_EVT: // shows the ble key info share with peer device to the user.
@@ -539,7 +644,12 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
     // device IO also has DisplayYesNo capability. show the passkey number to the user to
     // confirm it with the number displayed by peer device.
     logger.info("BLE GAP NC_REQ passkey: {}", received_passkey);
-    PASSKEY = received_passkey;
+    if (auto *connection = connections.find(peer_address_of(param->ble_security.ble_req.bd_addr))) {
+      connection->session.passkey = received_passkey;
+      connection->session.pairing = true;
+    } else {
+      logger.warn("NC_REQ from a peer which is not connected");
+    }
     esp_ble_confirm_reply(param->ble_security.ble_req.bd_addr, true);
   }
     break;
@@ -569,15 +679,14 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
   case ESP_GAP_BLE_SEC_REQ_EVT:
     logger.info("BLE GAP SEC_REQ");
 
-    remote_bd_addr.assign(param->ble_security.ble_req.bd_addr, param->ble_security.ble_req.bd_addr + ESP_BD_ADDR_LEN);
+    if (auto *connection = connections.find(peer_address_of(param->ble_security.ble_req.bd_addr))) {
+      connection->session.pairing = true;
+    }
 
     #if !defined(CONFIG_BT_CLASSIC_ENABLED)
     // inform gfps that there is a pairing request
     if (g_bt_interface != nullptr) {
-      // get the uint64_t peer address from the event
-      uint64_t peer_address = 0;
-      memcpy(&peer_address, param->ble_security.ble_req.bd_addr, sizeof(esp_bd_addr_t));
-      g_bt_interface->on_pairing_request(peer_address);
+      g_bt_interface->on_pairing_request(peer_address_of(param->ble_security.ble_req.bd_addr));
     }
     #endif
 
@@ -613,8 +722,277 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
   }
 }
 
+// Runs key based pairing writes through admission control, so a flood of
+// them is turned away before it costs an ECDH each. Other writes pass.
+static bool admit_write(uint16_t handle, uint64_t peer_address, const uint8_t *value,
+                        uint16_t length, esp_gatt_status_t *status) {
+#if NEARBY_PLATFORM_KBP_ADMISSION
+  if (handle != gfps_handles.value_handle(kKeyBasedPairing)) {
+    return true;
+  }
+  auto verdict = kbp_admission.admit(peer_address, value, length, gfps::Clock::now_ms());
+  if (verdict == gfps::KbpAdmission::Verdict::Admit) {
+    return true;
+  }
+  logger.warn("key based pairing write from {:#x} rejected: {}", peer_address,
+              gfps::KbpAdmission::to_string(verdict));
+  *status = verdict == gfps::KbpAdmission::Verdict::Malformed ? ESP_GATT_INVALID_ATTR_LEN
+                                                              : ESP_GATT_BUSY;
+  return false;
+#else
+  return true;
+#endif
+}
+
+// Handles a complete write (a plain one, or the reassembled value of an
+// executed prepared write) and returns the status to respond with.
+static esp_gatt_status_t handle_write(Connection *connection, uint16_t handle,
+                                      const uint8_t *value, uint16_t length) {
+  GFPS_LATENCY_START(write_start_us);
+  uint64_t peer_address = connection->address;
+  esp_gatt_status_t write_status = ESP_GATT_OK;
+  uint8_t ccc_slot = gfps_handles.ccc_slot(handle);
+  uint8_t value_slot = gfps_handles.value_slot(handle);
+
+  if (ccc_slot != GfpsLayout::kNone && length == 2){
+    logger.debug("Configuration of characteristic {}", (int)gfps_characteristics[ccc_slot].id);
+    uint16_t descr_value = value[1]<<8 | value[0];
+    if (descr_value == 0x0001) {
+      logger.info("notify enable");
+    } else if (descr_value == 0x0002) {
+      logger.info("indicate enable");
+    } else if (descr_value == 0x0000) {
+      logger.info("notify/indicate disable ");
+    } else {
+      logger.error("unknown descr value");
+    }
+  } else if (value_slot == GfpsLayout::kNone || !gfps_characteristics[value_slot].writable()) {
+    logger.error("Unknown characteristic handle: {}", handle);
+    write_status = ESP_GATT_INVALID_HANDLE;
+  } else if (!admit_write(handle, peer_address, value, length, &write_status)) {
+    // rejected before it reached the library, write_status says why
+  } else {
+    // use the g_ble_interface on_gatt_write callback to handle this
+    if (g_ble_interface != nullptr){
+      auto characteristic = (nearby_fp_Characteristic)gfps_characteristics[value_slot].id;
+      logger.debug("write to characteristic {}", (int)characteristic);
+      if (characteristic == kKeyBasedPairing && length == 80) {
+        // this has the remote's public key as the last 64 bytes, keep them with the session
+        memcpy(connection->session.remote_public_key, value + 16, 64);
+        logger.debug("got remote public key");
+      }
+      // now actually call the callback
+      logger.debug("Calling on_gatt_write with peer_address = {:#x}, characteristic = {}", peer_address, (int)characteristic);
+      GFPS_LATENCY_MARK_WRITE(characteristic, write_start_us);
+      GFPS_FLIGHT_RECORD(kFlightGattWrite, characteristic, handle, length);
+      serving = connection;
+      auto status = g_ble_interface->on_gatt_write(peer_address, characteristic, value, length);
+      serving = nullptr;
+      GFPS_LATENCY_RECORD(kLatencyGattWrite, characteristic, write_start_us);
+#if NEARBY_PLATFORM_KBP_ADMISSION
+      if (characteristic == kKeyBasedPairing) {
+        kbp_admission.report(peer_address, status == kNearbyStatusOK, gfps::Clock::now_ms());
+      }
+#endif
+      if (status != kNearbyStatusOK) {
+        logger.error("Error: on_gatt_write returned status {}", (int)status);
+      }
+    } else {
+      logger.error("g_ble_interface is null");
+    }
+  }
+  return write_status;
+}
+
+static void retry_notifications();
+
+// Hands queued notifications for `conn_id` to the stack, at most a batch
+// outstanding, until the link is congested. Takes connections_mutex, but
+// releases it around each send.
+static void drain_notifications(uint16_t conn_id) {
+  NotifyQueue::Entry entry;
+  bool sent = false;
+  std::unique_lock<std::mutex> lk(connections_mutex);
+  for (;;) {
+    auto *connection = connections.find_conn_id(conn_id);
+    if (connection == nullptr ||
+        !connection->session.notify_queue.next(entry, NEARBY_PLATFORM_NOTIFY_BATCH)) {
+      break;
+    }
+    lk.unlock();
+    bool indicate = false; // false = notification, true = indication
+    auto err = esp_ble_gatts_send_indicate(gfps_profile_tab[PROFILE_APP_IDX].gatts_if, conn_id,
+                                           entry.handle, entry.length, entry.data, indicate);
+    GFPS_FLIGHT_RECORD(kFlightGattNotify, entry.characteristic, err, entry.length);
+    lk.lock();
+    // the link may have closed meanwhile; its disconnect counted the queue
+    connection = connections.find_conn_id(conn_id);
+    if (connection == nullptr) {
+      break;
+    }
+    auto &queue = connection->session.notify_queue;
+    if (err != ESP_OK) {
+      logger.error("esp_ble_gatts_send_indicate failed: {}", err);
+      // stays queued; a confirmation still to come restarts the queue, and
+      // without one a timer retries it
+      queue.failed();
+      if (queue.in_flight() == 0 && notify_retry_timer == nullptr) {
+        notify_retry_timer =
+            nearby_platform_StartTimer(retry_notifications, NEARBY_PLATFORM_NOTIFY_RETRY_MS);
+        if (notify_retry_timer == nullptr) {
+          logger.warn("no timer to retry notifications for conn_id {}", conn_id);
+        }
+      }
+      break;
+    }
+    GFPS_LATENCY_NOTIFY(entry.characteristic);
+    queue.sent();
+    notify_stats.sent++;
+    notify_stats.depth--;
+    sent = true;
+  }
+  if (sent) {
+    notify_stats.batches++;
+  }
+}
+
+// Timer callback: drains every queue a refused send left stalled.
+static void retry_notifications() {
+  uint16_t stalled[NEARBY_PLATFORM_MAX_CONNECTIONS];
+  size_t count = 0;
+  {
+    std::lock_guard<std::mutex> lk(connections_mutex);
+    notify_retry_timer = nullptr;
+    connections.for_each([&](Connection &connection) {
+      if (connection.session.notify_queue.stalled() && count < NEARBY_PLATFORM_MAX_CONNECTIONS) {
+        stalled[count++] = connection.conn_id;
+      }
+    });
+    notify_stats.retries += count;
+  }
+  for (size_t i = 0; i < count; i++) {
+    drain_notifications(stalled[i]);
+  }
+}
+
+static PreparedWrite *find_prepared_write(uint16_t conn_id) {
+  for (auto &prepared : prepared_writes) {
+    if (prepared.used && prepared.conn_id == conn_id) {
+      return &prepared;
+    }
+  }
+  return nullptr;
+}
+
+static void release_prepared_write(PreparedWrite *prepared) {
+  memset(prepared->data, 0, prepared->length);
+  prepared->used = false;
+}
+
+// Adds one prepare write request to the connection's buffer and echoes it
+// back, as the prepare write response has to.
+static void prepare_write(esp_gatt_if_t gatts_if, const decltype(esp_ble_gatts_cb_param_t::write) *write) {
+  esp_gatt_status_t status = ESP_GATT_OK;
+  PreparedWrite *prepared = find_prepared_write(write->conn_id);
+  if (prepared == nullptr) {
+    for (size_t i = 0; i < kPrepareBuffers; i++) {
+      if (!prepared_writes[i].used) {
+        prepared = &prepared_writes[i];
+        *prepared = {true, write->conn_id, write->handle, 0, prepare_pool[i]};
+        break;
+      }
+    }
+  }
+  if (prepared == nullptr) {
+    logger.warn("no prepare buffer left for conn_id {}", write->conn_id);
+    status = ESP_GATT_PREPARE_Q_FULL;
+  } else if (prepared->handle != write->handle) {
+    // one characteristic per queue is all a seeker needs
+    logger.warn("prepared writes to handles {} and {} in one queue", prepared->handle, write->handle);
+    status = ESP_GATT_PREPARE_Q_FULL;
+  } else if (write->offset > prepared->length) {
+    status = ESP_GATT_INVALID_OFFSET;
+  } else if (write->offset + write->len > kPrepareBufferBytes) {
+    status = ESP_GATT_INVALID_ATTR_LEN;
+  } else {
+    memcpy(prepared->data + write->offset, write->value, write->len);
+    prepared->length = std::max<uint16_t>(prepared->length, write->offset + write->len);
+  }
+  if (!write->need_rsp) {
+    return;
+  }
+  if (status != ESP_GATT_OK) {
+    esp_ble_gatts_send_response(gatts_if, write->conn_id, write->trans_id, status, NULL);
+    return;
+  }
+  gatt_rsp.attr_value.handle = write->handle;
+  gatt_rsp.attr_value.offset = write->offset;
+  gatt_rsp.attr_value.len = write->len;
+  gatt_rsp.attr_value.auth_req = 0;
+  memcpy(gatt_rsp.attr_value.value, write->value, write->len);
+  esp_ble_gatts_send_response(gatts_if, write->conn_id, write->trans_id, ESP_GATT_OK, &gatt_rsp);
+}
+
+// Answers a read of a characteristic which is not served from the attribute
+// table. The first read (offset 0) asks the library for the value; reads at
+// a later offset (long reads) continue from the kept copy. Returns false if
+// the handle is not one of them.
+static bool read_characteristic(esp_gatt_if_t gatts_if, Connection *connection,
+                                const decltype(esp_ble_gatts_cb_param_t::read) *read,
+                                nearby_fp_Characteristic *characteristic_out) {
+  uint64_t peer_address = connection->address;
+  esp_gatt_status_t status = ESP_GATT_OK;
+  uint8_t slot = gfps_handles.value_slot(read->handle);
+  uint8_t buffer = slot == GfpsLayout::kNone ? GfpsLayout::kNone : GfpsLayout::read_buffer[slot];
+  if (buffer == GfpsLayout::kNone) {
+    logger.error("Unknown characteristic handle: {}", read->handle);
+    esp_ble_gatts_send_response(gatts_if, read->conn_id, read->trans_id, ESP_GATT_INVALID_HANDLE,
+                                NULL);
+    return false;
+  }
+  auto characteristic = (nearby_fp_Characteristic)gfps_characteristics[slot].id;
+  ReadValue *value = &connection->session.read_values[buffer];
+  *characteristic_out = characteristic;
+  if (read->offset == 0) {
+    size_t length = sizeof(value->data);
+    value->length = 0;
+    if (g_ble_interface == nullptr) {
+      logger.error("g_ble_interface is null");
+      status = ESP_GATT_INTERNAL_ERROR;
+    } else {
+      logger.debug("Calling on_gatt_read with peer_address = {:#x}, characteristic = {}",
+                   peer_address, (int)characteristic);
+      auto result = g_ble_interface->on_gatt_read(peer_address, characteristic, value->data, &length);
+      if (result == kNearbyStatusOK) {
+        value->length = length;
+      } else {
+        logger.error("on_gatt_read returned status {}", (int)result);
+        status = ESP_GATT_READ_NOT_PERMIT;
+      }
+    }
+  } else if (read->offset > value->length) {
+    status = ESP_GATT_INVALID_OFFSET;
+  }
+  if (status != ESP_GATT_OK) {
+    esp_ble_gatts_send_response(gatts_if, read->conn_id, read->trans_id, status, NULL);
+    return true;
+  }
+  // a read response carries at most MTU - 1 bytes, the seeker asks for the
+  // rest with read blob requests
+  uint16_t length = std::min<uint16_t>(value->length - read->offset, connection->session.mtu - 1);
+  gatt_rsp.attr_value.handle = read->handle;
+  gatt_rsp.attr_value.offset = read->offset;
+  gatt_rsp.attr_value.len = length;
+  gatt_rsp.attr_value.auth_req = 0;
+  memcpy(gatt_rsp.attr_value.value, value->data + read->offset, length);
+  esp_ble_gatts_send_response(gatts_if, read->conn_id, read->trans_id, ESP_GATT_OK, &gatt_rsp);
+  return true;
+}
+
 static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
 {
+  GFPS_LATENCY_START(event_start_us);
+  GFPS_FLIGHT_RECORD(kFlightGattsEvent, event, gatts_if, 0);
   uint64_t peer_address = 0;
   logger.debug("gatts_profile_event_handler: event = {}, gatts_if = {}",
                ble_gatts_evt_str(event),
@@ -622,131 +1000,88 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
   switch (event) {
   case ESP_GATTS_REG_EVT:
     logger.info("ESP_GATTS_REG_EVT");
-    esp_ble_gap_set_device_name(CONFIG_DEVICE_NAME);
+    {
+      // advertise the personalized name if one was set
+      char name[NEARBY_PLATFORM_PERSONALIZED_NAME_MAX + 1];
+      size_t length = sizeof(name);
+      if (nearby_platform_LoadDeviceName(name, &length) == kNearbyStatusOK) {
+        esp_ble_gap_set_device_name(name);
+      } else {
+        esp_ble_gap_set_device_name(CONFIG_DEVICE_NAME);
+      }
+    }
 
     // TODO: should we do this?
     // generate a resolvable random address
     // esp_ble_gap_config_local_privacy(true);
 
-    esp_ble_gatts_create_attr_tab(gatt_db, gatts_if, GFPS_IDX_NB, SVC_INST_ID);
+    esp_ble_gatts_create_attr_tab(gatt_db.data(), gatts_if, gatt_db.size(), SVC_INST_ID);
     break;
   case ESP_GATTS_READ_EVT:
-    for (int i = 0; i < 6; i++) {
-      peer_address += ((uint64_t)param->read.bda[i]) << (i * 8);
+    peer_address = peer_address_of(param->read.bda);
+    logger.debug("ESP_GATTS_READ_EVT, peer_address: {:#x}, handle: {}, offset: {}",
+                 peer_address, param->read.handle, param->read.offset);
+    if (!param->read.need_rsp) {
+      // a static value, already answered from the attribute table
+      break;
     }
-    logger.debug("ESP_GATTS_READ_EVT, peer_address: {:#x}", peer_address);
-    // use the g_ble_interface on_gatt_read callback to handle this
-    if (g_ble_interface != nullptr){
-      // get the characteristic handle
-      nearby_fp_Characteristic characteristic;
-      if (param->read.handle ==gfps_handle_table[IDX_CHAR_VAL_MODEL_ID]) {
-        logger.debug("read model id");
-        characteristic = kModelId;
-      } else if (param->read.handle ==gfps_handle_table[IDX_CHAR_VAL_KB_PAIRING]) {
-        logger.debug("read kb pairing");
-        characteristic = kKeyBasedPairing;
-      } else if (param->read.handle ==gfps_handle_table[IDX_CHAR_VAL_PASSKEY]) {
-        logger.debug("read passkey");
-        characteristic = kPasskey;
-      } else if (param->read.handle ==gfps_handle_table[IDX_CHAR_VAL_ACCOUNT_KEY]) {
-        logger.debug("read account key");
-        characteristic = kAccountKey;
-      } else if (param->read.handle ==gfps_handle_table[IDX_CHAR_VAL_FW_REVISION]) {
-        logger.debug("read firmware revision");
-        characteristic = kFirmwareRevision;
-      } else {
-        logger.error("Unknown characteristic handle: {}", param->read.handle);
+    {
+      Connection *connection = connections.find_conn_id(param->read.conn_id);
+      if (connection == nullptr) {
+        logger.error("read on unknown conn_id {}", param->read.conn_id);
+        esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id,
+                                    ESP_GATT_INTERNAL_ERROR, NULL);
         break;
       }
-      // make some memory for the output
-      size_t output_size = 32;
-      uint8_t *output = (uint8_t *)malloc(sizeof(uint8_t) * output_size);
-      // now actually call the callback
-      logger.debug("Calling on_gatt_read with peer_address = {:#x}, characteristic = {}", peer_address, (int)characteristic);
-      auto status = g_ble_interface->on_gatt_read(peer_address, characteristic, output, &output_size);
-      // if the status was good, send the response
-      if (status == kNearbyStatusOK) {
-        // write the response to the characteristic
-        esp_ble_gatts_set_attr_value(param->read.handle, output_size, output);
-      } else {
-        logger.error("on_gatt_read returned status {}", (int)status);
+      nearby_fp_Characteristic characteristic;
+      if (read_characteristic(gatts_if, connection, &param->read, &characteristic)) {
+        GFPS_LATENCY_RECORD(kLatencyGattRead, characteristic, event_start_us);
       }
-      // free the memory
-      free(output);
     }
     break;
-  case ESP_GATTS_WRITE_EVT:
-    for (int i = 0; i < 6; i++) {
-      peer_address += ((uint64_t)param->write.bda[i]) << (i * 8);
-    }
+  case ESP_GATTS_WRITE_EVT: {
+    peer_address = peer_address_of(param->write.bda);
     logger.debug("ESP_GATTS_WRITE_EVT, peer_address: {:#x}", peer_address);
     logger.debug("                     handle: {}, value len: {}", param->write.handle, param->write.len);
-    if (!param->write.is_prep){
-      bool is_cfg_handle =
-        gfps_handle_table[IDX_CHAR_CFG_KB_PAIRING] == param->write.handle ||
-        gfps_handle_table[IDX_CHAR_CFG_PASSKEY] == param->write.handle;
-
-      if (is_cfg_handle && param->write.len == 2){
-        logger.debug("Configuration of {}",
-                     param->write.handle == gfps_handle_table[IDX_CHAR_CFG_KB_PAIRING]
-                     ? "IDX_CHAR_CFG_KB_PAIRING"
-                     : "IDX_CHAR_CFG_PASSKEY");
-        uint16_t descr_value = param->write.value[1]<<8 | param->write.value[0];
-        if (descr_value == 0x0001) {
-          logger.info("notify enable");
-        } else if (descr_value == 0x0002) {
-          logger.info("indicate enable");
-        } else if (descr_value == 0x0000) {
-          logger.info("notify/indicate disable ");
-        } else {
-          logger.error("unknown descr value");
-        }
-      } else {
-        // use the g_ble_interface on_gatt_write callback to handle this
-        if (g_ble_interface != nullptr){
-          // get the characteristic handle
-          nearby_fp_Characteristic characteristic;
-          if (param->write.handle == gfps_handle_table[IDX_CHAR_VAL_KB_PAIRING]) {
-            logger.debug("write to IDX_CHAR_VAL_KB_PAIRING");
-            if (param->write.len == 80) {
-              // this has the remote's public key as the last 64 bytes, copy them to REMOTE_PUBLIC_KEY
-              memcpy(REMOTE_PUBLIC_KEY, param->write.value + 16, 64);
-              logger.debug("got remote public key");
-            }
-            characteristic = kKeyBasedPairing;
-          } else if (param->write.handle == gfps_handle_table[IDX_CHAR_VAL_PASSKEY]) {
-            logger.debug("write to IDX_CHAR_VAL_PASSKEY");
-            characteristic = kPasskey;
-          } else if (param->write.handle == gfps_handle_table[IDX_CHAR_VAL_ACCOUNT_KEY]) {
-            logger.debug("write to IDX_CHAR_VAL_ACCOUNT_KEY");
-            characteristic = kAccountKey;
-          } else {
-            logger.error("Unknown characteristic handle: {}", param->write.handle);
-            break;
-          }
-          // now actually call the callback
-          logger.debug("Calling on_gatt_write with peer_address = {:#x}, characteristic = {}", peer_address, (int)characteristic);
-          auto status = g_ble_interface->on_gatt_write(peer_address, characteristic, param->write.value, param->write.len);
-          if (status != kNearbyStatusOK) {
-            logger.error("Error: on_gatt_write returned status {}", (int)status);
-          }
-        } else {
-          logger.error("g_ble_interface is null");
-        }
+    Connection *connection = connections.find_conn_id(param->write.conn_id);
+    if (connection == nullptr) {
+      logger.error("write on unknown conn_id {}", param->write.conn_id);
+      if (param->write.need_rsp) {
+        esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id,
+                                    ESP_GATT_INTERNAL_ERROR, NULL);
       }
+      break;
+    }
+    if (!param->write.is_prep){
+      esp_gatt_status_t write_status =
+        handle_write(connection, param->write.handle, param->write.value, param->write.len);
       /* send response when param->write.need_rsp is true*/
       if (param->write.need_rsp){
         logger.info("send response");
-        esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_OK, NULL);
+        esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, write_status, NULL);
       }
     }else{
       /* handle prepare write */
-      logger.warn("ESP_GATTS_PREP_WRITE_EVT not implemented");
+      prepare_write(gatts_if, &param->write);
     }
+  }
     break;
-  case ESP_GATTS_EXEC_WRITE_EVT:
-    // the length of gattc prepare write data must be less than GATTS_DEMO_CHAR_VAL_LEN_MAX.
-    logger.warn("ESP_GATTS_EXEC_WRITE_EVT not implemented");
+  case ESP_GATTS_EXEC_WRITE_EVT: {
+    peer_address = peer_address_of(param->exec_write.bda);
+    logger.debug("ESP_GATTS_EXEC_WRITE_EVT, peer_address: {:#x}, flag: {}", peer_address,
+                 (int)param->exec_write.exec_write_flag);
+    esp_gatt_status_t write_status = ESP_GATT_OK;
+    PreparedWrite *prepared = find_prepared_write(param->exec_write.conn_id);
+    Connection *connection = connections.find_conn_id(param->exec_write.conn_id);
+    if (prepared != nullptr) {
+      if (param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC && connection != nullptr) {
+        write_status = handle_write(connection, prepared->handle, prepared->data, prepared->length);
+      }
+      release_prepared_write(prepared);
+    }
+    esp_ble_gatts_send_response(gatts_if, param->exec_write.conn_id, param->exec_write.trans_id,
+                                write_status, NULL);
+  }
     break;
   case ESP_GATTS_SET_ATTR_VAL_EVT:
     logger.info("ESP_GATTS_SET_ATTR_VAL_EVT, attr_handle {}, srvc_handle {}, status {}",
@@ -756,18 +1091,81 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
     break;
   case ESP_GATTS_MTU_EVT:
     logger.info("ESP_GATTS_MTU_EVT, MTU {}", (int)param->mtu.mtu);
+    if (auto *connection = connections.find_conn_id(param->mtu.conn_id)) {
+      connection->session.mtu = param->mtu.mtu;
+    }
     break;
-  case ESP_GATTS_CONF_EVT:
+  case ESP_GATTS_CONF_EVT: {
     logger.info("ESP_GATTS_CONF_EVT, status = {}, attr_handle {}", (int)param->conf.status, (int)param->conf.handle);
-
+    // a notification left, or the stack gave up on it: make room for the
+    // next one either way
+    bool open = false;
+    {
+      std::lock_guard<std::mutex> lk(connections_mutex);
+      if (auto *connection = connections.find_conn_id(param->conf.conn_id)) {
+        connection->session.notify_queue.confirmed();
+        open = true;
+      }
+      if (param->conf.status != ESP_GATT_OK) {
+        // the copy went to the stack, so there's nothing left to send again
+        notify_stats.dropped++;
+        logger.error("notification to conn_id {} failed, status {}", (int)param->conf.conn_id,
+                     (int)param->conf.status);
+      }
+    }
+    if (open) {
+      drain_notifications(param->conf.conn_id);
+    }
+  }
+    break;
+  case ESP_GATTS_CONGEST_EVT: {
+    logger.debug("ESP_GATTS_CONGEST_EVT, conn_id = {}, congested = {}", (int)param->congest.conn_id,
+                 param->congest.congested);
+    bool resume = false;
+    {
+      std::lock_guard<std::mutex> lk(connections_mutex);
+      if (auto *connection = connections.find_conn_id(param->congest.conn_id)) {
+        connection->session.notify_queue.set_congested(param->congest.congested);
+        if (param->congest.congested) {
+          notify_stats.congestions++;
+        } else {
+          resume = true;
+        }
+      }
+    }
+    if (resume) {
+      drain_notifications(param->congest.conn_id);
+    }
+  }
     break;
   case ESP_GATTS_START_EVT:
     logger.info("SERVICE_START_EVT, status {}, service_handle {}", (int)param->start.status, (int)param->start.service_handle);
     break;
   case ESP_GATTS_CONNECT_EVT: {
-    logger.info("ESP_GATTS_CONNECT_EVT, conn_id = {}", (int)param->connect.conn_id);
-    // update the connection id to each profile table
-    gfps_profile_tab[PROFILE_APP_IDX].conn_id = param->connect.conn_id;
+    peer_address = peer_address_of(param->connect.remote_bda);
+    logger.info("ESP_GATTS_CONNECT_EVT, conn_id = {}, peer_address: {:#x}",
+                (int)param->connect.conn_id, peer_address);
+    Connection *connection;
+    {
+      std::lock_guard<std::mutex> lk(connections_mutex);
+      connection = connections.open(param->connect.conn_id, peer_address);
+      if (connection != nullptr) {
+        connection->session.mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+        connection->session.passkey = PASSKEY;
+      }
+    }
+    if (connection == nullptr) {
+      logger.error("no room for conn_id {}, {} of {} connections open", (int)param->connect.conn_id,
+                   connections.size(), connections.capacity());
+      esp_ble_gap_disconnect(param->connect.remote_bda);
+      break;
+    }
+    // advertising stops with each connection; keep it going while another
+    // seeker can still connect
+    advertising = false;
+    if (!connections.full()) {
+      esp_ble_gap_start_advertising(&adv_params);
+    }
     esp_ble_conn_update_params_t conn_params = {0};
     memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
     /* For the iOS system, please refer to Apple official documents about the BLE connection parameters restrictions. */
@@ -784,21 +1182,44 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
   }
     break;
   case ESP_GATTS_DISCONNECT_EVT:
-    logger.info("ESP_GATTS_DISCONNECT_EVT, reason = {:#x}", (int)param->disconnect.reason);
-    esp_ble_gap_start_advertising(&adv_params);
+    logger.info("ESP_GATTS_DISCONNECT_EVT, conn_id = {}, reason = {:#x}",
+                (int)param->disconnect.conn_id, (int)param->disconnect.reason);
+    if (auto *prepared = find_prepared_write(param->disconnect.conn_id)) {
+      release_prepared_write(prepared);
+    }
+    {
+      // wipes the session, public key and read values included
+      std::lock_guard<std::mutex> lk(connections_mutex);
+      if (auto *connection = connections.find_conn_id(param->disconnect.conn_id)) {
+        size_t pending = connection->session.notify_queue.size();
+        notify_stats.dropped += pending;
+        notify_stats.depth -= pending;
+      }
+      connections.close(param->disconnect.conn_id);
+    }
+    GFPS_LATENCY_DUMP();
+    nearby_platform_MbedtlsArenaReset();
+    // the connect restarted advertising unless the table was full; starting
+    // it twice fails, and the failure would clear `advertising` while the
+    // controller is still advertising
+    if (!advertising) {
+      esp_ble_gap_start_advertising(&adv_params);
+    }
     break;
   case ESP_GATTS_CREAT_ATTR_TAB_EVT:{
     if (param->add_attr_tab.status != ESP_GATT_OK){
       logger.error("create attribute table failed, error code={:#x}", (int)param->add_attr_tab.status);
     }
-    else if (param->add_attr_tab.num_handle != GFPS_IDX_NB){
+    else if (param->add_attr_tab.num_handle != GfpsLayout::kNumAttributes){
       logger.error("create attribute table abnormally, num_handle ({}) \
-                        doesn't equal to GFPS_IDX_NB({})", (int)param->add_attr_tab.num_handle, (int)GFPS_IDX_NB);
+                        doesn't equal to the {} attributes", (int)param->add_attr_tab.num_handle, GfpsLayout::kNumAttributes);
+    }
+    else if (!gfps_handles.assign(param->add_attr_tab.handles, param->add_attr_tab.num_handle)){
+      logger.error("create attribute table abnormally, handles are not consecutive");
     }
     else {
       logger.info("create attribute table successfully, the number handle = {}", (int)param->add_attr_tab.num_handle);
-      memcpy(gfps_handle_table, param->add_attr_tab.handles, sizeof(gfps_handle_table));
-      esp_ble_gatts_start_service(gfps_handle_table[IDX_SVC]);
+      esp_ble_gatts_start_service(gfps_handles.handle(0));
     }
     break;
   }
@@ -807,7 +1228,6 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
   case ESP_GATTS_CANCEL_OPEN_EVT:
   case ESP_GATTS_CLOSE_EVT:
   case ESP_GATTS_LISTEN_EVT:
-  case ESP_GATTS_CONGEST_EVT:
   case ESP_GATTS_UNREG_EVT:
   case ESP_GATTS_DELETE_EVT:
   default:
@@ -896,7 +1316,8 @@ int32_t nearby_platform_GetMessageStreamPsm() {
   return -1;
 }
 
-// Sends a notification to the connected GATT client.
+// Queues a notification for a connected GATT client and sends it as soon as
+// the link takes it.
 //
 // peer_address   - Address of peer.
 // characteristic - Characteristic UUID
@@ -907,53 +1328,39 @@ nearby_platform_status nearby_platform_GattNotify(
     const uint8_t* message, size_t length) {
   logger.debug("GattNotify: peer_address={:#x}, characteristic={}, length={}",
                peer_address, (int)characteristic, length);
-  // look up the attribute handle for the characteristic from the gfp_handle_table
-  uint16_t attr_handle = 0;
-  switch (characteristic) {
-    case kModelId:
-      logger.debug("Notifying characteristic: kModelId");
-      attr_handle = gfps_handle_table[IDX_CHAR_VAL_MODEL_ID];
-      break;
-    case kKeyBasedPairing:
-      logger.debug("Notifying characteristic: kKeyBasedPairing");
-      attr_handle = gfps_handle_table[IDX_CHAR_VAL_KB_PAIRING];
-      break;
-    case kPasskey:
-      logger.debug("Notifying characteristic: kPasskey");
-      attr_handle = gfps_handle_table[IDX_CHAR_VAL_PASSKEY];
-      break;
-    case kAccountKey:
-      logger.debug("Notifying characteristic: kAccountKey");
-      attr_handle = gfps_handle_table[IDX_CHAR_VAL_ACCOUNT_KEY];
-      break;
-    case kFirmwareRevision:
-      logger.debug("Notifying characteristic: kFirmwareRevision");
-      attr_handle = gfps_handle_table[IDX_CHAR_VAL_FW_REVISION];
-      break;
-      // TODO: add support for kAdditionalData
-      // TODO: add support for kMessageStreamPsm
-    default:
-      logger.error("[{}] Unknown/unsupported characteristic: {}", __func__, (int)characteristic);
-      return kNearbyStatusError;
-  }
-  // now actually send the notification
-  uint16_t gatts_if = gfps_profile_tab[PROFILE_APP_IDX].gatts_if;
-  uint16_t conn_id = gfps_profile_tab[PROFILE_APP_IDX].conn_id;
-  logger.debug("Sending notification: gatts_if={}, conn_id={}, attr_handle={}, length={}",
-               gatts_if, conn_id, attr_handle, length);
-
-  // send the notification
-  bool indicate = false; // false = notification, true = indication
-  auto err = esp_ble_gatts_send_indicate(gatts_if,
-                                         conn_id,
-                                         attr_handle,
-                                         length,
-                                         (uint8_t*)message,
-                                         indicate);
-  if (err != ESP_OK) {
-    logger.error("esp_ble_gatts_send_indicate failed: {}", err);
+  // look up the attribute handle for the characteristic
+  uint8_t slot = GfpsLayout::slot(characteristic);
+  if (slot == GfpsLayout::kNone || !gfps_characteristics[slot].notifies()) {
+    logger.error("[{}] Unknown/unsupported characteristic: {}", __func__, (int)characteristic);
     return kNearbyStatusError;
   }
+  uint16_t attr_handle = gfps_handles.value_handle(characteristic);
+  uint16_t conn_id;
+  {
+    std::lock_guard<std::mutex> lk(connections_mutex);
+    Connection *connection = connections.find(peer_address);
+    if (connection == nullptr) {
+      logger.error("[{}] {:#x} is not connected", __func__, peer_address);
+      return kNearbyStatusError;
+    }
+    conn_id = connection->conn_id;
+    auto &queue = connection->session.notify_queue;
+    // queue the notification, then send what the link takes now; the rest
+    // goes out as confirmations come back or the congestion clears
+    if (!queue.push(attr_handle, characteristic, message, length)) {
+      notify_stats.dropped++;
+      logger.error("[{}] notification queue for conn_id {} is full ({} waiting, {} bytes)",
+                   __func__, conn_id, queue.size(), length);
+      return kNearbyStatusError;
+    }
+    notify_stats.queued++;
+    notify_stats.depth++;
+    notify_stats.max_depth = std::max<uint32_t>(notify_stats.max_depth, queue.size());
+    logger.debug("Queued notification: conn_id={}, attr_handle={}, length={}, {} waiting{}",
+                 conn_id, attr_handle, length, queue.size(),
+                 queue.congested() ? ", congested" : "");
+  }
+  drain_notifications(conn_id);
   return kNearbyStatusOK;
 }
 
@@ -966,6 +1373,19 @@ nearby_platform_status nearby_platform_GattNotify(
 nearby_platform_status nearby_platform_SetAdvertisement(
     const uint8_t* payload, size_t length,
     nearby_fp_AvertisementInterval interval) {
+  // The library rebuilds the payload (including the SHA-256 based account key
+  // filter) on every refresh, even when nothing changed. Reconfiguring the
+  // controller with the same bytes would only restart advertising, so skip it
+  // while advertising with the previous configuration is known to be running;
+  // if it stopped (a connection, or a failed start), go the long way round,
+  // which starts it again.
+  if (interval == raw_adv_interval && adv_config_done == 0 && advertising &&
+      raw_adv_data.size() == length &&
+      std::equal(payload, payload + length, raw_adv_data.begin())) {
+    std::lock_guard<std::mutex> lk(adv_mutex);
+    adv_stats.hits++;
+    return kNearbyStatusOK;
+  }
   logger.info("Setting advertisement, interval code: {}", (int)interval);
   // set the advertisement data
   raw_adv_data.assign(payload, payload + length);
@@ -991,15 +1411,48 @@ nearby_platform_status nearby_platform_SetAdvertisement(
   adv_params.adv_int_min = new_interval;
   adv_params.adv_int_max = new_interval;
 
+  {
+    std::lock_guard<std::mutex> lk(adv_mutex);
+    adv_stats.misses++;
+    adv_config_start_us = esp_timer_get_time();
+  }
+
+  // flagged first: the completion events can arrive before the calls return
+  adv_config_done |= ADV_CONFIG_FLAG;
+  adv_config_done |= SCAN_RSP_CONFIG_FLAG;
   esp_ble_gap_config_adv_data_raw(raw_adv_data.data(), raw_adv_data.size());
   // esp_ble_gap_config_adv_data(&adv_config); // NOTE: for some reason this isn't working...
   esp_ble_gap_config_adv_data(&scan_rsp_config);
-  adv_config_done |= ADV_CONFIG_FLAG;
-  adv_config_done |= SCAN_RSP_CONFIG_FLAG;
-
+  raw_adv_interval = interval;
   return kNearbyStatusOK;
 }
 
+nearby_platform_AdvertisementStats nearby_platform_GetAdvertisementStats() {
+  std::lock_guard<std::mutex> lk(adv_mutex);
+  nearby_platform_AdvertisementStats stats = adv_stats;
+  stats.saved_us =
+      adv_configs_completed ? stats.hits * stats.miss_us / adv_configs_completed : 0;
+  return stats;
+}
+
+nearby_platform_KbpAdmissionStats nearby_platform_GetKbpAdmissionStats() {
+#if NEARBY_PLATFORM_KBP_ADMISSION
+  return kbp_admission.stats();
+#else
+  return {};
+#endif
+}
+
+nearby_platform_NotifyStats nearby_platform_GetNotifyStats() {
+  std::lock_guard<std::mutex> lk(connections_mutex);
+  return notify_stats;
+}
+
+nearby_platform_ConnectionStats nearby_platform_GetConnectionStats() {
+  std::lock_guard<std::mutex> lk(connections_mutex);
+  return connections.stats();
+}
+
 // Initializes BLE
 //
 // ble_interface - GATT read and write callbacks structure.
@@ -1040,7 +1493,11 @@ nearby_platform_status nearby_platform_BleInit(
   esp_ble_gap_register_callback(gap_event_handler);
   esp_ble_gatts_app_register(ESP_APP_ID);
 
-  // esp_ble_gatt_set_local_mtu(500);
+  // offer the largest MTU, the seeker's MTU request settles on the smaller
+  // of the two
+  if (esp_ble_gatt_set_local_mtu(NEARBY_PLATFORM_GATT_MTU) != ESP_OK) {
+    logger.error("could not set the local MTU to {}", NEARBY_PLATFORM_GATT_MTU);
+  }
 
   return kNearbyStatusOK;
 }
@@ -1086,8 +1543,10 @@ uint64_t nearby_platform_GetSecondaryPublicAddress() {
 
 // Returns passkey used during pairing
 uint32_t nearby_platfrom_GetPairingPassKey() {
-  logger.info("GetPairingPassKey: {}", PASSKEY);
-  return PASSKEY;
+  Connection *connection = pairing_connection();
+  uint32_t passkey = connection != nullptr ? connection->session.passkey : PASSKEY;
+  logger.info("GetPairingPassKey: {}", passkey);
+  return passkey;
 }
 
 // Provides the passkey received from the remote party.
@@ -1097,13 +1556,20 @@ uint32_t nearby_platfrom_GetPairingPassKey() {
 // passkey - Passkey
 void nearby_platform_SetRemotePasskey(uint32_t passkey) {
   logger.info("SetRemotePasskey: {}", passkey);
-  bool accept = passkey == PASSKEY;
+  Connection *connection = pairing_connection();
+  if (connection == nullptr) {
+    logger.error("No seeker is pairing");
+    return;
+  }
+  bool accept = passkey == connection->session.passkey;
   if (accept) {
-    logger.info("Accepting pairing request, passkey matches");
+    logger.info("Accepting pairing request from {:#x}, passkey matches", connection->address);
   } else {
-    logger.error("Declining pairing request, passkey does not match");
+    logger.error("Declining pairing request from {:#x}, passkey does not match", connection->address);
   }
-  esp_ble_confirm_reply(remote_bd_addr.data(), accept);
+  esp_bd_addr_t bda;
+  bda_of(connection->address, bda);
+  esp_ble_confirm_reply(bda, accept);
 }
 
 // Sends a pairing request to the Seeker
@@ -1137,7 +1603,7 @@ nearby_platform_status nearby_platform_SetFastPairCapabilities() {
 // name - Zero terminated string name of device.
 nearby_platform_status nearby_platform_SetDeviceName(const char* name) {
   esp_bt_dev_set_device_name(name);
-  return kNearbyStatusOK;
+  return nearby_platform_StoreDeviceName(name);
 }
 
 // Gets null-terminated device name string in UTF-8 encoding
@@ -1148,9 +1614,7 @@ nearby_platform_status nearby_platform_SetDeviceName(const char* name) {
 //          On output, returns size of name in buffer.
 nearby_platform_status nearby_platform_GetDeviceName(char* name,
                                                      size_t* length) {
-  logger.warn("GetDeviceName not implemented");
-  // TODO: implement
-  return kNearbyStatusOK;
+  return nearby_platform_LoadDeviceName(name, length);
 }
 
 // Returns true if the device is in pairing mode (either fast-pair or manual).
@@ -151,7 +151,7 @@ nearby_platform_status nearby_platform_SetFastPairCapabilities() {
 // name - Zero terminated string name of device.
 nearby_platform_status nearby_platform_SetDeviceName(const char* name) {
   esp_bt_dev_set_device_name(name);
-  return kNearbyStatusOK;
+  return nearby_platform_StoreDeviceName(name);
 }
 
 // Gets null-terminated device name string in UTF-8 encoding
@@ -162,9 +162,7 @@ nearby_platform_status nearby_platform_SetDeviceName(const char* name) {
 //          On output, returns size of name in buffer.
 nearby_platform_status nearby_platform_GetDeviceName(char* name,
                                                      size_t* length) {
-  logger.warn("GetDeviceName not implemented");
-  // TODO: implement
-  return kNearbyStatusOK;
+  return nearby_platform_LoadDeviceName(name, length);
 }
 
 // Returns true if the device is in pairing mode (either fast-pair or manual).
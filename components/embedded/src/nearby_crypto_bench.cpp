@@ -0,0 +1,125 @@
+#include "embedded.hpp"
+
+#if NEARBY_PLATFORM_CRYPTO_BENCHMARK
+
+#include <aes/esp_aes.h>
+#include <esp_cpu.h>
+#include <mbedtls/aes.h>
+#include <mbedtls/sha256.h>
+
+static espp::Logger logger({.tag = "GFPS BENCH", .level = espp::Logger::Verbosity::DEBUG});
+
+static constexpr int kAesIterations = 1000;
+static constexpr int kShaIterations = 50;
+static constexpr size_t kShaBytes = 1024;
+
+// Runs `f` `iterations` times and returns the mean CPU cycles per run.
+template <typename F> static uint32_t measure_cycles(int iterations, F &&f) {
+  // warm up caches and lazily initialized peripherals
+  f();
+  uint32_t start = esp_cpu_get_cycle_count();
+  for (int i = 0; i < iterations; i++) {
+    f();
+  }
+  return (esp_cpu_get_cycle_count() - start) / iterations;
+}
+
+static void report(const char *test, const char *implementation, uint32_t cycles) {
+  logger.info("{:<8} {:<9} {:>7} cycles {:>7.2f} us", test, implementation, cycles,
+              (float)cycles / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+}
+
+// Every AES run sets the key and encrypts one block, as the platform API does.
+static void benchmark_aes() {
+  uint8_t key[16], block[16];
+  esp_fill_random(key, sizeof(key));
+  esp_fill_random(block, sizeof(block));
+
+  report("aes-ecb", "platform", measure_cycles(kAesIterations, [&] {
+    nearby_platform_Aes128Encrypt(block, block, key);
+  }));
+  report("aes-ecb", "software", measure_cycles(kAesIterations, [&] {
+    gfps::Aes128(key).encrypt(block, block);
+  }));
+  report("aes-ecb", "esp_aes", measure_cycles(kAesIterations, [&] {
+    esp_aes_context context;
+    esp_aes_init(&context);
+    esp_aes_setkey(&context, key, 128);
+    esp_aes_crypt_ecb(&context, ESP_AES_ENCRYPT, block, block);
+    esp_aes_free(&context);
+  }));
+  report("aes-ecb", "mbedtls", measure_cycles(kAesIterations, [&] {
+    mbedtls_aes_context context;
+    mbedtls_aes_init(&context);
+    mbedtls_aes_setkey_enc(&context, key, 128);
+    mbedtls_aes_crypt_ecb(&context, MBEDTLS_AES_ENCRYPT, block, block);
+    mbedtls_aes_free(&context);
+  }));
+}
+
+// Trial decryption of one block under 1 .. 64 account keys: re-expanding
+// every key, through the platform call per key (as the library does), and
+// batched with the keys cached. Reported per key.
+static void benchmark_aes_multi() {
+  static constexpr size_t kMaxKeys = 64;
+  static uint8_t keys[kMaxKeys][16];
+  static uint8_t outputs[kMaxKeys][16];
+  uint8_t block[16];
+  esp_fill_random(keys, sizeof(keys));
+  esp_fill_random(block, sizeof(block));
+
+  for (size_t num_keys = 1; num_keys <= kMaxKeys; num_keys *= 2) {
+    char test[16];
+    snprintf(test, sizeof(test), "aes-x%u", (unsigned)num_keys);
+    int iterations = std::max<int>(1, kAesIterations / (int)num_keys);
+    report(test, "software", measure_cycles(iterations, [&] {
+      for (size_t i = 0; i < num_keys; i++) {
+        gfps::Aes128(keys[i]).decrypt(block, outputs[i]);
+      }
+    }) / num_keys);
+    report(test, "platform", measure_cycles(iterations, [&] {
+      for (size_t i = 0; i < num_keys; i++) {
+        nearby_platform_Aes128Decrypt(block, outputs[i], keys[i]);
+      }
+    }) / num_keys);
+    // more keys than the cache holds measure the expansion cost as well
+    nearby_platform_Aes128CacheKeys(keys, num_keys);
+    report(test, "batched", measure_cycles(iterations, [&] {
+      nearby_platform_Aes128DecryptMulti(block, keys, num_keys, outputs);
+    }) / num_keys);
+  }
+  nearby_platform_Aes128ClearKeyCache();
+}
+
+static void benchmark_sha() {
+  static uint8_t data[kShaBytes];
+  uint8_t digest[32];
+  esp_fill_random(data, sizeof(data));
+
+  report("sha256/KB", "platform", measure_cycles(kShaIterations, [&] {
+    nearby_platform_Sha256Start();
+    nearby_platform_Sha256Update(data, sizeof(data));
+    nearby_platform_Sha256Finish(digest);
+  }));
+  report("sha256/KB", "software", measure_cycles(kShaIterations, [&] {
+    gfps::Sha256 sha;
+    sha.update(data, sizeof(data));
+    sha.finish(digest);
+  }));
+  report("sha256/KB", "mbedtls", measure_cycles(kShaIterations, [&] {
+    mbedtls_sha256(data, sizeof(data), digest, 0);
+  }));
+}
+
+void nearby_platform_RunCryptoBenchmark() {
+  logger.info("crypto benchmark, {} MHz", CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+  benchmark_aes();
+  benchmark_aes_multi();
+  benchmark_sha();
+}
+
+#else
+
+void nearby_platform_RunCryptoBenchmark() {}
+
+#endif // NEARBY_PLATFORM_CRYPTO_BENCHMARK
@@ -0,0 +1,78 @@
+#include "embedded.hpp"
+
+static espp::Logger logger({.tag = "GFPS NAME", .level = espp::Logger::Verbosity::DEBUG});
+
+// The personalized name, read from the "Name" persistence key on first use
+// and kept here afterwards, so GetDeviceName never touches flash.
+static char s_name[NEARBY_PLATFORM_PERSONALIZED_NAME_MAX + 1];
+static size_t s_name_length = 0;
+static bool s_name_loaded = false;
+static nearby_platform_DeviceNameStats s_stats;
+static std::mutex s_mutex;
+
+// Without a stored name the default is used, and the key is asked for again
+// next time (persistence may not be up yet); its cache remembers that the
+// key is absent, so that doesn't read flash either.
+static void load_name() {
+  if (s_name_loaded) {
+    return;
+  }
+#if NEARBY_FP_ENABLE_ADDITIONAL_DATA
+  size_t length = NEARBY_PLATFORM_PERSONALIZED_NAME_MAX;
+  if (nearby_platform_LoadValue(kStoredKeyPersonalizedName, (uint8_t *)s_name, &length) ==
+          kNearbyStatusOK &&
+      length > 0) {
+    s_name_length = length;
+    s_name[s_name_length] = 0;
+    s_name_loaded = true;
+    s_stats.name_loads++;
+    return;
+  }
+#endif
+  s_name_length = std::min(strlen(CONFIG_DEVICE_NAME), sizeof(s_name) - 1);
+  memcpy(s_name, CONFIG_DEVICE_NAME, s_name_length);
+  s_name[s_name_length] = 0;
+}
+
+nearby_platform_status nearby_platform_LoadDeviceName(char *name, size_t *length) {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  load_name();
+  s_stats.name_reads++;
+  if (*length <= s_name_length) {
+    logger.error("name buffer too small: {} bytes for a {} byte name", *length, s_name_length);
+    return kNearbyStatusError;
+  }
+  memcpy(name, s_name, s_name_length + 1);
+  *length = s_name_length;
+  return kNearbyStatusOK;
+}
+
+nearby_platform_status nearby_platform_StoreDeviceName(const char *name) {
+  size_t length = strlen(name);
+  if (length > NEARBY_PLATFORM_PERSONALIZED_NAME_MAX) {
+    logger.error("name of {} bytes is longer than {}", length,
+                 NEARBY_PLATFORM_PERSONALIZED_NAME_MAX);
+    return kNearbyStatusError;
+  }
+  std::lock_guard<std::mutex> lk(s_mutex);
+  load_name();
+  if (length == s_name_length && memcmp(name, s_name, length) == 0) {
+    return kNearbyStatusOK;
+  }
+  memcpy(s_name, name, length);
+  s_name[length] = 0;
+  s_name_length = length;
+  s_name_loaded = true;
+  s_stats.name_saves++;
+#if NEARBY_FP_ENABLE_ADDITIONAL_DATA
+  // the persistence cache writes it to flash in the background
+  return nearby_platform_SaveValue(kStoredKeyPersonalizedName, (const uint8_t *)s_name, length);
+#else
+  return kNearbyStatusOK;
+#endif
+}
+
+nearby_platform_DeviceNameStats nearby_platform_GetDeviceNameStats() {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  return s_stats;
+}
@@ -0,0 +1,385 @@
+#include "embedded.hpp"
+
+#if defined(NEARBY_PLATFORM_HAS_SE)
+
+#include <esp_cpu.h>
+#include <esp_heap_caps.h>
+#include <esp_idf_version.h>
+
+// 0 = mbedtls, 1 = compact gfps::P256
+#if !defined(NEARBY_PLATFORM_ECDH_ENGINE)
+#define NEARBY_PLATFORM_ECDH_ENGINE 1
+#endif
+
+// measure the peak stack use of each computed secret by painting the stack,
+// which writes up to kMaxStackPaint bytes per call
+#if !defined(NEARBY_PLATFORM_ECDH_STACK_STATS)
+#define NEARBY_PLATFORM_ECDH_STACK_STATS 0
+#endif
+
+#if NEARBY_PLATFORM_ECDH_ENGINE == 0
+#include <mbedtls/ecdh.h>
+#endif
+
+static espp::Logger logger({.tag = "GFPS ECDH", .level = espp::Logger::Verbosity::DEBUG});
+
+static nearby_platform_EcdhStats s_stats;
+// guards s_stats and the secret cache below; the expiry timer runs on the
+// timer task
+static std::mutex s_mutex;
+
+#if NEARBY_PLATFORM_ECDH_ENGINE == 0
+
+// The curve group and private key are set up once; mbedtls keeps them on
+// the heap.
+static struct {
+  mbedtls_ecp_group group;
+  mbedtls_mpi private_key;
+  bool ready;
+} s_engine;
+
+static int ecdh_random(void*, unsigned char* output, size_t length) {
+  esp_fill_random(output, length);
+  return 0;
+}
+
+static bool engine_init(const uint8_t private_key[32]) {
+  if (s_engine.ready) {
+    mbedtls_ecp_group_free(&s_engine.group);
+    mbedtls_mpi_free(&s_engine.private_key);
+  }
+  mbedtls_ecp_group_init(&s_engine.group);
+  mbedtls_mpi_init(&s_engine.private_key);
+  s_engine.ready =
+      mbedtls_ecp_group_load(&s_engine.group, MBEDTLS_ECP_DP_SECP256R1) == 0 &&
+      mbedtls_mpi_read_binary(&s_engine.private_key, private_key, 32) == 0 &&
+      mbedtls_ecp_check_privkey(&s_engine.group, &s_engine.private_key) == 0;
+  return s_engine.ready;
+}
+
+static bool engine_compute(const uint8_t public_key[64], uint8_t secret[32]) {
+  if (!s_engine.ready) {
+    return false;
+  }
+  uint8_t point[65] = {0x04}; // uncompressed
+  memcpy(point + 1, public_key, 64);
+  mbedtls_ecp_point remote;
+  mbedtls_mpi shared;
+  mbedtls_ecp_point_init(&remote);
+  mbedtls_mpi_init(&shared);
+  // the random source blinds the scalar multiplication
+  bool ok = mbedtls_ecp_point_read_binary(&s_engine.group, &remote, point, sizeof(point)) == 0 &&
+            mbedtls_ecp_check_pubkey(&s_engine.group, &remote) == 0 &&
+            mbedtls_ecdh_compute_shared(&s_engine.group, &shared, &remote,
+                                        &s_engine.private_key, ecdh_random, nullptr) == 0 &&
+            mbedtls_mpi_write_binary(&shared, secret, 32) == 0;
+  mbedtls_ecp_point_free(&remote);
+  mbedtls_mpi_free(&shared);
+  return ok;
+}
+
+static const char* engine_name = "mbedtls";
+
+#else
+
+// The key is used in place (it lives in flash) rather than copied to RAM.
+static struct {
+  const uint8_t *private_key;
+  bool ready;
+} s_engine;
+
+static bool engine_init(const uint8_t private_key[32]) {
+  s_engine.ready = gfps::P256::valid_scalar(private_key);
+  s_engine.private_key = private_key;
+  return s_engine.ready;
+}
+
+static bool engine_compute(const uint8_t public_key[64], uint8_t secret[32]) {
+  return s_engine.ready && gfps::P256::ecdh(s_engine.private_key, public_key, secret);
+}
+
+static const char* engine_name = "p256";
+
+#endif // NEARBY_PLATFORM_ECDH_ENGINE
+
+#if !defined(NEARBY_PLATFORM_ECDH_CACHE_ENTRIES)
+#define NEARBY_PLATFORM_ECDH_CACHE_ENTRIES 4
+#endif
+
+#if !defined(NEARBY_PLATFORM_ECDH_CACHE_MS)
+#define NEARBY_PLATFORM_ECDH_CACHE_MS 30000
+#endif
+
+// A secret is only returned for the exact public key it was computed from;
+// the hash just keeps the scan cheap. Entries expire a fixed time after they
+// were computed, however often they are hit.
+struct CachedSecret {
+  uint32_t hash;
+  uint32_t last_used; // 0 = empty
+  uint64_t created_ms;
+  uint8_t public_key[64];
+  uint8_t secret[32];
+};
+
+static std::array<CachedSecret, NEARBY_PLATFORM_ECDH_CACHE_ENTRIES> s_cache;
+static uint32_t s_cache_use_counter = 0;
+// fires when the oldest entry expires, so no secret outlives its time in RAM
+static void *s_expiry_timer = nullptr;
+// total cycles of computed secrets, to estimate what a hit saved
+static uint64_t s_computed_cycles = 0;
+
+static void wipe(void *data, size_t length) {
+  volatile uint8_t *p = (volatile uint8_t *)data;
+  while (length--) {
+    *p++ = 0;
+  }
+}
+
+// FNV-1a
+static uint32_t hash_public_key(const uint8_t public_key[64]) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < 64; i++) {
+    hash = (hash ^ public_key[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static void evict(CachedSecret &entry) {
+  wipe(&entry, sizeof(entry));
+  s_stats.cache_evictions++;
+}
+
+static void expire_secrets();
+
+// Arms the expiry timer for the oldest entry, unless it is already armed
+// (for an entry at least as old). Must be called with s_mutex held.
+static void arm_expiry_timer() {
+  if (s_expiry_timer) {
+    return;
+  }
+  const CachedSecret *oldest = nullptr;
+  for (auto &entry : s_cache) {
+    if (entry.last_used && (!oldest || entry.created_ms < oldest->created_ms)) {
+      oldest = &entry;
+    }
+  }
+  if (!oldest) {
+    return;
+  }
+  uint64_t age = gfps::Clock::now_ms() - oldest->created_ms;
+  uint32_t delay = age < NEARBY_PLATFORM_ECDH_CACHE_MS ? NEARBY_PLATFORM_ECDH_CACHE_MS - age : 0;
+  s_expiry_timer = nearby_platform_StartTimer(expire_secrets, std::max<uint32_t>(delay, 1));
+  if (!s_expiry_timer) {
+    // the next lookup still drops them
+    logger.warn("no timer to expire cached secrets");
+  }
+}
+
+// Timer callback: wipes every expired entry and waits for the next one.
+static void expire_secrets() {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  s_expiry_timer = nullptr;
+  uint64_t now = gfps::Clock::now_ms();
+  for (auto &entry : s_cache) {
+    if (entry.last_used && now - entry.created_ms >= NEARBY_PLATFORM_ECDH_CACHE_MS) {
+      evict(entry);
+    }
+  }
+  arm_expiry_timer();
+}
+
+static bool cache_lookup(const uint8_t public_key[64], uint8_t secret[32]) {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  uint32_t hash = hash_public_key(public_key);
+  uint64_t now = gfps::Clock::now_ms();
+  for (auto &entry : s_cache) {
+    if (!entry.last_used) {
+      continue;
+    }
+    if (now - entry.created_ms >= NEARBY_PLATFORM_ECDH_CACHE_MS) {
+      evict(entry);
+      continue;
+    }
+    if (entry.hash == hash && memcmp(entry.public_key, public_key, 64) == 0) {
+      memcpy(secret, entry.secret, 32);
+      entry.last_used = ++s_cache_use_counter;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void cache_insert(const uint8_t public_key[64], const uint8_t secret[32]) {
+  if (s_cache.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lk(s_mutex);
+  CachedSecret *victim = &s_cache[0];
+  for (auto &entry : s_cache) {
+    if (entry.last_used < victim->last_used) {
+      victim = &entry;
+    }
+  }
+  if (victim->last_used) {
+    evict(*victim);
+  }
+  victim->hash = hash_public_key(public_key);
+  victim->created_ms = gfps::Clock::now_ms();
+  memcpy(victim->public_key, public_key, 64);
+  memcpy(victim->secret, secret, 32);
+  victim->last_used = ++s_cache_use_counter;
+  arm_expiry_timer();
+}
+
+void nearby_platform_EcdhClearCache() {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  for (auto &entry : s_cache) {
+    wipe(&entry, sizeof(entry));
+  }
+  if (s_expiry_timer) {
+    nearby_platform_CancelTimer(s_expiry_timer);
+    s_expiry_timer = nullptr;
+  }
+}
+
+#if NEARBY_PLATFORM_ECDH_STACK_STATS
+
+// Stack use is measured by filling the free part of the task stack with a
+// pattern and looking for the lowest overwritten byte afterwards.
+static constexpr uint8_t kStackPaint = 0xa5;
+static constexpr size_t kMaxStackPaint = 8192;
+// room left for the frames of paint_stack and memset themselves
+static constexpr size_t kStackPaintMargin = 256;
+
+// Paints below its own frame, which is below every live frame of the
+// caller, and stores that frame address in `reference`.
+static __attribute__((noinline)) uint8_t* paint_stack(uint8_t** reference) {
+  uint8_t* stack_start = (uint8_t*)pxTaskGetStackStart(nullptr);
+  *reference = (uint8_t*)__builtin_frame_address(0);
+  uint8_t* top = *reference - kStackPaintMargin;
+  if (top <= stack_start) {
+    return nullptr;
+  }
+  uint8_t* bottom = std::max(stack_start, top - kMaxStackPaint);
+  memset(bottom, kStackPaint, top - bottom);
+  return bottom;
+}
+
+static size_t measure_stack(uint8_t* bottom, uint8_t* reference) {
+  if (!bottom) {
+    return 0;
+  }
+  uint8_t* p = bottom;
+  while (p < reference && *p == kStackPaint) {
+    p++;
+  }
+  return reference - p;
+}
+
+#endif // NEARBY_PLATFORM_ECDH_STACK_STATS
+
+nearby_platform_status nearby_platform_EcdhInit(const uint8_t private_key[32]) {
+  // secrets of the previous key are of no use any more
+  nearby_platform_EcdhClearCache();
+  std::lock_guard<std::mutex> lk(s_mutex);
+  size_t free_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+#if NEARBY_PLATFORM_ECDH_ENGINE == 0
+  uint32_t arena_before = nearby_platform_GetMbedtlsArenaStats().used_bytes;
+#endif
+  bool ok = engine_init(private_key);
+  size_t free_after = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+  s_stats.engine = engine_name;
+  s_stats.min_cycles = UINT32_MAX;
+  s_stats.state_bytes =
+      sizeof(s_engine) + (free_before > free_after ? free_before - free_after : 0);
+#if NEARBY_PLATFORM_ECDH_ENGINE == 0
+  // the group and key are allocated from the mbedtls arena, not the heap
+  uint32_t arena_after = nearby_platform_GetMbedtlsArenaStats().used_bytes;
+  s_stats.state_bytes += arena_after > arena_before ? arena_after - arena_before : 0;
+#endif
+  if (!ok) {
+    logger.error("{} engine rejected the anti-spoofing private key", engine_name);
+    return kNearbyStatusError;
+  }
+  logger.info("{} engine ready, {} bytes of state", engine_name, s_stats.state_bytes);
+  return kNearbyStatusOK;
+}
+
+// Generates a shared sec256p1 secret using remote party public key and this
+// device's private key.
+//
+// remote_party_public_key - Remote key.
+// secret                  - 256 bit shared secret.
+nearby_platform_status nearby_platform_GenSec256r1Secret(
+    const uint8_t remote_party_public_key[64], uint8_t secret[32]) {
+  if (cache_lookup(remote_party_public_key, secret)) {
+    uint32_t mean_cycles;
+    {
+      std::lock_guard<std::mutex> lk(s_mutex);
+      s_stats.cache_hits++;
+      mean_cycles = s_stats.cache_misses ? s_computed_cycles / s_stats.cache_misses : 0;
+      s_stats.cache_saved_cycles += mean_cycles;
+    }
+    logger.debug("{}: cached secret, saved ~{} us", engine_name,
+                 mean_cycles / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+    return kNearbyStatusOK;
+  }
+#if NEARBY_PLATFORM_ECDH_STACK_STATS
+  uint8_t* stack_reference;
+  uint8_t* painted = paint_stack(&stack_reference);
+#endif
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+  heap_caps_monitor_local_minimum_free_size_start();
+#endif
+  size_t free_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+
+  uint32_t start = esp_cpu_get_cycle_count();
+  bool ok = engine_compute(remote_party_public_key, secret);
+  uint32_t cycles = esp_cpu_get_cycle_count() - start;
+
+  size_t peak_heap = 0;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+  size_t lowest_free = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+  heap_caps_monitor_local_minimum_free_size_stop();
+  peak_heap = free_before > lowest_free ? free_before - lowest_free : 0;
+#endif
+#if NEARBY_PLATFORM_ECDH_ENGINE == 0
+  // mbedtls allocates from its arena, which the heap counters don't see
+  peak_heap = std::max<size_t>(peak_heap, nearby_platform_GetMbedtlsArenaStats().high_water_bytes);
+#endif
+#if NEARBY_PLATFORM_ECDH_STACK_STATS
+  size_t stack = measure_stack(painted, stack_reference);
+#else
+  size_t stack = 0;
+#endif
+
+  {
+    std::lock_guard<std::mutex> lk(s_mutex);
+    s_stats.calls++;
+    s_stats.failures += !ok;
+    s_stats.last_cycles = cycles;
+    s_stats.min_cycles = std::min(s_stats.min_cycles, cycles);
+    s_stats.max_cycles = std::max(s_stats.max_cycles, cycles);
+    s_stats.peak_stack_bytes = std::max<uint32_t>(s_stats.peak_stack_bytes, stack);
+    s_stats.peak_heap_bytes = std::max<uint32_t>(s_stats.peak_heap_bytes, peak_heap);
+    if (ok) {
+      s_stats.cache_misses++;
+      s_computed_cycles += cycles;
+    }
+  }
+  logger.debug("{}: {} cycles ({} us), {} bytes stack, {} bytes heap", engine_name, cycles,
+               cycles / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, stack, peak_heap);
+  if (!ok) {
+    logger.error("ECDH failed, invalid remote public key?");
+    return kNearbyStatusError;
+  }
+  cache_insert(remote_party_public_key, secret);
+  return kNearbyStatusOK;
+}
+
+nearby_platform_EcdhStats nearby_platform_GetEcdhStats() {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  return s_stats;
+}
+
+#endif // defined(NEARBY_PLATFORM_HAS_SE)
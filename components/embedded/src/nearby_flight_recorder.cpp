@@ -0,0 +1,64 @@
+#include "embedded.hpp"
+
+#include <esp_cpu.h>
+#include <esp_system.h>
+
+#if NEARBY_PLATFORM_FLIGHT_RECORDER
+
+#if !defined(NEARBY_PLATFORM_FLIGHT_RECORDER_SIZE)
+#define NEARBY_PLATFORM_FLIGHT_RECORDER_SIZE 64
+#endif
+
+static espp::Logger logger({.tag = "GFPS FLIGHT", .level = espp::Logger::Verbosity::DEBUG});
+
+// survives software resets, panics and watchdog resets
+static RTC_NOINIT_ATTR gfps::FlightLog<NEARBY_PLATFORM_FLIGHT_RECORDER_SIZE> s_flight_log;
+// kept in regular RAM: atomic instructions don't work on RTC memory
+static std::atomic<uint32_t> s_flight_seq{0};
+
+static void dump_flight_log(const char *title) {
+  logger.info("{}", title);
+  uint32_t prev_cycles = 0;
+  bool first = true;
+  char line[96];
+  s_flight_log.for_each([&](const gfps::FlightEntry &entry) {
+    gfps::format_flight_entry(entry, first ? entry.cycles : prev_cycles,
+                              CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, line, sizeof(line));
+    logger.info("  {}", line);
+    prev_cycles = entry.cycles;
+    first = false;
+  });
+}
+
+void nearby_platform_FlightRecorderInit() {
+  if (s_flight_seq.load() != 0) {
+    return;
+  }
+  esp_reset_reason_t reason = esp_reset_reason();
+  if (s_flight_log.valid() && reason != ESP_RST_POWERON) {
+    dump_flight_log("Flight recorder from previous boot:");
+  }
+  s_flight_log.clear();
+  s_flight_seq = 1;
+  nearby_platform_FlightRecord(gfps::kFlightBoot, 0, 0, reason);
+}
+
+void nearby_platform_FlightRecord(gfps::FlightEvent type, uint8_t code, uint16_t arg16,
+                                  uint32_t arg) {
+  if (s_flight_seq.load(std::memory_order_relaxed) == 0) {
+    // not initialized yet, don't clobber the previous boot's log
+    return;
+  }
+  uint32_t seq = s_flight_seq.fetch_add(1, std::memory_order_relaxed);
+  s_flight_log.write(seq, esp_cpu_get_cycle_count(), type, code, arg16, arg);
+}
+
+void nearby_platform_FlightRecorderDump() {
+  dump_flight_log("Flight recorder:");
+}
+
+#else
+
+void nearby_platform_FlightRecorderInit() {}
+
+#endif // NEARBY_PLATFORM_FLIGHT_RECORDER
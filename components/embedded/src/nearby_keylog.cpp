@@ -0,0 +1,169 @@
+#include "embedded.hpp"
+
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+
+#include <optional>
+
+#if NEARBY_PLATFORM_KEY_LOG
+
+#if !defined(NEARBY_PLATFORM_KEY_LOG_MAX_BYTES)
+#define NEARBY_PLATFORM_KEY_LOG_MAX_BYTES 256
+#endif
+
+static espp::Logger logger({.tag = "GFPS KEYLOG", .level = espp::Logger::Verbosity::DEBUG});
+
+// see partitions.csv
+static const char* partition_label = "gfps_keys";
+static constexpr esp_partition_subtype_t partition_subtype = (esp_partition_subtype_t)0x40;
+
+// The key log region: the gfps_keys partition
+struct PartitionFlash {
+  const esp_partition_t* partition;
+
+  bool read(size_t offset, void* data, size_t size) {
+    return esp_partition_read(partition, offset, data, size) == ESP_OK;
+  }
+  bool write(size_t offset, const void* data, size_t size) {
+    return esp_partition_write(partition, offset, data, size) == ESP_OK;
+  }
+  bool erase(size_t offset, size_t size) {
+    return esp_partition_erase_range(partition, offset, size) == ESP_OK;
+  }
+  static uint32_t crc32(const void* data, size_t size) {
+    return esp_rom_crc32_le(0, (const uint8_t*)data, size);
+  }
+};
+
+typedef gfps::KeyLog<PartitionFlash, NEARBY_PLATFORM_KEY_LOG_MAX_BYTES> KeyLog;
+
+static PartitionFlash s_flash;
+// created once the partition is found
+static std::optional<KeyLog> s_log;
+static std::mutex s_keylog_mutex;
+
+static void log_compaction(uint32_t compactions_before) {
+  if (s_log->stats().compactions != compactions_before) {
+    logger.info("compacted into bank {} (generation {}), {} bytes used", s_log->bank(),
+                s_log->generation(), s_log->write_offset());
+  }
+}
+
+nearby_platform_status nearby_platform_KeyLogInit() {
+  std::lock_guard<std::mutex> lk(s_keylog_mutex);
+  if (s_log) {
+    return kNearbyStatusOK;
+  }
+  s_flash.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, partition_subtype,
+                                               partition_label);
+  if (!s_flash.partition) {
+    logger.warn("no '{}' partition, account keys stay in NVS", partition_label);
+    return kNearbyStatusError;
+  }
+  size_t bank_bytes =
+      s_flash.partition->size / 2 / s_flash.partition->erase_size * s_flash.partition->erase_size;
+  if (bank_bytes < 2 * KeyLog::kRecordBytes) {
+    logger.error("'{}' partition is too small", partition_label);
+    return kNearbyStatusError;
+  }
+  s_log.emplace(s_flash, bank_bytes);
+  int64_t start_us = esp_timer_get_time();
+  if (!s_log->mount()) {
+    if (s_log->formatted()) {
+      logger.error("failed to format '{}' partition", partition_label);
+      s_log.reset();
+      return kNearbyStatusError;
+    }
+    // the account keys are in there: keep using the log, loads and saves
+    // fail (and retry the mount) instead of falling back to an empty NVS
+    logger.error("failed to read '{}' partition", partition_label);
+    return kNearbyStatusOK;
+  }
+  s_log->set_replay_us(esp_timer_get_time() - start_us);
+  if (s_log->formatted()) {
+    logger.info("formatted '{}' partition", partition_label);
+    return kNearbyStatusOK;
+  }
+  auto stats = s_log->stats();
+  logger.info("replayed {} records from bank {} in {} us, {} of {} bytes used",
+              stats.replay_records, s_log->bank(), stats.replay_us, stats.bank_used_bytes,
+              stats.bank_bytes);
+  return kNearbyStatusOK;
+}
+
+// Mounts the log again if reading it failed so far. Must be called with
+// s_keylog_mutex held.
+static bool ensure_mounted() {
+  if (!s_log) {
+    return false;
+  }
+  if (!s_log->mounted() && !s_log->mount()) {
+    logger.error("failed to read '{}' partition", partition_label);
+    return false;
+  }
+  return true;
+}
+
+esp_err_t nearby_platform_KeyLogLoad(uint8_t* output, size_t* length) {
+  std::lock_guard<std::mutex> lk(s_keylog_mutex);
+  if (!ensure_mounted()) {
+    return ESP_FAIL;
+  }
+  if (!s_log->present()) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  return s_log->load(output, length) ? ESP_OK : ESP_ERR_NVS_INVALID_LENGTH;
+}
+
+nearby_platform_status nearby_platform_KeyLogSave(const uint8_t* input, size_t length) {
+  std::lock_guard<std::mutex> lk(s_keylog_mutex);
+  if (!ensure_mounted()) {
+    return kNearbyStatusError;
+  }
+  uint32_t compactions = s_log->stats().compactions;
+  if (!s_log->save(input, length)) {
+    logger.error("failed to save {} bytes", length);
+    return kNearbyStatusError;
+  }
+  log_compaction(compactions);
+  return kNearbyStatusOK;
+}
+
+void nearby_platform_KeyLogMaintain() {
+  std::lock_guard<std::mutex> lk(s_keylog_mutex);
+  if (!s_log) {
+    return;
+  }
+  uint32_t compactions = s_log->stats().compactions;
+  if (!s_log->maintain()) {
+    logger.error("background compaction failed");
+  }
+  log_compaction(compactions);
+}
+
+nearby_platform_KeyLogStats nearby_platform_GetKeyLogStats() {
+  std::lock_guard<std::mutex> lk(s_keylog_mutex);
+  return s_log ? s_log->stats() : nearby_platform_KeyLogStats{};
+}
+
+#else
+
+nearby_platform_status nearby_platform_KeyLogInit() {
+  return kNearbyStatusError;
+}
+
+esp_err_t nearby_platform_KeyLogLoad(uint8_t* output, size_t* length) {
+  return ESP_FAIL;
+}
+
+nearby_platform_status nearby_platform_KeyLogSave(const uint8_t* input, size_t length) {
+  return kNearbyStatusError;
+}
+
+void nearby_platform_KeyLogMaintain() {}
+
+nearby_platform_KeyLogStats nearby_platform_GetKeyLogStats() {
+  return {};
+}
+
+#endif // NEARBY_PLATFORM_KEY_LOG
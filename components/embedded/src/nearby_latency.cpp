@@ -0,0 +1,113 @@
+#include "embedded.hpp"
+
+#if NEARBY_PLATFORM_LATENCY_STATS
+
+static espp::Logger logger({.tag = "GFPS LATENCY", .level = espp::Logger::Verbosity::DEBUG});
+
+static const char *latency_stage_names[] = {
+  "read",
+  "write",
+  "write->notify",
+};
+static_assert(sizeof(latency_stage_names) / sizeof(*latency_stage_names) == kLatencyNumStages);
+
+static const char *latency_characteristic_names[kLatencyNumCharacteristics] = {
+  "model id",
+  "kb pairing",
+  "passkey",
+  "account key",
+  "fw revision",
+  "additional data",
+  "msg stream psm",
+  "unknown",
+};
+
+static gfps::LatencyHistogram s_histograms[kLatencyNumStages][kLatencyNumCharacteristics];
+// start time of the last write to each characteristic which is still waiting
+// for its notification, 0 if none
+static int64_t s_pending_write_us[kLatencyNumCharacteristics];
+// recorded from the BTC task and from whatever task calls GattNotify
+static portMUX_TYPE s_latency_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static size_t latency_index(int characteristic) {
+  if (characteristic < 0 || characteristic >= (int)kLatencyNumCharacteristics) {
+    return kLatencyNumCharacteristics - 1;
+  }
+  return characteristic;
+}
+
+void nearby_platform_RecordLatency(nearby_platform_LatencyStage stage,
+                                   int characteristic, uint32_t us) {
+  if (stage >= kLatencyNumStages) {
+    return;
+  }
+  portENTER_CRITICAL(&s_latency_lock);
+  s_histograms[stage][latency_index(characteristic)].record(us);
+  portEXIT_CRITICAL(&s_latency_lock);
+}
+
+void nearby_platform_MarkLatencyWrite(int characteristic, int64_t start_us) {
+  portENTER_CRITICAL(&s_latency_lock);
+  s_pending_write_us[latency_index(characteristic)] = start_us;
+  portEXIT_CRITICAL(&s_latency_lock);
+}
+
+void nearby_platform_RecordLatencyNotify(int characteristic, int64_t now_us) {
+  size_t index = latency_index(characteristic);
+  portENTER_CRITICAL(&s_latency_lock);
+  int64_t start_us = s_pending_write_us[index];
+  if (start_us != 0) {
+    s_pending_write_us[index] = 0;
+    s_histograms[kLatencyGattWriteNotify][index].record((uint32_t)(now_us - start_us));
+  }
+  portEXIT_CRITICAL(&s_latency_lock);
+}
+
+gfps::LatencyHistogram nearby_platform_GetLatencyHistogram(
+    nearby_platform_LatencyStage stage, int characteristic) {
+  gfps::LatencyHistogram histogram;
+  if (stage >= kLatencyNumStages) {
+    return histogram;
+  }
+  portENTER_CRITICAL(&s_latency_lock);
+  histogram = s_histograms[stage][latency_index(characteristic)];
+  portEXIT_CRITICAL(&s_latency_lock);
+  return histogram;
+}
+
+void nearby_platform_DumpLatencyStats() {
+  for (int stage = 0; stage < kLatencyNumStages; stage++) {
+    for (size_t c = 0; c < kLatencyNumCharacteristics; c++) {
+      // copy under the lock, log without it
+      auto histogram = nearby_platform_GetLatencyHistogram((nearby_platform_LatencyStage)stage, c);
+      if (histogram.count() == 0) {
+        continue;
+      }
+      logger.info("{} {}: n={}, min={}us, mean={}us, p50<={}us, p99<={}us, max={}us",
+                  latency_stage_names[stage], latency_characteristic_names[c],
+                  histogram.count(), histogram.min_us(), histogram.mean_us(),
+                  histogram.percentile_us(50), histogram.percentile_us(99),
+                  histogram.max_us());
+      for (size_t b = 0; b < gfps::LatencyHistogram::kNumBuckets; b++) {
+        if (histogram.bucket(b) == 0) {
+          continue;
+        }
+        logger.debug("    >= {:>7}us: {}", gfps::LatencyHistogram::bucket_floor_us(b),
+                     histogram.bucket(b));
+      }
+    }
+  }
+}
+
+void nearby_platform_ResetLatencyStats() {
+  portENTER_CRITICAL(&s_latency_lock);
+  for (auto &stage : s_histograms) {
+    for (auto &histogram : stage) {
+      histogram.reset();
+    }
+  }
+  memset(s_pending_write_us, 0, sizeof(s_pending_write_us));
+  portEXIT_CRITICAL(&s_latency_lock);
+}
+
+#endif // NEARBY_PLATFORM_LATENCY_STATS
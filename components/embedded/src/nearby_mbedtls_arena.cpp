@@ -0,0 +1,159 @@
+#include "embedded.hpp"
+
+#include <mbedtls/platform.h>
+
+static espp::Logger logger({.tag = "GFPS ARENA", .level = espp::Logger::Verbosity::DEBUG});
+
+// 0 leaves mbedtls on the system heap
+#if !defined(NEARBY_PLATFORM_MBEDTLS_ARENA_BYTES)
+#define NEARBY_PLATFORM_MBEDTLS_ARENA_BYTES 6144
+#endif
+
+#if NEARBY_PLATFORM_MBEDTLS_ARENA_BYTES > 0
+
+#if !defined(MBEDTLS_PLATFORM_MEMORY)
+#error "the mbedtls arena needs MBEDTLS_PLATFORM_MEMORY"
+#endif
+
+// Every block starts with a header; blocks are laid out in allocation order
+// and each header links to the one below, so freed blocks on top can be
+// popped until a live one is reached.
+struct BlockHeader {
+  uint32_t size;         // payload bytes, rounded up to kAlignment
+  uint32_t previous : 31; // offset of the block below, kNoBlock for the first
+  uint32_t freed : 1;
+};
+
+static constexpr size_t kAlignment = 8;
+static constexpr uint32_t kNoBlock = 0x7fffffff;
+static_assert(sizeof(BlockHeader) % kAlignment == 0);
+
+alignas(kAlignment) static uint8_t s_arena[NEARBY_PLATFORM_MBEDTLS_ARENA_BYTES];
+static size_t s_used = 0;           // bytes from the bottom in use
+static uint32_t s_top = kNoBlock;   // offset of the topmost block
+static uint32_t s_arena_live = 0;   // live allocations in the arena
+static nearby_platform_MbedtlsArenaStats s_stats;
+static std::mutex s_mutex;
+
+static BlockHeader *block_at(uint32_t offset) {
+  return reinterpret_cast<BlockHeader *>(s_arena + offset);
+}
+
+// A payload follows its header, and an empty one may sit at the very end.
+static bool in_arena(const void *p) {
+  return p > s_arena && p <= s_arena + sizeof(s_arena);
+}
+
+static void wipe(void *data, size_t length) {
+  volatile uint8_t *p = (volatile uint8_t *)data;
+  while (length--) {
+    *p++ = 0;
+  }
+}
+
+// Pops freed blocks off the top, wiping what they held.
+static void pop_freed() {
+  while (s_top != kNoBlock && block_at(s_top)->freed) {
+    BlockHeader *block = block_at(s_top);
+    uint32_t previous = block->previous;
+    wipe(block, sizeof(BlockHeader) + block->size);
+    s_used = s_top;
+    s_top = previous;
+  }
+  if (s_top == kNoBlock && s_used == 0 && s_stats.used_bytes != 0) {
+    s_stats.resets++;
+  }
+  s_stats.used_bytes = s_used;
+}
+
+static void *arena_calloc(size_t count, size_t size) {
+  if (count && size > SIZE_MAX / count) {
+    return nullptr;
+  }
+  size_t bytes = count * size;
+  size_t rounded = (bytes + kAlignment - 1) & ~(kAlignment - 1);
+  std::lock_guard<std::mutex> lk(s_mutex);
+  s_stats.live++;
+  s_stats.peak_live = std::max(s_stats.peak_live, s_stats.live);
+  size_t available = sizeof(s_arena) - s_used;
+  if (bytes <= sizeof(s_arena) && available >= sizeof(BlockHeader) &&
+      rounded <= available - sizeof(BlockHeader)) {
+    BlockHeader *block = block_at(s_used);
+    block->size = rounded;
+    block->previous = s_top;
+    block->freed = 0;
+    s_top = s_used;
+    s_used += sizeof(BlockHeader) + rounded;
+    s_arena_live++;
+    s_stats.allocations++;
+    s_stats.used_bytes = s_used;
+    s_stats.high_water_bytes = std::max<uint32_t>(s_stats.high_water_bytes, s_used);
+    // popped blocks are wiped already; this is just calloc's promise
+    uint8_t *payload = reinterpret_cast<uint8_t *>(block + 1);
+    memset(payload, 0, bytes);
+    return payload;
+  }
+  s_stats.fallbacks++;
+  s_stats.fallback_peak_bytes = std::max<uint32_t>(s_stats.fallback_peak_bytes, bytes);
+  void *p = calloc(count, size);
+  if (!p) {
+    s_stats.live--;
+  }
+  return p;
+}
+
+static void arena_free(void *p) {
+  if (!p) {
+    return;
+  }
+  std::lock_guard<std::mutex> lk(s_mutex);
+  // may have been allocated before the arena was installed
+  s_stats.live -= s_stats.live > 0;
+  if (!in_arena(p)) {
+    free(p);
+    return;
+  }
+  BlockHeader *block = reinterpret_cast<BlockHeader *>(p) - 1;
+  block->freed = 1;
+  s_arena_live--;
+  // blocks freed out of order are reclaimed once the ones above them go
+  pop_freed();
+}
+
+nearby_platform_status nearby_platform_MbedtlsArenaInit() {
+  s_stats.arena_bytes = sizeof(s_arena);
+  if (mbedtls_platform_set_calloc_free(arena_calloc, arena_free) != 0) {
+    logger.error("could not install the mbedtls arena");
+    return kNearbyStatusError;
+  }
+  logger.info("mbedtls arena: {} bytes", sizeof(s_arena));
+  return kNearbyStatusOK;
+}
+
+void nearby_platform_MbedtlsArenaReset() {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  pop_freed();
+  wipe(s_arena + s_used, sizeof(s_arena) - s_used);
+  logger.debug("mbedtls arena: {} / {} bytes in use by {} blocks, high water {}, {} fallbacks",
+               s_used, sizeof(s_arena), s_arena_live, s_stats.high_water_bytes,
+               s_stats.fallbacks);
+}
+
+nearby_platform_MbedtlsArenaStats nearby_platform_GetMbedtlsArenaStats() {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  return s_stats;
+}
+
+#else
+
+nearby_platform_status nearby_platform_MbedtlsArenaInit() {
+  return kNearbyStatusOK;
+}
+
+void nearby_platform_MbedtlsArenaReset() {}
+
+nearby_platform_MbedtlsArenaStats nearby_platform_GetMbedtlsArenaStats() {
+  return {};
+}
+
+#endif // NEARBY_PLATFORM_MBEDTLS_ARENA_BYTES > 0
@@ -1,13 +1,213 @@
 #include "embedded.hpp"
 
+static espp::Logger logger({.tag = "GFPS PERSIST", .level = espp::Logger::Verbosity::DEBUG});
+
 // static handle to nvs storage for the embedded namespace
 static constexpr char* nvs_namespace_embedded = "embedded";
 static constexpr char* nvs_stored_key_names[] = {
   "KeyList",
   "Name"
 };
+static constexpr size_t num_stored_keys = std::size(nvs_stored_key_names);
 static nvs_handle_t nvs_handle_embedded;
 
+#if !defined(NEARBY_PLATFORM_PERSISTENCE_CACHE_BYTES)
+#define NEARBY_PLATFORM_PERSISTENCE_CACHE_BYTES 256
+#endif
+
+#if !defined(NEARBY_PLATFORM_PERSISTENCE_FLUSH_MS)
+#define NEARBY_PLATFORM_PERSISTENCE_FLUSH_MS 1000
+#endif
+
+// longest wait before retrying a flush which failed; the wait doubles from
+// NEARBY_PLATFORM_PERSISTENCE_FLUSH_MS with each failure in a row
+#if !defined(NEARBY_PLATFORM_PERSISTENCE_RETRY_MAX_MS)
+#define NEARBY_PLATFORM_PERSISTENCE_RETRY_MAX_MS 60000
+#endif
+
+// RAM copy of one stored key. Values which don't fit are not cached and go
+// straight to flash.
+struct CachedValue {
+  bool loaded;  // data reflects what is (or will be) in flash
+  bool present; // the key exists
+  bool dirty;   // data has not been written to flash yet
+  size_t length;
+  uint8_t data[NEARBY_PLATFORM_PERSISTENCE_CACHE_BYTES];
+};
+
+static CachedValue s_cache[num_stored_keys];
+static nearby_platform_PersistenceStats s_stats;
+static bool s_flush_pending = false;
+// added to the flush delay after a failed flush, 0 once one succeeds
+static uint32_t s_flush_backoff_ms = 0;
+static std::mutex s_cache_mutex;
+static std::condition_variable s_flush_cv;
+// serializes the flush task and nearby_platform_PersistenceFlush
+static std::mutex s_flush_mutex;
+static std::unique_ptr<espp::Task> s_flush_task;
+// the account key list is kept in the key log partition instead of NVS
+static bool s_use_keylog = false;
+
+static bool in_keylog(size_t key) {
+  return s_use_keylog && key == kStoredKeyAccountKeyList;
+}
+
+static esp_err_t read_value(nearby_fp_StoredKey key, uint8_t* output, size_t* length) {
+  if (in_keylog(key)) {
+    return nearby_platform_KeyLogLoad(output, length);
+  }
+  return nvs_get_blob(nvs_handle_embedded, nvs_stored_key_names[key], output, length);
+}
+
+static esp_err_t write_value(nearby_fp_StoredKey key, const uint8_t* input, size_t length) {
+  esp_err_t err;
+  if (in_keylog(key)) {
+    err = nearby_platform_KeyLogSave(input, length) == kNearbyStatusOK ? ESP_OK : ESP_FAIL;
+  } else {
+    err = nvs_set_blob(nvs_handle_embedded,
+                       nvs_stored_key_names[key],
+                       input, length);
+  }
+  GFPS_FLIGHT_RECORD(kFlightPersistSave, key, err, length);
+  return err;
+}
+
+// Moves an account key list saved by an older firmware from NVS to the key
+// log. The NVS copy is erased once the key log has it, and on a later boot if
+// the erase failed, so a stale list can't come back.
+static void import_keylist_from_nvs() {
+  const char* name = nvs_stored_key_names[kStoredKeyAccountKeyList];
+  uint8_t data[NEARBY_PLATFORM_PERSISTENCE_CACHE_BYTES];
+  size_t length = sizeof(data);
+  esp_err_t err = nearby_platform_KeyLogLoad(data, &length);
+  if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND && err != ESP_ERR_NVS_INVALID_LENGTH) {
+    // can't tell whether the key log has a list; try again on the next boot
+    logger.error("failed to read the key log, not importing from NVS: {}", err);
+    s_stats.errors++;
+    return;
+  }
+  bool imported = err != ESP_ERR_NVS_NOT_FOUND;
+  length = sizeof(data);
+  if (nvs_get_blob(nvs_handle_embedded, name, imported ? nullptr : data, &length) != ESP_OK) {
+    return;
+  }
+  if (!imported) {
+    logger.info("importing {} byte account key list from NVS", length);
+    nearby_platform_status status = nearby_platform_KeyLogSave(data, length);
+    memset(data, 0, sizeof(data));
+    if (status != kNearbyStatusOK) {
+      logger.error("failed to import the account key list, leaving it in NVS");
+      s_stats.errors++;
+      return;
+    }
+  }
+  err = nvs_erase_key(nvs_handle_embedded, name);
+  if (err == ESP_OK) {
+    err = nvs_commit(nvs_handle_embedded);
+  }
+  if (err != ESP_OK) {
+    logger.error("failed to erase the imported account key list from NVS: {}", err);
+    s_stats.errors++;
+  }
+}
+
+// Writes every dirty value and commits. The cache lock is only held while
+// copying a value, so loads and saves are not blocked by flash writes. A value
+// which fails to reach flash stays dirty and the flush task retries it, backing
+// off while the failures go on.
+static nearby_platform_status flush_dirty_values() {
+  std::lock_guard<std::mutex> flush_lk(s_flush_mutex);
+  nearby_platform_status status = kNearbyStatusOK;
+  bool written = false;
+  bool uncommitted[num_stored_keys] = {};
+  uint8_t data[NEARBY_PLATFORM_PERSISTENCE_CACHE_BYTES];
+  {
+    std::lock_guard<std::mutex> lk(s_cache_mutex);
+    s_flush_pending = false;
+  }
+  for (size_t i = 0; i < num_stored_keys; i++) {
+    size_t length;
+    {
+      std::lock_guard<std::mutex> lk(s_cache_mutex);
+      if (!s_cache[i].dirty) {
+        continue;
+      }
+      length = s_cache[i].length;
+      memcpy(data, s_cache[i].data, length);
+      // a save that races with the write below marks it dirty again
+      s_cache[i].dirty = false;
+    }
+    esp_err_t err = write_value((nearby_fp_StoredKey)i, data, length);
+    std::lock_guard<std::mutex> lk(s_cache_mutex);
+    if (err != ESP_OK) {
+      logger.error("failed to write {}: {}", nvs_stored_key_names[i], err);
+      s_stats.errors++;
+      s_cache[i].dirty = true;
+      status = kNearbyStatusError;
+      continue;
+    }
+    s_stats.flash_writes++;
+    // the key log needs no commit
+    uncommitted[i] = !in_keylog(i);
+    written = written || uncommitted[i];
+  }
+  if (written) {
+    esp_err_t err = nvs_commit(nvs_handle_embedded);
+    std::lock_guard<std::mutex> lk(s_cache_mutex);
+    if (err != ESP_OK) {
+      logger.error("failed to commit: {}", err);
+      s_stats.errors++;
+      // write them again with the next commit
+      for (size_t i = 0; i < num_stored_keys; i++) {
+        s_cache[i].dirty = s_cache[i].dirty || uncommitted[i];
+      }
+      status = kNearbyStatusError;
+    } else {
+      s_stats.commits++;
+    }
+  }
+  std::lock_guard<std::mutex> lk(s_cache_mutex);
+  if (status != kNearbyStatusOK) {
+    // SaveValue has already returned OK for these, so they must not wait for
+    // an unrelated save to be flushed
+    s_flush_backoff_ms = std::min<uint32_t>(
+        std::max<uint32_t>(2 * s_flush_backoff_ms, NEARBY_PLATFORM_PERSISTENCE_FLUSH_MS),
+        NEARBY_PLATFORM_PERSISTENCE_RETRY_MAX_MS);
+    s_flush_pending = true;
+    s_flush_cv.notify_all();
+  } else {
+    s_flush_backoff_ms = 0;
+  }
+  return status;
+}
+
+// Waits for a save, gives further saves NEARBY_PLATFORM_PERSISTENCE_FLUSH_MS
+// to arrive, then writes them all at once.
+static bool flush_task_fn(std::mutex &m, std::condition_variable &cv) {
+  {
+    std::unique_lock<std::mutex> lk(s_cache_mutex);
+    if (!s_flush_cv.wait_for(lk, std::chrono::seconds(1), [] { return s_flush_pending; })) {
+      return false;
+    }
+    // the delay is counted from the first unflushed save and is not extended
+    // by later ones
+    s_flush_cv.wait_for(
+        lk, std::chrono::milliseconds(NEARBY_PLATFORM_PERSISTENCE_FLUSH_MS + s_flush_backoff_ms),
+        [] { return !s_flush_pending; });
+    if (!s_flush_pending) {
+      // flushed explicitly in the meantime
+      return false;
+    }
+  }
+  flush_dirty_values();
+  if (s_use_keylog) {
+    // compact now rather than during a later save
+    nearby_platform_KeyLogMaintain();
+  }
+  // don't want to stop the task
+  return false;
+}
+
 // Loads stored key
 //
 // key    - Type of key to fetch.
@@ -17,12 +217,39 @@ static nvs_handle_t nvs_handle_embedded;
 nearby_platform_status nearby_platform_LoadValue(nearby_fp_StoredKey key,
                                                  uint8_t* output,
                                                  size_t* length) {
-  esp_err_t err = nvs_get_blob(nvs_handle_embedded,
-                                nvs_stored_key_names[key],
-                                output, length);
-  if (err != ESP_OK) {
+  if ((size_t)key >= num_stored_keys) {
+    return kNearbyStatusError;
+  }
+  std::lock_guard<std::mutex> lk(s_cache_mutex);
+  CachedValue &value = s_cache[key];
+  if (value.loaded) {
+    s_stats.hits++;
+  } else {
+    s_stats.misses++;
+    size_t read_length = sizeof(value.data);
+    esp_err_t err = read_value(key, value.data, &read_length);
+    GFPS_FLIGHT_RECORD(kFlightPersistLoad, key, err, read_length);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) {
+      value.loaded = true;
+      value.present = err == ESP_OK;
+      value.length = value.present ? read_length : 0;
+    } else if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+      // too big to cache, read it directly every time
+      err = read_value(key, output, length);
+      if (err != ESP_OK) {
+        return kNearbyStatusError;
+      }
+      return kNearbyStatusOK;
+    } else {
+      s_stats.errors++;
+      return kNearbyStatusError;
+    }
+  }
+  if (!value.present || *length < value.length) {
     return kNearbyStatusError;
   }
+  memcpy(output, value.data, value.length);
+  *length = value.length;
   return kNearbyStatusOK;
 }
 
@@ -34,15 +261,60 @@ nearby_platform_status nearby_platform_LoadValue(nearby_fp_StoredKey key,
 nearby_platform_status nearby_platform_SaveValue(nearby_fp_StoredKey key,
                                                  const uint8_t* input,
                                                  size_t length) {
-  esp_err_t err = nvs_set_blob(nvs_handle_embedded,
-                               nvs_stored_key_names[key],
-                               input, length);
-  if (err != ESP_OK) {
+  if ((size_t)key >= num_stored_keys) {
     return kNearbyStatusError;
   }
+  CachedValue &value = s_cache[key];
+  if (length > sizeof(value.data) || !s_flush_task) {
+    // too big to cache (or no flush task yet): write through. Holding the
+    // flush lock keeps a flush which already copied an older value from
+    // writing it over this one.
+    std::lock_guard<std::mutex> flush_lk(s_flush_mutex);
+    {
+      std::lock_guard<std::mutex> lk(s_cache_mutex);
+      value.loaded = false;
+      value.dirty = false;
+    }
+    esp_err_t err = write_value(key, input, length);
+    if (err == ESP_OK) {
+      err = nvs_commit(nvs_handle_embedded);
+    }
+    return err == ESP_OK ? kNearbyStatusOK : kNearbyStatusError;
+  }
+  std::unique_lock<std::mutex> lk(s_cache_mutex);
+  if (value.loaded && value.present && value.length == length &&
+      memcmp(value.data, input, length) == 0) {
+    s_stats.writes_saved++;
+    return kNearbyStatusOK;
+  }
+  if (value.dirty) {
+    // replaces a value which never reached flash
+    s_stats.writes_saved++;
+  }
+  memcpy(value.data, input, length);
+  value.length = length;
+  value.loaded = true;
+  value.present = true;
+  value.dirty = true;
+  if (!s_flush_pending) {
+    s_flush_pending = true;
+    s_flush_cv.notify_all();
+  }
   return kNearbyStatusOK;
 }
 
+nearby_platform_status nearby_platform_PersistenceFlush() {
+  nearby_platform_status status = flush_dirty_values();
+  // wake the flush task so it stops waiting for a flush that already happened
+  s_flush_cv.notify_all();
+  return status;
+}
+
+nearby_platform_PersistenceStats nearby_platform_GetPersistenceStats() {
+  std::lock_guard<std::mutex> lk(s_cache_mutex);
+  return s_stats;
+}
+
 // Initializes persistence module
 nearby_platform_status nearby_platform_PersistenceInit() {
   // open the NVS "embedded" namespace and store the handle
@@ -51,5 +323,18 @@ nearby_platform_status nearby_platform_PersistenceInit() {
   if (err != ESP_OK) {
     return kNearbyStatusError;
   }
+  if (!s_use_keylog && nearby_platform_KeyLogInit() == kNearbyStatusOK) {
+    s_use_keylog = true;
+    import_keylist_from_nvs();
+  }
+  if (!s_flush_task) {
+    s_flush_task = espp::Task::make_unique({
+        .name = "nearby persist",
+        .callback = flush_task_fn,
+        .stack_size_bytes = 4096,
+        .priority = 1,
+      });
+    s_flush_task->start();
+  }
   return kNearbyStatusOK;
 }
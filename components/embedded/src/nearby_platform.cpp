@@ -2,25 +2,64 @@
 
 static espp::Logger logger({.tag = "GFPS OS", .level = espp::Logger::Verbosity::DEBUG});
 
-static std::chrono::system_clock::time_point s_start_time;
+// GetCurrentTimeMs counts from OsInit
+static uint64_t s_start_time_ms = 0;
 
-std::vector<espp::Timer*> s_timers_to_delete;
+#if !defined(NEARBY_PLATFORM_TIMER_POOL_SIZE)
+#define NEARBY_PLATFORM_TIMER_POOL_SIZE 16
+#endif
 
-void nearby_platform_Cleanup() {
-  logger.debug("cleaning up {} timers", s_timers_to_delete.size());
-  for (auto t : s_timers_to_delete) {
-    delete t;
+// All nearby timers share one wheel (1 ms ticks) and one task which runs
+// their callbacks, instead of one espp::Timer (and task) per timer. With the
+// virtual clock there is no task: nearby_platform_AdvanceTimeMs runs them.
+typedef gfps::TimerService<NEARBY_PLATFORM_TIMER_POOL_SIZE> TimerService;
+
+static void record_timer_fire(TimerService::Handle handle, TimerService::Callback callback) {
+  GFPS_FLIGHT_RECORD(kFlightTimerFire, TimerService::Wheel::generation_of(handle),
+                     TimerService::Wheel::index_of(handle), (uintptr_t)callback);
+}
+
+static TimerService s_timers(record_timer_fire);
+
+#if !NEARBY_PLATFORM_VIRTUAL_CLOCK
+static std::mutex s_timer_task_mutex;
+static std::unique_ptr<espp::Task> s_timer_task;
+
+static bool timer_task_fn(std::mutex &m, std::condition_variable &cv) {
+  s_timers.run_once(m, cv);
+  // don't want to stop the task
+  return false;
+}
+#endif
+
+static void start_timer_service() {
+  s_timers.start();
+#if !NEARBY_PLATFORM_VIRTUAL_CLOCK
+  std::lock_guard<std::mutex> lk(s_timer_task_mutex);
+  if (s_timer_task) {
+    return;
   }
-  s_timers_to_delete.clear();
+  s_timer_task = espp::Task::make_unique({
+      .name = "nearby timers",
+      .callback = timer_task_fn,
+      .stack_size_bytes = 4096,
+      .priority = 5,
+    });
+  s_timer_task->start();
+#endif
+}
+
+#if NEARBY_PLATFORM_VIRTUAL_CLOCK
+void nearby_platform_AdvanceTimeMs(unsigned int ms) {
+  s_timers.advance(ms);
 }
+#endif
 
 /////////////////PLATFORM///////////////////////
 
 // Gets current time in ms.
 unsigned int nearby_platform_GetCurrentTimeMs() {
-  auto now = std::chrono::system_clock::now();
-  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - s_start_time);
-  return elapsed.count();
+  return gfps::Clock::now_ms() - s_start_time_ms;
 }
 
 // Starts a timer. Returns an opaque timer handle or null on error.
@@ -29,39 +68,37 @@ unsigned int nearby_platform_GetCurrentTimeMs() {
 // delay_ms - Number of milliseconds to run the timer.
 void* nearby_platform_StartTimer(void (*callback)(), unsigned int delay_ms) {
   logger.debug("starting timer with delay {} ms", delay_ms);
-  espp::Timer* timer = new espp::Timer(espp::Timer::Config{
-      .name = "nearby timer",
-      .period = std::chrono::milliseconds(0), // one-shot
-      .delay = std::chrono::milliseconds(delay_ms),
-      .callback = [callback]() {
-        if (callback) callback();
-        return true; // stop the timer
-      },
-    });
-  return timer;
+  start_timer_service();
+  TimerService::Handle handle = s_timers.start_timer(callback, delay_ms);
+  if (!handle) {
+    logger.error("no free timers, pool size {}", TimerService::capacity());
+    return nullptr;
+  }
+  GFPS_FLIGHT_RECORD(kFlightTimerStart, TimerService::Wheel::generation_of(handle),
+                     TimerService::Wheel::index_of(handle), delay_ms);
+  return (void*)(uintptr_t)handle;
 }
 
 // Cancels a timer
 //
 // timer - Timer handle returned by StartTimer.
 nearby_platform_status nearby_platform_CancelTimer(void* timer) {
-  // clean up any timers that should be deleted
-  nearby_platform_Cleanup();
-
-  // add this timer to the list of timers to delete
-  espp::Timer* t = (espp::Timer*)timer;
-  if (!t) return kNearbyStatusError;
+  TimerService::Handle handle = (TimerService::Handle)(uintptr_t)timer;
+  if (!handle) return kNearbyStatusError;
   logger.debug("canceling timer");
-  // NOTE: this function is actually called from within the timer's callback, so
-  //       we can't cancel/delete it here. Instead, we'll add it to a list of
-  //       timers to cancel/delete later.
-  s_timers_to_delete.push_back(t);
+  GFPS_FLIGHT_RECORD(kFlightTimerCancel, TimerService::Wheel::generation_of(handle),
+                     TimerService::Wheel::index_of(handle), 0);
+  // NOTE: this function is also called from within the timer's own callback,
+  //       in which case the timer has already been released and the handle
+  //       is stale; that is not an error.
+  s_timers.cancel_timer(handle);
   return kNearbyStatusOK;
 }
 
 // Initializes OS module
 nearby_platform_status nearby_platform_OsInit() {
-  s_start_time = std::chrono::system_clock::now();
+  s_start_time_ms = gfps::Clock::now_ms();
+  start_timer_service();
   return kNearbyStatusOK;
 }
 
@@ -0,0 +1,137 @@
+#include "embedded.hpp"
+
+static espp::Logger logger({.tag = "GFPS RAND", .level = espp::Logger::Verbosity::DEBUG});
+
+#if !defined(NEARBY_PLATFORM_RANDOM_POOL_BYTES)
+#define NEARBY_PLATFORM_RANDOM_POOL_BYTES 128
+#endif
+
+// the refill task is woken once fewer bytes than this are left
+#if !defined(NEARBY_PLATFORM_RANDOM_LOW_WATERMARK)
+#define NEARBY_PLATFORM_RANDOM_LOW_WATERMARK 32
+#endif
+
+// bytes generated between reseeds from the hardware RNG
+#if !defined(NEARBY_PLATFORM_RANDOM_RESEED_BYTES)
+#define NEARBY_PLATFORM_RANDOM_RESEED_BYTES 65536
+#endif
+
+// Bytes are handed out from the top of the pool and wiped as they go, so
+// pool[0, level) is always unused output.
+static uint8_t s_pool[NEARBY_PLATFORM_RANDOM_POOL_BYTES];
+static size_t s_level = 0;
+static gfps::CtrDrbg s_drbg;
+static bool s_seeded = false;
+static bool s_deterministic = false;
+static size_t s_generated_since_reseed = 0;
+static bool s_refill_requested = false;
+static nearby_platform_RandomStats s_stats;
+static std::mutex s_mutex;
+static std::condition_variable s_refill_cv;
+static std::unique_ptr<espp::Task> s_refill_task;
+
+static void seed_from_hardware(bool reseed) {
+  uint8_t entropy[gfps::CtrDrbg::kSeedBytes];
+  esp_fill_random(entropy, sizeof(entropy));
+  if (reseed) {
+    s_drbg.reseed(entropy);
+    s_stats.reseeds++;
+  } else {
+    s_drbg.instantiate(entropy);
+  }
+  volatile uint8_t *p = entropy;
+  for (size_t i = 0; i < sizeof(entropy); i++) {
+    p[i] = 0;
+  }
+  s_generated_since_reseed = 0;
+}
+
+// Tops the pool up. Must be called with s_mutex held.
+static void refill() {
+  if (!s_seeded) {
+    seed_from_hardware(false);
+    s_seeded = true;
+  } else if (!s_deterministic && s_generated_since_reseed >= NEARBY_PLATFORM_RANDOM_RESEED_BYTES) {
+    seed_from_hardware(true);
+  }
+  size_t length = sizeof(s_pool) - s_level;
+  uint64_t start = esp_timer_get_time();
+  s_drbg.generate(s_pool + s_level, length);
+  s_stats.refill_us += esp_timer_get_time() - start;
+  s_stats.refills++;
+  s_generated_since_reseed += length;
+  s_level = sizeof(s_pool);
+}
+
+static bool refill_task_fn(std::mutex &m, std::condition_variable &cv) {
+  std::unique_lock<std::mutex> lk(s_mutex);
+  if (s_refill_cv.wait_for(lk, std::chrono::seconds(1), [] { return s_refill_requested; })) {
+    s_refill_requested = false;
+    refill();
+  }
+  // don't want to stop the task
+  return false;
+}
+
+void nearby_platform_RandomFill(uint8_t *output, size_t length) {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  while (length) {
+    if (s_level == 0) {
+      s_stats.stalls++;
+      refill();
+    }
+    size_t n = std::min(length, s_level);
+    uint8_t *top = s_pool + s_level - n;
+    memcpy(output, top, n);
+    memset(top, 0, n);
+    s_level -= n;
+    output += n;
+    length -= n;
+    s_stats.bytes += n;
+  }
+  if (s_level < NEARBY_PLATFORM_RANDOM_LOW_WATERMARK && s_refill_task && !s_refill_requested) {
+    s_refill_requested = true;
+    s_refill_cv.notify_all();
+  }
+}
+
+// Generates a random number.
+uint8_t nearby_platform_Rand() {
+  uint8_t value;
+  nearby_platform_RandomFill(&value, 1);
+  return value;
+}
+
+void nearby_platform_RandomSeed(const uint8_t seed[32]) {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  s_drbg.instantiate(seed);
+  s_seeded = true;
+  s_deterministic = true;
+  // drop whatever the previous seed produced
+  memset(s_pool, 0, sizeof(s_pool));
+  s_level = 0;
+  s_stats.deterministic = true;
+  logger.warn("random pool is deterministic, not for production use");
+}
+
+nearby_platform_RandomStats nearby_platform_GetRandomStats() {
+  std::lock_guard<std::mutex> lk(s_mutex);
+  return s_stats;
+}
+
+void nearby_platform_RandomInit() {
+  if (s_refill_task) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lk(s_mutex);
+    refill();
+  }
+  s_refill_task = espp::Task::make_unique({
+      .name = "nearby rand",
+      .callback = refill_task_fn,
+      .stack_size_bytes = 2048,
+      .priority = 1,
+    });
+  s_refill_task->start();
+}
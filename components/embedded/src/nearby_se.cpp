@@ -4,21 +4,45 @@
 
 static espp::Logger logger({.tag = "GFPS SE", .level = espp::Logger::Verbosity::DEBUG});
 
-static constexpr char* kAntiSpoofingPrivateKey = CONFIG_ANTISPOOFING_PRIVATE_KEY;
-static std::string decoded_anti_spoofing_private_key;
+// Decoded at compile time and kept in flash, so no copy of it sits in RAM.
+static constexpr auto kAntiSpoofingPrivateKey =
+    gfps::base64_decode<32>(CONFIG_ANTISPOOFING_PRIVATE_KEY);
+static_assert(kAntiSpoofingPrivateKey.valid,
+              "CONFIG_ANTISPOOFING_PRIVATE_KEY is not a valid base64 string");
+static_assert(kAntiSpoofingPrivateKey.length == 32,
+              "CONFIG_ANTISPOOFING_PRIVATE_KEY must decode to a 32 byte private key");
 
-// Generates a random number.
-uint8_t nearby_platform_Rand() {
-  return (uint8_t)esp_random();
-}
+// nearby_platform_Rand lives in nearby_random.cpp
 
 #if !defined(NEARBY_PLATFORM_USE_MBEDTLS)
 
+// 1 = ESP32 AES / SHA peripherals, 0 = portable software implementation
+#if !defined(NEARBY_PLATFORM_CRYPTO_BACKEND) || !defined(ESP_PLATFORM)
+#undef NEARBY_PLATFORM_CRYPTO_BACKEND
+#define NEARBY_PLATFORM_CRYPTO_BACKEND 0
+#endif
+
+#if NEARBY_PLATFORM_CRYPTO_BACKEND
+#include <aes/esp_aes.h>
+// IDF routes mbedtls SHA-256 to the SHA peripheral (CONFIG_MBEDTLS_HARDWARE_SHA)
+#include <mbedtls/sha256.h>
+
+static mbedtls_sha256_context sha256_context;
+#else
+static gfps::Sha256 sha256_context;
+#endif
+
 // Computes the sha256 incrementally. Sha256Start() is called first, then
 // Sha256Update() one or more times, and finally Sha256Finish().
 nearby_platform_status nearby_platform_Sha256Start() {
-  logger.warn("nearby_platform_Sha256Start not implemented");
-  // TODO: Implement.
+#if NEARBY_PLATFORM_CRYPTO_BACKEND
+  mbedtls_sha256_init(&sha256_context);
+  if (mbedtls_sha256_starts(&sha256_context, 0) != 0) {
+    return kNearbyStatusError;
+  }
+#else
+  sha256_context.start();
+#endif
   return kNearbyStatusOK;
 }
 
@@ -28,8 +52,13 @@ nearby_platform_status nearby_platform_Sha256Start() {
 // length - Length of data to process.
 nearby_platform_status nearby_platform_Sha256Update(const void* data,
                                                     size_t length) {
-  logger.warn("nearby_platform_Sha256Update not implemented");
-  // TODO: Implement.
+#if NEARBY_PLATFORM_CRYPTO_BACKEND
+  if (mbedtls_sha256_update(&sha256_context, (const unsigned char*)data, length) != 0) {
+    return kNearbyStatusError;
+  }
+#else
+  sha256_context.update(data, length);
+#endif
   return kNearbyStatusOK;
 }
 
@@ -37,11 +66,35 @@ nearby_platform_status nearby_platform_Sha256Update(const void* data,
 //
 // out - Contains the final 256 bit sha.
 nearby_platform_status nearby_platform_Sha256Finish(uint8_t out[32]) {
-  logger.warn("nearby_platform_Sha256Finish not implemented");
-  // TODO: Implement.
+#if NEARBY_PLATFORM_CRYPTO_BACKEND
+  int ret = mbedtls_sha256_finish(&sha256_context, out);
+  mbedtls_sha256_free(&sha256_context);
+  if (ret != 0) {
+    return kNearbyStatusError;
+  }
+#else
+  sha256_context.finish(out);
+#endif
   return kNearbyStatusOK;
 }
 
+#if NEARBY_PLATFORM_CRYPTO_BACKEND
+static nearby_platform_status aes128_crypt_ecb(int mode,
+                                               const uint8_t input[AES_MESSAGE_SIZE_BYTES],
+                                               uint8_t output[AES_MESSAGE_SIZE_BYTES],
+                                               const uint8_t key[AES_MESSAGE_SIZE_BYTES]) {
+  esp_aes_context context;
+  esp_aes_init(&context);
+  int ret = esp_aes_setkey(&context, key, 128);
+  if (ret == 0) {
+    ret = esp_aes_crypt_ecb(&context, mode, input, output);
+  }
+  // also clears the key
+  esp_aes_free(&context);
+  return ret == 0 ? kNearbyStatusOK : kNearbyStatusError;
+}
+#endif
+
 // Encrypts a data block with AES128 in ECB mode.
 //
 // input - Input data block to be encrypted.
@@ -51,9 +104,12 @@ nearby_platform_status nearby_platform_Aes128Encrypt(
     const uint8_t input[AES_MESSAGE_SIZE_BYTES],
     uint8_t output[AES_MESSAGE_SIZE_BYTES],
     const uint8_t key[AES_MESSAGE_SIZE_BYTES]) {
-  logger.warn("nearby_platform_Aes128Encrypt not implemented");
-  // TODO: Implement.
+#if NEARBY_PLATFORM_CRYPTO_BACKEND
+  return aes128_crypt_ecb(ESP_AES_ENCRYPT, input, output, key);
+#else
+  gfps::Aes128(key).encrypt(input, output);
   return kNearbyStatusOK;
+#endif
 }
 
 // Decrypts a data block with AES128 in ECB mode.
@@ -65,69 +121,35 @@ nearby_platform_status nearby_platform_Aes128Decrypt(
     const uint8_t input[AES_MESSAGE_SIZE_BYTES],
     uint8_t output[AES_MESSAGE_SIZE_BYTES],
     const uint8_t key[AES_MESSAGE_SIZE_BYTES]) {
-  logger.warn("nearby_platform_Aes128Decrypt not implemented");
-  // TODO: Implement.
+#if NEARBY_PLATFORM_CRYPTO_BACKEND
+  return aes128_crypt_ecb(ESP_AES_DECRYPT, input, output, key);
+#else
+  gfps::Aes128(key).decrypt(input, output);
   return kNearbyStatusOK;
+#endif
 }
 
 #endif // !defined(NEARBY_PLATFORM_USE_MBEDTLS)
 
-#if defined(NEARBY_PLATFORM_HAS_SE)
-
-// Generates a shared sec256p1 secret using remote party public key and this
-// device's private key.
-//
-// remote_party_public_key - Remote key.
-// secret                  - 256 bit shared secret.
-nearby_platform_status nearby_platform_GenSec256r1Secret(
-    const uint8_t remote_party_public_key[64], uint8_t secret[32]) {
-  logger.warn("nearby_platform_GenSec256r1Secret not implemented");
-  // TODO: Implement.
-  return kNearbyStatusOK;
-}
-
-#endif // defined(NEARBY_PLATFORM_HAS_SE)
-
-// from https://stackoverflow.com/a/44562527
-std::string base64_decode(const std::string_view in) {
-  // table from '+' to 'z'
-  const uint8_t lookup[] = {
-      62,  255, 62,  255, 63,  52,  53, 54, 55, 56, 57, 58, 59, 60, 61, 255,
-      255, 0,   255, 255, 255, 255, 0,  1,  2,  3,  4,  5,  6,  7,  8,  9,
-      10,  11,  12,  13,  14,  15,  16, 17, 18, 19, 20, 21, 22, 23, 24, 25,
-      255, 255, 255, 255, 63,  255, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
-      36,  37,  38,  39,  40,  41,  42, 43, 44, 45, 46, 47, 48, 49, 50, 51};
-  static_assert(sizeof(lookup) == 'z' - '+' + 1);
-
-  std::string out;
-  int val = 0, valb = -8;
-  for (uint8_t c : in) {
-    if (c < '+' || c > 'z')
-      break;
-    c -= '+';
-    if (lookup[c] >= 64)
-      break;
-    val = (val << 6) + lookup[c];
-    valb += 6;
-    if (valb >= 0) {
-      out.push_back(char((val >> valb) & 0xFF));
-      valb -= 8;
-    }
-  }
-  return out;
-}
+// nearby_platform_GenSec256r1Secret lives in nearby_ecdh.cpp
 
 // Returns anti-spoofing 128 bit private key.
 // Only used if the implementation also uses the
 // nearby_platform_GenSec256r1Secret() routine defined in gen_secret.c.
 // Return NULL if not implemented.
 const uint8_t* nearby_platform_GetAntiSpoofingPrivateKey() {
-  return reinterpret_cast<const uint8_t*>(decoded_anti_spoofing_private_key.data());
+  return kAntiSpoofingPrivateKey.bytes.data();
 }
 
 // Initializes secure element module
 nearby_platform_status nearby_platform_SecureElementInit() {
-  static std::string_view key(kAntiSpoofingPrivateKey);
-  decoded_anti_spoofing_private_key = base64_decode(key);
+  if (nearby_platform_MbedtlsArenaInit() != kNearbyStatusOK) {
+    return kNearbyStatusError;
+  }
+  nearby_platform_RandomInit();
+#if defined(NEARBY_PLATFORM_HAS_SE)
+  return nearby_platform_EcdhInit(nearby_platform_GetAntiSpoofingPrivateKey());
+#else
   return kNearbyStatusOK;
+#endif
 }
@@ -2,17 +2,28 @@
 
 static espp::Logger logger({.tag="embedded", .level=espp::Logger::Verbosity::DEBUG});
 
-// Generates conditional trace line. This is usually wrapped in a macro to
-// provide compiler parameters.
-//
-// level    - Debug level, higher is less messages.
-// filename - Name of file calling trace.
-// lineno   - Source line of trace call.
-// fmt      - printf() style format string (%).
-// ...      - A series of parameters indicated by the fmt string.
-void nearby_platform_Trace(nearby_platform_TraceLevel level,
-                           const char *filename, int lineno, const char *fmt,
-                           ...) {
+#if !defined(NEARBY_PLATFORM_TRACE_RING_SIZE)
+#define NEARBY_PLATFORM_TRACE_RING_SIZE 32
+#endif
+
+#if NEARBY_PLATFORM_DEFERRED_TRACE
+// When deferred tracing is enabled, nearby_platform_Trace only copies its
+// arguments into this ring; the trace task does the formatting and the UART
+// output so the calling task (usually the Bluedroid BTC task) never blocks.
+static gfps::TraceRing<NEARBY_PLATFORM_TRACE_RING_SIZE> s_trace_ring;
+// only touched by nearby_platform_TraceInit
+static std::unique_ptr<espp::Task> s_trace_task;
+// set once the trace task runs, read by every tracing task
+static std::atomic<bool> s_trace_running{false};
+// the ring has a single consumer; the trace task and a crashing task take
+// turns through this
+static std::timed_mutex s_drain_mutex;
+static std::atomic<uint32_t> s_trace_captured{0};
+static std::atomic<uint32_t> s_trace_printed{0};
+#endif
+
+static void print_trace_prefix(nearby_platform_TraceLevel level,
+                               const char *filename, int lineno) {
   switch (level) {
   case kTraceLevelVerbose:
     fmt::print(fg(fmt::color::dark_gray), "[GFPS/V]{}:{}: ", filename, lineno);
@@ -34,13 +45,116 @@ void nearby_platform_Trace(nearby_platform_TraceLevel level,
     fmt::print(fg(fmt::terminal_color::red), "[GFPS/U]{}:{}: ", filename, lineno);
     break;
   }
+}
+
+#if NEARBY_PLATFORM_DEFERRED_TRACE || NEARBY_PLATFORM_TOKENIZED_TRACE
+// Prints a captured trace record, either rendered with its original format
+// string or as a tokenized line for tools/trace_tokens.py.
+static void print_trace_record(const gfps::TraceRecord &record) {
+#if NEARBY_PLATFORM_TOKENIZED_TRACE
+  char line[gfps::TraceTokenEncoder::kMaxLineBytes];
+  size_t length = gfps::TraceTokenEncoder::encode_line(record, line);
+  fwrite(line, 1, length, stdout);
+#else
+  char line[256];
+  record.render(line, sizeof(line));
+  fmt::print("({}) ", record.timestamp_us / 1000);
+  print_trace_prefix((nearby_platform_TraceLevel)record.level,
+                     record.filename, record.lineno);
+  printf("%s\n", line);
+#endif
+}
+#endif
+
+#if NEARBY_PLATFORM_DEFERRED_TRACE
+// Prints every record in the ring, and how many were dropped since the last
+// drain. Called with s_drain_mutex held.
+static void drain_trace_ring() {
+  static uint32_t reported_drops = 0;
+  while (s_trace_ring.pop(print_trace_record)) {
+    s_trace_printed++;
+  }
+  uint32_t dropped = s_trace_ring.dropped();
+  if (dropped != reported_drops) {
+    fmt::print(fg(fmt::terminal_color::yellow), "[GFPS/W] {} trace records dropped\n",
+               dropped - reported_drops);
+    reported_drops = dropped;
+  }
+}
+
+// Drains the trace ring, then sleeps until the next poll.
+static bool trace_task_fn(std::mutex &m, std::condition_variable &cv) {
+  {
+    std::lock_guard<std::timed_mutex> drain_lk(s_drain_mutex);
+    drain_trace_ring();
+  }
+  // producers don't signal the task (that would cost them a syscall), so
+  // simply poll the ring
+  std::unique_lock<std::mutex> lk(m);
+  cv.wait_for(lk, std::chrono::milliseconds(10));
+  // don't want to stop the task
+  return false;
+}
+#endif
+
+// Generates conditional trace line. This is usually wrapped in a macro to
+// provide compiler parameters.
+//
+// level    - Debug level, higher is less messages.
+// filename - Name of file calling trace.
+// lineno   - Source line of trace call.
+// fmt      - printf() style format string (%).
+// ...      - A series of parameters indicated by the fmt string.
+void nearby_platform_Trace(nearby_platform_TraceLevel level,
+                           const char *filename, int lineno, const char *fmt,
+                           ...) {
   va_list args;
   va_start(args, fmt);
+#if NEARBY_PLATFORM_DEFERRED_TRACE
+  // until the trace task is running, fall through to synchronous output
+  if (s_trace_running.load(std::memory_order_acquire)) {
+    bool captured = s_trace_ring.push([&](gfps::TraceRecord &record) {
+      record.timestamp_us = esp_timer_get_time();
+      record.filename = filename;
+      record.lineno = lineno;
+      record.level = (uint8_t)level;
+      record.capture(fmt, args);
+    });
+    if (captured) {
+      s_trace_captured++;
+    }
+    va_end(args);
+    return;
+  }
+#endif
+#if NEARBY_PLATFORM_TOKENIZED_TRACE
+  gfps::TraceRecord record;
+  record.timestamp_us = esp_timer_get_time();
+  record.filename = filename;
+  record.lineno = lineno;
+  record.level = (uint8_t)level;
+  record.capture(fmt, args);
+  print_trace_record(record);
+  va_end(args);
+  return;
+#endif
+  print_trace_prefix(level, filename, lineno);
   vprintf(fmt, args);
   va_end(args);
   printf("\n");
 }
 
+// Returns the deferred trace counters.
+nearby_platform_TraceStats nearby_platform_GetTraceStats() {
+  nearby_platform_TraceStats stats = {};
+#if NEARBY_PLATFORM_DEFERRED_TRACE
+  stats.captured = s_trace_captured.load();
+  stats.dropped = s_trace_ring.dropped();
+  stats.printed = s_trace_printed.load();
+#endif
+  return stats;
+}
+
 // Processes assert. Processes a failed assertion.
 //
 // filename - Name of file calling assert.
@@ -48,12 +162,39 @@ void nearby_platform_Trace(nearby_platform_TraceLevel level,
 // reason   - String message indicating reason for assert.
 void nearby_platfrom_CrashOnAssert(const char *filename, int lineno,
                                    const char *reason) {
+#if NEARBY_PLATFORM_DEFERRED_TRACE
+  // the traces leading up to the assert are still in the ring; print them
+  // before ours, and print anything traced from here on directly
+  s_trace_running.store(false, std::memory_order_release);
+  // if the trace task is mid-drain it finishes shortly, unless it is the
+  // task which asserted
+  if (s_drain_mutex.try_lock_for(std::chrono::milliseconds(100))) {
+    drain_trace_ring();
+    s_drain_mutex.unlock();
+  }
+#endif
   logger.error("Assert failed: {}", reason);
   logger.error("File: {}, line: {}", filename, lineno);
+  GFPS_FLIGHT_RECORD(kFlightAssert, 0, lineno,
+                     gfps::trace_token(gfps::trace_basename(filename)));
   abort();
 }
 
 // Initializes trace module.
 void nearby_platform_TraceInit(void) {
-
+  nearby_platform_FlightRecorderInit();
+#if NEARBY_PLATFORM_DEFERRED_TRACE
+  if (s_trace_task) {
+    return;
+  }
+  logger.info("Starting deferred trace task, ring size {}", s_trace_ring.capacity());
+  s_trace_task = espp::Task::make_unique({
+      .name = "gfps trace",
+      .callback = trace_task_fn,
+      .stack_size_bytes = 4096,
+      .priority = 1,
+    });
+  s_trace_task->start();
+  s_trace_running.store(true, std::memory_order_release);
+#endif
 }
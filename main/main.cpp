@@ -54,6 +54,9 @@ void on_fp_event(nearby_event_Event* event) {
 extern "C" void app_main(void) {
   logger.info("Bootup");
 
+  // dump the events leading up to a crash before anything overwrites them
+  nearby_platform_FlightRecorderInit();
+
   // Initialize NVS.
   auto ret = nvs_flash_init();
   if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -65,6 +68,9 @@ extern "C" void app_main(void) {
   logger.info("Device name: '{}'", CONFIG_DEVICE_NAME);
   logger.info("Model ID: 0x{:x}", CONFIG_MODEL_ID);
 
+  // does nothing unless NEARBY_PLATFORM_CRYPTO_BENCHMARK is enabled
+  nearby_platform_RunCryptoBenchmark();
+
   #if CONFIG_BT_CLASSIC_ENABLED
   esp_bt_mode_t mode = ESP_BT_MODE_BTDM;
   logger.info("BT mode");
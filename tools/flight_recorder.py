@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Decoder for the GFPS flight recorder.
+
+When the firmware is built with NEARBY_PLATFORM_FLIGHT_RECORDER=1, the last
+platform events are kept in RTC no-init memory as a gfps::FlightLog (see
+components/embedded/include/nearby_flight_recorder.hpp). The firmware dumps it
+on the next boot; when that boot never comes, read the memory off the chip
+instead and decode it here, e.g.
+
+    esptool.py --chip esp32 dump_mem 0x50000000 8192 rtc_slow.bin
+    flight_recorder.py rtc_slow.bin
+
+The log is found by its magic, so any dump that contains it will do (a raw
+memory dump, or the RTC region of a core dump). The output is the same as the
+firmware's own dump.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x47465052  # "GFPR"
+HEADER = struct.Struct('<II')  # magic, capacity
+ENTRY = struct.Struct('<IIII')  # seq, cycles, info, arg
+
+# must match gfps::FlightEvent and flight_event_name()
+EVENT_NAMES = [
+    'BOOT', 'GAP', 'GATTS', 'GATT_WRITE', 'GATT_NOTIFY', 'TIMER_START',
+    'TIMER_CANCEL', 'TIMER_FIRE', 'PERSIST_LOAD', 'PERSIST_SAVE', 'ASSERT',
+]
+
+
+def find_logs(image):
+    """Yields (offset, capacity) of every plausible FlightLog in the image."""
+    magic = struct.pack('<I', MAGIC)
+    offset = image.find(magic)
+    while offset >= 0:
+        if offset + HEADER.size <= len(image):
+            _, capacity = HEADER.unpack_from(image, offset)
+            power_of_two = capacity >= 2 and capacity & (capacity - 1) == 0
+            if power_of_two and offset + HEADER.size + capacity * ENTRY.size <= len(image):
+                yield offset, capacity
+        offset = image.find(magic, offset + 1)
+
+
+def read_entries(image, offset, capacity):
+    """Returns the valid entries of the log at `offset`, oldest first.
+
+    Follows FlightLog::for_each: a slot only counts if it holds the sequence
+    number that belongs there, so slots torn by a reset are skipped."""
+    slots = [ENTRY.unpack_from(image, offset + HEADER.size + i * ENTRY.size)
+             for i in range(capacity)]
+    newest = max(seq for seq, _, _, _ in slots)
+    oldest = newest - capacity + 1 if newest >= capacity else 1
+    entries = []
+    for seq in range(oldest, newest + 1):
+        slot = slots[seq & (capacity - 1)]
+        if slot[0] == seq:
+            entries.append(slot)
+    return entries
+
+
+def format_entry(entry, prev_cycles, cpu_mhz):
+    """Same text as gfps::format_flight_entry."""
+    seq, cycles, info, arg = entry
+    delta_us = ((cycles - prev_cycles) & 0xffffffff) // cpu_mhz if cpu_mhz else 0
+    kind = info & 0xff
+    name = EVENT_NAMES[kind] if kind < len(EVENT_NAMES) else 'UNKNOWN'
+    return '#%u +%uus %s code=%u arg16=%u arg=%u (0x%x)' % (
+        seq, delta_us, name, (info >> 8) & 0xff, info >> 16, arg, arg)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--cpu-mhz', type=int, default=160,
+                        help='CPU clock the cycle counts were taken at (default: 160)')
+    parser.add_argument('image', help='memory dump containing the flight log')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+    logs = list(find_logs(image))
+    if not logs:
+        print('no flight log in %s' % args.image, file=sys.stderr)
+        return 1
+    for offset, capacity in logs:
+        if len(logs) > 1:
+            print('flight log at offset 0x%x:' % offset)
+        prev_cycles = None
+        for entry in read_entries(image, offset, capacity):
+            print(format_entry(entry, entry[1] if prev_cycles is None else prev_cycles,
+                               args.cpu_mhz))
+            prev_cycles = entry[1]
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
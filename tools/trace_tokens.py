@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+"""Token database builder and detokenizer for tokenized GFPS traces.
+
+When the firmware is built with NEARBY_PLATFORM_TOKENIZED_TRACE=1, every
+nearby_platform_Trace call is printed as a line of the form '$<base64>', where
+the base64 payload is a binary record (see
+components/embedded/include/nearby_trace_tokens.hpp) that references the format
+string and the source file by their 32 bit FNV-1a hashes.
+
+Build the token database from the sources (done automatically by the build):
+
+    trace_tokens.py database -o gfps_trace_tokens.csv external/nearby/embedded components/embedded/src
+
+Turn a captured console log back into readable text:
+
+    trace_tokens.py detokenize --db build/gfps_trace_tokens.csv capture.txt
+    idf.py monitor | trace_tokens.py detokenize --db build/gfps_trace_tokens.csv
+"""
+
+import argparse
+import base64
+import binascii
+import csv
+import os
+import re
+import struct
+import sys
+
+SOURCE_EXTENSIONS = ('.c', '.cc', '.cpp', '.h', '.hpp')
+
+# NEARBY_TRACE(level, "fmt" "more fmt", ...) and direct
+# nearby_platform_Trace(level, file, line, "fmt", ...) calls
+TRACE_CALL = re.compile(
+    r'(?:NEARBY_TRACE\s*\(\s*[^,]+,|nearby_platform_Trace\s*\([^,]+,[^,]+,[^,]+,)'
+    r'\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+STRING_LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+
+# must match TraceFormatWalker in nearby_trace_ring.hpp
+CONVERSION = re.compile(r'%(?P<flags>[-+ #0]*)(?P<width>[0-9.*]*)(?P<length>[hlLqjzt]*)(?P<type>.?)')
+
+LEVELS = {1: 'E', 2: 'W', 3: 'I', 4: 'D', 5: 'V'}
+
+
+def fnv1a(data):
+    h = 0x811c9dc5
+    for b in data:
+        h ^= b
+        h = (h * 0x01000193) & 0xffffffff
+    return h
+
+
+def unescape(literal):
+    return literal.encode('latin-1').decode('unicode_escape').encode('latin-1')
+
+
+def scan_file(path):
+    with open(path, encoding='utf-8', errors='replace') as f:
+        text = f.read()
+    for match in TRACE_CALL.finditer(text):
+        parts = STRING_LITERAL.findall(match.group(1))
+        yield unescape(''.join(parts))
+
+
+def build_database(roots):
+    entries = {}
+    for root in roots:
+        for dirpath, _, filenames in os.walk(root):
+            for name in filenames:
+                if not name.endswith(SOURCE_EXTENSIONS):
+                    continue
+                entries[fnv1a(name.encode())] = ('file', name.encode())
+                for fmt in scan_file(os.path.join(dirpath, name)):
+                    entries[fnv1a(fmt)] = ('fmt', fmt)
+    return entries
+
+
+def write_database(entries, path):
+    with open(path, 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['token', 'kind', 'string'])
+        for token, (kind, string) in sorted(entries.items()):
+            writer.writerow(['%08x' % token, kind, string.decode('latin-1')])
+
+
+def read_database(path):
+    entries = {}
+    with open(path, newline='') as f:
+        for row in csv.DictReader(f):
+            entries[int(row['token'], 16)] = row['string']
+    return entries
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def remaining(self):
+        return len(self.data) - self.pos
+
+    def u8(self):
+        value = self.data[self.pos]
+        self.pos += 1
+        return value
+
+    def u32(self):
+        value = struct.unpack_from('<I', self.data, self.pos)[0]
+        self.pos += 4
+        return value
+
+    def f32(self):
+        value = struct.unpack_from('<f', self.data, self.pos)[0]
+        self.pos += 4
+        return value
+
+    def varint(self):
+        value = 0
+        shift = 0
+        while True:
+            b = self.u8()
+            value |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                return value
+
+    def zigzag(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+    def string(self):
+        length = self.u8()
+        value = self.data[self.pos:self.pos + length]
+        self.pos += length
+        return value.decode('utf-8', errors='replace')
+
+
+def render(fmt, reader):
+    """Formats `fmt` with the arguments encoded in `reader`."""
+    out = []
+    pos = 0
+    for match in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:match.start()])
+        pos = match.end()
+        conv = match.group('type')
+        if match.group(0) == '%%':
+            out.append('%')
+            continue
+        try:
+            stars = [reader.zigzag() for _ in range(match.group('width').count('*'))]
+            width = match.group('width')
+            for star in stars:
+                width = width.replace('*', str(star), 1)
+            spec = '%' + match.group('flags') + width
+            if conv in 'dic':
+                value = reader.zigzag()
+                out.append((spec + ('c' if conv == 'c' else 'd')) % (chr(value & 0xff) if conv == 'c' else value))
+            elif conv in 'uxXo':
+                value = reader.varint()
+                if conv == 'u':
+                    conv = 'd'
+                out.append((spec + conv) % value)
+            elif conv == 'p':
+                out.append('0x%x' % reader.varint())
+            elif conv in 'fFeEgGaA':
+                out.append((spec + (conv if conv not in 'aA' else 'e')) % reader.f32())
+            elif conv == 's':
+                out.append((spec + 's') % reader.string())
+            else:
+                out.append(match.group(0))
+        except (IndexError, struct.error):
+            # arguments were truncated on the device
+            out.append(match.group(0))
+    out.append(fmt[pos:])
+    return ''.join(out)
+
+
+def detokenize_line(line, database):
+    if not line.startswith('$'):
+        return line
+    try:
+        record = base64.b64decode(line[1:].strip(), validate=True)
+        reader = Reader(record)
+        level = reader.u8()
+        fmt_token = reader.u32()
+        file_token = reader.u32()
+        lineno = reader.varint()
+    except (binascii.Error, IndexError, struct.error):
+        return line
+    fmt = database.get(fmt_token)
+    filename = database.get(file_token, '<%08x>' % file_token)
+    if fmt is None:
+        message = '<unknown token %08x> %s' % (fmt_token, record[reader.pos:].hex())
+    else:
+        message = render(fmt, reader)
+    return '[GFPS/%s]%s:%d: %s\n' % (LEVELS.get(level, 'U'), filename, lineno, message)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest='command', required=True)
+    db = sub.add_parser('database', help='build the token database from source directories')
+    db.add_argument('-o', '--output', required=True)
+    db.add_argument('roots', nargs='+')
+    de = sub.add_parser('detokenize', help='decode a captured log')
+    de.add_argument('--db', required=True)
+    de.add_argument('input', nargs='?', help='captured log (default: stdin)')
+    args = parser.parse_args()
+
+    if args.command == 'database':
+        entries = build_database([r for r in args.roots if os.path.isdir(r)])
+        write_database(entries, args.output)
+        return 0
+
+    database = read_database(args.db)
+    stream = open(args.input, encoding='utf-8', errors='replace') if args.input else sys.stdin
+    with stream:
+        for line in stream:
+            sys.stdout.write(detokenize_line(line, database))
+            sys.stdout.flush()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())